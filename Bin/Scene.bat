@@ -0,0 +1 @@
+start SparseVolumeDXR.exe -scene Assets/Scene.txt
@@ -0,0 +1,2351 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Mesh-processing benchmarks for SparseVolumeDXR. Portable; on Linux, build with
+// g++ -std=c++14 -O2 -pthread -include stdafx.h -I../SparseVolumeDXR/XUSG *.cpp ../SparseVolumeDXR/XUSG/Optional/*.cpp
+
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <new>
+#if defined(WIN32) || defined(_WIN32)
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "Optional/XUSGKBufferRasterizer.h"
+#include "Optional/XUSGMeshletBuilder.h"
+#include "Optional/XUSGObjLoader.h"
+#include "Optional/XUSGObjScanner.h"
+#include "Optional/XUSGPlyLoader.h"
+#include "Optional/XUSGSceneManifest.h"
+#include "Optional/XUSGSoAStream.h"
+#include "Optional/XUSGSparseRayCaster.h"
+#include "Optional/XUSGStlLoader.h"
+#include "Optional/XUSGTriangleBVH.h"
+
+using namespace std;
+using namespace XUSG;
+
+static const char* g_defaultFiles[] =
+{
+	"Assets/bunny.obj",
+	"Assets/dragon.obj",
+	"Assets/TuringBowl.obj"
+};
+
+// Heap allocations through the global operator new, counted for the -alloc mode. The
+// array forms forward to these by default, and the sized form to the unsized one.
+static atomic<uint64_t> g_numAllocations(0);
+
+void* operator new(size_t size)
+{
+	++g_numAllocations;
+	const auto p = malloc(size ? size : 1);
+	if (!p) throw bad_alloc();
+
+	return p;
+}
+
+// Out of line for GCC, which otherwise sees the free() of the pointers of operator new
+// at the inlined call sites (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+struct ScanResult
+{
+	uint64_t	NumFloats;
+	uint64_t	NumIndices;
+	double		FloatSum;
+	int64_t		IndexSum;
+};
+
+// Runs func numRuns times and returns the fastest time in seconds.
+static double timeBest(uint32_t numRuns, const function<void()>& func)
+{
+	auto best = 1e30;
+	for (auto i = 0u; i < numRuns; ++i)
+	{
+		const auto startTime = chrono::steady_clock::now();
+		func();
+		best = (min)(best, chrono::duration<double>(chrono::steady_clock::now() - startTime).count());
+	}
+
+	return best;
+}
+
+// Peak resident set size of the process in bytes; it never decreases over a run.
+static uint64_t getPeakRSS()
+{
+#if defined(WIN32) || defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters = {};
+
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+	struct rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+
+#if defined(__APPLE__)
+	return static_cast<uint64_t>(usage.ru_maxrss);			// Bytes
+#else
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;	// Kilobytes
+#endif
+#endif
+}
+
+static string toJSONString(const char* str)
+{
+	string result = "\"";
+	for (auto p = str; *p; ++p)
+	{
+		const auto c = static_cast<unsigned char>(*p);
+		if (c == '"' || c == '\\') result += '\\';
+		if (c >= 0x20) result += *p;
+		else
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		}
+	}
+	result += '"';
+
+	return result;
+}
+
+static bool readFile(const char* fileName, vector<char>& data)
+{
+	FILE* pFile = fopen(fileName, "rb");
+	if (!pFile) return false;
+
+	fseek(pFile, 0, SEEK_END);
+	data.resize(static_cast<size_t>(ftell(pFile)));
+	rewind(pFile);
+	const auto size = fread(data.data(), 1, data.size(), pFile);
+	fclose(pFile);
+
+	return size == data.size();
+}
+
+//--------------------------------------------------------------------------------------
+// Numeric token scanning: fscanf_s as in ObjLoader::PARSER_STDIO versus ObjScanner
+//--------------------------------------------------------------------------------------
+
+#if defined(_MSC_VER)
+#define SCAN_TOKEN(pFile, buffer)	fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer)))
+#define SCAN(pFile, ...)			fscanf_s(pFile, __VA_ARGS__)
+#else
+#define SCAN_TOKEN(pFile, buffer)	fscanf(pFile, "%255s", buffer)
+#define SCAN(pFile, ...)			fscanf(pFile, __VA_ARGS__)
+#endif
+
+static void scanStdio(const char* fileName, ScanResult& result)
+{
+	result = {};
+	FILE* pFile = fopen(fileName, "r");
+	if (!pFile) return;
+
+	char buffer[256];
+	while (SCAN_TOKEN(pFile, buffer) != EOF)
+	{
+		if (buffer[0] == 'v' && (buffer[1] == '\0' || (buffer[1] == 'n' && buffer[2] == '\0')))
+		{
+			float f[3];
+			result.NumFloats += SCAN(pFile, "%f %f %f", &f[0], &f[1], &f[2]);
+			result.FloatSum += static_cast<double>(f[0]) + f[1] + f[2];
+		}
+		else if (buffer[0] == 'f' && buffer[1] == '\0')
+		{
+			long long vi;
+			while (SCAN(pFile, "%lld", &vi) > 0)
+			{
+				result.IndexSum += vi;
+				++result.NumIndices;
+				for (uint8_t i = 0; i < 2; ++i)
+				{
+					const auto c = fgetc(pFile);
+					if (c != '/')
+					{
+						ungetc(c, pFile);
+						break;
+					}
+
+					if (SCAN(pFile, "%lld", &vi) > 0)
+					{
+						result.IndexSum += vi;
+						++result.NumIndices;
+					}
+				}
+			}
+		}
+		else if (!fgets(buffer, sizeof(buffer), pFile)) break;
+	}
+
+	fclose(pFile);
+}
+
+static void scanSimd(const vector<char>& data, ScanResult& result)
+{
+	result = {};
+	auto p = data.data();
+	const auto pEnd = p + data.size();
+
+	while (p < pEnd)
+	{
+		p = ObjScanner::SkipBlanks(p, pEnd);
+		const auto key = p < pEnd ? p[0] : '\0';
+		const auto key1 = p + 1 < pEnd ? p[1] : '\0';
+		const auto key2 = p + 2 < pEnd ? p[2] : '\0';
+		if (key == 'v' && (ObjScanner::IsBlank(key1) || (key1 == 'n' && ObjScanner::IsBlank(key2))))
+		{
+			float f[3];
+			p += key1 == 'n' ? 2 : 1;
+			for (auto& c : f) p = ObjScanner::ParseFloat(p, pEnd, c);
+			result.FloatSum += static_cast<double>(f[0]) + f[1] + f[2];
+			result.NumFloats += 3;
+		}
+		else if (key == 'f' && ObjScanner::IsBlank(key1))
+		{
+			for (++p; ; )
+			{
+				p = ObjScanner::SkipBlanks(p, pEnd);
+				if (p >= pEnd || !(ObjScanner::IsDigit(*p) || *p == '-')) break;
+
+				int64_t v, vt, vn;
+				const auto mask = ObjScanner::ParseIndexTriplet(p, pEnd, v, vt, vn);
+				result.IndexSum += v;
+				result.IndexSum += mask & ObjScanner::INDEX_VT ? vt : 0;
+				result.IndexSum += mask & ObjScanner::INDEX_VN ? vn : 0;
+				result.NumIndices += 1 + !!(mask & ObjScanner::INDEX_VT) + !!(mask & ObjScanner::INDEX_VN);
+			}
+		}
+		p = ObjScanner::SkipLine(p, pEnd);
+	}
+}
+
+static int benchScanner(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "tokens" << setw(14) << "fscanf MB/s"
+		<< setw(14) << "scanner MB/s" << setw(10) << "speedup" << setw(12) << "ns/token" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		vector<char> data;
+		if (!readFile(fileName, data))
+		{
+			cerr << "Cannot open " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		ScanResult stdioResult, simdResult;
+		const auto stdioTime = timeBest(numRuns, [&]() { scanStdio(fileName, stdioResult); });
+		const auto simdTime = timeBest(numRuns, [&]() { scanSimd(data, simdResult); });
+
+		const auto same = stdioResult.NumFloats == simdResult.NumFloats && stdioResult.FloatSum == simdResult.FloatSum &&
+			stdioResult.NumIndices == simdResult.NumIndices && stdioResult.IndexSum == simdResult.IndexSum;
+		success = success && same;
+
+		const auto numTokens = simdResult.NumFloats + simdResult.NumIndices;
+		const auto mb = data.size() / (1024.0 * 1024.0);
+		cout << left << setw(24) << fileName << right << setw(12) << numTokens << fixed << setprecision(1)
+			<< setw(14) << mb / stdioTime << setw(14) << mb / simdTime << setw(9) << stdioTime / simdTime << "x"
+			<< setw(12) << simdTime * 1e9 / numTokens << (same ? "" : "  MISMATCH") << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Full import: ObjLoader::PARSER_STDIO versus ObjLoader::PARSER_MAPPED
+//--------------------------------------------------------------------------------------
+
+// Normals listed but referenced by some faces only, or by none: each face without references
+// must still get its normal-index slots, in one chunk or across the chunks of the threads.
+static bool checkNormalIndexPadding()
+{
+	const auto fileName = "SparseVolumeBench_vn.obj";
+	const auto gridSize = 64u;
+	const auto writeObj = [&](bool isLarge)
+	{
+		ofstream file(fileName, ios::binary);
+		const auto size = isLarge ? gridSize : 2u;
+		for (auto y = 0u; y < size; ++y)
+			for (auto x = 0u; x < size; ++x) file << "v " << x << " " << y << " 0\n";
+		file << "vn 0 0 1\nvn 0 0 -1\n";
+		for (auto y = 0u; y + 1 < size; ++y)
+		{
+			for (auto x = 0u; x + 1 < size; ++x)
+			{
+				// The first half of the large grid has plain faces, the second half v//vn faces.
+				const auto i = y * size + x + 1;
+				if (isLarge && y >= size / 2) file << "f " << i << "//1 " << i + 1 << "//1 " << i + size << "//1\n"
+					<< "f " << i + 1 << "//1 " << i + size + 1 << "//1 " << i + size << "//1\n";
+				else file << "f " << i << " " << i + 1 << " " << i + size << "\n"
+					<< "f " << i + 1 << " " << i + size + 1 << " " << i + size << "\n";
+			}
+		}
+
+		return file.good();
+	};
+
+	auto success = writeObj(false);
+	ObjLoader loader;
+	loader.SetParser(ObjLoader::PARSER_MAPPED);
+	success = success && loader.Import(fileName) && loader.GetNumVertices() == 4 && loader.GetNumIndices() == 6;
+
+	// Single-chunk and multi-chunk parses must agree.
+	ObjLoader serialLoader, parallelLoader;
+	serialLoader.SetNumThreads(1);
+	parallelLoader.SetNumThreads(4);
+	success = success && writeObj(true) && serialLoader.Import(fileName) && parallelLoader.Import(fileName);
+	success = success && serialLoader.GetNumVertices() == gridSize * gridSize &&
+		serialLoader.GetNumVertices() == parallelLoader.GetNumVertices() &&
+		serialLoader.GetNumIndices() == parallelLoader.GetNumIndices() &&
+		!memcmp(serialLoader.GetVertices(), parallelLoader.GetVertices(),
+			static_cast<size_t>(serialLoader.GetVertexStride()) * serialLoader.GetNumVertices()) &&
+		!memcmp(serialLoader.GetIndices(), parallelLoader.GetIndices(), sizeof(uint32_t) * serialLoader.GetNumIndices());
+	remove(fileName);
+
+	cout << left << setw(24) << "vn without f refs" << right << setw(12) << (success ? "ok" : "FAILED") << endl;
+
+	return success;
+}
+
+static int benchImport(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "vertices" << setw(12) << "stdio ms"
+		<< setw(12) << "mapped ms" << setw(10) << "speedup" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader stdioLoader, mappedLoader;
+		stdioLoader.SetParser(ObjLoader::PARSER_STDIO);
+		mappedLoader.SetParser(ObjLoader::PARSER_MAPPED);
+
+		auto imported = true;
+		const auto stdioTime = timeBest(numRuns, [&]() { imported = stdioLoader.Import(fileName) && imported; });
+		const auto mappedTime = timeBest(numRuns, [&]() { imported = mappedLoader.Import(fileName) && imported; });
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		cout << left << setw(24) << fileName << right << setw(12) << mappedLoader.GetNumVertices()
+			<< fixed << setprecision(2) << setw(12) << stdioTime * 1000.0 << setw(12) << mappedTime * 1000.0
+			<< setprecision(1) << setw(9) << stdioTime / mappedTime << "x" << endl;
+	}
+
+	if (!checkNormalIndexPadding()) success = false;
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// PLY and STL import: the same triangles as the OBJ import, in each encoding
+//--------------------------------------------------------------------------------------
+
+template<typename T>
+static void writeValue(ofstream& file, T value, bool bigEndian)
+{
+	const uint16_t endianProbe = 1;
+	char bytes[sizeof(T)];
+	memcpy(bytes, &value, sizeof(T));
+	if (bigEndian == (*reinterpret_cast<const uint8_t*>(&endianProbe) == 1)) reverse(bytes, bytes + sizeof(T));
+	file.write(bytes, sizeof(T));
+}
+
+// Positions as float or double, optionally with a color ahead of them, an extra per-face
+// property, an unused element, and the faces ahead of the vertices.
+static bool writePly(const char* fileName, const ObjLoader& loader, bool bigEndian, bool isDouble, bool hasExtras)
+{
+	const auto numVert = loader.GetNumVertices();
+	const auto numTri = loader.GetNumIndices() / 3;
+	const auto stride = loader.GetVertexStride();
+	const auto pIndices = loader.GetIndices();
+	const auto type = isDouble ? "double" : "float";
+
+	ofstream file(fileName, ios::binary);
+	file << "ply\nformat " << (bigEndian ? "binary_big_endian" : "binary_little_endian") << " 1.0\n";
+	const auto writeVertexHeader = [&]()
+	{
+		file << "element vertex " << numVert << "\n";
+		if (hasExtras) file << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+		file << "property " << type << " x\nproperty " << type << " y\nproperty " << type << " z\n";
+	};
+	const auto writeFaceHeader = [&]()
+	{
+		file << "element face " << numTri << "\n";
+		if (hasExtras) file << "property ushort flags\n";
+		file << "property list uchar int vertex_indices\n";
+	};
+	if (hasExtras) file << "element material 2\nproperty list uchar float values\n";
+	if (hasExtras) writeFaceHeader();
+	writeVertexHeader();
+	if (!hasExtras) writeFaceHeader();
+	file << "end_header\n";
+
+	const auto writeVertices = [&]()
+	{
+		for (auto i = 0u; i < numVert; ++i)
+		{
+			float p[3];
+			memcpy(p, &loader.GetVertices()[static_cast<size_t>(stride) * i], sizeof(p));
+			if (hasExtras) file.write("\x80\x40\x20", 3);
+			for (const auto& c : p)
+				if (isDouble) writeValue<double>(file, c, bigEndian);
+				else writeValue<float>(file, c, bigEndian);
+		}
+	};
+	const auto writeFaces = [&]()
+	{
+		for (auto i = 0u; i < numTri; ++i)
+		{
+			if (hasExtras) writeValue<uint16_t>(file, static_cast<uint16_t>(i), bigEndian);
+			file.put(3);
+			for (uint8_t j = 0; j < 3; ++j) writeValue<int32_t>(file, static_cast<int32_t>(pIndices[3 * i + j]), bigEndian);
+		}
+	};
+	if (hasExtras)
+	{
+		for (uint8_t i = 0; i < 2; ++i)
+		{
+			file.put(i);
+			for (uint8_t j = 0; j < i; ++j) writeValue<float>(file, 1.0f, bigEndian);
+		}
+		writeFaces();
+	}
+	writeVertices();
+	if (!hasExtras) writeFaces();
+
+	return file.good();
+}
+
+static bool writeStl(const char* fileName, const ObjLoader& loader)
+{
+	const auto numTri = loader.GetNumIndices() / 3;
+	const auto stride = loader.GetVertexStride();
+	const auto pIndices = loader.GetIndices();
+
+	ofstream file(fileName, ios::binary);
+	const char header[80] = "SparseVolumeBench";
+	file.write(header, sizeof(header));
+	file.write(reinterpret_cast<const char*>(&numTri), sizeof(numTri));
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const float normal[3] = {};
+		file.write(reinterpret_cast<const char*>(normal), sizeof(normal));
+		for (uint8_t j = 0; j < 3; ++j)
+			file.write(reinterpret_cast<const char*>(&loader.GetVertices()[static_cast<size_t>(stride) * pIndices[3 * i + j]]), sizeof(float[3]));
+		file.write("\0\0", 2);
+	}
+
+	return file.good();
+}
+
+// Both loaders must produce the same triangles, corner by corner, from the same positions.
+static bool matchCorners(const ObjLoader& loader, const ObjLoader& refLoader)
+{
+	if (loader.GetNumIndices() != refLoader.GetNumIndices()) return false;
+
+	for (auto i = 0u; i < loader.GetNumIndices(); ++i)
+	{
+		const auto pPos = &loader.GetVertices()[static_cast<size_t>(loader.GetVertexStride()) * loader.GetIndices()[i]];
+		const auto pRefPos = &refLoader.GetVertices()[static_cast<size_t>(refLoader.GetVertexStride()) * refLoader.GetIndices()[i]];
+		if (memcmp(pPos, pRefPos, sizeof(float[3]))) return false;
+	}
+
+	return true;
+}
+
+static int benchFormats(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(24) << "format" << setw(12) << "vertices"
+		<< setw(12) << "triangles" << setw(12) << "import ms" << setw(12) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		// Plain positions without transforms, so that the written files round-trip exactly.
+		ObjLoader objLoader;
+		if (!objLoader.Import(fileName, false, true, false))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		const auto report = [&](const char* format, const ObjLoader& loader, double importTime, bool check)
+		{
+			cout << left << setw(24) << fileName << right << setw(24) << format << setw(12) << loader.GetNumVertices()
+				<< setw(12) << loader.GetNumIndices() / 3 << fixed << setprecision(2) << setw(12) << importTime * 1000.0
+				<< setw(12) << (check ? "ok" : "FAILED") << endl;
+			if (!check) success = false;
+		};
+
+		const struct
+		{
+			const char* Name;
+			bool BigEndian;
+			bool IsDouble;
+			bool HasExtras;
+		} plyFormats[] =
+		{
+			{ "PLY LE float", false, false, false },
+			{ "PLY BE float", true, false, false },
+			{ "PLY LE double", false, true, false },
+			{ "PLY BE double", true, true, false },
+			{ "PLY LE float, extras", false, false, true },
+			{ "PLY BE double, extras", true, true, true }
+		};
+
+		const auto plyFileName = "SparseVolumeBench_fmt.ply";
+		for (const auto& format : plyFormats)
+		{
+			PlyLoader loader;
+			auto imported = writePly(plyFileName, objLoader, format.BigEndian, format.IsDouble, format.HasExtras);
+			const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(plyFileName, false, true, false) && imported; });
+			report(format.Name, loader, importTime, imported && loader.GetNumVertices() == objLoader.GetNumVertices() &&
+				matchCorners(loader, objLoader));
+		}
+		remove(plyFileName);
+
+		// STL is unindexed, so the import welds it back into at most the OBJ vertices, and
+		// enabling the weld must not weld it again.
+		const auto stlFileName = "SparseVolumeBench_fmt.stl";
+		StlLoader loader, weldLoader;
+		weldLoader.SetVertexWelding(true);
+		auto imported = writeStl(stlFileName, objLoader);
+		const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(stlFileName, false, true, false) && imported; });
+		imported = weldLoader.Import(stlFileName, false, true, false) && imported;
+		remove(stlFileName);
+		report("STL binary", loader, importTime, imported && loader.GetNumVertices() <= objLoader.GetNumVertices() &&
+			loader.GetImportStats().NumVerticesBeforeWeld == loader.GetNumIndices() && matchCorners(loader, objLoader) &&
+			weldLoader.GetNumVertices() == loader.GetNumVertices() && matchCorners(weldLoader, objLoader));
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Index optimization: simulated post-transform cache miss ratio
+//--------------------------------------------------------------------------------------
+
+static int benchACMR(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "triangles" << setw(14) << "ACMR before"
+		<< setw(14) << "ACMR after" << setw(12) << "FIFO 16" << setw(14) << "optimize ms" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader, optLoader;
+		loader.SetVertexWelding(true);
+		optLoader.SetVertexWelding(true);
+		optLoader.SetIndexOptimization(true);
+
+		auto imported = true;
+		const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(fileName) && imported; });
+		const auto optTime = timeBest(numRuns, [&]() { imported = optLoader.Import(fileName) && imported; });
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		const auto& stats = optLoader.GetImportStats();
+		cout << left << setw(24) << fileName << right << setw(12) << optLoader.GetNumIndices() / 3
+			<< fixed << setprecision(3) << setw(14) << stats.ACMRBefore << setw(14) << stats.ACMRAfter
+			<< setw(12) << ObjLoader::ComputeACMR(optLoader.GetIndices(), optLoader.GetNumIndices(), optLoader.GetNumVertices(), 16)
+			<< setprecision(2) << setw(14) << (optTime - importTime) * 1000.0 << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Quantization: GPU bytes and round-trip error of the compact encoding
+//--------------------------------------------------------------------------------------
+
+static int benchQuantize(const vector<const char*>& fileNames, uint32_t)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "float KB" << setw(12) << "compact KB"
+		<< setw(14) << "pos error" << setw(14) << "rel error" << setw(14) << "normal deg" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader, compactLoader;
+		compactLoader.SetQuantization(true);
+		if (!loader.Import(fileName) || !compactLoader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		// Mirrors SparseVolume::createIB, which narrows indices when all vertices fit in 16 bits.
+		const auto numVert = compactLoader.GetNumVertices();
+		const auto indexSize = numVert <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+		const auto floatBytes = loader.GetVertexStride() * loader.GetNumVertices() + sizeof(uint32_t) * loader.GetNumIndices();
+		const auto compactBytes = compactLoader.GetVertexStride() * numVert + indexSize * compactLoader.GetNumIndices();
+
+		const auto& stats = compactLoader.GetImportStats();
+		const auto scale = compactLoader.GetDequantizationScale();
+		const auto extent = 2.0f * (max)(scale.x, (max)(scale.y, scale.z));
+		cout << left << setw(24) << fileName << right << fixed << setprecision(1) << setw(12) << floatBytes / 1024.0
+			<< setw(12) << compactBytes / 1024.0 << scientific << setprecision(2) << setw(14) << stats.MaxPositionError
+			<< setw(14) << stats.MaxPositionError / extent << fixed << setprecision(4) << setw(14) << stats.MaxNormalError << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Post-import passes: scalar over interleaved vertices versus SIMD over SoA streams
+//--------------------------------------------------------------------------------------
+
+static void flipAoS(uint8_t* pVertices, uint32_t stride, uint32_t numVert)
+{
+	for (auto i = 0u; i < numVert; ++i)
+	{
+		const auto p = reinterpret_cast<float*>(pVertices + static_cast<size_t>(stride) * i);
+		const auto tmp = p[1];
+		p[1] = p[2];
+		p[2] = -tmp;
+	}
+}
+
+static void normalizeAoS(uint8_t* pVertices, uint32_t stride, uint32_t numVert)
+{
+	for (auto i = 0u; i < numVert; ++i)
+	{
+		const auto p = reinterpret_cast<float*>(pVertices + static_cast<size_t>(stride) * i);
+		const auto l = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		if (l > 0.0f)
+		{
+			p[0] /= l;
+			p[1] /= l;
+			p[2] /= l;
+		}
+	}
+}
+
+static void boundsAoS(const uint8_t* pVertices, uint32_t stride, uint32_t numVert, float(&minVal)[3], float(&maxVal)[3])
+{
+	const auto p0 = reinterpret_cast<const float*>(pVertices);
+	for (uint8_t c = 0; c < 3; ++c) minVal[c] = maxVal[c] = p0[c];
+	for (auto i = 1u; i < numVert; ++i)
+	{
+		const auto p = reinterpret_cast<const float*>(pVertices + static_cast<size_t>(stride) * i);
+		for (uint8_t c = 0; c < 3; ++c)
+		{
+			minVal[c] = p[c] < minVal[c] ? p[c] : minVal[c];
+			maxVal[c] = p[c] > maxVal[c] ? p[c] : maxVal[c];
+		}
+	}
+}
+
+static int benchSoA(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << setw(14) << "pass" << right << setw(12) << "vertices"
+		<< setw(12) << "AoS ms" << setw(12) << "SoA ms" << setw(10) << "speedup" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		if (!loader.Import(fileName, true, false))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		const auto numVert = loader.GetNumVertices();
+		const auto stride = loader.GetVertexStride();
+		vector<uint8_t> vertices(loader.GetVertices(), loader.GetVertices() + static_cast<size_t>(stride) * numVert);
+		const auto pNormals = vertices.data() + sizeof(float[3]);
+
+		SoAStream positions, normals;
+		positions.Load(vertices.data(), stride, numVert);
+		normals.Load(pNormals, stride, numVert);
+
+		float minAoS[3], maxAoS[3], minSoA[3], maxSoA[3];
+		const auto report = [&](const char* pass, double aosTime, double soaTime)
+		{
+			cout << left << setw(24) << fileName << setw(14) << pass << right << setw(12) << numVert << fixed << setprecision(3);
+			if (aosTime > 0.0) cout << setw(12) << aosTime * 1000.0 << setw(12) << soaTime * 1000.0
+				<< setprecision(1) << setw(9) << aosTime / soaTime << "x" << endl;
+			else cout << setw(12) << "-" << setw(12) << soaTime * 1000.0 << setw(10) << "-" << endl;
+		};
+
+		report("flip", timeBest(numRuns, [&]() { flipAoS(vertices.data(), stride, numVert); }),
+			timeBest(numRuns, [&]() { positions.SwapYZ(); positions.NegateZ(); }));
+		report("normalize", timeBest(numRuns, [&]() { normalizeAoS(pNormals, stride, numVert); }),
+			timeBest(numRuns, [&]() { normals.Normalize(); }));
+		report("bounds", timeBest(numRuns, [&]() { boundsAoS(vertices.data(), stride, numVert, minAoS, maxAoS); }),
+			timeBest(numRuns, [&]() { positions.GetBounds(minSoA, maxSoA); }));
+		// Conversion overhead paid once per import
+		report("load + store", 0.0, timeBest(numRuns, [&]()
+		{
+			positions.Load(vertices.data(), stride, numVert);
+			positions.Store(vertices.data(), stride);
+		}));
+
+		if (memcmp(minAoS, minSoA, sizeof(minAoS)) || memcmp(maxAoS, maxSoA, sizeof(maxAoS)))
+		{
+			cerr << "Bounds mismatch for " << fileName << endl;
+			success = false;
+		}
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Meshlets: cluster statistics and frustum culling, as in mesh-shader depth peeling
+//--------------------------------------------------------------------------------------
+
+static int benchMeshlets(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	// Same limits as MESHLET_MAX_VERTICES and MESHLET_MAX_PRIMITIVES of the renderer
+	const auto maxVertices = 64u;
+	const auto maxPrimitives = 124u;
+
+	cout << left << setw(24) << "file" << right << setw(12) << "triangles" << setw(10) << "meshlets"
+		<< setw(12) << "vert fill" << setw(12) << "prim fill" << setw(12) << "vert reuse"
+		<< setw(12) << "visible" << setw(12) << "build ms" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		loader.SetVertexWelding(true);
+		loader.SetIndexOptimization(true);
+		if (!loader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		MeshletBuilder builder;
+		const auto buildTime = timeBest(numRuns, [&]()
+		{
+			builder.Clear();
+			builder.Add(loader.GetIndices(), loader.GetNumIndices(), loader.GetPositions(),
+				loader.GetPositionStride(), loader.GetNumVertices(), 0, maxVertices, maxPrimitives);
+		});
+
+		// Every triangle lands in exactly one meshlet, and every packed index is in range.
+		const auto numMeshlets = builder.GetNumMeshlets();
+		const auto pMeshlets = builder.GetMeshlets();
+		auto numPrimitives = 0u;
+		for (auto i = 0u; i < numMeshlets; ++i)
+		{
+			const auto& meshlet = pMeshlets[i];
+			numPrimitives += meshlet.PrimitiveCount;
+			success = success && meshlet.VertexCount <= maxVertices && meshlet.PrimitiveCount <= maxPrimitives;
+			for (auto j = 0u; j < meshlet.PrimitiveCount; ++j)
+			{
+				const auto primitive = builder.GetPrimitives()[meshlet.PrimitiveOffset + j];
+				for (uint8_t k = 0; k < 3; ++k)
+					success = success && ((primitive >> (8 * k)) & 0xff) < meshlet.VertexCount;
+			}
+		}
+		if (numPrimitives != loader.GetNumIndices() / 3)
+		{
+			cerr << "Triangle count mismatch for " << fileName << endl;
+			success = false;
+		}
+
+		// Orthographic view of the lower-left quarter of the AABB
+		const auto& aabb = loader.GetAABB();
+		const auto sizeX = (aabb.Max.x - aabb.Min.x) / 2.0f, sizeY = (aabb.Max.y - aabb.Min.y) / 2.0f;
+		const auto depth = (max)(aabb.Max.z - aabb.Min.z, 1e-6f);
+		const float viewProj[4][4] =
+		{
+			{ 2.0f / sizeX, 0.0f, 0.0f, 0.0f },
+			{ 0.0f, 2.0f / sizeY, 0.0f, 0.0f },
+			{ 0.0f, 0.0f, 1.0f / depth, 0.0f },
+			{ -(2.0f * aabb.Min.x + sizeX) / sizeX, -(2.0f * aabb.Min.y + sizeY) / sizeY, -aabb.Min.z / depth, 1.0f }
+		};
+		float planes[6][4];
+		MeshletBuilder::GetFrustumPlanes(planes, viewProj);
+		auto numVisible = 0u;
+		for (auto i = 0u; i < numMeshlets; ++i)
+		{
+			const auto& bound = builder.GetBounds()[i];
+			if (MeshletBuilder::IsSphereInFrustum(planes, bound.Center, bound.Radius)) ++numVisible;
+		}
+
+		const auto avgVertices = static_cast<double>(builder.GetNumVertexIndices()) / numMeshlets;
+		const auto avgPrimitives = static_cast<double>(numPrimitives) / numMeshlets;
+		cout << left << setw(24) << fileName << right << setw(12) << numPrimitives << setw(10) << numMeshlets
+			<< fixed << setprecision(1) << setw(11) << 100.0 * avgVertices / maxVertices << "%"
+			<< setw(11) << 100.0 * avgPrimitives / maxPrimitives << "%"
+			<< setprecision(2) << setw(12) << static_cast<double>(builder.GetNumVertexIndices()) / loader.GetNumVertices()
+			<< setprecision(1) << setw(11) << 100.0 * numVisible / numMeshlets << "%"
+			<< setprecision(2) << setw(12) << buildTime * 1000.0 << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Scene manifests: parsing, path resolution and instance packing of SceneManifest, and the
+// parse rate of a large manifest
+//--------------------------------------------------------------------------------------
+
+static bool isTransformNear(const float a[3][4], const float b[3][4])
+{
+	for (uint8_t i = 0; i < 3; ++i)
+		for (uint8_t j = 0; j < 4; ++j)
+			if (fabsf(a[i][j] - b[i][j]) > 1.0e-5f) return false;
+
+	return true;
+}
+
+static int benchScene(const vector<const char*>&, uint32_t numRuns)
+{
+	cout << left << setw(32) << "case" << right << setw(10) << "meshes" << setw(10) << "instances"
+		<< setw(10) << "ranges" << setw(10) << "check" << endl;
+
+	auto success = true;
+	const auto report = [&](const char* name, const SceneManifest& scene, bool check)
+	{
+		cout << left << setw(32) << name << right << setw(10) << scene.GetNumMeshes() << setw(10) << scene.GetNumInstances()
+			<< setw(10) << scene.GetNumDrawRanges() << setw(10) << (check ? "ok" : "FAILED") << endl;
+		success = success && check;
+	};
+
+	const auto parse = [](SceneManifest& scene, const string& text, const char* baseDir = "")
+	{
+		return scene.Parse(text.c_str(), text.size(), baseDir);
+	};
+
+	// The four instance transform forms
+	{
+		SceneManifest scene;
+		const float translation[] = { 1.0f, 2.0f, 3.0f };
+		float scaled[3][4], rotated[3][4];
+		SceneManifest::ComposeTransform(scaled, translation, 2.0f);
+		SceneManifest::ComposeTransform(rotated, translation, 2.0f, 0.0f, 90.0f, 0.0f);
+		const float translated[3][4] = { { 1.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 2.0f }, { 0.0f, 0.0f, 1.0f, 3.0f } };
+		const float matrix[3][4] = { { 1.0f, 2.0f, 3.0f, 4.0f }, { 5.0f, 6.0f, 7.0f, 8.0f }, { 9.0f, 10.0f, 11.0f, 12.0f } };
+
+		// A yaw of 90 degrees turns +z to +x, as XMMatrixRotationRollPitchYaw().
+		auto check = parse(scene, "mesh a a.obj\r\n"
+			"instance a 1 2 3\r\n"
+			"instance a 1 2 3 2\r\n"
+			"instance a 1 2 3 2 0 90 0 # yaw\r\n"
+			"instance a 1 2 3 4 5 6 7 8 9 10 11 12\r\n") && scene.GetNumInstances() == 4;
+		check = check && fabsf(rotated[0][2] - 2.0f) < 1.0e-5f && fabsf(rotated[2][0] + 2.0f) < 1.0e-5f;
+		if (check)
+		{
+			const auto pInstances = scene.GetInstances();
+			check = isTransformNear(pInstances[0].Transform, translated) && isTransformNear(pInstances[1].Transform, scaled) &&
+				isTransformNear(pInstances[2].Transform, rotated) && isTransformNear(pInstances[3].Transform, matrix);
+		}
+		report("transforms of 3/4/7/12 values", scene, check);
+	}
+
+	// Malformed manifests fail as a whole.
+	const struct
+	{
+		const char* Name;
+		const char* Text;
+	} malformed[] =
+	{
+		{ "duplicate mesh name", "mesh a a.obj\nmesh a b.obj\ninstance a 0 0 0\n" },
+		{ "unknown mesh", "mesh a a.obj\ninstance b 0 0 0\n" },
+		{ "junk after instance", "mesh a a.obj\ninstance a 0 0 0 x\n" },
+		{ "junk after mesh", "mesh a a.obj x\ninstance a 0 0 0\n" },
+		{ "5 transform values", "mesh a a.obj\ninstance a 0 0 0 1 0\n" },
+		{ "13 transform values", "mesh a a.obj\ninstance a 1 0 0 0 0 1 0 0 0 0 1 0 1\n" },
+		{ "unknown keyword", "mesh a a.obj\ninstances a 0 0 0\n" }
+	};
+	for (const auto& test : malformed)
+	{
+		SceneManifest scene;
+		report(test.Name, scene, !parse(scene, test.Text));
+	}
+
+	// Mesh files relative to the manifest, unless absolute
+	{
+		SceneManifest scene;
+		auto check = parse(scene, "mesh a models/a.obj\nmesh b /models/b.obj\nmesh c C:\\models\\c.obj\nmesh d \\\\server\\d.obj\n"
+			"instance a 0 0 0\ninstance b 0 0 0\ninstance c 0 0 0\ninstance d 0 0 0\n", "scenes/") && scene.GetNumMeshes() == 4;
+		if (check)
+		{
+			const auto pMeshes = scene.GetMeshes();
+			check = pMeshes[0].FileName == "scenes/models/a.obj" && pMeshes[1].FileName == "/models/b.obj" &&
+				pMeshes[2].FileName == "C:\\models\\c.obj" && pMeshes[3].FileName == "\\\\server\\d.obj";
+		}
+		report("relative and absolute paths", scene, check);
+
+		// Load() takes the directory of the manifest.
+		const auto fileName = "./SparseVolumeBench_scene.txt";
+		{
+			ofstream file(fileName, ios::binary);
+			file << "mesh a a.obj\ninstance a 0 0 0\n";
+		}
+		check = scene.Load(fileName) && scene.GetNumMeshes() == 1 && scene.GetMeshes()[0].FileName == "./a.obj";
+		remove(fileName);
+		report("paths relative to a file", scene, check);
+	}
+
+	// Unreferenced meshes are dropped, and the instances are grouped by mesh in manifest order.
+	{
+		SceneManifest scene;
+		auto check = parse(scene, "mesh a a.obj\nmesh b b.obj\nmesh c c.obj\nmesh d d.obj\n"
+			"instance c 0 0 0\ninstance a 1 0 0\ninstance c 2 0 0\ninstance a 3 0 0\ninstance c 4 0 0\n") &&
+			scene.GetNumMeshes() == 2 && scene.GetNumInstances() == 5 && scene.GetNumDrawRanges() == 2;
+		if (check)
+		{
+			const auto pMeshes = scene.GetMeshes();
+			const auto pInstances = scene.GetInstances();
+			const auto pDrawRanges = scene.GetDrawRanges();
+			const uint32_t meshIndices[] = { 0, 0, 1, 1, 1 };
+			const float xs[] = { 1.0f, 3.0f, 0.0f, 2.0f, 4.0f };
+			check = pMeshes[0].Name == "a" && pMeshes[1].Name == "c" &&
+				pDrawRanges[0].MeshIndex == 0 && pDrawRanges[0].FirstInstance == 0 && pDrawRanges[0].NumInstances == 2 &&
+				pDrawRanges[1].MeshIndex == 1 && pDrawRanges[1].FirstInstance == 2 && pDrawRanges[1].NumInstances == 3;
+			for (uint8_t i = 0; i < 5; ++i)
+				check = check && pInstances[i].MeshIndex == meshIndices[i] && pInstances[i].Transform[0][3] == xs[i];
+		}
+		report("compaction and draw ranges", scene, check);
+	}
+
+	// A large manifest of every transform form, for the parse rate
+	{
+		const auto numMeshes = 16u, numInstances = 100000u;
+		string text;
+		for (auto i = 0u; i < numMeshes; ++i) text += "mesh m" + to_string(i) + " m" + to_string(i) + ".obj\n";
+		for (auto i = 0u; i < numInstances; ++i)
+		{
+			text += "instance m" + to_string(i * 7 % numMeshes) + " " + to_string(i) + " 0.5 -2";
+			switch (i % 4)
+			{
+			case 1: text += " 1.5"; break;
+			case 2: text += " 1.5 10 20 30"; break;
+			case 3: text += " 0 0 1 0 1 0 0 -1 0"; break;
+			}
+			text += "\n";
+		}
+
+		SceneManifest scene;
+		auto check = true;
+		const auto parseTime = timeBest(numRuns, [&]() { check = parse(scene, text) && check; });
+		check = check && scene.GetNumMeshes() == numMeshes && scene.GetNumInstances() == numInstances;
+		for (auto i = 0u; check && i < scene.GetNumDrawRanges(); ++i)
+		{
+			const auto& drawRange = scene.GetDrawRanges()[i];
+			for (auto j = drawRange.FirstInstance; j < drawRange.FirstInstance + drawRange.NumInstances; ++j)
+				check = check && scene.GetInstances()[j].MeshIndex == drawRange.MeshIndex;
+		}
+		report("100k instances", scene, check);
+		cout << fixed << setprecision(2) << "Parse and pack: " << parseTime * 1000.0 << " ms, "
+			<< (parseTime > 0.0 ? numInstances / parseTime / 1.0e6 : 0.0) << " M instances/s" << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Mesh cleanup: removed triangles and vertices, and the non-manifold edges left
+//--------------------------------------------------------------------------------------
+
+// Vertices within the weld tolerance but on both sides of a grid cell boundary must still
+// weld, and vertices farther apart must not.
+static bool checkToleranceWelding()
+{
+	const auto fileName = "SparseVolumeBench_weld.obj";
+	{
+		ofstream file(fileName, ios::binary);
+		file << "v 0.00999 0 0\nv 0.01001 0 0\nv 0 1 0\nv 0.03 0 0\nf 1 3 4\nf 2 4 3\n";
+	}
+
+	ObjLoader loader;
+	loader.SetVertexWelding(true, 0.01f);
+	const auto success = loader.Import(fileName, false) && loader.GetNumVertices() == 3;
+	remove(fileName);
+
+	cout << left << setw(24) << "weld across cells" << right << setw(12) << (success ? "ok" : "FAILED") << endl;
+
+	return success;
+}
+
+static int benchCleanup(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "triangles" << setw(12) << "cleaned"
+		<< setw(12) << "degenerate" << setw(12) << "duplicate" << setw(12) << "unref vert"
+		<< setw(14) << "non-manifold" << setw(12) << "cleanup ms" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader, cleanLoader;
+		loader.SetNumThreads(0);
+		loader.SetVertexWelding(true);
+		cleanLoader.SetNumThreads(0);
+		cleanLoader.SetVertexWelding(true);
+		cleanLoader.SetMeshCleanup(true);
+
+		auto imported = true;
+		const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(fileName) && imported; });
+		const auto cleanTime = timeBest(numRuns, [&]() { imported = cleanLoader.Import(fileName) && imported; });
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		// The removed counts must add up, and no kept triangle may repeat a vertex.
+		const auto& stats = cleanLoader.GetImportStats();
+		const auto numTri = cleanLoader.GetNumIndices() / 3;
+		const auto pIndices = cleanLoader.GetIndices();
+		auto valid = loader.GetNumIndices() / 3 == numTri + stats.NumDegenerateTriangles + stats.NumDuplicateTriangles &&
+			loader.GetNumVertices() == cleanLoader.GetNumVertices() + stats.NumUnreferencedVertices;
+		for (auto i = 0u; i < numTri && valid; ++i)
+		{
+			const auto pTri = &pIndices[3 * i];
+			valid = pTri[0] != pTri[1] && pTri[1] != pTri[2] && pTri[2] != pTri[0] &&
+				(max)(pTri[0], (max)(pTri[1], pTri[2])) < cleanLoader.GetNumVertices();
+		}
+		if (!valid)
+		{
+			cerr << "Invalid cleanup of " << fileName << endl;
+			success = false;
+		}
+
+		cout << left << setw(24) << fileName << right << setw(12) << loader.GetNumIndices() / 3 << setw(12) << numTri
+			<< setw(12) << stats.NumDegenerateTriangles << setw(12) << stats.NumDuplicateTriangles
+			<< setw(12) << stats.NumUnreferencedVertices << setw(14) << stats.NumNonManifoldEdges
+			<< fixed << setprecision(2) << setw(12) << (cleanTime - importTime) * 1000.0 << endl;
+	}
+
+	if (!checkToleranceWelding()) success = false;
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Triangle reordering: locality of the Morton order alone and with index optimization
+//--------------------------------------------------------------------------------------
+
+// Sorted hashes of the triangles by their vertex positions, rotated to start at the vertex
+// of the smallest hash; equal for the same triangles in any order and vertex numbering.
+static void hashTriangles(const ObjLoader& loader, vector<uint64_t>& hashes)
+{
+	const auto stride = loader.GetVertexStride();
+	const auto pIndices = loader.GetIndices();
+	const auto numTri = loader.GetLODs()[0].NumIndices / 3;
+	hashes.resize(numTri);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		uint64_t vertexHashes[3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			uint32_t bits[3];
+			memcpy(bits, &loader.GetVertices()[static_cast<size_t>(stride) * pIndices[3 * i + j]], sizeof(bits));
+			auto& h = vertexHashes[j];
+			h = 0xcbf29ce484222325ull;
+			for (const auto& b : bits) h = (h ^ b) * 0x100000001b3ull;
+		}
+
+		const auto& vh = vertexHashes;
+		const auto first = vh[0] < vh[1] ? (vh[0] < vh[2] ? 0 : 2) : (vh[1] < vh[2] ? 1 : 2);
+		auto h = 0ull;
+		for (uint8_t j = 0; j < 3; ++j) h = h * 0x9e3779b97f4a7c15ull + vh[(first + j) % 3];
+		hashes[i] = h;
+	}
+	sort(hashes.begin(), hashes.end());
+}
+
+static int benchMorton(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "triangles" << setw(12) << "dist before"
+		<< setw(12) << "dist after" << setw(12) << "ACMR before" << setw(12) << "ACMR after"
+		<< setw(12) << "+opt dist" << setw(12) << "+opt ACMR" << setw(12) << "reorder ms" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader, mortonLoader, optLoader;
+		loader.SetNumThreads(0);
+		loader.SetVertexWelding(true);
+		mortonLoader.SetNumThreads(0);
+		mortonLoader.SetVertexWelding(true);
+		mortonLoader.SetTriangleReordering(true);
+		optLoader.SetNumThreads(0);
+		optLoader.SetVertexWelding(true);
+		optLoader.SetTriangleReordering(true);
+		optLoader.SetIndexOptimization(true);
+
+		auto imported = true;
+		const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(fileName) && imported; });
+		const auto mortonTime = timeBest(numRuns, [&]() { imported = mortonLoader.Import(fileName) && imported; });
+		imported = optLoader.Import(fileName) && imported;
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		// Reordering must keep the same triangles with their windings.
+		vector<uint64_t> hashes, mortonHashes;
+		hashTriangles(loader, hashes);
+		hashTriangles(mortonLoader, mortonHashes);
+		if (hashes != mortonHashes || loader.GetNumVertices() != mortonLoader.GetNumVertices())
+		{
+			cerr << "Invalid triangle reordering of " << fileName << endl;
+			success = false;
+		}
+
+		const auto& stats = mortonLoader.GetImportStats();
+		const auto& optStats = optLoader.GetImportStats();
+		cout << left << setw(24) << fileName << right << setw(12) << mortonLoader.GetNumIndices() / 3
+			<< fixed << setprecision(1) << setw(12) << stats.IndexDistanceBefore << setw(12) << stats.IndexDistanceAfter
+			<< setprecision(3) << setw(12) << stats.ACMRBefore << setw(12) << stats.ACMRAfter
+			<< setprecision(1) << setw(12) << optStats.IndexDistanceAfter << setprecision(3) << setw(12) << optStats.ACMRAfter
+			<< setprecision(2) << setw(12) << (mortonTime - importTime) * 1000.0 << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// LOD chain: topology kept at every level, and the cost of generating it
+//--------------------------------------------------------------------------------------
+
+struct LODTopology
+{
+	uint32_t NumBorderEdges;
+	uint32_t NumNonManifoldEdges;
+	uint32_t NumDegenerateTriangles;	// Repeated vertices or zero area
+};
+
+static LODTopology getLODTopology(const ObjLoader& loader, const ObjLoader::LOD& lod, vector<uint64_t>& edges)
+{
+	LODTopology topology = {};
+	const auto stride = loader.GetVertexStride();
+	const auto pIndices = &loader.GetIndices()[lod.StartIndex];
+	const auto numTri = lod.NumIndices / 3;
+	edges.resize(lod.NumIndices);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto pTri = &pIndices[3 * i];
+		float p[3][3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto v0 = (min)(pTri[j], pTri[(j + 1) % 3]);
+			const auto v1 = (max)(pTri[j], pTri[(j + 1) % 3]);
+			edges[3 * i + j] = (static_cast<uint64_t>(v0) << 32) | v1;
+			memcpy(p[j], &loader.GetVertices()[static_cast<size_t>(stride) * pTri[j]], sizeof(p[j]));
+		}
+
+		const float e1[] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+		const float e2[] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+		const float n[] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		if (pTri[0] == pTri[1] || pTri[1] == pTri[2] || pTri[2] == pTri[0] || (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f))
+			++topology.NumDegenerateTriangles;
+	}
+
+	// Edges used once are on the border, and edges used more than twice are non-manifold.
+	sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); )
+	{
+		auto j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i]) ++j;
+		if (j - i == 1) ++topology.NumBorderEdges;
+		else if (j - i > 2) ++topology.NumNonManifoldEdges;
+		i = j;
+	}
+
+	return topology;
+}
+
+static int benchLODs(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(8) << "level" << setw(12) << "triangles" << setw(12) << "border"
+		<< setw(14) << "non-manifold" << setw(12) << "degenerate" << setw(12) << "error" << setw(12) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		// Without normals, welded vertices are unique positions, so that the edges are shared
+		// across normal seams as well.
+		ObjLoader loader, lodLoader;
+		loader.SetVertexWelding(true);
+		loader.SetMeshCleanup(true);
+		lodLoader.SetVertexWelding(true);
+		lodLoader.SetMeshCleanup(true);
+		lodLoader.SetLODChain(true);
+
+		auto imported = true;
+		const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(fileName, false) && imported; });
+		const auto lodImportTime = timeBest(numRuns, [&]() { imported = lodLoader.Import(fileName, false) && imported; });
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		// Every level keeps the border and the non-manifold edges of the full mesh, has no
+		// degenerate triangles, and has fewer triangles than the level before.
+		vector<uint64_t> edges;
+		const auto pLODs = lodLoader.GetLODs();
+		const auto baseTopology = getLODTopology(lodLoader, pLODs[0], edges);
+		for (auto i = 0u; i < lodLoader.GetNumLODs(); ++i)
+		{
+			const auto topology = getLODTopology(lodLoader, pLODs[i], edges);
+			const auto check = topology.NumBorderEdges == baseTopology.NumBorderEdges &&
+				topology.NumNonManifoldEdges == baseTopology.NumNonManifoldEdges && !topology.NumDegenerateTriangles &&
+				(i == 0 || pLODs[i].NumIndices < pLODs[i - 1].NumIndices);
+			if (!check) success = false;
+
+			cout << left << setw(24) << fileName << right << setw(8) << i << setw(12) << pLODs[i].NumIndices / 3
+				<< setw(12) << topology.NumBorderEdges << setw(14) << topology.NumNonManifoldEdges
+				<< setw(12) << topology.NumDegenerateTriangles << scientific << setprecision(2) << setw(12) << pLODs[i].Error
+				<< setw(12) << (check ? "ok" : "FAILED") << endl;
+		}
+
+		cout << fixed << setprecision(2) << "Import: " << importTime * 1000.0 << " ms, with LODs: " << lodImportTime * 1000.0
+			<< " ms, generating LODs: " << lodLoader.GetImportStats().LODTime * 1000.0 << " ms" << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Heap allocations of repeated imports with every post-import stage enabled
+//--------------------------------------------------------------------------------------
+
+static int benchAlloc(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	cout << left << setw(24) << "file" << right << setw(12) << "first" << setw(12) << "steady"
+		<< setw(12) << "new loader" << setw(12) << "import ms" << endl;
+
+	// Single-threaded, since each worker thread launch allocates; the mesh cache is off, as
+	// its file name is a string.
+	const auto setupLoader = [](ObjLoader& loader, const shared_ptr<ObjLoader::Scratch>& scratch)
+	{
+		loader.SetNumThreads(1);
+		loader.SetScratch(scratch);
+		loader.SetVertexWelding(true);
+		loader.SetMeshCleanup(true);
+		loader.SetTriangleReordering(true);
+		loader.SetIndexOptimization(true);
+		loader.SetLODChain(true);
+		loader.SetQuantization(true);
+		loader.SetVertexLayout(ObjLoader::VERTEX_LAYOUT_SPLIT);
+	};
+
+	auto success = true;
+	numRuns = (max)(numRuns, 2u);
+	for (const auto& fileName : fileNames)
+	{
+		const auto scratch = ObjLoader::MakeScratch();
+		ObjLoader loader;
+		setupLoader(loader, scratch);
+
+		// Every import after the first must be free of allocations.
+		auto imported = true;
+		uint64_t first = 0, steady = 0;
+		auto importTime = 1e30;
+		for (auto i = 0u; i < numRuns; ++i)
+		{
+			const auto numAllocations = g_numAllocations.load();
+			const auto startTime = chrono::steady_clock::now();
+			imported = loader.Import(fileName) && imported;
+			importTime = (min)(importTime, chrono::duration<double>(chrono::steady_clock::now() - startTime).count());
+			if (i == 0) first = g_numAllocations - numAllocations;
+			else steady = (max)(steady, g_numAllocations - numAllocations);
+		}
+
+		// A new loader on the warm scratch allocates its output only.
+		const auto numAllocations = g_numAllocations.load();
+		{
+			ObjLoader newLoader;
+			setupLoader(newLoader, scratch);
+			imported = newLoader.Import(fileName) && imported;
+		}
+		const auto newLoaderAllocations = g_numAllocations - numAllocations;
+
+		if (!imported)
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		if (steady > 0)
+		{
+			cerr << "Repeated imports of " << fileName << " still allocate" << endl;
+			success = false;
+		}
+
+		cout << left << setw(24) << fileName << right << setw(12) << first << setw(12) << steady
+			<< setw(12) << newLoaderAllocations << fixed << setprecision(2) << setw(12) << importTime * 1000.0 << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// CPU k-buffer: depth-peeling throughput, checked against a plain per-triangle scan
+//--------------------------------------------------------------------------------------
+
+// Perspective view of the AABB from -z at the given distance in radii, for row vectors
+static void getViewProj(const ObjLoader::AABB& aabb, float distance, float aspectRatio, float(&viewProj)[4][4])
+{
+	const float center[] = { (aabb.Min.x + aabb.Max.x) / 2.0f, (aabb.Min.y + aabb.Max.y) / 2.0f, (aabb.Min.z + aabb.Max.z) / 2.0f };
+	const float extent[] = { aabb.Max.x - center[0], aabb.Max.y - center[1], aabb.Max.z - center[2] };
+	const auto radius = (max)(sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]), 1e-6f);
+	const float eye[] = { center[0], center[1], center[2] - distance * radius };
+	const auto zNear = (max)((distance - 1.0f) * radius * 0.9f, 0.01f * radius);
+	const auto zFar = (distance + 1.1f) * radius;
+
+	const auto yScale = 1.0f / tanf(3.14159265f / 8.0f), xScale = yScale / aspectRatio;
+	const auto a = zFar / (zFar - zNear), b = -zNear * zFar / (zFar - zNear);
+	const float matrix[4][4] =
+	{
+		{ xScale, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, yScale, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, a, 1.0f },
+		{ -xScale * eye[0], -yScale * eye[1], b - a * eye[2], -eye[2] }
+	};
+	memcpy(viewProj, matrix, sizeof(matrix));
+}
+
+// Every triangle over its whole bounding box, without clipping, tiles, threads or SIMD;
+// the view keeps the mesh in front of the near plane.
+static void rasterizeReference(const ObjLoader& loader, const float viewProj[4][4],
+	uint32_t width, uint32_t height, uint32_t numLayers, vector<uint32_t>& kBuffer)
+{
+	const auto farDepth = 1.0f;
+	uint32_t clearValue;
+	memcpy(&clearValue, &farDepth, sizeof(uint32_t));
+	kBuffer.assign(static_cast<size_t>(width) * height * numLayers, clearValue);
+
+	const auto pIndices = loader.GetIndices();
+	for (auto t = 0u; t + 2 < loader.GetNumIndices(); t += 3)
+	{
+		double x[3], y[3], z[3];
+		int64_t fx[3], fy[3];
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			const auto& p = reinterpret_cast<const ObjLoader::float3*>(loader.GetPositions() +
+				static_cast<size_t>(loader.GetPositionStride()) * pIndices[t + i])[0];
+			float clip[4];
+			for (uint8_t j = 0; j < 4; ++j)
+				clip[j] = p.x * viewProj[0][j] + p.y * viewProj[1][j] + p.z * viewProj[2][j] + viewProj[3][j];
+			const auto invW = 1.0f / clip[3];
+			x[i] = (clip[0] * invW * 0.5f + 0.5f) * width;
+			y[i] = (0.5f - clip[1] * invW * 0.5f) * height;
+			z[i] = clip[2] * invW;
+			fx[i] = static_cast<int64_t>(floor(x[i] * 256.0 + 0.5));
+			fy[i] = static_cast<int64_t>(floor(y[i] * 256.0 + 0.5));
+		}
+
+		const auto area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fx[2] - fx[0]) * (fy[1] - fy[0]);
+		if (area == 0) continue;
+		if (area < 0)
+		{
+			swap(x[1], x[2]);
+			swap(y[1], y[2]);
+			swap(z[1], z[2]);
+			swap(fx[1], fx[2]);
+			swap(fy[1], fy[2]);
+		}
+		const auto dx1 = x[1] - x[0], dy1 = y[1] - y[0], dx2 = x[2] - x[0], dy2 = y[2] - y[0];
+		const auto det = dx1 * dy2 - dx2 * dy1;
+		const auto a = det != 0.0 ? ((z[1] - z[0]) * dy2 - (z[2] - z[0]) * dy1) / det : 0.0;
+		const auto b = det != 0.0 ? ((z[2] - z[0]) * dx1 - (z[1] - z[0]) * dx2) / det : 0.0;
+		const auto c = z[0] - a * x[0] - b * y[0];
+
+		for (auto py = 0u; py < height; ++py)
+		{
+			for (auto px = 0u; px < width; ++px)
+			{
+				// Strictly inside, or on a top or left edge
+				const auto sx = static_cast<int64_t>(px) * 256 + 128, sy = static_cast<int64_t>(py) * 256 + 128;
+				auto inside = true;
+				for (uint8_t i = 0; i < 3 && inside; ++i)
+				{
+					const auto j = (i + 1) % 3;
+					const auto e = (fx[j] - fx[i]) * (sy - fy[i]) - (sx - fx[i]) * (fy[j] - fy[i]);
+					const auto isTopLeft = (fy[i] == fy[j] && fx[j] > fx[i]) || fy[j] < fy[i];
+					inside = e > 0 || (e == 0 && isTopLeft);
+				}
+				if (!inside) continue;
+
+				auto depthF = static_cast<float>(a * (px + 0.5) + b * (py + 0.5) + c);
+				if (!(depthF < 1.0f)) continue;
+				depthF = (max)(depthF, 0.0f);
+				uint32_t depth;
+				memcpy(&depth, &depthF, sizeof(uint32_t));
+				const auto pLayers = &kBuffer[(static_cast<size_t>(width) * py + px) * numLayers];
+				for (auto i = 0u; i < numLayers; ++i)
+				{
+					const auto prev = pLayers[i];
+					pLayers[i] = (min)(prev, depth);
+					depth = (max)(depth, prev);
+				}
+			}
+		}
+	}
+}
+
+static int benchKBuffer(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	// Same layer count as NUM_K_LAYERS of the renderer
+	const auto width = 1280u, height = 720u, numLayers = 16u;
+	const auto refWidth = 160u, refHeight = 90u;
+
+	cout << left << setw(24) << "file" << right << setw(12) << "triangles" << setw(10) << "covered"
+		<< setw(10) << "layers" << setw(10) << "full" << setw(12) << "1 thread ms" << setw(12) << "raster ms"
+		<< setw(12) << "near ms" << setw(10) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		loader.SetVertexWelding(true);
+		loader.SetTriangleReordering(true);
+		if (!loader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		const auto draw = [&loader](KBufferRasterizer& rasterizer, const float viewProj[4][4])
+		{
+			rasterizer.Clear();
+			rasterizer.Draw(viewProj, loader.GetPositions(), loader.GetPositionStride(),
+				loader.GetNumVertices(), loader.GetIndices(), loader.GetNumIndices());
+		};
+
+		float viewProj[4][4], nearViewProj[4][4];
+		getViewProj(loader.GetAABB(), 2.5f, static_cast<float>(width) / height, viewProj);
+		getViewProj(loader.GetAABB(), 0.5f, static_cast<float>(width) / height, nearViewProj);
+
+		KBufferRasterizer rasterizer, serialRasterizer;
+		rasterizer.Init(width, height, numLayers);
+		serialRasterizer.Init(width, height, numLayers);
+		serialRasterizer.SetNumThreads(1);
+		const auto serialTime = timeBest(numRuns, [&]() { draw(serialRasterizer, viewProj); });
+		const auto rasterTime = timeBest(numRuns, [&]() { draw(rasterizer, viewProj); });
+
+		// Coverage statistics of the full view
+		const auto pKBuffer = rasterizer.GetKBuffer();
+		const auto numPixels = width * height;
+		uint64_t numCovered = 0, numFragments = 0, numFull = 0;
+		for (auto i = 0u; i < numPixels; ++i)
+		{
+			auto numPixelLayers = 0u;
+			while (numPixelLayers < numLayers && pKBuffer[numLayers * i + numPixelLayers] != 0x3f800000) ++numPixelLayers;
+			if (numPixelLayers > 0) ++numCovered;
+			if (numPixelLayers == numLayers) ++numFull;
+			numFragments += numPixelLayers;
+		}
+
+		// Threads must not change the result, including with near-plane clipping.
+		auto check = memcmp(pKBuffer, serialRasterizer.GetKBuffer(), sizeof(uint32_t) * numPixels * numLayers) == 0;
+		const auto nearTime = timeBest(numRuns, [&]() { draw(rasterizer, nearViewProj); });
+		draw(serialRasterizer, nearViewProj);
+		check = check && memcmp(rasterizer.GetKBuffer(), serialRasterizer.GetKBuffer(), sizeof(uint32_t) * numPixels * numLayers) == 0;
+
+		// Tiles and SIMD must match the plain scan.
+		vector<uint32_t> refKBuffer;
+		KBufferRasterizer smallRasterizer;
+		smallRasterizer.Init(refWidth, refHeight, numLayers);
+		getViewProj(loader.GetAABB(), 2.5f, static_cast<float>(refWidth) / refHeight, viewProj);
+		draw(smallRasterizer, viewProj);
+		rasterizeReference(loader, viewProj, refWidth, refHeight, numLayers, refKBuffer);
+		check = check && memcmp(smallRasterizer.GetKBuffer(), refKBuffer.data(), sizeof(uint32_t) * refKBuffer.size()) == 0;
+
+		if (!check)
+		{
+			cerr << "K-buffer mismatch for " << fileName << endl;
+			success = false;
+		}
+
+		cout << left << setw(24) << fileName << right << setw(12) << loader.GetNumIndices() / 3
+			<< fixed << setprecision(1) << setw(9) << 100.0 * numCovered / numPixels << "%"
+			<< setprecision(2) << setw(10) << (numCovered ? static_cast<double>(numFragments) / numCovered : 0.0)
+			<< setprecision(1) << setw(9) << (numCovered ? 100.0 * numFull / numCovered : 0.0) << "%"
+			<< setprecision(2) << setw(12) << serialTime * 1000.0 << setw(12) << rasterTime * 1000.0
+			<< setw(12) << nearTime * 1000.0 << setw(10) << (check ? "ok" : "FAILED") << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// CPU sparse ray casting: the scene of the renderer, checked against a per-pixel port of
+// PSSparseRayCast.hlsl and optionally against a screenshot of the GPU path
+//--------------------------------------------------------------------------------------
+
+static void multiply(const float a[4][4], const float b[4][4], float(&c)[4][4])
+{
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j)
+			c[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+}
+
+// XMMatrixLookAtLH(); also returns the camera axes
+static void lookAtLH(const float eye[3], const float focus[3], float(&view)[4][4], float(&axes)[3][3])
+{
+	const auto normalize = [](float(&v)[3])
+	{
+		const auto length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		for (auto& c : v) c /= length;
+	};
+
+	auto& x = axes[0];
+	auto& y = axes[1];
+	auto& z = axes[2];
+	for (uint8_t i = 0; i < 3; ++i) z[i] = focus[i] - eye[i];
+	normalize(z);
+	x[0] = z[2];	// Cross product of the up axis (0, 1, 0) and z
+	x[1] = 0.0f;
+	x[2] = -z[0];
+	normalize(x);
+	y[0] = z[1] * x[2] - z[2] * x[1];
+	y[1] = z[2] * x[0] - z[0] * x[2];
+	y[2] = z[0] * x[1] - z[1] * x[0];
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		for (uint8_t j = 0; j < 3; ++j) view[i][j] = axes[j][i];
+		view[i][3] = 0.0f;
+		view[3][i] = -(axes[i][0] * eye[0] + axes[i][1] * eye[1] + axes[i][2] * eye[2]);
+	}
+	view[3][3] = 1.0f;
+}
+
+struct RayCastScene
+{
+	uint32_t	Width, Height;
+	float		ViewProj[4][4];
+	float		ViewProjLS[4][4];
+	float		Eye[3];
+	float		Axes[3][3];	// Camera x, y and z in world space
+	float		Scales[2];	// Projection x and y scales
+	float		LightDir[3];	// Toward the light, as RayGenConstants::LightDir
+};
+
+// Camera, light and projections of SparseVolumeDXR and SparseVolume::UpdateFrame()
+static void setupRayCastScene(const ObjLoader::AABB& aabb, uint32_t width, uint32_t height, RayCastScene& scene)
+{
+	const auto zNear = 1.0f, zFar = 1000.0f, zNearLS = 1.0f, zFarLS = 128.0f;
+	scene.Width = width;
+	scene.Height = height;
+
+	const float eye[] = { 8.0f, 12.0f, -14.0f }, focus[] = { 0.0f, 4.0f, 0.0f };
+	float view[4][4];
+	memcpy(scene.Eye, eye, sizeof(eye));
+	lookAtLH(eye, focus, view, scene.Axes);
+	scene.Scales[1] = 1.0f / tanf(3.14159265f / 8.0f);
+	scene.Scales[0] = scene.Scales[1] * height / width;
+	const auto range = zFar / (zFar - zNear);
+	const float proj[4][4] =
+	{
+		{ scene.Scales[0], 0.0f, 0.0f, 0.0f },
+		{ 0.0f, scene.Scales[1], 0.0f, 0.0f },
+		{ 0.0f, 0.0f, range, 1.0f },
+		{ 0.0f, 0.0f, -range * zNear, 0.0f }
+	};
+	multiply(view, proj, scene.ViewProj);
+
+	// Bounding box center and half of the largest extent
+	const float bound[] = { (aabb.Max.x + aabb.Min.x) / 2.0f, (aabb.Max.y + aabb.Min.y) / 2.0f, (aabb.Max.z + aabb.Min.z) / 2.0f,
+		(max)(aabb.Max.x - aabb.Min.x, (max)(aabb.Max.y - aabb.Min.y, aabb.Max.z - aabb.Min.z)) / 2.0f };
+	const float lightPt[] = { bound[0] - 10.0f, bound[1] + 45.0f, bound[2] - 75.0f };
+	float viewLS[4][4], axesLS[3][3];
+	lookAtLH(lightPt, bound, viewLS, axesLS);
+	const auto size = bound[3] * 3.0f;
+	const float projLS[4][4] =
+	{
+		{ 2.0f / size, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 2.0f / size, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f / (zFarLS - zNearLS), 0.0f },
+		{ 0.0f, 0.0f, -zNearLS / (zFarLS - zNearLS), 1.0f }
+	};
+	multiply(viewLS, projLS, scene.ViewProjLS);
+	for (uint8_t i = 0; i < 3; ++i) scene.LightDir[i] = -axesLS[2][i];
+}
+
+static float loadDepth(const uint32_t* pLayers, uint32_t i)
+{
+	float depth;
+	memcpy(&depth, &pLayers[i], sizeof(float));
+
+	return depth;
+}
+
+// getLightPathThickness() of PSSparseRayCast.hlsl: the occupied depth intervals of the
+// light-space k-buffer in front of the point
+static float lightPathThicknessReference(const RayCastScene& scene, const uint32_t* pKBufferLS,
+	uint32_t lightSize, uint32_t numLayers, const float pos[3])
+{
+	const auto zNearLS = 1.0f, zFarLS = 128.0f;
+	const auto& m = scene.ViewProjLS;
+	float p[3];
+	for (uint8_t j = 0; j < 3; ++j) p[j] = pos[0] * m[0][j] + pos[1] * m[1][j] + pos[2] * m[2][j] + m[3][j];
+	const auto u = (p[0] * 0.5f + 0.5f) * lightSize, v = (0.5f - p[1] * 0.5f) * lightSize;
+	if (!(u < lightSize) || !(v < lightSize)) return 0.0f;
+
+	const auto pLayers = &pKBufferLS[(static_cast<size_t>(lightSize) * static_cast<uint32_t>((max)(v, 0.0f)) +
+		static_cast<uint32_t>((max)(u, 0.0f))) * numLayers];
+	auto thickness = 0.0f;
+	for (auto i = 0u; i < numLayers / 2; ++i)
+	{
+		const auto depthFront = loadDepth(pLayers, i * 2);
+		auto depthBack = loadDepth(pLayers, i * 2 + 1);
+		if (depthFront > p[2] || depthBack >= 1.0f) break;
+		depthBack = (min)(depthBack, p[2]);
+		thickness += (depthBack - depthFront) * (zFarLS - zNearLS);
+	}
+
+	return thickness;
+}
+
+// PSSparseRayCast.hlsl line by line with std::exp, except that the world positions come
+// from the camera axes rather than an inverse matrix
+static void rayCastReference(const RayCastScene& scene, const uint32_t* pKBuffer, const uint32_t* pKBufferLS,
+	uint32_t lightSize, uint32_t numLayers, vector<uint8_t>& image)
+{
+	const auto zNear = 1.0f, zFar = 1000.0f;
+	const float clear[] = { 0.0f, 0.2f, 0.4f };
+	const auto toViewZ = [&](float z) { return zNear * zFar / (zFar - z * (zFar - zNear)); };
+	const auto lightPathThickness = [&](const float pos[3])
+	{
+		return lightPathThicknessReference(scene, pKBufferLS, lightSize, numLayers, pos);
+	};
+
+	image.resize(static_cast<size_t>(scene.Width) * scene.Height * 4);
+	for (auto y = 0u; y < scene.Height; ++y)
+	{
+		for (auto x = 0u; x < scene.Width; ++x)
+		{
+			const auto pLayers = &pKBuffer[(static_cast<size_t>(scene.Width) * y + x) * numLayers];
+			const auto ndcX = (x + 0.5f) / scene.Width * 2.0f - 1.0f, ndcY = 1.0f - (y + 0.5f) / scene.Height * 2.0f;
+			const auto toWorld = [&](float viewZ, float(&pos)[3])
+			{
+				for (uint8_t j = 0; j < 3; ++j)
+					pos[j] = scene.Eye[j] + (scene.Axes[0][j] * ndcX / scene.Scales[0] +
+						scene.Axes[1][j] * ndcY / scene.Scales[1] + scene.Axes[2][j]) * viewZ;
+			};
+
+			auto thickness = 0.0f, scatter = 0.0f;
+			for (auto i = 0u; i < numLayers / 2; ++i)
+			{
+				const auto depthFront = loadDepth(pLayers, i * 2);
+				const auto depthBack = loadDepth(pLayers, i * 2 + 1);
+				if (depthFront >= 1.0f || depthBack >= 1.0f) break;
+
+				const auto zFront = toViewZ(depthFront), zBack = toViewZ(depthBack);
+				float posFront[3], posFMid[3], posBMid[3], posBack[3];
+				toWorld(zFront, posFront);
+				toWorld(zBack, posBack);
+				for (uint8_t j = 0; j < 3; ++j)
+				{
+					posFMid[j] = posFront[j] + (posBack[j] - posFront[j]) / 3.0f;
+					posBMid[j] = posFront[j] + (posBack[j] - posFront[j]) * (2.0f / 3.0f);
+				}
+
+				const auto thicknessSeg = zBack - zFront;
+				const double thicknesses[] =
+				{
+					lightPathThickness(posFront) + thickness,
+					lightPathThickness(posFMid) + thicknessSeg / 3.0f + thickness,
+					lightPathThickness(posBMid) + thicknessSeg * (2.0f / 3.0f) + thickness,
+					lightPathThickness(posBack) + thickness + thicknessSeg
+				};
+				thickness += thicknessSeg;
+
+				// Simpson rule of the transmissions
+				scatter += static_cast<float>(thicknessSeg / 8.0 * (exp(-thicknesses[0]) +
+					3.0 * (exp(-thicknesses[1]) + exp(-thicknesses[2])) + exp(-thicknesses[3])));
+			}
+
+			const auto transmission = exp(-thickness);
+			const auto pPixel = &image[(static_cast<size_t>(scene.Width) * y + x) * 4];
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto radiance = scatter * 0.8 + 0.2;
+				const auto color = sqrt(radiance + (clear[j] * clear[j] - radiance) * transmission);
+				pPixel[j] = static_cast<uint8_t>((min)((max)(color, 0.0), 1.0) * 255.0 + 0.5);
+			}
+			pPixel[3] = 255;
+		}
+	}
+}
+
+// Binary PPM (P6) with 8-bit channels, as screenshots convert to
+static bool readPPM(const char* fileName, vector<uint8_t>& rgb, uint32_t& width, uint32_t& height)
+{
+	ifstream file(fileName, ios::binary);
+	string magic;
+	file >> magic;
+	if (magic != "P6") return false;
+
+	uint32_t values[3];
+	for (auto& value : values)
+	{
+		file >> ws;
+		while (file.peek() == '#') file.ignore(numeric_limits<streamsize>::max(), '\n') >> ws;
+		file >> value;
+	}
+	if (!file || values[2] != 255) return false;
+	file.get();
+
+	width = values[0];
+	height = values[1];
+	rgb.resize(static_cast<size_t>(width) * height * 3);
+	file.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+
+	return static_cast<bool>(file);
+}
+
+static bool writePPM(const char* fileName, const vector<uint8_t>& rgba, uint32_t width, uint32_t height)
+{
+	ofstream file(fileName, ios::binary);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+		file.write(reinterpret_cast<const char*>(&rgba[4 * i]), 3);
+
+	return static_cast<bool>(file);
+}
+
+// Largest and mean channel differences, and the pixels with any channel beyond the tolerance
+static void compareImages(const uint8_t* pRGBA, const uint8_t* pOther, uint8_t otherComp, size_t numPixels,
+	uint32_t tolerance, uint32_t& maxDiff, double& meanDiff, size_t& numOverTolerance)
+{
+	uint64_t diffSum = 0;
+	maxDiff = 0;
+	numOverTolerance = 0;
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		auto pixelDiff = 0u;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto diff = static_cast<uint32_t>(abs(pRGBA[4 * i + j] - pOther[otherComp * i + j]));
+			pixelDiff = (max)(diff, pixelDiff);
+			diffSum += diff;
+		}
+		maxDiff = (max)(pixelDiff, maxDiff);
+		if (pixelDiff > tolerance) ++numOverTolerance;
+	}
+	meanDiff = numPixels ? static_cast<double>(diffSum) / (3 * numPixels) : 0.0;
+}
+
+static int benchRayCast(const vector<const char*>& fileNames, uint32_t numRuns,
+	const char* refFileName, const char* outFileName, uint32_t tolerance)
+{
+	// Same sizes as the renderer window, SHADOW_MAP_SIZE and NUM_K_LAYERS
+	const auto width = 1280u, height = 720u, lightSize = 1024u, numLayers = 16u;
+
+	// At most this share of the pixels may go beyond the tolerance against the GPU screenshot,
+	// for the differences of rasterization and LOD selection along the silhouettes.
+	const auto maxOverToleranceRatio = 0.01;
+	const auto maxPortOverRatio = 0.0001;
+
+	vector<uint8_t> refImage;
+	uint32_t refWidth = 0, refHeight = 0;
+	if (refFileName && !readPPM(refFileName, refImage, refWidth, refHeight))
+	{
+		cerr << "Cannot read " << refFileName << " as a binary PPM" << endl;
+
+		return 1;
+	}
+	if (refFileName && (refWidth != width || refHeight != height))
+	{
+		cerr << "The reference image must be " << width << "x" << height << endl;
+
+		return 1;
+	}
+
+	cout << left << setw(24) << "file" << right << setw(12) << "k-buffer ms" << setw(12) << "1 thread ms"
+		<< setw(12) << "raycast ms" << setw(10) << "port max" << setw(10) << "port over" << setw(10) << "gpu max" << setw(10) << "gpu mean"
+		<< setw(10) << "gpu over" << setw(10) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		loader.SetVertexWelding(true);
+		if (!loader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		RayCastScene scene;
+		setupRayCastScene(loader.GetAABB(), width, height, scene);
+
+		// View and light k-buffers, as the depth-peeling passes
+		KBufferRasterizer rasterizer, rasterizerLS;
+		rasterizer.Init(width, height, numLayers);
+		rasterizerLS.Init(lightSize, lightSize, numLayers);
+		const auto kBufferTime = timeBest(numRuns, [&]()
+		{
+			for (auto pRasterizer : { &rasterizer, &rasterizerLS })
+			{
+				pRasterizer->Clear();
+				pRasterizer->Draw(pRasterizer == &rasterizer ? scene.ViewProj : scene.ViewProjLS, loader.GetPositions(),
+					loader.GetPositionStride(), loader.GetNumVertices(), loader.GetIndices(), loader.GetNumIndices());
+			}
+		});
+
+		SparseRayCaster rayCaster, serialRayCaster;
+		vector<uint8_t> image(static_cast<size_t>(width) * height * 4), serialImage(image.size()), portImage;
+		for (auto pRayCaster : { &rayCaster, &serialRayCaster })
+		{
+			pRayCaster->SetView(width, height, scene.ViewProj, 1.0f, 1000.0f);
+			pRayCaster->SetLight(lightSize, scene.ViewProjLS, 1.0f, 128.0f);
+			pRayCaster->SetNumLayers(numLayers);
+		}
+		serialRayCaster.SetNumThreads(1);
+		const auto serialTime = timeBest(numRuns, [&]() { serialRayCaster.Render(serialImage.data(), rasterizer.GetKBuffer(), rasterizerLS.GetKBuffer()); });
+		const auto rayCastTime = timeBest(numRuns, [&]() { rayCaster.Render(image.data(), rasterizer.GetKBuffer(), rasterizerLS.GetKBuffer()); });
+
+		// Threads must not change the result, and the lanes must follow the plain port within a level,
+		// but for the rare points whose light-space texel changes with the rounding.
+		rayCastReference(scene, rasterizer.GetKBuffer(), rasterizerLS.GetKBuffer(), lightSize, numLayers, portImage);
+		uint32_t portMaxDiff;
+		double portMeanDiff;
+		size_t numPortOver;
+		compareImages(image.data(), portImage.data(), 4, static_cast<size_t>(width) * height, 1, portMaxDiff, portMeanDiff, numPortOver);
+		auto check = image == serialImage && numPortOver <= maxPortOverRatio * width * height;
+
+		uint32_t gpuMaxDiff = 0;
+		double gpuMeanDiff = 0.0;
+		size_t numGpuOver = 0;
+		if (refFileName)
+		{
+			compareImages(image.data(), refImage.data(), 3, static_cast<size_t>(width) * height, tolerance, gpuMaxDiff, gpuMeanDiff, numGpuOver);
+			check = check && numGpuOver <= maxOverToleranceRatio * width * height;
+		}
+
+		if (!check)
+		{
+			cerr << "Ray-cast mismatch for " << fileName << endl;
+			success = false;
+		}
+
+		if (outFileName && !writePPM(outFileName, image, width, height))
+		{
+			cerr << "Cannot write " << outFileName << endl;
+			success = false;
+		}
+
+		cout << left << setw(24) << fileName << right << fixed << setprecision(2) << setw(12) << kBufferTime * 1000.0
+			<< setw(12) << serialTime * 1000.0 << setw(12) << rayCastTime * 1000.0 << setw(10) << portMaxDiff << setw(10) << numPortOver;
+		if (refFileName)
+			cout << setw(10) << gpuMaxDiff << setw(10) << gpuMeanDiff << setprecision(1) << setw(9) << 100.0 * numGpuOver / (width * height) << "%";
+		else cout << setw(10) << "-" << setw(10) << "-" << setw(10) << "-";
+		cout << setw(10) << (check ? "ok" : "FAILED") << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// CPU light-ray BVH: the all-hit RayLengthSum of SparseRayCast.hlsl at the sample points of
+// the ray generation, checked against plain ray-triangle tests and against the light-path
+// thickness of the shadow-map k-buffer
+//--------------------------------------------------------------------------------------
+
+// Every triangle in double precision, front facing when clockwise from the ray origin
+static double rayLengthSumReference(const ObjLoader& loader, const double origin[3], const double dir[3], uint32_t& numHits)
+{
+	const auto pPositions = loader.GetPositions();
+	const auto stride = loader.GetPositionStride();
+	const auto pIndices = loader.GetIndices();
+	const auto numIndices = loader.GetNumIndices();
+
+	auto sum = 0.0;
+	numHits = 0;
+	for (auto i = 0u; i + 2 < numIndices; i += 3)
+	{
+		double v[3][3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			float p[3];
+			memcpy(p, &pPositions[static_cast<size_t>(stride) * pIndices[i + j]], sizeof(p));
+			for (uint8_t k = 0; k < 3; ++k) v[j][k] = p[k];
+		}
+
+		// Moller-Trumbore
+		double e1[3], e2[3], s[3], p[3], q[3];
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			e1[k] = v[1][k] - v[0][k];
+			e2[k] = v[2][k] - v[0][k];
+			s[k] = origin[k] - v[0][k];
+		}
+		const auto cross = [](const double a[3], const double b[3], double(&c)[3])
+		{
+			c[0] = a[1] * b[2] - a[2] * b[1];
+			c[1] = a[2] * b[0] - a[0] * b[2];
+			c[2] = a[0] * b[1] - a[1] * b[0];
+		};
+		cross(dir, e2, p);
+		const auto det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (det == 0.0) continue;
+		const auto u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+		if (u < 0.0 || u > 1.0) continue;
+		cross(s, e1, q);
+		const auto v2 = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) / det;
+		if (v2 < 0.0 || u + v2 > 1.0) continue;
+		const auto t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+		if (t < 0.0 || t > 10000.0) continue;
+
+		// The geometric normal e1 x e2 faces the ray for front faces; det = -dot(dir, e1 x e2).
+		sum += det > 0.0 ? -t : t;
+		++numHits;
+	}
+
+	return sum;
+}
+
+// Front, 1/3, 2/3 and back points of every view segment, as raygenMain(), from every
+// pixelStep-th pixel, in tiles of tileSize x tileSize of those pixels
+static void getLightRayOrigins(const RayCastScene& scene, const uint32_t* pKBuffer, uint32_t width, uint32_t height,
+	uint32_t numLayers, uint32_t pixelStep, uint32_t tileSize, vector<float>& origins)
+{
+	const auto zNear = 1.0f, zFar = 1000.0f;
+	const auto toViewZ = [&](float z) { return zNear * zFar / (zFar - z * (zFar - zNear)); };
+	const auto tileStep = pixelStep * tileSize;
+	origins.clear();
+	for (auto tileY = 0u; tileY < height; tileY += tileStep)
+	{
+		for (auto tileX = 0u; tileX < width; tileX += tileStep)
+		{
+			for (auto y = tileY + pixelStep / 2; y < (min)(tileY + tileStep, height); y += pixelStep)
+			{
+				for (auto x = tileX + pixelStep / 2; x < (min)(tileX + tileStep, width); x += pixelStep)
+				{
+					const auto pLayers = &pKBuffer[(static_cast<size_t>(width) * y + x) * numLayers];
+					const auto ndcX = (x + 0.5f) / width * 2.0f - 1.0f, ndcY = 1.0f - (y + 0.5f) / height * 2.0f;
+					for (auto i = 0u; i < numLayers / 2; ++i)
+					{
+						const auto depthFront = loadDepth(pLayers, i * 2);
+						const auto depthBack = loadDepth(pLayers, i * 2 + 1);
+						if (depthFront >= 1.0f || depthBack >= 1.0f) break;
+
+						const auto zFront = toViewZ(depthFront), zBack = toViewZ(depthBack);
+						for (uint8_t j = 0; j < 4; ++j)
+						{
+							const auto viewZ = zFront + (zBack - zFront) * j / 3.0f;
+							for (uint8_t k = 0; k < 3; ++k)
+								origins.emplace_back(scene.Eye[k] + (scene.Axes[0][k] * ndcX / scene.Scales[0] +
+									scene.Axes[1][k] * ndcY / scene.Scales[1] + scene.Axes[2][k]) * viewZ);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+static int benchBVH(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	// Same sizes as the renderer window, SHADOW_MAP_SIZE and NUM_K_LAYERS; light rays go from
+	// every 4th pixel, and the brute-force check takes every 64th ray.
+	const auto width = 1280u, height = 720u, lightSize = 1024u, numLayers = 16u;
+	const auto pixelStep = 4u, refStep = 64u;
+	const auto tMax = 10000.0f;
+
+	// The shadow-map thickness must be within a few light texels of the rays along the
+	// silhouettes, for all but this share of the points. This holds for the closed meshes
+	// within the light depth range and the k-buffer layers, and is not checked otherwise.
+	const auto maxOverRatio = 0.02;
+
+	cout << left << setw(24) << "file" << right << setw(10) << "tris" << setw(10) << "nodes" << setw(8) << "SAH"
+		<< setw(10) << "build ms" << setw(10) << "rays" << setw(10) << "Mrays/s" << setw(10) << "ref over"
+		<< setw(10) << "cull max" << setw(10) << "kbuf mean" << setw(10) << "kbuf over" << setw(10) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		loader.SetVertexWelding(true);
+		if (!loader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		RayCastScene scene;
+		setupRayCastScene(loader.GetAABB(), width, height, scene);
+
+		TriangleBVH bvh;
+		const auto buildTime = timeBest(numRuns, [&]()
+		{
+			bvh.Clear();
+			bvh.AddTriangles(loader.GetPositions(), loader.GetPositionStride(), loader.GetNumVertices(),
+				loader.GetIndices(), loader.GetNumIndices());
+			bvh.Build();
+		});
+
+		// View and light k-buffers, as the depth-peeling passes
+		KBufferRasterizer rasterizer, rasterizerLS;
+		rasterizer.Init(width, height, numLayers);
+		rasterizerLS.Init(lightSize, lightSize, numLayers);
+		for (auto pRasterizer : { &rasterizer, &rasterizerLS })
+			pRasterizer->Draw(pRasterizer == &rasterizer ? scene.ViewProj : scene.ViewProjLS, loader.GetPositions(),
+				loader.GetPositionStride(), loader.GetNumVertices(), loader.GetIndices(), loader.GetNumIndices());
+
+		vector<float> origins;
+		getLightRayOrigins(scene, rasterizer.GetKBuffer(), width, height, numLayers, pixelStep, 1, origins);
+		vector<TriangleBVH::Ray> rays(origins.size() / 3);
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			auto& ray = rays[i];
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				ray.Origin[k] = origins[i * 3 + k];
+				ray.Direction[k] = scene.LightDir[k];
+			}
+			ray.TMin = 0.0f;
+			ray.TMax = tMax;
+		}
+
+		const auto numRays = static_cast<uint32_t>(rays.size());
+		vector<float> sums(numRays);
+		const auto traceTime = timeBest(numRuns, [&]()
+		{
+			for (auto i = 0u; i < numRays; ++i) sums[i] = bvh.TraceRayLengthSum(rays[i]);
+		});
+
+		// The sizes of the scene and of a light texel
+		const auto& aabb = loader.GetAABB();
+		const auto extent = (max)(aabb.Max.x - aabb.Min.x, (max)(aabb.Max.y - aabb.Min.y, aabb.Max.z - aabb.Min.z));
+		const auto texelSize = extent * 1.5f / lightSize;
+
+		// Same hits as the plain tests, but for the rays grazing edges within the rounding
+		auto numRefOver = 0u;
+		for (auto i = 0u; i < numRays; i += refStep)
+		{
+			const auto& ray = rays[i];
+			const double origin[] = { ray.Origin[0], ray.Origin[1], ray.Origin[2] };
+			const double dir[] = { ray.Direction[0], ray.Direction[1], ray.Direction[2] };
+			uint32_t numHits, numRefHits;
+			const auto sum = bvh.TraceRayLengthSum(ray, TriangleBVH::RAY_FLAG_NONE, &numHits);
+			const auto refSum = rayLengthSumReference(loader, origin, dir, numRefHits);
+			if (numHits != numRefHits || fabs(sum - refSum) > 1.0e-4 * extent * (numHits + 1)) ++numRefOver;
+		}
+
+		// TRACE_RAY_ONCE: the signed sum equals the back-face sum less the front-face sum.
+		auto cullMaxDiff = 0.0f;
+		for (auto i = 0u; i < numRays; i += refStep)
+		{
+			const auto front = bvh.TraceRayLengthSum(rays[i], TriangleBVH::RAY_FLAG_CULL_BACK_FACING_TRIANGLES);
+			const auto back = bvh.TraceRayLengthSum(rays[i], TriangleBVH::RAY_FLAG_CULL_FRONT_FACING_TRIANGLES);
+			cullMaxDiff = (max)(fabsf(back - front - sums[i]) / extent, cullMaxDiff);
+		}
+
+		// Against the shadow-map path
+		auto kBufferSumDiff = 0.0;
+		auto numKBufferOver = 0u;
+		for (auto i = 0u; i < numRays; ++i)
+		{
+			const auto thickness = lightPathThicknessReference(scene, rasterizerLS.GetKBuffer(), lightSize, numLayers, rays[i].Origin);
+			const auto diff = fabsf(thickness - sums[i]);
+			kBufferSumDiff += diff;
+			if (diff > 4.0f * texelSize) ++numKBufferOver;
+		}
+		const auto kBufferMeanDiff = numRays ? kBufferSumDiff / numRays / texelSize : 0.0;
+
+		auto isKBufferExact = true;
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			const float corner[] = { i & 1 ? aabb.Max.x : aabb.Min.x, i & 2 ? aabb.Max.y : aabb.Min.y, i & 4 ? aabb.Max.z : aabb.Min.z };
+			const auto& m = scene.ViewProjLS;
+			const auto z = corner[0] * m[0][2] + corner[1] * m[1][2] + corner[2] * m[2][2] + m[3][2];
+			isKBufferExact = isKBufferExact && z >= 0.0f && z <= 1.0f;
+		}
+		for (auto i = 0u; i < lightSize * lightSize && isKBufferExact; ++i)
+			isKBufferExact = loadDepth(&rasterizerLS.GetKBuffer()[static_cast<size_t>(numLayers) * i], numLayers - 1) >= 1.0f;
+
+		const auto numRefRays = (numRays + refStep - 1) / refStep;
+		const auto check = numRefOver <= numRefRays / 1000 && cullMaxDiff < 1.0e-4f &&
+			(!isKBufferExact || numKBufferOver <= maxOverRatio * numRays);
+		if (!check)
+		{
+			cerr << "Light-ray mismatch for " << fileName << endl;
+			success = false;
+		}
+
+		cout << left << setw(24) << fileName << right << setw(10) << bvh.GetNumTriangles() << setw(10) << bvh.GetNumNodes()
+			<< fixed << setprecision(1) << setw(8) << bvh.GetSAHCost() << setprecision(2) << setw(10) << buildTime * 1000.0
+			<< setw(10) << numRays << setw(10) << (traceTime > 0.0 ? numRays / traceTime / 1.0e6 : 0.0)
+			<< setw(10) << numRefOver << setprecision(6) << setw(10) << cullMaxDiff << setprecision(2) << setw(10) << kBufferMeanDiff
+			<< setprecision(1) << setw(9) << (numRays ? 100.0 * numKBufferOver / numRays : 0.0) << (isKBufferExact ? "%" : "?")
+			<< setw(10) << (check ? "ok" : "FAILED") << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Light-ray packets: the light rays of raygenMain() share LightDir, so TriangleBVH traces
+// them in packets of 8 or 16 with one inverse direction and child order; compared with
+// single rays from every pixel, in tiles of 4 x 4 pixels
+//--------------------------------------------------------------------------------------
+
+static int benchPacket(const vector<const char*>& fileNames, uint32_t numRuns)
+{
+	const auto width = 1280u, height = 720u, numLayers = 16u;
+	const auto tileSize = 4u;
+	const auto tMax = 10000.0f;
+
+	const TriangleBVH::TraceMode modes[] =
+	{
+		TriangleBVH::TRACE_MODE_SINGLE,
+		TriangleBVH::TRACE_MODE_PACKET_8,
+		TriangleBVH::TRACE_MODE_PACKET_16
+	};
+	const char* modeNames[] = { "single", "packet 8", "packet 16" };
+
+	cout << left << setw(24) << "file" << setw(12) << "mode" << right << setw(10) << "rays"
+		<< setw(10) << "ms" << setw(10) << "Mrays/s" << setw(10) << "speedup" << setw(10) << "check" << endl;
+
+	auto success = true;
+	for (const auto& fileName : fileNames)
+	{
+		ObjLoader loader;
+		loader.SetVertexWelding(true);
+		if (!loader.Import(fileName))
+		{
+			cerr << "Cannot import " << fileName << endl;
+			success = false;
+			continue;
+		}
+
+		RayCastScene scene;
+		setupRayCastScene(loader.GetAABB(), width, height, scene);
+
+		TriangleBVH bvh;
+		bvh.AddTriangles(loader.GetPositions(), loader.GetPositionStride(), loader.GetNumVertices(),
+			loader.GetIndices(), loader.GetNumIndices());
+		bvh.Build();
+
+		KBufferRasterizer rasterizer;
+		rasterizer.Init(width, height, numLayers);
+		rasterizer.Draw(scene.ViewProj, loader.GetPositions(), loader.GetPositionStride(),
+			loader.GetNumVertices(), loader.GetIndices(), loader.GetNumIndices());
+
+		vector<float> origins;
+		getLightRayOrigins(scene, rasterizer.GetKBuffer(), width, height, numLayers, 1, tileSize, origins);
+		const auto numRays = static_cast<uint32_t>(origins.size() / 3);
+
+		// Packets must give the very sums of single rays.
+		vector<float> singleSums(numRays), sums(numRays);
+		auto singleTime = 0.0;
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			auto& modeSums = i ? sums : singleSums;
+			const auto time = timeBest(numRuns, [&]()
+			{
+				bvh.TraceRayLengthSums(modeSums.data(), origins.data(), numRays, scene.LightDir, 0.0f, tMax,
+					TriangleBVH::RAY_FLAG_NONE, modes[i]);
+			});
+			if (i == 0) singleTime = time;
+
+			const auto check = !numRays || !memcmp(modeSums.data(), singleSums.data(), sizeof(float) * numRays);
+			if (!check)
+			{
+				cerr << "Packet sums differ from single rays for " << fileName << endl;
+				success = false;
+			}
+
+			cout << left << setw(24) << fileName << setw(12) << modeNames[i] << right << setw(10) << numRays
+				<< fixed << setprecision(2) << setw(10) << time * 1000.0 << setw(10) << (time > 0.0 ? numRays / time / 1.0e6 : 0.0)
+				<< setw(10) << (time > 0.0 ? singleTime / time : 0.0) << setw(10) << (check ? "ok" : "FAILED") << endl;
+		}
+	}
+
+	return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Import suite: every combination of the Import() options, with optional JSON output
+// for comparing versions
+//--------------------------------------------------------------------------------------
+
+static int benchSuite(const vector<const char*>& fileNames, uint32_t numRuns, const char* jsonFileName)
+{
+	struct Result
+	{
+		const char*	FileName;
+		uint8_t		Options;
+		uint64_t	NumBytes;
+		uint32_t	NumVertices;
+		uint32_t	NumTriangles;
+		double		Time;
+		uint64_t	PeakRSS;
+	};
+
+	enum Option : uint8_t
+	{
+		OPTION_NEED_NORM = (1 << 0),
+		OPTION_NEED_AABB = (1 << 1),
+		OPTION_FOR_DX = (1 << 2),
+		OPTION_SWAP_YZ = (1 << 3),
+		NUM_OPTION_COMBINATIONS = (1 << 4)
+	};
+
+	cout << left << setw(24) << "file" << setw(20) << "norm aabb dx yz" << right << setw(12) << "triangles"
+		<< setw(12) << "ms" << setw(12) << "MB/s" << setw(12) << "Mtri/s" << setw(14) << "peak RSS MB" << endl;
+
+	// The peak RSS is that of the process so far, so the files are best listed smallest first.
+	auto success = true;
+	vector<Result> results;
+	for (const auto& fileName : fileNames)
+	{
+		for (uint8_t options = 0; options < NUM_OPTION_COMBINATIONS; ++options)
+		{
+			const auto needNorm = (options & OPTION_NEED_NORM) != 0;
+			const auto needAABB = (options & OPTION_NEED_AABB) != 0;
+			const auto forDX = (options & OPTION_FOR_DX) != 0;
+			const auto swapYZ = (options & OPTION_SWAP_YZ) != 0;
+
+			ObjLoader loader;
+			auto imported = true;
+			const auto importTime = timeBest(numRuns, [&]() { imported = loader.Import(fileName, needNorm, needAABB, forDX, swapYZ) && imported; });
+			if (!imported)
+			{
+				cerr << "Cannot import " << fileName << endl;
+				success = false;
+				break;
+			}
+
+			Result result;
+			result.FileName = fileName;
+			result.Options = options;
+			result.NumBytes = loader.GetImportStats().NumBytes;
+			result.NumVertices = loader.GetNumVertices();
+			result.NumTriangles = loader.GetNumIndices() / 3;
+			result.Time = importTime;
+			result.PeakRSS = getPeakRSS();
+			results.emplace_back(result);
+
+			const char* flags[] = { "-    ", "norm ", "-    ", "aabb ", "-  ", "dx ", "-", "yz" };
+			const auto optionNames = string(flags[needNorm]) + flags[2 + needAABB] + flags[4 + forDX] + flags[6 + swapYZ];
+			cout << left << setw(24) << fileName << setw(20) << optionNames << right << setw(12) << result.NumTriangles
+				<< fixed << setprecision(2) << setw(12) << importTime * 1000.0 << setw(12) << result.NumBytes / importTime / 1e6
+				<< setw(12) << result.NumTriangles / importTime / 1e6 << setw(14) << result.PeakRSS / 1048576.0 << endl;
+		}
+	}
+
+	if (jsonFileName)
+	{
+		ofstream file(jsonFileName);
+		if (!file)
+		{
+			cerr << "Cannot write " << jsonFileName << endl;
+
+			return 1;
+		}
+
+		const auto timestamp = time(nullptr);
+		file << "{" << endl;
+		file << "  \"benchmark\": \"suite\"," << endl;
+		file << "  \"timestamp\": " << static_cast<int64_t>(timestamp) << "," << endl;
+		file << "  \"runs\": " << numRuns << "," << endl;
+		file << "  \"meshCacheVersion\": " << ObjLoader::MeshCacheVersion << "," << endl;
+		file << "  \"results\": [" << endl;
+		file << setprecision(9);
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const auto& result = results[i];
+			const auto boolean = [&result](uint8_t option) { return result.Options & option ? "true" : "false"; };
+			file << "    { \"file\": " << toJSONString(result.FileName)
+				<< ", \"needNorm\": " << boolean(OPTION_NEED_NORM) << ", \"needAABB\": " << boolean(OPTION_NEED_AABB)
+				<< ", \"forDX\": " << boolean(OPTION_FOR_DX) << ", \"swapYZ\": " << boolean(OPTION_SWAP_YZ)
+				<< ", \"bytes\": " << result.NumBytes << ", \"vertices\": " << result.NumVertices
+				<< ", \"triangles\": " << result.NumTriangles << ", \"seconds\": " << result.Time
+				<< ", \"bytesPerSecond\": " << result.NumBytes / result.Time
+				<< ", \"trianglesPerSecond\": " << result.NumTriangles / result.Time
+				<< ", \"peakRSSBytes\": " << result.PeakRSS << " }" << (i + 1 < results.size() ? "," : "") << endl;
+		}
+		file << "  ]" << endl;
+		file << "}" << endl;
+	}
+
+	return success ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	string mode = "scanner";
+	auto numRuns = 5u;
+	const char* jsonFileName = nullptr;
+	const char* refFileName = nullptr;
+	const char* outFileName = nullptr;
+	auto tolerance = 8u;
+	vector<const char*> fileNames;
+	for (auto i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-runs") && i + 1 < argc) numRuns = (max)(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "-json") && i + 1 < argc) jsonFileName = argv[++i];
+		else if (!strcmp(argv[i], "-ref") && i + 1 < argc) refFileName = argv[++i];
+		else if (!strcmp(argv[i], "-out") && i + 1 < argc) outFileName = argv[++i];
+		else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc) tolerance = static_cast<uint32_t>((max)(atoi(argv[++i]), 0));
+		else if (argv[i][0] == '-') mode = argv[i] + 1;
+		else fileNames.emplace_back(argv[i]);
+	}
+	if (fileNames.empty()) fileNames.assign(g_defaultFiles, g_defaultFiles + sizeof(g_defaultFiles) / sizeof(g_defaultFiles[0]));
+
+	if (mode == "scanner") return benchScanner(fileNames, numRuns);
+	if (mode == "import") return benchImport(fileNames, numRuns);
+	if (mode == "formats") return benchFormats(fileNames, numRuns);
+	if (mode == "acmr") return benchACMR(fileNames, numRuns);
+	if (mode == "quantize") return benchQuantize(fileNames, numRuns);
+	if (mode == "soa") return benchSoA(fileNames, numRuns);
+	if (mode == "meshlets") return benchMeshlets(fileNames, numRuns);
+	if (mode == "scene") return benchScene(fileNames, numRuns);
+	if (mode == "cleanup") return benchCleanup(fileNames, numRuns);
+	if (mode == "morton") return benchMorton(fileNames, numRuns);
+	if (mode == "lods") return benchLODs(fileNames, numRuns);
+	if (mode == "alloc") return benchAlloc(fileNames, numRuns);
+	if (mode == "kbuffer") return benchKBuffer(fileNames, numRuns);
+	if (mode == "raycast") return benchRayCast(fileNames, numRuns, refFileName, outFileName, tolerance);
+	if (mode == "bvh") return benchBVH(fileNames, numRuns);
+	if (mode == "packet") return benchPacket(fileNames, numRuns);
+	if (mode == "suite") return benchSuite(fileNames, numRuns, jsonFileName);
+
+	cerr << "Usage: SparseVolumeBench [-scanner|-import|-formats|-acmr|-quantize|-soa|-meshlets|-scene|-cleanup|-morton|-lods|-alloc|-kbuffer|-raycast|-bvh|-packet|-suite] [-runs N] [-json file]"
+		" [-ref image.ppm] [-out image.ppm] [-tolerance N] [files...]" << endl;
+
+	return 1;
+}
@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "DepthPeelMeshlet.hlsli"
+
+groupshared Payload s_payload;
+groupshared uint s_numVisible;
+
+//--------------------------------------------------------------------------------------
+// Meshlet culling against the view frustum; the back faces are kept, since depth
+// peeling needs every layer of the surface.
+//--------------------------------------------------------------------------------------
+[numthreads(MESHLET_GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID, uint GTid : SV_GroupThreadID)
+{
+	if (GTid == 0) s_numVisible = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// One thread per meshlet and instance
+	const uint threadIdx = g_baseThread + DTid;
+	const uint instanceIdx = threadIdx / g_numMeshlets;
+	const uint meshletIdx = g_firstMeshlet + threadIdx % g_numMeshlets;
+
+	bool visible = false;
+	if (instanceIdx < g_numInstances)
+	{
+		const Instance instance = g_instances[g_baseInstance + instanceIdx];
+		const float4 bound = g_meshletBounds[meshletIdx];
+		const float3 center = TransformToWorld(instance, bound.xyz);
+
+		// The radius grows by the largest axis scale of the world transform.
+		const float3x3 world = float3x3(instance.World[0].xyz, instance.World[1].xyz, instance.World[2].xyz);
+		const float3 scales = float3(length(world._11_21_31), length(world._12_22_32), length(world._13_23_33));
+		const float radius = bound.w * max(scales.x, max(scales.y, scales.z));
+
+		visible = true;
+		[unroll]
+		for (uint i = 0; i < 6; ++i)
+			visible = visible && dot(g_frustumPlanes[i].xyz, center) + g_frustumPlanes[i].w >= -radius;
+	}
+
+	// Compact the visible meshlets into the payload
+	if (visible)
+	{
+		uint idx;
+		InterlockedAdd(s_numVisible, 1, idx);
+		s_payload.Instances[idx] = g_baseInstance + instanceIdx;
+		s_payload.Meshlets[idx] = meshletIdx;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	DispatchMesh(s_numVisible, 1, 1, s_payload);
+}
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct Instance
+{
+	float4	World[3];	// Rows of the 3x4 world matrix, as in the ray-tracing instance descs
+};
+
+struct Meshlet
+{
+	uint	VertexOffset;
+	uint	VertexCount;
+	uint	PrimitiveOffset;
+	uint	PrimitiveCount;
+};
+
+struct Payload
+{
+	uint	Instances[MESHLET_GROUP_SIZE];
+	uint	Meshlets[MESHLET_GROUP_SIZE];
+};
+
+//--------------------------------------------------------------------------------------
+// Constant buffers
+//--------------------------------------------------------------------------------------
+// Registers are explicit, since the amplification and mesh shaders use different subsets.
+cbuffer cbMatrices : register (b0)
+{
+	matrix	g_viewProj;
+	float4	g_frustumPlanes[6];	// World space, facing inward
+};
+
+cbuffer cbMeshlets : register (b1)
+{
+	uint	g_firstMeshlet;
+	uint	g_numMeshlets;
+	uint	g_baseInstance;
+	uint	g_numInstances;
+	uint	g_quantizedPositions;	// SNORM16 positions, dequantized by the world transforms
+	uint	g_baseThread;			// Of the chunk, for draws split at the group count limit
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+StructuredBuffer<Instance>	g_instances		: register (t0);
+StructuredBuffer<Meshlet>	g_meshlets		: register (t1);
+StructuredBuffer<float4>	g_meshletBounds	: register (t2);	// Bounding spheres
+StructuredBuffer<uint>		g_vertexIndices	: register (t3);
+StructuredBuffer<uint>		g_primitives	: register (t4);	// Local indices packed as 8:8:8
+ByteAddressBuffer			g_positions		: register (t5);
+
+//--------------------------------------------------------------------------------------
+// Object space to world space
+//--------------------------------------------------------------------------------------
+float3 TransformToWorld(Instance instance, float3 pos)
+{
+	const float4 p = float4(pos, 1.0);
+
+	return float3(dot(instance.World[0], p), dot(instance.World[1], p), dot(instance.World[2], p));
+}
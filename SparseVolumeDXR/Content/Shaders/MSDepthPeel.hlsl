@@ -0,0 +1,57 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "DepthPeelMeshlet.hlsli"
+
+#define MESHLET_GROUP_THREADS	128
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct VertexOut
+{
+	float4	Pos	: SV_POSITION;
+};
+
+//--------------------------------------------------------------------------------------
+// Position fetch, either float3 or SNORM16x4
+//--------------------------------------------------------------------------------------
+float3 LoadPosition(uint i)
+{
+	if (g_quantizedPositions)
+	{
+		const uint2 q = g_positions.Load2(i * 8);
+		const int3 v = int3(uint3(q.x << 16, q.x, q.y << 16)) >> 16;	// Sign extension
+
+		return max(v / 32767.0, -1.0);
+	}
+
+	return asfloat(g_positions.Load3(i * 12));
+}
+
+//--------------------------------------------------------------------------------------
+// Meshlet vertex processing
+//--------------------------------------------------------------------------------------
+[numthreads(MESHLET_GROUP_THREADS, 1, 1)]
+[outputtopology("triangle")]
+void main(uint GTid : SV_GroupThreadID, uint Gid : SV_GroupID, in payload Payload payload,
+	out vertices VertexOut verts[MESHLET_MAX_VERTICES], out indices uint3 prims[MESHLET_MAX_PRIMITIVES])
+{
+	const Instance instance = g_instances[payload.Instances[Gid]];
+	const Meshlet meshlet = g_meshlets[payload.Meshlets[Gid]];
+	SetMeshOutputCounts(meshlet.VertexCount, meshlet.PrimitiveCount);
+
+	if (GTid < meshlet.VertexCount)
+	{
+		const uint vertexIdx = g_vertexIndices[meshlet.VertexOffset + GTid];
+		const float3 posW = TransformToWorld(instance, LoadPosition(vertexIdx));
+		verts[GTid].Pos = mul(float4(posW, 1.0), g_viewProj);
+	}
+
+	if (GTid < meshlet.PrimitiveCount)
+	{
+		const uint prim = g_primitives[meshlet.PrimitiveOffset + GTid];
+		prims[GTid] = uint3(prim & 0xff, (prim >> 8) & 0xff, (prim >> 16) & 0xff);
+	}
+}
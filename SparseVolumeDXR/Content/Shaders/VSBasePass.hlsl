@@ -7,22 +7,41 @@
 //--------------------------------------------------------------------------------------
 struct VSIn
 {
-	float3	Pos	: POSITION;
-	float3	Nrm	: NORMAL;
+	float3	Pos			: POSITION;
+	uint	InstanceId	: SV_InstanceID;
+};
+
+struct Instance
+{
+	float4	World[3];	// Rows of the 3x4 world matrix, as in the ray-tracing instance descs
 };
 
 //--------------------------------------------------------------------------------------
-// Constant buffer
+// Constant buffers
 //--------------------------------------------------------------------------------------
 cbuffer cbMatrices
 {
-	matrix g_worldViewProj;
+	matrix g_viewProj;
+};
+
+cbuffer cbInstance
+{
+	uint g_baseInstance;	// SV_InstanceID does not include the start instance of the draw
 };
 
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+StructuredBuffer<Instance> g_instances;
+
 //--------------------------------------------------------------------------------------
 // Base vertex processing
 //--------------------------------------------------------------------------------------
 float4 main(VSIn input) : SV_POSITION
 {
-	return mul(float4(input.Pos, 1.0), g_worldViewProj);
+	const Instance instance = g_instances[g_baseInstance + input.InstanceId];
+	const float4 pos = float4(input.Pos, 1.0);
+	const float3 posW = float3(dot(instance.World[0], pos), dot(instance.World[1], pos), dot(instance.World[2], pos));
+
+	return mul(float4(posW, 1.0), g_viewProj);
 }
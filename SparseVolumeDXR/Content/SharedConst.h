@@ -5,6 +5,11 @@
 #define	NUM_K_LAYERS		16
 #define	SHADOW_MAP_SIZE		1024
 
+#define	MESHLET_MAX_VERTICES	64
+#define	MESHLET_MAX_PRIMITIVES	124
+#define	MESHLET_GROUP_SIZE		32
+#define	MAX_DISPATCH_GROUPS		65535
+
 #define CLEAR_COLOR			0.0f, 0.2f, 0.4f
 //#define CORN_FLOWER_BLUE	0.392156899, 0.584313750, 0.929411829
 
@@ -13,3 +18,5 @@ static const float g_zFar = 1000.0f;
 
 static const float g_zNearLS = 1.0f;
 static const float g_zFarLS = 128.0f;
+
+static const float g_lodPixelError = 1.0f;
@@ -2,8 +2,13 @@
 // Copyright (c) XU, Tianchen. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#include <cfloat>
 #include "SharedConst.h"
+#include "Optional/XUSGMeshletBuilder.h"
 #include "Optional/XUSGObjLoader.h"
+#include "Optional/XUSGPlyLoader.h"
+#include "Optional/XUSGSceneManifest.h"
+#include "Optional/XUSGStlLoader.h"
 #include "SparseVolume.h"
 
 using namespace std;
@@ -11,12 +16,38 @@ using namespace DirectX;
 using namespace XUSG;
 using namespace XUSG::RayTracing;
 
+struct CBDepthPeel
+{
+	DirectX::XMFLOAT4X4	ViewProj;
+	float				FrustumPlanes[6][4];	// World space, for meshlet culling
+};
+
 struct CBPerFrame
 {
 	DirectX::XMFLOAT4X4	ScreenToWorld;
 	DirectX::XMFLOAT4X4	ViewProjLS;
 };
 
+struct DrawCommand
+{
+	uint32_t	BaseInstance;	// Root constant; SV_InstanceID does not include StartInstanceLocation
+	uint32_t	IndexCountPerInstance;
+	uint32_t	InstanceCount;
+	uint32_t	StartIndexLocation;
+	int32_t		BaseVertexLocation;
+	uint32_t	StartInstanceLocation;
+};
+
+struct MeshletConstants
+{
+	uint32_t	FirstMeshlet;
+	uint32_t	NumMeshlets;
+	uint32_t	BaseInstance;
+	uint32_t	NumInstances;
+	uint32_t	QuantizedPositions;
+	uint32_t	BaseThread;
+};
+
 struct RayGenConstants
 {
 	DirectX::XMFLOAT4X4	ScreenToWorld;
@@ -29,22 +60,54 @@ const wchar_t* SparseVolume::AnyHitShaderName = L"anyHitMain";
 const wchar_t* SparseVolume::MissShaderName = L"missMain";
 
 SparseVolume::SparseVolume() :
-	m_instances()
+	m_instances(),
+	m_importFlags(0)
 {
 	m_shaderLib = ShaderLib::MakeUnique();
+	m_scene = make_unique<SceneManifest>();
 }
 
 SparseVolume::~SparseVolume()
 {
+	// The worker reads members of this object; let it finish before they are destroyed.
+	if (m_meshImport.valid()) m_meshImport.wait();
+}
+
+bool SparseVolume::LoadMesh(const char* fileName, uint8_t importFlags)
+{
+	if (m_meshImport.valid()) return false;
+
+	// A single mesh is a scene of one instance with the identity transform.
+	const float identity[3][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } };
+	m_scene->Clear();
+	m_scene->AddInstance(m_scene->AddMesh(fileName, fileName), identity);
+	m_scene->Pack();
+
+	m_importFlags = importFlags;
+	m_meshImport = async(launch::async, &SparseVolume::importMeshes, this);
+
+	return true;
+}
+
+bool SparseVolume::LoadScene(const char* fileName, uint8_t importFlags)
+{
+	if (m_meshImport.valid()) return false;
+	XUSG_N_RETURN(m_scene->Load(fileName), false);
+
+	m_importFlags = importFlags;
+	m_meshImport = async(launch::async, &SparseVolume::importMeshes, this);
+
+	return true;
 }
 
 bool SparseVolume::Init(RayTracing::CommandList* pCommandList, const DescriptorTableLib::sptr& descriptorTableLib,
 	uint32_t width, uint32_t height, Format rtFormat, Format dsFormat, vector<Resource::uptr>& uploaders,
-	GeometryBuffer* pGeometry, const char* fileName, const XMFLOAT4& posScale)
+	vector<GeometryBuffer>* pGeometries, const XMFLOAT4& posScale, bool meshShaderSupported)
 {
 	const auto pDevice = pCommandList->GetRTDevice();
 	m_rayTracingPipelineLib = RayTracing::PipelineLib::MakeUnique(pDevice);
 	m_graphicsPipelineLib = Graphics::PipelineLib::MakeUnique(pDevice);
+	if (meshShaderSupported) m_meshShaderPipelineLib = Ultimate::PipelineLib::MakeUnique(pDevice);
 	m_computePipelineLib = Compute::PipelineLib::MakeUnique(pDevice);
 	m_pipelineLayoutLib = PipelineLayoutLib::MakeUnique(pDevice);
 	m_descriptorTableLib = descriptorTableLib;
@@ -53,21 +116,174 @@ bool SparseVolume::Init(RayTracing::CommandList* pCommandList, const DescriptorT
 	m_viewport.y = static_cast<float>(height);
 	m_posScale = posScale;
 
-	m_useRayTracing = pGeometry;
+	m_useRayTracing = pGeometries;
+
+	// Join the mesh imports started by LoadMesh() or LoadScene().
+	const auto waitStart = chrono::steady_clock::now();
+	XUSG_N_RETURN(m_meshImport.valid() && m_meshImport.get(), false);
+	const auto waitTime = chrono::duration<double>(chrono::steady_clock::now() - waitStart).count();
+	const auto quantize = (m_importFlags & IMPORT_QUANTIZE) != 0;
+	const auto streaming = (m_importFlags & IMPORT_STREAMING) != 0;
+	const auto numMeshes = m_scene->GetNumMeshes();
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		const auto& importStats = m_meshLoaders[i]->GetImportStats();
+		cout << "Imported " << m_scene->GetMeshes()[i].FileName << (importStats.CacheHit ? " (mesh cache)" : "") << ": "
+			<< importStats.NumBytes << " bytes in " << importStats.ImportTime * 1000.0 << " ms ("
+			<< importStats.GetBytesPerSecond() / (1024.0 * 1024.0) << " MB/s) on a worker thread" << endl;
+		cout << "Vertices: " << importStats.NumVerticesBeforeWeld << " -> " << importStats.NumVerticesAfterWeld << " after welding" << endl;
+		if ((m_importFlags & IMPORT_CLEANUP) && !streaming)
+		{
+			const auto numTriangles = m_meshLoaders[i]->GetLODs()[0].NumIndices / 3;
+			cout << "Triangles: " << numTriangles + importStats.NumDegenerateTriangles + importStats.NumDuplicateTriangles
+				<< " -> " << numTriangles << " after cleanup (" << importStats.NumDegenerateTriangles << " degenerate, "
+				<< importStats.NumDuplicateTriangles << " duplicate), " << importStats.NumUnreferencedVertices
+				<< " unreferenced vertices, " << importStats.NumNonManifoldEdges << " non-manifold edges" << endl;
+		}
+		if (!streaming) cout << "ACMR: " << importStats.ACMRBefore << " -> " << importStats.ACMRAfter << ", index distance: "
+			<< importStats.IndexDistanceBefore << " -> " << importStats.IndexDistanceAfter << " after triangle reordering and index optimization" << endl;
+		if (quantize) cout << "Quantization error: " << importStats.MaxPositionError << " (position), "
+			<< importStats.MaxNormalError << " degrees (normal)" << endl;
+
+		const auto pLODs = m_meshLoaders[i]->GetLODs();
+		cout << "LODs: " << pLODs[0].NumIndices / 3;
+		for (auto j = 1u; j < m_meshLoaders[i]->GetNumLODs(); ++j) cout << " -> " << pLODs[j].NumIndices / 3;
+		cout << " triangles";
+		if (m_meshLoaders[i]->GetNumLODs() > 1 && !importStats.CacheHit) cout << " in " << importStats.LODTime * 1000.0 << " ms";
+		cout << endl;
+	}
+	cout << "Scene: " << numMeshes << " meshes, " << m_scene->GetNumInstances() << " instances, "
+		<< waitTime * 1000.0 << " ms waited for the import" << endl;
+
+	// Pack the meshes into shared vertex and index buffers, so that one batch draws all the instances;
+	// a lone mesh is uploaded in place. Indices stay relative to the base vertex of their mesh,
+	// and the levels of detail of each mesh follow its full-detail indices.
+	unique_ptr<MeshletBuilder> meshletBuilder;
+	if (meshShaderSupported) meshletBuilder = make_unique<MeshletBuilder>();
+	m_meshRanges.resize(numMeshes);
+	m_meshLODs.clear();
+	uint32_t numVertices = 0, numIndices = 0;
+	auto use16Bit = quantize;
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		const auto& meshLoader = m_meshLoaders[i];
+		const auto pLODs = meshLoader->GetLODs();
+		auto& meshRange = m_meshRanges[i];
+		meshRange.BaseVertex = numVertices;
+		meshRange.NumVertices = meshLoader->GetNumVertices();
+		meshRange.StartIndex = numIndices + pLODs[0].StartIndex;
+		meshRange.NumIndices = pLODs[0].NumIndices;
+		meshRange.FirstLOD = static_cast<uint32_t>(m_meshLODs.size());
+		meshRange.NumLODs = meshLoader->GetNumLODs();
+		for (auto j = 0u; j < meshRange.NumLODs; ++j)
+			m_meshLODs.push_back({ numIndices + pLODs[j].StartIndex, pLODs[j].NumIndices, pLODs[j].Error, 0, 0 });
+		if (meshletBuilder) buildMeshlets(*meshletBuilder, *meshLoader, &m_meshLODs[meshRange.FirstLOD], meshRange.BaseVertex);
+		numVertices += meshRange.NumVertices;
+		numIndices += meshLoader->GetNumIndices();
+		use16Bit = use16Bit && meshRange.NumVertices <= UINT16_MAX;
+	}
+
+	// The position streams must share one layout. The attribute layouts differ by format (OBJ
+	// texture coordinates, PLY and STL normals only, nothing when streamed); as depth peeling
+	// binds the positions only, mixed attribute layouts leave out the attribute stream.
+	const auto positionStride = m_meshLoaders[0]->GetPositionStride();
+	auto attributeStride = m_meshLoaders[0]->GetAttributeStride();
+	for (const auto& meshLoader : m_meshLoaders)
+	{
+		if (meshLoader->GetPositionStride() != positionStride)
+		{
+			cerr << "Meshes of the scene have different position layouts" << endl;
+
+			return false;
+		}
+		if (meshLoader->GetAttributeStride() != attributeStride) attributeStride = 0;
+	}
+
+	auto pPositions = m_meshLoaders[0]->GetPositions();
+	auto pAttributes = m_meshLoaders[0]->GetAttributes();
+	auto pIndices = m_meshLoaders[0]->GetIndices();
+	vector<uint8_t> positions, attributes;
+	vector<uint32_t> indices;
+	if (numMeshes > 1)
+	{
+		positions.reserve(static_cast<size_t>(positionStride) * numVertices);
+		attributes.reserve(static_cast<size_t>(attributeStride) * numVertices);
+		indices.reserve(numIndices);
+		for (const auto& meshLoader : m_meshLoaders)
+		{
+			const auto numMeshVertices = meshLoader->GetNumVertices();
+			positions.insert(positions.end(), meshLoader->GetPositions(),
+				meshLoader->GetPositions() + static_cast<size_t>(positionStride) * numMeshVertices);
+			if (attributeStride > 0) attributes.insert(attributes.end(), meshLoader->GetAttributes(),
+				meshLoader->GetAttributes() + static_cast<size_t>(attributeStride) * numMeshVertices);
+			indices.insert(indices.end(), meshLoader->GetIndices(), meshLoader->GetIndices() + meshLoader->GetNumIndices());
+		}
+		pPositions = positions.data();
+		pAttributes = attributes.data();
+		pIndices = indices.data();
+	}
 
-	// Load inputs
-	ObjLoader objLoader;
-	if (!objLoader.Import(fileName, true, true)) return false;
-	XUSG_N_RETURN(createVB(pCommandList, objLoader.GetNumVertices(), objLoader.GetVertexStride(), objLoader.GetVertices(), uploaders), false);
-	XUSG_N_RETURN(createIB(pCommandList, objLoader.GetNumIndices(), objLoader.GetIndices(), uploaders), false);
+	// Quantized positions are SNORM16 over the AABB of each mesh; the dequantization is folded into
+	// the world transforms, so the vertex shader and the BLASes consume them unchanged.
+	m_positionFormat = quantize ? Format::R16G16B16A16_SNORM : Format::R32G32B32_FLOAT;
+	XUSG_N_RETURN(createVB(pCommandList, VB_POSITION, numVertices, positionStride, pPositions, uploaders), false);
+	if (attributeStride > 0)
+		XUSG_N_RETURN(createVB(pCommandList, VB_ATTRIBUTE, numVertices, attributeStride, pAttributes, uploaders), false);
+	XUSG_N_RETURN(createIB(pCommandList, numIndices, pIndices, use16Bit, uploaders), false);
+	if (meshletBuilder) XUSG_N_RETURN(createMeshlets(pCommandList, *meshletBuilder, uploaders), false);
+
+	// Initialize world transforms: mesh dequantization, then the instance transform, then the position scale
+	const auto numInstances = m_scene->GetNumInstances();
+	const auto pInstances = m_scene->GetInstances();
+	const auto posScaleXform = XMMatrixScaling(m_posScale.w, m_posScale.w, m_posScale.w) *
+		XMMatrixTranslation(m_posScale.x, m_posScale.y, m_posScale.z);
+	auto boundMin = XMVectorReplicate(FLT_MAX);
+	auto boundMax = XMVectorReplicate(-FLT_MAX);
+	m_worlds.resize(numInstances);
+	m_instanceBounds.resize(numInstances);
+	for (auto i = 0u; i < numInstances; ++i)
+	{
+		const auto& meshLoader = m_meshLoaders[pInstances[i].MeshIndex];
+		const auto dequantScale = meshLoader->GetDequantizationScale();
+		const auto dequantBias = meshLoader->GetDequantizationBias();
+		const auto dequant = quantize ? XMMatrixScaling(dequantScale.x, dequantScale.y, dequantScale.z) *
+			XMMatrixTranslation(dequantBias.x, dequantBias.y, dequantBias.z) : XMMatrixIdentity();
+		const auto transform = XMLoadFloat3x4(reinterpret_cast<const XMFLOAT3X4*>(pInstances[i].Transform));
+		const auto world = transform * posScaleXform;
+		XMStoreFloat3x4(&m_worlds[i], dequant * world);
+
+		// Bounding sphere for LOD selection; the LOD errors are in unquantized object units.
+		const auto& aabb = meshLoader->GetAABB();
+		const auto center = XMVectorSet((aabb.Max.x + aabb.Min.x) / 2.0f,
+			(aabb.Max.y + aabb.Min.y) / 2.0f, (aabb.Max.z + aabb.Min.z) / 2.0f, 1.0f);
+		const auto halfExt = XMVectorSet((aabb.Max.x - aabb.Min.x) / 2.0f,
+			(aabb.Max.y - aabb.Min.y) / 2.0f, (aabb.Max.z - aabb.Min.z) / 2.0f, 0.0f);
+		const auto scale = XMVectorMax(XMVector3Length(world.r[0]), XMVectorMax(XMVector3Length(world.r[1]), XMVector3Length(world.r[2])));
+		auto& instanceBound = m_instanceBounds[i];
+		XMStoreFloat3(&instanceBound.Center, XMVector3Transform(center, world));
+		instanceBound.Radius = XMVectorGetX(XMVector3Length(halfExt) * scale);
+		instanceBound.ErrorScale = XMVectorGetX(scale);
+
+		// Grow the boundary by the transformed AABB corners
+		for (uint8_t j = 0; j < 8; ++j)
+		{
+			const auto corner = XMVector3Transform(XMVectorSet(j & 1 ? aabb.Max.x : aabb.Min.x,
+				j & 2 ? aabb.Max.y : aabb.Min.y, j & 4 ? aabb.Max.z : aabb.Min.z, 1.0f), transform);
+			boundMin = XMVectorMin(boundMin, corner);
+			boundMax = XMVectorMax(boundMax, corner);
+		}
+	}
 
 	// Extract boundary
-	const auto& aabb = objLoader.GetAABB();
-	const XMFLOAT3 ext(aabb.Max.x - aabb.Min.x, aabb.Max.y - aabb.Min.y, aabb.Max.z - aabb.Min.z);
-	m_bound.x = (aabb.Max.x + aabb.Min.x) / 2.0f;
-	m_bound.y = (aabb.Max.y + aabb.Min.y) / 2.0f;
-	m_bound.z = (aabb.Max.z + aabb.Min.z) / 2.0f;
+	XMFLOAT3 aabbMin, aabbMax;
+	XMStoreFloat3(&aabbMin, boundMin);
+	XMStoreFloat3(&aabbMax, boundMax);
+	const XMFLOAT3 ext(aabbMax.x - aabbMin.x, aabbMax.y - aabbMin.y, aabbMax.z - aabbMin.z);
+	m_bound.x = (aabbMax.x + aabbMin.x) / 2.0f;
+	m_bound.y = (aabbMax.y + aabbMin.y) / 2.0f;
+	m_bound.z = (aabbMax.z + aabbMin.z) / 2.0f;
 	m_bound.w = (max)(ext.x, (max)(ext.y, ext.z)) / 2.0f;
+	m_meshLoaders.clear();
 
 	// Create output grids and build acceleration structures
 	m_depthKBuffer = Texture2D::MakeUnique();
@@ -84,27 +300,24 @@ bool SparseVolume::Init(RayTracing::CommandList* pCommandList, const DescriptorT
 
 	// Create constant buffers
 	m_cbDepthPeel = ConstantBuffer::MakeUnique();
-	XUSG_N_RETURN(m_cbDepthPeel->Create(pDevice, sizeof(XMFLOAT4X4[FrameCount]), FrameCount,
+	XUSG_N_RETURN(m_cbDepthPeel->Create(pDevice, sizeof(CBDepthPeel[FrameCount]), FrameCount,
 		nullptr, MemoryType::UPLOAD, MemoryFlag::NONE, L"CBDepthPeel"), false);
 
 	m_cbDepthPeelLS = ConstantBuffer::MakeUnique();
-	XUSG_N_RETURN(m_cbDepthPeelLS->Create(pDevice, sizeof(XMFLOAT4X4[FrameCount]), FrameCount,
+	XUSG_N_RETURN(m_cbDepthPeelLS->Create(pDevice, sizeof(CBDepthPeel[FrameCount]), FrameCount,
 		nullptr, MemoryType::UPLOAD, MemoryFlag::NONE, L"CBDepthPeelLS"), false);
 
 	m_cbPerFrame = ConstantBuffer::MakeUnique();
 	XUSG_N_RETURN(m_cbPerFrame->Create(pDevice, sizeof(CBPerFrame[FrameCount]), FrameCount,
 		nullptr, MemoryType::UPLOAD, MemoryFlag::NONE, L"CBPerFrame"), false);
 
-	// Initialize world transform
-	XMStoreFloat3x4(&m_world, XMMatrixIdentity());
-
 	// Create input layout and descriptor tables
 	XUSG_N_RETURN(createInputLayout(), false);
 	XUSG_N_RETURN(createDescriptorTables(), false);
 	if (m_useRayTracing)
 	{
 		// Build ASes, create pipelines, and build shader tables
-		XUSG_N_RETURN(buildAccelerationStructures(pCommandList, pGeometry), false);
+		XUSG_N_RETURN(buildAccelerationStructures(pCommandList, *pGeometries), false);
 		XUSG_N_RETURN(createPipelineLayouts(pDevice), false);
 		XUSG_N_RETURN(createPipelines(rtFormat, dsFormat), false);
 		XUSG_N_RETURN(buildShaderTables(pDevice), false);
@@ -116,21 +329,16 @@ bool SparseVolume::Init(RayTracing::CommandList* pCommandList, const DescriptorT
 		XUSG_N_RETURN(createPipelines(rtFormat, dsFormat), false);
 	}
 
+	// Upload the instance transforms and draw commands; the latter depend on the depth-peeling pipeline layout
+	XUSG_N_RETURN(createInstances(pCommandList, uploaders), false);
+
 	return true;
 }
 
 void SparseVolume::UpdateFrame(const RayTracing::Device* pDevice, uint8_t frameIndex, CXMMATRIX viewProj)
 {
-	// General matrices
-	//const auto world = XMMatrixScaling(m_bound.w, m_bound.w, m_bound.w) *
-		//XMMatrixTranslation(m_bound.x, m_bound.y, m_bound.z);
-	const auto world = XMMatrixScaling(m_posScale.w, m_posScale.w, m_posScale.w) *
-		XMMatrixTranslation(m_posScale.x, m_posScale.y, m_posScale.z);
-	XMStoreFloat3x4(&m_world, world);
-	{
-		const auto pCbData = reinterpret_cast<XMFLOAT4X4*>(m_cbDepthPeel->Map(frameIndex));
-		XMStoreFloat4x4(pCbData, XMMatrixTranspose(world * viewProj));
-	}
+	// General matrices; world transforms are per instance
+	updateDepthPeelCB(m_cbDepthPeel.get(), frameIndex, viewProj);
 
 	// Light-space matrices
 	const auto focusPt = XMLoadFloat4(&m_bound);
@@ -140,10 +348,11 @@ void SparseVolume::UpdateFrame(const RayTracing::Device* pDevice, uint8_t frameI
 	const auto viewProjLS = viewLS * projLS;
 	const auto pCbData = reinterpret_cast<CBPerFrame*>(m_cbPerFrame->Map(frameIndex));
 	XMStoreFloat4x4(&pCbData->ViewProjLS, XMMatrixTranspose(viewProjLS));
-	{
-		const auto pCbData = reinterpret_cast<XMFLOAT4X4*>(m_cbDepthPeelLS->Map(frameIndex));
-		XMStoreFloat4x4(pCbData, XMMatrixTranspose(world * viewProjLS));
-	}
+	updateDepthPeelCB(m_cbDepthPeelLS.get(), frameIndex, viewProjLS);
+
+	// Levels of detail, for the camera and for the shadow map coverage
+	selectLODs(frameIndex, LOD_PASS_CAMERA, viewProj, m_viewport);
+	selectLODs(frameIndex, LOD_PASS_LIGHT, viewProjLS, XMFLOAT2(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE));
 
 	// Screen space matrices
 	const auto toScreen = XMMATRIX
@@ -171,18 +380,18 @@ void SparseVolume::UpdateFrame(const RayTracing::Device* pDevice, uint8_t frameI
 }
 
 void SparseVolume::Render(RayTracing::CommandList* pCommandList, uint8_t frameIndex,
-	const Descriptor& rtv, const Descriptor& dsv, const Descriptor& lsDsv)
+	const Descriptor& rtv, const Descriptor& dsv, const Descriptor& lsDsv, bool useMeshShader)
 {
-	depthPeelLightSpace(pCommandList, frameIndex, lsDsv);
-	depthPeel(pCommandList, frameIndex, dsv, false);
+	depthPeelLightSpace(pCommandList, frameIndex, lsDsv, useMeshShader);
+	depthPeel(pCommandList, frameIndex, dsv, useMeshShader, false);
 
 	render(pCommandList, frameIndex, rtv);
 }
 
 void SparseVolume::RenderDXR(RayTracing::CommandList* pCommandList,
-	uint8_t frameIndex, RenderTarget* pDst, const Descriptor& dsv)
+	uint8_t frameIndex, RenderTarget* pDst, const Descriptor& dsv, bool useMeshShader)
 {
-	depthPeel(pCommandList, frameIndex, dsv);
+	depthPeel(pCommandList, frameIndex, dsv, useMeshShader);
 	rayTrace(pCommandList, frameIndex);
 
 	ResourceBarrier barriers[2];
@@ -195,40 +404,131 @@ void SparseVolume::RenderDXR(RayTracing::CommandList* pCommandList,
 	pCommandList->CopyTextureRegion(dstCopyLoc, 0, 0, 0, srcCopyLoc);
 }
 
-bool SparseVolume::createVB(XUSG::CommandList* pCommandList, uint32_t numVert,
-	uint32_t stride, const uint8_t* pData, vector<Resource::uptr>& uploaders)
+SparseVolume::MeshFormat SparseVolume::GetMeshFormat(const char* fileName)
+{
+	// Choose the importer by the file extension.
+	const string name(fileName);
+	const auto extPos = name.find_last_of('.');
+	auto ext = extPos != string::npos ? name.substr(extPos + 1) : string();
+	for (auto& c : ext) c = static_cast<char>(tolower(c));
+	if (ext == "ply") return MESH_FORMAT_PLY;
+	if (ext == "stl") return MESH_FORMAT_STL;
+
+	return MESH_FORMAT_OBJ;
+}
+
+bool SparseVolume::importMeshes()
 {
-	m_vertexBuffer = VertexBuffer::MakeUnique();
-	XUSG_N_RETURN(m_vertexBuffer->Create(pCommandList->GetDevice(), numVert, stride,
+	// Meshes are imported one after another, as each import is already multi-threaded.
+	const auto quantize = (m_importFlags & IMPORT_QUANTIZE) != 0;
+	const auto streaming = (m_importFlags & IMPORT_STREAMING) != 0;
+	const auto numMeshes = m_scene->GetNumMeshes();
+	if (numMeshes == 0) return false;
+
+	// The parts are imported one after another, so they share the import temporaries.
+	const auto scratch = ObjLoader::MakeScratch();
+	m_meshLoaders.resize(numMeshes);
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		const auto fileName = m_scene->GetMeshes()[i].FileName.c_str();
+		auto& meshLoader = m_meshLoaders[i];
+		switch (GetMeshFormat(fileName))
+		{
+		case MESH_FORMAT_PLY:
+			meshLoader = make_unique<PlyLoader>();
+			break;
+		case MESH_FORMAT_STL:
+			meshLoader = make_unique<StlLoader>();
+			break;
+		default:
+			meshLoader = make_unique<ObjLoader>();
+		}
+		meshLoader->SetNumThreads(0);
+		meshLoader->SetScratch(scratch);
+		meshLoader->SetMeshCache(true);
+		meshLoader->SetVertexWelding(true);
+		meshLoader->SetTriangleReordering(true);
+		meshLoader->SetIndexOptimization(true);
+		meshLoader->SetVertexLayout(ObjLoader::VERTEX_LAYOUT_SPLIT);
+		meshLoader->SetQuantization(quantize);
+		meshLoader->SetStreaming(streaming);
+		meshLoader->SetLODChain(true);
+		meshLoader->SetMeshCleanup((m_importFlags & IMPORT_CLEANUP) != 0);
+		XUSG_N_RETURN(meshLoader->Import(fileName, true, true), false);
+	}
+
+	return true;
+}
+
+bool SparseVolume::createVB(XUSG::CommandList* pCommandList, VertexBufferIndex index,
+	uint32_t numVert, uint32_t stride, const uint8_t* pData, vector<Resource::uptr>& uploaders)
+{
+	auto& vertexBuffer = m_vertexBuffers[index];
+	vertexBuffer = VertexBuffer::MakeUnique();
+	XUSG_N_RETURN(vertexBuffer->Create(pCommandList->GetDevice(), numVert, stride,
 		ResourceFlag::NONE, MemoryType::DEFAULT), false);
 	uploaders.emplace_back(Resource::MakeUnique());
 
-	return m_vertexBuffer->Upload(pCommandList, uploaders.back().get(), pData,
+	return vertexBuffer->Upload(pCommandList, uploaders.back().get(), pData,
 		stride * numVert, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
 }
 
 bool SparseVolume::createIB(XUSG::CommandList* pCommandList, uint32_t numIndices,
-	const uint32_t* pData, vector<Resource::uptr>& uploaders)
+	const uint32_t* pData, bool use16Bit, vector<Resource::uptr>& uploaders)
 {
-	m_numIndices = numIndices;
-	const uint32_t byteWidth = sizeof(uint32_t) * numIndices;
+	const uint32_t byteWidth = (use16Bit ? sizeof(uint16_t) : sizeof(uint32_t)) * numIndices;
+
+	// Narrow the indices when every vertex is addressable with 16 bits.
+	vector<uint16_t> indices16;
+	if (use16Bit) indices16.assign(pData, pData + numIndices);
 
 	m_indexBuffer = IndexBuffer::MakeUnique();
-	XUSG_N_RETURN(m_indexBuffer->Create(pCommandList->GetDevice(), byteWidth, Format::R32_UINT,
+	XUSG_N_RETURN(m_indexBuffer->Create(pCommandList->GetDevice(), byteWidth, use16Bit ? Format::R16_UINT : Format::R32_UINT,
 		ResourceFlag::NONE, MemoryType::DEFAULT), false);
 	uploaders.emplace_back(Resource::MakeUnique());
 
-	return m_indexBuffer->Upload(pCommandList, uploaders.back().get(), pData,
-		byteWidth, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	return m_indexBuffer->Upload(pCommandList, uploaders.back().get(), use16Bit ?
+		static_cast<const void*>(indices16.data()) : pData, byteWidth, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+}
+
+void SparseVolume::buildMeshlets(MeshletBuilder& meshletBuilder, const ObjLoader& meshLoader,
+	MeshLOD* pLODs, uint32_t baseVertex) const
+{
+	// Quantized positions are decoded to their SNORM values only; the meshlet bounds stay in the
+	// space of the vertex buffer, since the world transforms carry the dequantization.
+	const auto numVertices = meshLoader.GetNumVertices();
+	auto pPositions = meshLoader.GetPositions();
+	auto positionStride = meshLoader.GetPositionStride();
+	vector<float> positions;
+	if (m_importFlags & IMPORT_QUANTIZE)
+	{
+		positions.resize(3 * static_cast<size_t>(numVertices));
+		for (auto i = 0u; i < numVertices; ++i)
+		{
+			const auto pQuantized = reinterpret_cast<const int16_t*>(&pPositions[static_cast<size_t>(positionStride) * i]);
+			for (uint8_t j = 0; j < 3; ++j) positions[3 * i + j] = (max)(pQuantized[j] / 32767.0f, -1.0f);
+		}
+		pPositions = reinterpret_cast<const uint8_t*>(positions.data());
+		positionStride = sizeof(float[3]);
+	}
+
+	// Each level of detail has its own meshlets, with the vertex indices made global.
+	const auto pIndices = meshLoader.GetIndices();
+	const auto pMeshLODs = meshLoader.GetLODs();
+	for (auto i = 0u; i < meshLoader.GetNumLODs(); ++i)
+	{
+		pLODs[i].FirstMeshlet = meshletBuilder.GetNumMeshlets();
+		pLODs[i].NumMeshlets = meshletBuilder.Add(&pIndices[pMeshLODs[i].StartIndex], pMeshLODs[i].NumIndices,
+			pPositions, positionStride, numVertices, baseVertex, MESHLET_MAX_VERTICES, MESHLET_MAX_PRIMITIVES);
+	}
 }
 
 bool SparseVolume::createInputLayout()
 {
-	// Define the vertex input layout.
+	// Define the vertex input layout. Depth peeling only fetches the position stream.
 	const InputElement inputElements[] =
 	{
-		{ "POSITION",	0, Format::R32G32B32_FLOAT, 0, 0,							InputClassification::PER_VERTEX_DATA, 0 },
-		{ "NORMAL",		0, Format::R32G32B32_FLOAT, 0, XUSG_APPEND_ALIGNED_ELEMENT,	InputClassification::PER_VERTEX_DATA, 0 }
+		{ "POSITION",	0, m_positionFormat,		0, 0,							InputClassification::PER_VERTEX_DATA, 0 }
 	};
 
 	XUSG_X_RETURN(m_pInputLayout, m_graphicsPipelineLib->CreateInputLayout(inputElements, static_cast<uint32_t>(size(inputElements))), false);
@@ -245,10 +545,31 @@ bool SparseVolume::createPipelineLayouts(const RayTracing::Device* pDevice)
 		pipelineLayout->SetRootCBV(CONSTANTS, 0, 0, Shader::Stage::VS);
 		pipelineLayout->SetRange(SRV_UAVS, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		pipelineLayout->SetShaderStage(SRV_UAVS, Shader::Stage::PS);
+		pipelineLayout->SetRootSRV(INSTANCES, 0, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::VS);
+		pipelineLayout->SetConstants(BASE_INSTANCE, 1, 1, 0, Shader::Stage::VS);
 		XUSG_X_RETURN(m_pipelineLayouts[DEPTH_PEEL_LAYOUT], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
 			PipelineLayoutFlag::ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT, L"DepthPeelingLayout"), false);
 	}
 
+	// Depth peeling pass with mesh shaders; the amplification shader culls the meshlets.
+	if (m_meshlets)
+	{
+		// Get pipeline layout
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRootCBV(CONSTANTS, 0, 0);
+		pipelineLayout->SetRange(SRV_UAVS, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetShaderStage(SRV_UAVS, Shader::Stage::PS);
+		pipelineLayout->SetRootSRV(INSTANCES, 0, 0, DescriptorFlag::DATA_STATIC);
+		pipelineLayout->SetConstants(MESHLET_CONSTANTS, XUSG_UINT32_SIZE_OF(MeshletConstants), 1, 0);
+		pipelineLayout->SetRootSRV(MESHLETS, 1, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::MS);
+		pipelineLayout->SetRootSRV(MESHLET_BOUNDS, 2, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::AS);
+		pipelineLayout->SetRootSRV(MESHLET_VERTICES, 3, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::MS);
+		pipelineLayout->SetRootSRV(MESHLET_PRIMITIVES, 4, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::MS);
+		pipelineLayout->SetRootSRV(MESHLET_POSITIONS, 5, 0, DescriptorFlag::DATA_STATIC, Shader::Stage::MS);
+		XUSG_X_RETURN(m_pipelineLayouts[DEPTH_PEEL_MESHLET_LAYOUT], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"DepthPeelingMeshletLayout"), false);
+	}
+
 	// Sparse volume rendering pass with shadow mapping
 	{
 		// Get pipeline layout
@@ -304,6 +625,23 @@ bool SparseVolume::createPipelines(Format rtFormat, Format dsFormat)
 		XUSG_X_RETURN(m_pipelines[DEPTH_PEEL], state->GetPipeline(m_graphicsPipelineLib.get(), L"DepthPeeling"), false);
 	}
 
+	if (m_meshlets)
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::AS, AS_DEPTH_PEEL, L"ASDepthPeel.cso"), false);
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::MS, MS_DEPTH_PEEL, L"MSDepthPeel.cso"), false);
+
+		const auto state = Ultimate::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[DEPTH_PEEL_MESHLET_LAYOUT]);
+		state->SetShader(Shader::Stage::AS, m_shaderLib->GetShader(Shader::Stage::AS, AS_DEPTH_PEEL));
+		state->SetShader(Shader::Stage::MS, m_shaderLib->GetShader(Shader::Stage::MS, MS_DEPTH_PEEL));
+		state->SetShader(Shader::Stage::PS, m_shaderLib->GetShader(Shader::Stage::PS, PS_DEPTH_PEEL));
+		state->RSSetState(Graphics::RasterizerPreset::CULL_NONE, m_meshShaderPipelineLib.get());
+		state->DSSetState(Graphics::DepthStencilPreset::DEPTH_READ_LESS, m_meshShaderPipelineLib.get());
+		state->OMSetDSVFormat(dsFormat);
+
+		XUSG_X_RETURN(m_pipelines[DEPTH_PEEL_MESHLET], state->GetPipeline(m_meshShaderPipelineLib.get(), L"DepthPeelingMeshlet"), false);
+	}
+
 	{
 		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::VS, VS_SCREEN_QUAD, L"VSScreenQuad.cso"), false);
 		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::PS, PS_SPARSE_RAYCAST, L"PSSparseRayCast.cso"), false);
@@ -379,42 +717,155 @@ bool SparseVolume::createDescriptorTables()
 	return true;
 }
 
-bool SparseVolume::buildAccelerationStructures(RayTracing::CommandList* pCommandList, GeometryBuffer* pGeometry)
+bool SparseVolume::createInstances(XUSG::CommandList* pCommandList, vector<Resource::uptr>& uploaders)
+{
+	const auto pDevice = pCommandList->GetDevice();
+	const auto numInstances = static_cast<uint32_t>(m_worlds.size());
+
+	// World transforms, fetched per instance by the depth-peeling vertex shader
+	m_instanceWorlds = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_instanceWorlds->Create(pDevice, numInstances, sizeof(XMFLOAT3X4), ResourceFlag::NONE,
+		MemoryType::DEFAULT, 0, nullptr, 0, nullptr, MemoryFlag::NONE, L"InstanceWorlds"), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_instanceWorlds->Upload(pCommandList, uploaders.back().get(), m_worlds.data(),
+		sizeof(XMFLOAT3X4) * numInstances, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+
+	// Levels of detail are selected per frame and LOD pass; start from full detail.
+	const auto numDrawRanges = m_scene->GetNumDrawRanges();
+	const auto numDrawSets = FrameCount * NUM_LOD_PASS;
+	m_lodLevels.assign(numDrawSets * numDrawRanges, 0);
+
+	// A lone mesh draws all of its instances with DrawIndexed(); several meshes are batched
+	// into one ExecuteIndirect() of a draw per mesh. The draws are rewritten by UpdateFrame(),
+	// so they live in the upload heap, in one set per frame and LOD pass.
+	if (numDrawRanges <= 1) return true;
+
+	const auto pDrawRanges = m_scene->GetDrawRanges();
+	m_drawCommands = Buffer::MakeUnique();
+	XUSG_N_RETURN(m_drawCommands->Create(pDevice, sizeof(DrawCommand) * numDrawSets * numDrawRanges, ResourceFlag::NONE,
+		MemoryType::UPLOAD, 0, nullptr, 0, nullptr, MemoryFlag::NONE, L"DrawCommands"), false);
+
+	const auto pDrawCommands = reinterpret_cast<DrawCommand*>(m_drawCommands->Map());
+	XUSG_N_RETURN(pDrawCommands, false);
+	for (auto i = 0u; i < numDrawSets * numDrawRanges; ++i)
+	{
+		const auto& drawRange = pDrawRanges[i % numDrawRanges];
+		const auto& meshRange = m_meshRanges[drawRange.MeshIndex];
+		auto& drawCommand = pDrawCommands[i];
+		drawCommand.BaseInstance = drawRange.FirstInstance;
+		drawCommand.IndexCountPerInstance = meshRange.NumIndices;
+		drawCommand.InstanceCount = drawRange.NumInstances;
+		drawCommand.StartIndexLocation = meshRange.StartIndex;
+		drawCommand.BaseVertexLocation = static_cast<int32_t>(meshRange.BaseVertex);
+		drawCommand.StartInstanceLocation = drawRange.FirstInstance;
+	}
+
+	IndirectArgument args[2];
+	args[0].Type = IndirectArgumentType::CONSTANT;
+	args[0].Constant.Index = BASE_INSTANCE;
+	args[0].Constant.DestOffsetIn32BitValues = 0;
+	args[0].Constant.Num32BitValuesToSet = 1;
+	args[1].Type = IndirectArgumentType::DRAW_INDEXED;
+	m_drawCommandLayout = CommandLayout::MakeUnique();
+	XUSG_N_RETURN(m_drawCommandLayout->Create(pDevice, sizeof(DrawCommand), static_cast<uint32_t>(size(args)),
+		args, m_pipelineLayouts[DEPTH_PEEL_LAYOUT], 0, L"DrawCommandLayout"), false);
+
+	return true;
+}
+
+bool SparseVolume::createMeshlets(XUSG::CommandList* pCommandList, const MeshletBuilder& meshletBuilder,
+	vector<Resource::uptr>& uploaders)
+{
+	if (meshletBuilder.GetNumMeshlets() == 0) return true;
+
+	const auto createBuffer = [pCommandList, &uploaders](StructuredBuffer::uptr& buffer, uint32_t numElements,
+		uint32_t stride, const void* pData, const wchar_t* name)
+	{
+		buffer = StructuredBuffer::MakeUnique();
+		XUSG_N_RETURN(buffer->Create(pCommandList->GetDevice(), numElements, stride, ResourceFlag::NONE,
+			MemoryType::DEFAULT, 0, nullptr, 0, nullptr, MemoryFlag::NONE, name), false);
+		uploaders.emplace_back(Resource::MakeUnique());
+
+		return buffer->Upload(pCommandList, uploaders.back().get(), pData,
+			stride * numElements, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	};
+
+	XUSG_N_RETURN(createBuffer(m_meshlets, meshletBuilder.GetNumMeshlets(), sizeof(MeshletBuilder::Meshlet),
+		meshletBuilder.GetMeshlets(), L"Meshlets"), false);
+	XUSG_N_RETURN(createBuffer(m_meshletBounds, meshletBuilder.GetNumMeshlets(), sizeof(MeshletBuilder::BoundingSphere),
+		meshletBuilder.GetBounds(), L"MeshletBounds"), false);
+	XUSG_N_RETURN(createBuffer(m_meshletVertices, meshletBuilder.GetNumVertexIndices(), sizeof(uint32_t),
+		meshletBuilder.GetVertexIndices(), L"MeshletVertices"), false);
+	XUSG_N_RETURN(createBuffer(m_meshletPrimitives, meshletBuilder.GetNumPrimitives(), sizeof(uint32_t),
+		meshletBuilder.GetPrimitives(), L"MeshletPrimitives"), false);
+
+	return true;
+}
+
+bool SparseVolume::buildAccelerationStructures(RayTracing::CommandList* pCommandList, vector<GeometryBuffer>& geometries)
 {
 	const auto pDevice = pCommandList->GetRTDevice();
+	const auto numMeshes = static_cast<uint32_t>(m_meshRanges.size());
+	const auto numInstances = static_cast<uint32_t>(m_worlds.size());
 
-	// Set geometries
+	// Set geometries; each mesh has one BLAS, shared by all of its instances
 	const auto geometryFlags = GeometryFlag::NONE;
-	BottomLevelAS::SetTriangleGeometries(*pGeometry, 1, Format::R32G32B32_FLOAT,
-		&m_vertexBuffer->GetVBV(), &m_indexBuffer->GetIBV(), &geometryFlags);
+	const auto& vbv = m_vertexBuffers[VB_POSITION]->GetVBV();
+	const auto& ibv = m_indexBuffer->GetIBV();
+	const uint32_t indexSize = ibv.Format == Format::R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+	geometries.resize(numMeshes);
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		const auto& meshRange = m_meshRanges[i];
+		VertexBufferView meshVBV;
+		IndexBufferView meshIBV;
+		m_vertexBuffers[VB_POSITION]->CreateVBV(meshVBV, meshRange.NumVertices, vbv.StrideInBytes, meshRange.BaseVertex);
+		m_indexBuffer->CreateIBV(meshIBV, ibv.Format, indexSize * meshRange.NumIndices,
+			static_cast<size_t>(indexSize) * meshRange.StartIndex);
+		BottomLevelAS::SetTriangleGeometries(geometries[i], 1, m_positionFormat, &meshVBV, &meshIBV, &geometryFlags);
+	}
 
 	// Prebuild
-	m_bottomLevelAS = BottomLevelAS::MakeUnique();
+	m_bottomLevelASs.resize(numMeshes);
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		m_bottomLevelASs[i] = BottomLevelAS::MakeUnique();
+		XUSG_N_RETURN(m_bottomLevelASs[i]->Prebuild(pDevice, 1, geometries[i]), false);
+	}
 	m_topLevelAS = TopLevelAS::MakeUnique();
-	XUSG_N_RETURN(m_bottomLevelAS->Prebuild(pDevice, 1, *pGeometry), false);
-	XUSG_N_RETURN(m_topLevelAS->Prebuild(pDevice, 1), false);
+	XUSG_N_RETURN(m_topLevelAS->Prebuild(pDevice, numInstances), false);
 
 	// Allocate AS buffers
-	XUSG_N_RETURN(m_bottomLevelAS->Allocate(pDevice, m_descriptorTableLib.get()), false);
+	for (auto& bottomLevelAS : m_bottomLevelASs)
+		XUSG_N_RETURN(bottomLevelAS->Allocate(pDevice, m_descriptorTableLib.get()), false);
 	XUSG_N_RETURN(m_topLevelAS->Allocate(pDevice, m_descriptorTableLib.get()), false);
 
 	// Create scratch buffer
 	auto scratchSize = m_topLevelAS->GetScratchDataByteSize();
-	scratchSize = (max)(m_bottomLevelAS->GetScratchDataByteSize(), scratchSize);
+	for (const auto& bottomLevelAS : m_bottomLevelASs)
+		scratchSize = (max)(bottomLevelAS->GetScratchDataByteSize(), scratchSize);
 	m_scratch = Buffer::MakeUnique();
 	XUSG_N_RETURN(AccelerationStructure::AllocateUAVBuffer(pDevice, m_scratch.get(), scratchSize), false);
 
-	// Set instance
-	float* const pTransform[] = { reinterpret_cast<float*>(&m_world) };
+	// Set instances
+	const auto pInstances = m_scene->GetInstances();
+	vector<const BottomLevelAS*> bottomLevelASs(numInstances);
+	vector<const float*> transforms(numInstances);
+	for (auto i = 0u; i < numInstances; ++i)
+	{
+		bottomLevelASs[i] = m_bottomLevelASs[pInstances[i].MeshIndex].get();
+		transforms[i] = reinterpret_cast<const float*>(&m_worlds[i]);
+	}
 	m_instances = Buffer::MakeUnique();
-	const BottomLevelAS* ppBottomLevelAS[] = { m_bottomLevelAS.get() };
-	TopLevelAS::SetInstances(pDevice, m_instances.get(), 1, ppBottomLevelAS, pTransform);
-
-	// Build bottom level ASs
-	m_bottomLevelAS->Build(pCommandList, m_scratch.get());
+	TopLevelAS::SetInstances(pDevice, m_instances.get(), numInstances, bottomLevelASs.data(), transforms.data());
 
+	// Build bottom level ASs; they share the scratch buffer, so each build is fenced by a UAV barrier
 	const ResourceBarrier barrier = { nullptr, ResourceState::UNORDERED_ACCESS };
-	pCommandList->Barrier(1, &barrier);
+	for (auto& bottomLevelAS : m_bottomLevelASs)
+	{
+		bottomLevelAS->Build(pCommandList, m_scratch.get());
+		pCommandList->Barrier(1, &barrier);
+	}
 
 	// Build top level AS
 	m_topLevelAS->Build(pCommandList, m_scratch.get(), m_instances.get(),
@@ -422,7 +873,8 @@ bool SparseVolume::buildAccelerationStructures(RayTracing::CommandList* pCommand
 
 	// Set resource barriers
 	ResourceBarrier barriers[2];
-	auto numBarriers = m_vertexBuffer->SetBarrier(barriers, ResourceState::VERTEX_AND_CONSTANT_BUFFER);
+	auto numBarriers = m_vertexBuffers[VB_POSITION]->SetBarrier(barriers,
+		ResourceState::VERTEX_AND_CONSTANT_BUFFER | ResourceState::NON_PIXEL_SHADER_RESOURCE);
 	numBarriers = m_indexBuffer->SetBarrier(barriers, ResourceState::INDEX_BUFFER, numBarriers);
 	pCommandList->Barrier(numBarriers, barriers);
 
@@ -458,20 +910,22 @@ bool SparseVolume::buildShaderTables(const RayTracing::Device* pDevice)
 	return true;
 }
 
-void SparseVolume::depthPeel(RayTracing::CommandList* pCommandList,
-	uint8_t frameIndex, const Descriptor& dsv, bool setPipeline)
+void SparseVolume::depthPeel(RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+	const Descriptor& dsv, bool useMeshShader, bool setPipeline)
 {
+	useMeshShader = useMeshShader && m_meshlets;
+
 	// Set resource barrier
 	ResourceBarrier barrier;
 	m_depthKBuffer->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS); // Auto promotion
 
 	// Set descriptor tables
-	pCommandList->SetGraphicsPipelineLayout(m_pipelineLayouts[DEPTH_PEEL_LAYOUT]);
+	pCommandList->SetGraphicsPipelineLayout(m_pipelineLayouts[useMeshShader ? DEPTH_PEEL_MESHLET_LAYOUT : DEPTH_PEEL_LAYOUT]);
 	pCommandList->SetGraphicsRootConstantBufferView(CONSTANTS, m_cbDepthPeel.get(), m_cbDepthPeel->GetCBVOffset(frameIndex));
 	pCommandList->SetGraphicsDescriptorTable(SRV_UAVS, m_uavTables[UAV_TABLE_KBUFFER]);
 
 	// Set pipeline state
-	if (setPipeline) pCommandList->SetPipelineState(m_pipelines[DEPTH_PEEL]);
+	if (setPipeline) pCommandList->SetPipelineState(m_pipelines[useMeshShader ? DEPTH_PEEL_MESHLET : DEPTH_PEEL]);
 
 	// Set viewport
 	Viewport viewport(0.0f, 0.0f, m_viewport.x, m_viewport.y);
@@ -485,26 +939,26 @@ void SparseVolume::depthPeel(RayTracing::CommandList* pCommandList,
 		m_depthKBuffer.get(), XMVECTORU32{ reinterpret_cast<const uint32_t&>(maxDepth) }.u);
 
 	// Record commands.
-	pCommandList->IASetVertexBuffers(0, 1, &m_vertexBuffer->GetVBV());
-	pCommandList->IASetIndexBuffer(m_indexBuffer->GetIBV());
-	pCommandList->IASetPrimitiveTopology(PrimitiveTopology::TRIANGLELIST);
-	pCommandList->DrawIndexed(m_numIndices, 1, 0, 0, 0);
+	if (useMeshShader) dispatchMeshlets(pCommandList, frameIndex, LOD_PASS_CAMERA);
+	else drawInstances(pCommandList, frameIndex, LOD_PASS_CAMERA);
 }
 
-void SparseVolume::depthPeelLightSpace(RayTracing::CommandList* pCommandList,
-	uint8_t frameIndex, const Descriptor& dsv)
+void SparseVolume::depthPeelLightSpace(RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+	const Descriptor& dsv, bool useMeshShader)
 {
+	useMeshShader = useMeshShader && m_meshlets;
+
 	// Set resource barrier
 	ResourceBarrier barrier;
 	m_lsDepthKBuffer->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS); // Auto promotion
 
 	// Set descriptor tables
-	pCommandList->SetGraphicsPipelineLayout(m_pipelineLayouts[DEPTH_PEEL_LAYOUT]);
+	pCommandList->SetGraphicsPipelineLayout(m_pipelineLayouts[useMeshShader ? DEPTH_PEEL_MESHLET_LAYOUT : DEPTH_PEEL_LAYOUT]);
 	pCommandList->SetGraphicsRootConstantBufferView(CONSTANTS, m_cbDepthPeelLS.get(), m_cbDepthPeelLS->GetCBVOffset(frameIndex));
 	pCommandList->SetGraphicsDescriptorTable(SRV_UAVS, m_uavTables[UAV_TABLE_LS_KBUFFER]);
 
 	// Set pipeline state
-	pCommandList->SetPipelineState(m_pipelines[DEPTH_PEEL]);
+	pCommandList->SetPipelineState(m_pipelines[useMeshShader ? DEPTH_PEEL_MESHLET : DEPTH_PEEL]);
 
 	// Set viewport
 	Viewport viewport(0.0f, 0.0f, static_cast<float>(SHADOW_MAP_SIZE), static_cast<float>(SHADOW_MAP_SIZE));
@@ -518,10 +972,124 @@ void SparseVolume::depthPeelLightSpace(RayTracing::CommandList* pCommandList,
 		m_lsDepthKBuffer.get(), XMVECTORU32{ reinterpret_cast<const uint32_t&>(maxDepth) }.u);
 
 	// Record commands.
-	pCommandList->IASetVertexBuffers(0, 1, &m_vertexBuffer->GetVBV());
+	if (useMeshShader) dispatchMeshlets(pCommandList, frameIndex, LOD_PASS_LIGHT);
+	else drawInstances(pCommandList, frameIndex, LOD_PASS_LIGHT);
+}
+
+void SparseVolume::updateDepthPeelCB(ConstantBuffer* pCB, uint8_t frameIndex, CXMMATRIX viewProj)
+{
+	const auto pCbData = reinterpret_cast<CBDepthPeel*>(pCB->Map(frameIndex));
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, viewProj);
+	XMStoreFloat4x4(&pCbData->ViewProj, XMMatrixTranspose(viewProj));
+	MeshletBuilder::GetFrustumPlanes(pCbData->FrustumPlanes, m.m);
+}
+
+void SparseVolume::selectLODs(uint8_t frameIndex, LODPass pass, CXMMATRIX viewProj, const XMFLOAT2& viewport)
+{
+	// Pixels per world unit at clip-space w = 1; an orthographic projection keeps w = 1 everywhere.
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, viewProj);
+	const auto pixelsPerUnit = (max)(XMVectorGetX(XMVector3Length(XMVectorSet(m._11, m._21, m._31, 0.0f))) * viewport.x,
+		XMVectorGetX(XMVector3Length(XMVectorSet(m._12, m._22, m._32, 0.0f))) * viewport.y) / 2.0f;
+	const auto wAxis = XMVectorSet(m._14, m._24, m._34, 0.0f);
+	const auto wAxisLength = XMVectorGetX(XMVector3Length(wAxis));
+
+	const auto numDrawRanges = m_scene->GetNumDrawRanges();
+	const auto pDrawRanges = m_scene->GetDrawRanges();
+	const auto drawSet = (frameIndex * NUM_LOD_PASS + pass) * numDrawRanges;
+	const auto pDrawCommands = m_drawCommands ? reinterpret_cast<DrawCommand*>(m_drawCommands->Map()) + drawSet : nullptr;
+	for (auto i = 0u; i < numDrawRanges; ++i)
+	{
+		// A mesh takes the coarsest level whose error stays within the pixel budget at the nearest
+		// point of every instance, so that all of its instances still draw in one batch.
+		const auto& drawRange = pDrawRanges[i];
+		auto maxError = FLT_MAX;
+		for (auto j = drawRange.FirstInstance; j < drawRange.FirstInstance + drawRange.NumInstances; ++j)
+		{
+			const auto& instanceBound = m_instanceBounds[j];
+			const auto w = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&instanceBound.Center), wAxis)) +
+				m._44 - instanceBound.Radius * wAxisLength;
+			const auto error = w > 0.0f ? g_lodPixelError * w / (pixelsPerUnit * instanceBound.ErrorScale) : 0.0f;
+			maxError = (min)(error, maxError);
+		}
+
+		const auto& meshRange = m_meshRanges[drawRange.MeshIndex];
+		const auto pLODs = &m_meshLODs[meshRange.FirstLOD];
+		uint8_t level = 0;
+		while (level + 1u < meshRange.NumLODs && pLODs[level + 1].Error <= maxError) ++level;
+		m_lodLevels[drawSet + i] = level;
+
+		if (pDrawCommands)
+		{
+			pDrawCommands[i].IndexCountPerInstance = pLODs[level].NumIndices;
+			pDrawCommands[i].StartIndexLocation = pLODs[level].StartIndex;
+		}
+	}
+}
+
+void SparseVolume::drawInstances(RayTracing::CommandList* pCommandList, uint8_t frameIndex, LODPass pass)
+{
+	const auto numDrawRanges = m_scene->GetNumDrawRanges();
+	const auto drawSet = (frameIndex * NUM_LOD_PASS + pass) * numDrawRanges;
+
+	pCommandList->SetGraphicsRootShaderResourceView(INSTANCES, m_instanceWorlds.get());
+	pCommandList->IASetVertexBuffers(0, 1, &m_vertexBuffers[VB_POSITION]->GetVBV());
 	pCommandList->IASetIndexBuffer(m_indexBuffer->GetIBV());
 	pCommandList->IASetPrimitiveTopology(PrimitiveTopology::TRIANGLELIST);
-	pCommandList->DrawIndexed(m_numIndices, 1, 0, 0, 0);
+
+	if (m_drawCommandLayout)
+		pCommandList->ExecuteIndirect(m_drawCommandLayout.get(), numDrawRanges,
+			m_drawCommands.get(), sizeof(DrawCommand) * drawSet);
+	else
+	{
+		const auto& meshRange = m_meshRanges[0];
+		const auto& meshLOD = m_meshLODs[meshRange.FirstLOD + m_lodLevels[drawSet]];
+		pCommandList->SetGraphics32BitConstant(BASE_INSTANCE, 0);
+		pCommandList->DrawIndexed(meshLOD.NumIndices, m_scene->GetNumInstances(),
+			meshLOD.StartIndex, static_cast<int32_t>(meshRange.BaseVertex), 0);
+	}
+}
+
+void SparseVolume::dispatchMeshlets(RayTracing::CommandList* pCommandList, uint8_t frameIndex, LODPass pass)
+{
+	const auto numDrawRanges = m_scene->GetNumDrawRanges();
+	const auto pDrawRanges = m_scene->GetDrawRanges();
+	const auto drawSet = (frameIndex * NUM_LOD_PASS + pass) * numDrawRanges;
+
+	pCommandList->SetGraphicsRootShaderResourceView(INSTANCES, m_instanceWorlds.get());
+	pCommandList->SetGraphicsRootShaderResourceView(MESHLETS, m_meshlets.get());
+	pCommandList->SetGraphicsRootShaderResourceView(MESHLET_BOUNDS, m_meshletBounds.get());
+	pCommandList->SetGraphicsRootShaderResourceView(MESHLET_VERTICES, m_meshletVertices.get());
+	pCommandList->SetGraphicsRootShaderResourceView(MESHLET_PRIMITIVES, m_meshletPrimitives.get());
+	pCommandList->SetGraphicsRootShaderResourceView(MESHLET_POSITIONS, m_vertexBuffers[VB_POSITION].get());
+
+	// One amplification thread per meshlet and instance, at the levels selected for the draws;
+	// draws of more groups than a dispatch allows are split into chunks.
+	for (auto i = 0u; i < numDrawRanges; ++i)
+	{
+		const auto& drawRange = pDrawRanges[i];
+		const auto& meshRange = m_meshRanges[drawRange.MeshIndex];
+		const auto& meshLOD = m_meshLODs[meshRange.FirstLOD + m_lodLevels[drawSet + i]];
+		if (meshLOD.NumMeshlets == 0) continue;
+
+		MeshletConstants constants;
+		constants.FirstMeshlet = meshLOD.FirstMeshlet;
+		constants.NumMeshlets = meshLOD.NumMeshlets;
+		constants.BaseInstance = drawRange.FirstInstance;
+		constants.NumInstances = drawRange.NumInstances;
+		constants.QuantizedPositions = m_positionFormat == Format::R16G16B16A16_SNORM;
+		constants.BaseThread = 0;
+		pCommandList->SetGraphics32BitConstants(MESHLET_CONSTANTS, XUSG_UINT32_SIZE_OF(MeshletConstants), &constants);
+
+		const auto numGroups = XUSG_DIV_UP(meshLOD.NumMeshlets * drawRange.NumInstances, MESHLET_GROUP_SIZE);
+		for (auto baseGroup = 0u; baseGroup < numGroups; baseGroup += MAX_DISPATCH_GROUPS)
+		{
+			if (baseGroup > 0) pCommandList->SetGraphics32BitConstant(MESHLET_CONSTANTS, baseGroup * MESHLET_GROUP_SIZE,
+				XUSG_UINT32_SIZE_OF(MeshletConstants) - 1);
+			pCommandList->DispatchMesh((min)(numGroups - baseGroup, static_cast<uint32_t>(MAX_DISPATCH_GROUPS)), 1, 1);
+		}
+	}
 }
 
 void SparseVolume::render(RayTracing::CommandList* pCommandList, uint8_t frameIndex, const Descriptor& rtv)
@@ -6,21 +6,48 @@
 
 #include "RayTracing/XUSGRayTracing.h"
 
+namespace XUSG
+{
+	class MeshletBuilder;
+	class ObjLoader;
+	class SceneManifest;
+}
+
 class SparseVolume
 {
 public:
+	enum MeshFormat : uint8_t
+	{
+		MESH_FORMAT_OBJ,
+		MESH_FORMAT_PLY,	// Binary PLY
+		MESH_FORMAT_STL		// Binary STL
+	};
+
+	enum ImportFlag : uint8_t
+	{
+		IMPORT_QUANTIZE = (1 << 0),	// Compact vertex and index encoding
+		IMPORT_STREAMING = (1 << 1),	// Out-of-core import through the mesh cache file
+		IMPORT_CLEANUP = (1 << 2)		// Remove degenerate and duplicate triangles and unreferenced vertices
+	};
+
 	SparseVolume();
 	virtual ~SparseVolume();
 
+	// Start importing the meshes on a worker thread; Init() joins it before creating the buffers.
+	bool LoadMesh(const char* fileName, uint8_t importFlags = 0);
+	bool LoadScene(const char* fileName, uint8_t importFlags = 0);
 	bool Init(XUSG::RayTracing::CommandList* pCommandList, const XUSG::DescriptorTableLib::sptr& descriptorTableLib,
 		uint32_t width, uint32_t height, XUSG::Format rtFormat, XUSG::Format dsFormat, std::vector<XUSG::Resource::uptr>& uploaders,
-		XUSG::RayTracing::GeometryBuffer* pGeometry, const char* fileName, const DirectX::XMFLOAT4& posScale);
+		std::vector<XUSG::RayTracing::GeometryBuffer>* pGeometries, const DirectX::XMFLOAT4& posScale,
+		bool meshShaderSupported = false);
 
 	void UpdateFrame(const XUSG::RayTracing::Device* pDevice, uint8_t frameIndex, DirectX::CXMMATRIX viewProj);
-	void Render(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex,
-		const XUSG::Descriptor& rtv, const XUSG::Descriptor& dsv, const XUSG::Descriptor& lsDsv);
+	void Render(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex, const XUSG::Descriptor& rtv,
+		const XUSG::Descriptor& dsv, const XUSG::Descriptor& lsDsv, bool useMeshShader = false);
 	void RenderDXR(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex,
-		XUSG::RenderTarget* pDst, const XUSG::Descriptor& dsv);
+		XUSG::RenderTarget* pDst, const XUSG::Descriptor& dsv, bool useMeshShader = false);
+
+	static MeshFormat GetMeshFormat(const char* fileName);
 
 	static const uint8_t FrameCount = 3;
 
@@ -28,6 +55,7 @@ protected:
 	enum PipelineLayoutIndex : uint8_t
 	{
 		DEPTH_PEEL_LAYOUT,
+		DEPTH_PEEL_MESHLET_LAYOUT,
 		SPARSE_RAYCAST_LAYOUT,
 		GLOBAL_LAYOUT,
 		RAY_GEN_LAYOUT,
@@ -38,7 +66,19 @@ protected:
 	enum PipelineLayoutSlot : uint8_t
 	{
 		CONSTANTS,
-		SRV_UAVS
+		SRV_UAVS,
+		INSTANCES,		// Depth peeling only
+		BASE_INSTANCE	// Depth peeling only
+	};
+
+	enum MeshletPipelineLayoutSlot : uint8_t
+	{
+		MESHLET_CONSTANTS = BASE_INSTANCE,	// Follows CONSTANTS, SRV_UAVS and INSTANCES
+		MESHLETS,
+		MESHLET_BOUNDS,
+		MESHLET_VERTICES,
+		MESHLET_PRIMITIVES,
+		MESHLET_POSITIONS
 	};
 
 	enum GlobalPipelineLayoutSlot : uint8_t
@@ -51,6 +91,7 @@ protected:
 	enum PipelineIndex : uint8_t
 	{
 		DEPTH_PEEL,
+		DEPTH_PEEL_MESHLET,
 		SPARSE_RAYCAST,
 		RAY_TRACING,
 
@@ -66,6 +107,14 @@ protected:
 		NUM_UAV_TABLE
 	};
 
+	enum VertexBufferIndex : uint8_t
+	{
+		VB_POSITION,	// Position-only stream for depth peeling and BLAS building
+		VB_ATTRIBUTE,
+
+		NUM_VB
+	};
+
 	enum VertexShaderID : uint8_t
 	{
 		VS_BASE_PASS,
@@ -78,26 +127,80 @@ protected:
 		PS_SPARSE_RAYCAST
 	};
 
-	bool createVB(XUSG::CommandList* pCommandList, uint32_t numVert,
+	enum AmplificationShaderID : uint8_t
+	{
+		AS_DEPTH_PEEL
+	};
+
+	enum MeshShaderID : uint8_t
+	{
+		MS_DEPTH_PEEL
+	};
+
+	enum LODPass : uint8_t
+	{
+		LOD_PASS_CAMERA,
+		LOD_PASS_LIGHT,
+
+		NUM_LOD_PASS
+	};
+
+	struct MeshRange
+	{
+		uint32_t BaseVertex;
+		uint32_t NumVertices;
+		uint32_t StartIndex;	// Level 0, which the BLAS is built from
+		uint32_t NumIndices;
+		uint32_t FirstLOD;
+		uint32_t NumLODs;
+	};
+
+	struct MeshLOD
+	{
+		uint32_t StartIndex;
+		uint32_t NumIndices;
+		float Error;			// Object units
+		uint32_t FirstMeshlet;
+		uint32_t NumMeshlets;
+	};
+
+	struct InstanceBound
+	{
+		DirectX::XMFLOAT3 Center;	// World space
+		float Radius;
+		float ErrorScale;			// Object-to-world scale of the LOD errors
+	};
+
+	bool importMeshes();
+	bool createVB(XUSG::CommandList* pCommandList, VertexBufferIndex index, uint32_t numVert,
 		uint32_t stride, const uint8_t* pData, std::vector<XUSG::Resource::uptr>& uploaders);
-	bool createIB(XUSG::CommandList* pCommandList, uint32_t numIndices,
-		const uint32_t* pData, std::vector<XUSG::Resource::uptr>& uploaders);
+	bool createIB(XUSG::CommandList* pCommandList, uint32_t numIndices, const uint32_t* pData,
+		bool use16Bit, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createInputLayout();
 	bool createPipelineLayouts(const XUSG::RayTracing::Device* pDevice);
 	bool createPipelines(XUSG::Format rtFormat, XUSG::Format dsFormat);
 	bool createDescriptorTables();
+	bool createInstances(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
+	bool createMeshlets(XUSG::CommandList* pCommandList, const XUSG::MeshletBuilder& meshletBuilder,
+		std::vector<XUSG::Resource::uptr>& uploaders);
+	void buildMeshlets(XUSG::MeshletBuilder& meshletBuilder, const XUSG::ObjLoader& meshLoader,
+		MeshLOD* pLODs, uint32_t baseVertex) const;
 	bool buildAccelerationStructures(XUSG::RayTracing::CommandList* pCommandList,
-		XUSG::RayTracing::GeometryBuffer* pGeometry);
+		std::vector<XUSG::RayTracing::GeometryBuffer>& geometries);
 	bool buildShaderTables(const XUSG::RayTracing::Device* pDevice);
 
-	void depthPeel(XUSG::RayTracing::CommandList* pCommandList,
-		uint8_t frameIndex, const XUSG::Descriptor& dsv, bool setPipeline = true);
-	void depthPeelLightSpace(XUSG::RayTracing::CommandList* pCommandList,
-		uint8_t frameIndex, const XUSG::Descriptor& dsv);
+	void depthPeel(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+		const XUSG::Descriptor& dsv, bool useMeshShader, bool setPipeline = true);
+	void depthPeelLightSpace(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+		const XUSG::Descriptor& dsv, bool useMeshShader);
+	void updateDepthPeelCB(XUSG::ConstantBuffer* pCB, uint8_t frameIndex, DirectX::CXMMATRIX viewProj);
+	void selectLODs(uint8_t frameIndex, LODPass pass, DirectX::CXMMATRIX viewProj, const DirectX::XMFLOAT2& viewport);
+	void drawInstances(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex, LODPass pass);
+	void dispatchMeshlets(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex, LODPass pass);
 	void render(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex, const XUSG::Descriptor& rtv);
 	void rayTrace(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex);
 
-	XUSG::RayTracing::BottomLevelAS::uptr m_bottomLevelAS;
+	std::vector<XUSG::RayTracing::BottomLevelAS::uptr> m_bottomLevelASs;
 	XUSG::RayTracing::TopLevelAS::uptr m_topLevelAS;
 
 	const XUSG::InputLayout*	m_pInputLayout;
@@ -107,8 +210,27 @@ protected:
 	XUSG::DescriptorTable		m_srvTable;
 	XUSG::DescriptorTable		m_uavTables[NUM_UAV_TABLE];
 
-	XUSG::VertexBuffer::uptr	m_vertexBuffer;
+	XUSG::VertexBuffer::uptr	m_vertexBuffers[NUM_VB];
 	XUSG::IndexBuffer::uptr		m_indexBuffer;
+	std::vector<MeshRange>		m_meshRanges;
+	std::vector<MeshLOD>		m_meshLODs;
+	std::vector<InstanceBound>	m_instanceBounds;
+	std::vector<uint8_t>		m_lodLevels;		// Per frame, LOD pass and mesh
+
+	std::unique_ptr<XUSG::SceneManifest> m_scene;
+	std::vector<std::unique_ptr<XUSG::ObjLoader>> m_meshLoaders;
+	std::future<bool>			m_meshImport;
+	uint8_t						m_importFlags;
+
+	XUSG::StructuredBuffer::uptr m_instanceWorlds;	// Per-instance world transforms for depth peeling
+	XUSG::Buffer::uptr			m_drawCommands;		// One indirect draw per frame, LOD pass and mesh
+	XUSG::CommandLayout::uptr	m_drawCommandLayout;
+
+	// Meshlets of every level of detail, for mesh-shader depth peeling
+	XUSG::StructuredBuffer::uptr m_meshlets;
+	XUSG::StructuredBuffer::uptr m_meshletBounds;
+	XUSG::StructuredBuffer::uptr m_meshletVertices;
+	XUSG::StructuredBuffer::uptr m_meshletPrimitives;
 
 	XUSG::Texture2D::uptr		m_depthKBuffer;
 	XUSG::Texture2D::uptr		m_lsDepthKBuffer;
@@ -121,7 +243,8 @@ protected:
 	XUSG::Buffer::uptr			m_scratch;
 	XUSG::Buffer::uptr			m_instances;
 
-	DirectX::XMFLOAT3X4			m_world;
+	std::vector<DirectX::XMFLOAT3X4> m_worlds;
+	XUSG::Format				m_positionFormat;
 
 	// Shader tables
 	static const wchar_t* HitGroupName;
@@ -135,6 +258,7 @@ protected:
 	XUSG::ShaderLib::uptr				m_shaderLib;
 	XUSG::RayTracing::PipelineLib::uptr	m_rayTracingPipelineLib;
 	XUSG::Graphics::PipelineLib::uptr	m_graphicsPipelineLib;
+	XUSG::Ultimate::PipelineLib::uptr	m_meshShaderPipelineLib;
 	XUSG::Compute::PipelineLib::uptr	m_computePipelineLib;
 	XUSG::PipelineLayoutLib::uptr		m_pipelineLayoutLib;
 	XUSG::DescriptorTableLib::sptr		m_descriptorTableLib;
@@ -142,7 +266,6 @@ protected:
 	DirectX::XMFLOAT2	m_viewport;
 	DirectX::XMFLOAT4	m_bound;
 	DirectX::XMFLOAT4	m_posScale;
-	uint32_t			m_numIndices;
 
 	bool				m_useRayTracing;
 };
@@ -22,16 +22,19 @@ static const float g_fovAngleY = XM_PIDIV4;
 SparseVolumeDXR::SparseVolumeDXR(uint32_t width, uint32_t height, std::wstring name) :
 	DXFramework(width, height, name),
 	m_isDxrSupported(false),
+	m_isMeshShaderSupported(false),
 	m_frameIndex(0),
 	m_viewport(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height)),
 	m_scissorRect(0, 0, static_cast<long>(width), static_cast<long>(height)),
 	m_deviceType(DEVICE_DISCRETE),
 	m_useRayTracing(false),
+	m_useMeshShader(false),
 	m_showFPS(true),
 	m_isPaused(false),
 	m_tracking(false),
 	m_meshFileName("Assets/bunny.obj"),
 	m_meshPosScale(0.0f, 0.0f, 0.0f, 1.0f),
+	m_meshImportFlags(0),
 	m_screenShot(0)
 {
 #if defined (_DEBUG)
@@ -53,8 +56,15 @@ SparseVolumeDXR::~SparseVolumeDXR()
 
 void SparseVolumeDXR::OnInit()
 {
+	// The mesh import started in ParseCommandLineArgs() runs while the device is created.
+	const auto startTime = chrono::steady_clock::now();
 	LoadPipeline();
+	const auto pipelineTime = chrono::steady_clock::now();
 	LoadAssets();
+	const auto assetsTime = chrono::steady_clock::now();
+
+	cout << "Startup: LoadPipeline " << chrono::duration<double, milli>(pipelineTime - startTime).count()
+		<< " ms, LoadAssets " << chrono::duration<double, milli>(assetsTime - pipelineTime).count() << " ms" << endl;
 }
 
 // Load the rendering pipeline dependencies.
@@ -128,6 +138,14 @@ void SparseVolumeDXR::LoadPipeline()
 	//else m_title += wstring(L" - ") + dxgiAdapterDesc.Description;
 	ThrowIfFailed(hr);
 
+	// Mesh shaders are optional; depth peeling falls back to the vertex shader without them.
+	{
+		D3D12_FEATURE_DATA_D3D12_OPTIONS7 feature = {};
+		const auto pDevice = static_cast<ID3D12Device*>(m_device->GetHandle());
+		m_isMeshShaderSupported = SUCCEEDED(pDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS7, &feature, sizeof(feature)))
+			&& feature.MeshShaderTier != D3D12_MESH_SHADER_TIER_NOT_SUPPORTED;
+	}
+
 	// Create the command queue.
 	m_commandQueue = CommandQueue::MakeUnique();
 	XUSG_N_RETURN(m_commandQueue->Create(m_device.get(), CommandListType::DIRECT, CommandQueueFlag::NONE,
@@ -181,11 +199,10 @@ void SparseVolumeDXR::LoadAssets()
 		ResourceFlag::DENY_SHADER_RESOURCE);
 
 	vector<Resource::uptr> uploaders(0);
-	GeometryBuffer geometry;
-	m_sparseVolume = make_unique<SparseVolume>();
+	vector<GeometryBuffer> geometries;
 	XUSG_N_RETURN(m_sparseVolume->Init(pCommandList, m_descriptorTableLib, m_width, m_height,
-		m_renderTargets[0]->GetFormat(), m_depth->GetFormat(), uploaders, m_isDxrSupported ? &geometry : nullptr,
-		m_meshFileName.c_str(), m_meshPosScale), ThrowIfFailed(E_FAIL));
+		m_renderTargets[0]->GetFormat(), m_depth->GetFormat(), uploaders, m_isDxrSupported ? &geometries : nullptr,
+		m_meshPosScale, m_isMeshShaderSupported), ThrowIfFailed(E_FAIL));
 
 	// Close the command list and execute it to begin the initial GPU setup.
 	XUSG_N_RETURN(pCommandList->Close(), ThrowIfFailed(E_FAIL));
@@ -282,6 +299,9 @@ void SparseVolumeDXR::OnKeyUp(uint8_t key)
 	case 'R':
 		m_useRayTracing = !m_useRayTracing && m_isDxrSupported;
 		break;
+	case 'M':
+		m_useMeshShader = !m_useMeshShader && m_isMeshShaderSupported;
+		break;
 	}
 }
 
@@ -378,6 +398,9 @@ void SparseVolumeDXR::ParseCommandLineArgs(wchar_t* argv[], int argc)
 	{
 		if (isArgMatched(i, L"warp")) m_deviceType = DEVICE_WARP;
 		else if (isArgMatched(i, L"uma")) m_deviceType = DEVICE_UMA;
+		else if (isArgMatched(i, L"quantize")) m_meshImportFlags |= SparseVolume::IMPORT_QUANTIZE;
+		else if (isArgMatched(i, L"stream")) m_meshImportFlags |= SparseVolume::IMPORT_STREAMING;
+		else if (isArgMatched(i, L"cleanup")) m_meshImportFlags |= SparseVolume::IMPORT_CLEANUP;
 		else if (isArgMatched(i, L"mesh"))
 		{
 			if (hasNextArgValue(i))
@@ -391,7 +414,22 @@ void SparseVolumeDXR::ParseCommandLineArgs(wchar_t* argv[], int argc)
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.z);
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.w);
 		}
+		else if (isArgMatched(i, L"scene"))
+		{
+			if (hasNextArgValue(i))
+			{
+				m_sceneFileName.resize(wcslen(argv[++i]));
+				for (size_t j = 0; j < m_sceneFileName.size(); ++j)
+					m_sceneFileName[j] = static_cast<char>(argv[i][j]);
+			}
+		}
 	}
+
+	// Start importing the meshes, so that file I/O and parsing overlap window and device creation.
+	m_sparseVolume = make_unique<SparseVolume>();
+	if (m_sceneFileName.empty()) m_sparseVolume->LoadMesh(m_meshFileName.c_str(), m_meshImportFlags);
+	else if (!m_sparseVolume->LoadScene(m_sceneFileName.c_str(), m_meshImportFlags))
+		cerr << "Invalid scene manifest " << m_sceneFileName << endl;
 }
 
 void SparseVolumeDXR::PopulateCommandList()
@@ -428,8 +466,9 @@ void SparseVolumeDXR::PopulateCommandList()
 
 	// Voxelizer rendering
 	const auto pRenderTarget = m_renderTargets[m_frameIndex].get();
-	if (m_useRayTracing) m_sparseVolume->RenderDXR(pCommandList, m_frameIndex, pRenderTarget, m_depth->GetDSV());
-	else m_sparseVolume->Render(pCommandList, m_frameIndex, pRenderTarget->GetRTV(), m_depth->GetDSV(), m_lsDepth->GetDSV());
+	if (m_useRayTracing) m_sparseVolume->RenderDXR(pCommandList, m_frameIndex, pRenderTarget, m_depth->GetDSV(), m_useMeshShader);
+	else m_sparseVolume->Render(pCommandList, m_frameIndex, pRenderTarget->GetRTV(),
+		m_depth->GetDSV(), m_lsDepth->GetDSV(), m_useMeshShader);
 
 	// Indicate that the back buffer will now be used to present.
 	const auto numBarriers = pRenderTarget->SetBarrier(&barrier, ResourceState::PRESENT);
@@ -538,6 +577,7 @@ double SparseVolumeDXR::CalculateFrameStats(float* pTimeStep)
 		else windowText << L"[F1]";
 
 		windowText << L"    [R] " << (m_useRayTracing ? "Ray tracing" : "Shadow map array");
+		windowText << L"    [M] " << (m_useMeshShader ? "Mesh shader" : "Vertex shader");
 		windowText << L"    [F11] screen shot";
 
 		SetCustomWindowText(windowText.str().c_str());
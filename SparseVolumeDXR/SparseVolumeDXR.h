@@ -64,6 +64,7 @@ private:
 	XUSG::CommandQueue::uptr		m_commandQueue;
 
 	bool m_isDxrSupported;
+	bool m_isMeshShaderSupported;
 
 	XUSG::RayTracing::Device::uptr m_device;
 	XUSG::RenderTarget::uptr m_renderTargets[FrameCount];
@@ -88,6 +89,7 @@ private:
 	DeviceType	m_deviceType;
 	StepTimer	m_timer;
 	bool		m_useRayTracing;
+	bool		m_useMeshShader;
 	bool		m_showFPS;
 	bool		m_isPaused;
 
@@ -98,6 +100,8 @@ private:
 	// User external settings
 	std::string m_meshFileName;
 	XMFLOAT4 m_meshPosScale;
+	std::string m_sceneFileName;
+	uint8_t m_meshImportFlags;
 
 	// Screen-shot helpers and state
 	XUSG::Buffer::uptr	m_readBuffer;
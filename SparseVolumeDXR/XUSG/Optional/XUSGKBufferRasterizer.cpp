@@ -0,0 +1,417 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <thread>
+#include "XUSGKBufferRasterizer.h"
+#include "XUSGParallel.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XUSG_KBUFFER_RASTERIZER_SSE2 1
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+// 16.8 fixed point as in D3D; with the guard band below, the edge functions fit 64 bits.
+static const int32_t g_subpixelBits = 8;
+static const int32_t g_subpixelScale = 1 << g_subpixelBits;
+static const int32_t g_halfPixel = g_subpixelScale / 2;
+static const float g_guardBandPixels = 8192.0f;
+
+// Clip planes, as the bits of the vertex outcodes
+enum ClipPlane : uint8_t
+{
+	CLIP_NEAR,
+	CLIP_FAR,
+	CLIP_LEFT,
+	CLIP_RIGHT,
+	CLIP_BOTTOM,
+	CLIP_TOP,
+	CLIP_W,
+
+	NUM_CLIP_PLANE
+};
+
+// Signed distance to the clip plane, >= 0 inside
+static float getClipDistance(const float pos[4], uint8_t plane, const float guardBand[2])
+{
+	switch (plane)
+	{
+	case CLIP_NEAR:
+		return pos[2];
+	case CLIP_FAR:
+		return pos[3] - pos[2];
+	case CLIP_LEFT:
+		return guardBand[0] * pos[3] + pos[0];
+	case CLIP_RIGHT:
+		return guardBand[0] * pos[3] - pos[0];
+	case CLIP_BOTTOM:
+		return guardBand[1] * pos[3] + pos[1];
+	case CLIP_TOP:
+		return guardBand[1] * pos[3] - pos[1];
+	default:
+		return pos[3] - 1.0e-9f;
+	}
+}
+
+KBufferRasterizer::KBufferRasterizer() :
+	m_width(0),
+	m_height(0),
+	m_numLayers(0),
+	m_numTilesX(0),
+	m_numTilesY(0),
+	m_numThreads(0),
+	m_numDrawnTriangles(0),
+	m_guardBand()
+{
+}
+
+KBufferRasterizer::~KBufferRasterizer()
+{
+}
+
+void KBufferRasterizer::Init(uint32_t width, uint32_t height, uint32_t numLayers)
+{
+	m_width = width;
+	m_height = height;
+	m_numLayers = (max)(numLayers, 1u);
+	m_numTilesX = (width + TileSize - 1) / TileSize;
+	m_numTilesY = (height + TileSize - 1) / TileSize;
+
+	// NDC extents of the guard band, so that the screen coordinates stay in 16.8 fixed point
+	m_guardBand[0] = width ? 1.0f + 2.0f * g_guardBandPixels / width : 1.0f;
+	m_guardBand[1] = height ? 1.0f + 2.0f * g_guardBandPixels / height : 1.0f;
+
+	m_kBuffer.resize(static_cast<size_t>(width) * height * m_numLayers);
+	m_bins.clear();
+	Clear();
+}
+
+void KBufferRasterizer::SetNumThreads(uint32_t numThreads)
+{
+	m_numThreads = numThreads;
+}
+
+void KBufferRasterizer::Clear()
+{
+	const auto farDepth = 1.0f;
+	uint32_t clearValue;
+	memcpy(&clearValue, &farDepth, sizeof(uint32_t));
+	fill(m_kBuffer.begin(), m_kBuffer.end(), clearValue);
+	m_numDrawnTriangles = 0;
+}
+
+void KBufferRasterizer::Draw(const float worldViewProj[4][4], const void* pPositions, uint32_t stride,
+	uint32_t numVertices, const uint32_t* pIndices, uint32_t numIndices)
+{
+	const auto numTriangles = numIndices / 3;
+	if (m_kBuffer.empty() || numTriangles < 1) return;
+
+	const auto numThreads = getNumThreads();
+	const auto numTiles = m_numTilesX * m_numTilesY;
+	const auto pPosData = reinterpret_cast<const uint8_t*>(pPositions);
+
+	// Vertices to clip space, with the outcodes for trivial accepts and rejects
+	m_vertices.resize(numVertices);
+	Parallel::For(numThreads, numVertices, 64, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto p = reinterpret_cast<const float*>(&pPosData[static_cast<size_t>(stride) * i]);
+			auto& vertex = m_vertices[i];
+			for (uint8_t j = 0; j < 4; ++j)
+				vertex.Pos[j] = p[0] * worldViewProj[0][j] + p[1] * worldViewProj[1][j] +
+				p[2] * worldViewProj[2][j] + worldViewProj[3][j];
+
+			vertex.OutCode = 0;
+			for (uint8_t j = 0; j < NUM_CLIP_PLANE; ++j)
+				if (!(getClipDistance(vertex.Pos, j, m_guardBand) >= 0.0f)) vertex.OutCode |= 1 << j;
+		}
+	});
+
+	// Setup and binning, each range into its own triangles and bins
+	const auto numBinSets = (min)(numThreads, numTriangles / 1024 + 1);
+	if (m_triangles.size() < numBinSets) m_triangles.resize(numBinSets);
+	if (m_bins.size() < numBinSets) m_bins.resize(numBinSets);
+	Parallel::Run(numBinSets, [&](uint32_t r)
+	{
+		auto& triangles = m_triangles[r];
+		auto& bins = m_bins[r];
+		triangles.clear();
+		bins.resize(numTiles);
+		for (auto& bin : bins) bin.clear();
+
+		const auto begin = static_cast<uint32_t>(static_cast<uint64_t>(numTriangles) * r / numBinSets);
+		const auto end = static_cast<uint32_t>(static_cast<uint64_t>(numTriangles) * (r + 1) / numBinSets);
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto pTri = &pIndices[3 * i];
+			if (pTri[0] >= numVertices || pTri[1] >= numVertices || pTri[2] >= numVertices) continue;
+
+			const Vertex* pVertices[] = { &m_vertices[pTri[0]], &m_vertices[pTri[1]], &m_vertices[pTri[2]] };
+			if (pVertices[0]->OutCode & pVertices[1]->OutCode & pVertices[2]->OutCode) continue;
+
+			const float* pPos[] = { pVertices[0]->Pos, pVertices[1]->Pos, pVertices[2]->Pos };
+			const auto outCodes = static_cast<uint8_t>(pVertices[0]->OutCode | pVertices[1]->OutCode | pVertices[2]->OutCode);
+			const auto first = static_cast<uint32_t>(triangles.size());
+			if (outCodes) clipTriangle(pPos, outCodes, triangles);
+			else setupTriangle(pPos, triangles);
+
+			for (auto j = first; j < triangles.size(); ++j)
+			{
+				const auto& triangle = triangles[j];
+				const auto tileMaxX = static_cast<uint32_t>(triangle.MaxX) / TileSize;
+				const auto tileMaxY = static_cast<uint32_t>(triangle.MaxY) / TileSize;
+				for (auto y = static_cast<uint32_t>(triangle.MinY) / TileSize; y <= tileMaxY; ++y)
+					for (auto x = static_cast<uint32_t>(triangle.MinX) / TileSize; x <= tileMaxX; ++x)
+						bins[m_numTilesX * y + x].emplace_back(j);
+			}
+		}
+	});
+
+	for (auto r = 0u; r < numBinSets; ++r) m_numDrawnTriangles += static_cast<uint32_t>(m_triangles[r].size());
+
+	// Tiles are disjoint, so the threads take them in turn without synchronization.
+	atomic<uint32_t> nextTile(0);
+	Parallel::Run((min)(numThreads, numTiles), [&](uint32_t)
+	{
+		for (auto tile = nextTile++; tile < numTiles; tile = nextTile++) rasterizeTile(tile, numBinSets);
+	});
+}
+
+uint32_t KBufferRasterizer::GetWidth() const
+{
+	return m_width;
+}
+
+uint32_t KBufferRasterizer::GetHeight() const
+{
+	return m_height;
+}
+
+uint32_t KBufferRasterizer::GetNumLayers() const
+{
+	return m_numLayers;
+}
+
+uint32_t KBufferRasterizer::GetNumDrawnTriangles() const
+{
+	return m_numDrawnTriangles;
+}
+
+const uint32_t* KBufferRasterizer::GetKBuffer() const
+{
+	return m_kBuffer.data();
+}
+
+void KBufferRasterizer::CopyLayers(uint32_t* pDst) const
+{
+	const auto numPixels = static_cast<size_t>(m_width) * m_height;
+	for (size_t i = 0; i < numPixels; ++i)
+		for (auto j = 0u; j < m_numLayers; ++j)
+			pDst[numPixels * j + i] = m_kBuffer[m_numLayers * i + j];
+}
+
+void KBufferRasterizer::setupTriangle(const float* const pPositions[3], vector<Triangle>& triangles) const
+{
+	// Viewport transform with the y axis down, then snapped to the subpixel grid
+	double x[3], y[3], z[3];
+	int32_t fx[3], fy[3];
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto& pos = pPositions[i];
+		const auto invW = 1.0f / pos[3];
+		x[i] = (pos[0] * invW * 0.5f + 0.5f) * m_width;
+		y[i] = (0.5f - pos[1] * invW * 0.5f) * m_height;
+		z[i] = pos[2] * invW;
+		fx[i] = static_cast<int32_t>(floor(x[i] * g_subpixelScale + 0.5));
+		fy[i] = static_cast<int32_t>(floor(y[i] * g_subpixelScale + 0.5));
+	}
+
+	// Both windings are drawn; the back faces are flipped to the front winding.
+	const auto area = static_cast<int64_t>(fx[1] - fx[0]) * (fy[2] - fy[0]) - static_cast<int64_t>(fx[2] - fx[0]) * (fy[1] - fy[0]);
+	if (area == 0) return;
+	if (area < 0)
+	{
+		swap(x[1], x[2]);
+		swap(y[1], y[2]);
+		swap(z[1], z[2]);
+		swap(fx[1], fx[2]);
+		swap(fy[1], fy[2]);
+	}
+
+	// Pixels whose centers lie in the bounding box, clamped to the target
+	Triangle triangle;
+	triangle.MinX = (max)(((min)(fx[0], (min)(fx[1], fx[2])) - g_halfPixel + g_subpixelScale - 1) >> g_subpixelBits, 0);
+	triangle.MinY = (max)(((min)(fy[0], (min)(fy[1], fy[2])) - g_halfPixel + g_subpixelScale - 1) >> g_subpixelBits, 0);
+	triangle.MaxX = (min)(((max)(fx[0], (max)(fx[1], fx[2])) - g_halfPixel) >> g_subpixelBits, static_cast<int32_t>(m_width) - 1);
+	triangle.MaxY = (min)(((max)(fy[0], (max)(fy[1], fy[2])) - g_halfPixel) >> g_subpixelBits, static_cast<int32_t>(m_height) - 1);
+	if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY) return;
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		// With the y axis down, the top edges go right and the left edges go up.
+		const auto j = (i + 1) % 3;
+		const auto isTopLeft = (fy[i] == fy[j] && fx[j] > fx[i]) || fy[j] < fy[i];
+		triangle.EdgeA[i] = static_cast<int64_t>(fy[i]) - fy[j];
+		triangle.EdgeB[i] = static_cast<int64_t>(fx[j]) - fx[i];
+		triangle.EdgeC[i] = -triangle.EdgeA[i] * fx[i] - triangle.EdgeB[i] * fy[i] - (isTopLeft ? 0 : 1);
+	}
+
+	// Depth plane from the unsnapped positions, as the GPU interpolates z at the pixel centers
+	const auto dx1 = x[1] - x[0], dy1 = y[1] - y[0], dz1 = z[1] - z[0];
+	const auto dx2 = x[2] - x[0], dy2 = y[2] - y[0], dz2 = z[2] - z[0];
+	const auto det = dx1 * dy2 - dx2 * dy1;
+	triangle.DepthPlane[0] = det != 0.0 ? (dz1 * dy2 - dz2 * dy1) / det : 0.0;
+	triangle.DepthPlane[1] = det != 0.0 ? (dz2 * dx1 - dz1 * dx2) / det : 0.0;
+	triangle.DepthPlane[2] = z[0] - triangle.DepthPlane[0] * x[0] - triangle.DepthPlane[1] * y[0];
+
+	triangles.emplace_back(triangle);
+}
+
+void KBufferRasterizer::clipTriangle(const float* const pPositions[3], uint8_t outCodes, vector<Triangle>& triangles) const
+{
+	// Sutherland-Hodgman against the crossed planes; each adds at most one vertex.
+	float polygons[2][3 + NUM_CLIP_PLANE][4];
+	uint8_t numVertices = 3;
+	for (uint8_t i = 0; i < 3; ++i) memcpy(polygons[0][i], pPositions[i], sizeof(float[4]));
+
+	auto src = 0u;
+	for (uint8_t plane = 0; plane < NUM_CLIP_PLANE && numVertices >= 3; ++plane)
+	{
+		if (!(outCodes & (1 << plane))) continue;
+
+		const auto& input = polygons[src];
+		auto& output = polygons[src ^ 1];
+		uint8_t numOutput = 0;
+		for (uint8_t i = 0; i < numVertices; ++i)
+		{
+			const auto& a = input[i];
+			const auto& b = input[(i + 1) % numVertices];
+			const auto da = getClipDistance(a, plane, m_guardBand);
+			const auto db = getClipDistance(b, plane, m_guardBand);
+			if (da >= 0.0f) memcpy(output[numOutput++], a, sizeof(float[4]));
+			if ((da >= 0.0f) != (db >= 0.0f))
+			{
+				const auto t = da / (da - db);
+				for (uint8_t j = 0; j < 4; ++j) output[numOutput][j] = a[j] + (b[j] - a[j]) * t;
+				++numOutput;
+			}
+		}
+
+		numVertices = numOutput;
+		src ^= 1;
+	}
+
+	// Triangle fan of the clipped polygon
+	for (uint8_t i = 2; i < numVertices; ++i)
+	{
+		const float* pFan[] = { polygons[src][0], polygons[src][i - 1], polygons[src][i] };
+		setupTriangle(pFan, triangles);
+	}
+}
+
+void KBufferRasterizer::rasterizeTile(uint32_t tile, uint32_t numBinSets)
+{
+	const auto left = static_cast<int32_t>(tile % m_numTilesX * TileSize);
+	const auto top = static_cast<int32_t>(tile / m_numTilesX * TileSize);
+	const auto right = (min)(left + static_cast<int32_t>(TileSize), static_cast<int32_t>(m_width)) - 1;
+	const auto bottom = (min)(top + static_cast<int32_t>(TileSize), static_cast<int32_t>(m_height)) - 1;
+
+	for (auto r = 0u; r < numBinSets; ++r)
+	{
+		const auto& triangles = m_triangles[r];
+		for (const auto& i : m_bins[r][tile]) rasterizeTriangle(triangles[i], left, top, right, bottom);
+	}
+}
+
+void KBufferRasterizer::rasterizeTriangle(const Triangle& triangle, int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+	const auto minX = (max)(triangle.MinX, left);
+	const auto minY = (max)(triangle.MinY, top);
+	const auto maxX = (min)(triangle.MaxX, right);
+	const auto maxY = (min)(triangle.MaxY, bottom);
+
+	// Edge functions at the first pixel center, stepped by whole pixels
+	const int64_t px = static_cast<int64_t>(minX) * g_subpixelScale + g_halfPixel;
+	const int64_t py = static_cast<int64_t>(minY) * g_subpixelScale + g_halfPixel;
+	int64_t rowEdges[3], stepX[3], stepY[3];
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		rowEdges[i] = triangle.EdgeA[i] * px + triangle.EdgeB[i] * py + triangle.EdgeC[i];
+		stepX[i] = triangle.EdgeA[i] * g_subpixelScale;
+		stepY[i] = triangle.EdgeB[i] * g_subpixelScale;
+	}
+
+#if XUSG_KBUFFER_RASTERIZER_SSE2
+	// Offsets of 4 pixels in two pairs of 64-bit lanes
+	__m128i offsets01[3], offsets23[3];
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		offsets01[i] = _mm_set_epi64x(stepX[i], 0);
+		offsets23[i] = _mm_set_epi64x(3 * stepX[i], 2 * stepX[i]);
+	}
+#endif
+
+	for (auto y = minY; y <= maxY; ++y)
+	{
+		int64_t edges[] = { rowEdges[0], rowEdges[1], rowEdges[2] };
+		auto x = minX;
+
+#if XUSG_KBUFFER_RASTERIZER_SSE2
+		for (; x + 3 <= maxX; x += 4)
+		{
+			// The sign bit of a lane is set when its pixel is outside any edge.
+			auto outside01 = _mm_setzero_si128(), outside23 = _mm_setzero_si128();
+			for (uint8_t i = 0; i < 3; ++i)
+			{
+				const auto e = _mm_set1_epi64x(edges[i]);
+				outside01 = _mm_or_si128(outside01, _mm_add_epi64(e, offsets01[i]));
+				outside23 = _mm_or_si128(outside23, _mm_add_epi64(e, offsets23[i]));
+				edges[i] += 4 * stepX[i];
+			}
+
+			const auto mask = ~(_mm_movemask_pd(_mm_castsi128_pd(outside01)) |
+				(_mm_movemask_pd(_mm_castsi128_pd(outside23)) << 2)) & 0xf;
+			for (uint8_t i = 0; i < 4; ++i) if (mask & (1 << i)) insertDepth(triangle, x + i, y);
+		}
+#endif
+
+		for (; x <= maxX; ++x)
+		{
+			if ((edges[0] | edges[1] | edges[2]) >= 0) insertDepth(triangle, x, y);
+			for (uint8_t i = 0; i < 3; ++i) edges[i] += stepX[i];
+		}
+
+		for (uint8_t i = 0; i < 3; ++i) rowEdges[i] += stepY[i];
+	}
+}
+
+void KBufferRasterizer::insertDepth(const Triangle& triangle, int32_t x, int32_t y)
+{
+	// Passes the depth test against the cleared depth buffer (LESS than 1.0)
+	auto z = static_cast<float>(triangle.DepthPlane[0] * (x + 0.5) + triangle.DepthPlane[1] * (y + 0.5) + triangle.DepthPlane[2]);
+	if (!(z < 1.0f)) return;
+	z = (max)(z, 0.0f);
+
+	// Non-negative floats order as their bits; the insertion is that of PSDepthPeel.hlsl.
+	uint32_t depth;
+	memcpy(&depth, &z, sizeof(uint32_t));
+	const auto pLayers = &m_kBuffer[(static_cast<size_t>(m_width) * y + x) * m_numLayers];
+	if (depth >= pLayers[m_numLayers - 1]) return;
+
+	for (auto i = 0u; i < m_numLayers; ++i)
+	{
+		const auto prev = pLayers[i];
+		pLayers[i] = (min)(prev, depth);
+		depth = (max)(depth, prev);
+	}
+}
+
+uint32_t KBufferRasterizer::getNumThreads() const
+{
+	return m_numThreads ? m_numThreads : (max)(thread::hardware_concurrency(), 1u);
+}
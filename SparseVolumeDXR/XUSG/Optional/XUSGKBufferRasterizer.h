@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Portable CPU counterpart of the depth-peeling pass (PSDepthPeel.hlsl). Triangles are
+	// clipped in homogeneous space, binned to screen tiles, and the tiles are rasterized in
+	// parallel with 16.8 fixed-point edge functions and the D3D top-left fill rule, sampling
+	// at the pixel centers. Both windings are drawn, as with CULL_NONE. Each pixel keeps its
+	// nearest depths sorted, encoded as the bits of the NDC z like the R32_UINT slices on the
+	// GPU; the insertion is the same min/max exchange, so the draw order does not matter.
+	class KBufferRasterizer
+	{
+	public:
+		KBufferRasterizer();
+		virtual ~KBufferRasterizer();
+
+		void Init(uint32_t width, uint32_t height, uint32_t numLayers);
+		void SetNumThreads(uint32_t numThreads);	// 0 for the hardware concurrency
+		void Clear();	// Every layer to the bits of 1.0f, as the GPU k-buffer is cleared
+
+		// Positions are 3 floats at the start of each element of the given byte stride. The
+		// matrix takes row vectors (clip = (p, 1) * worldViewProj) as in DirectXMath, and the
+		// viewport covers the whole target with the depth range [0, 1].
+		void Draw(const float worldViewProj[4][4], const void* pPositions, uint32_t stride,
+			uint32_t numVertices, const uint32_t* pIndices, uint32_t numIndices);
+
+		uint32_t GetWidth() const;
+		uint32_t GetHeight() const;
+		uint32_t GetNumLayers() const;
+		uint32_t GetNumDrawnTriangles() const;	// After clipping, since the last clear
+
+		// Pixel-major: the numLayers sorted depths of each pixel are adjacent.
+		const uint32_t* GetKBuffer() const;
+		// Layer-major into numLayers slices of width x height, as the GPU texture array
+		void CopyLayers(uint32_t* pDst) const;
+
+		static const uint32_t TileSize = 64;
+
+	protected:
+		struct Vertex
+		{
+			float		Pos[4];	// Clip space
+			uint8_t		OutCode;
+		};
+
+		struct Triangle
+		{
+			int64_t		EdgeA[3];	// E(x, y) = A * x + B * y + C in subpixels, > 0 inside
+			int64_t		EdgeB[3];
+			int64_t		EdgeC[3];	// Biased by the fill rule, so that E >= 0 inside
+			double		DepthPlane[3];	// z = a * x + b * y + c in pixels
+			int32_t		MinX, MinY;	// Covered pixels, inclusive
+			int32_t		MaxX, MaxY;
+		};
+
+		void setupTriangle(const float* const pPositions[3], std::vector<Triangle>& triangles) const;
+		void clipTriangle(const float* const pPositions[3], uint8_t outCodes, std::vector<Triangle>& triangles) const;
+		void rasterizeTile(uint32_t tile, uint32_t numBinSets);
+		void rasterizeTriangle(const Triangle& triangle, int32_t left, int32_t top, int32_t right, int32_t bottom);
+		void insertDepth(const Triangle& triangle, int32_t x, int32_t y);
+
+		uint32_t getNumThreads() const;
+
+		std::vector<uint32_t>		m_kBuffer;
+		std::vector<Vertex>			m_vertices;
+		std::vector<std::vector<Triangle>> m_triangles;				// Per thread
+		std::vector<std::vector<std::vector<uint32_t>>> m_bins;	// Per thread and tile
+
+		uint32_t	m_width;
+		uint32_t	m_height;
+		uint32_t	m_numLayers;
+		uint32_t	m_numTilesX;
+		uint32_t	m_numTilesY;
+		uint32_t	m_numThreads;
+		uint32_t	m_numDrawnTriangles;
+		float		m_guardBand[2];	// Clip-space x and y extents, in units of w
+	};
+}
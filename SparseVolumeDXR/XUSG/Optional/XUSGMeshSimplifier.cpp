@@ -0,0 +1,294 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGMeshSimplifier.h"
+
+using namespace std;
+using namespace XUSG;
+
+static inline void getTriangleNormal(const float* p0, const float* p1, const float* p2, float n[3])
+{
+	const float e1[] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	const float e2[] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+MeshSimplifier::MeshSimplifier() :
+	m_numVertices(0)
+{
+}
+
+MeshSimplifier::~MeshSimplifier()
+{
+}
+
+void MeshSimplifier::Init(const void* pPositions, uint32_t stride, uint32_t numVertices)
+{
+	m_numVertices = numVertices;
+	m_positions.resize(static_cast<size_t>(numVertices) * 3);
+	const auto pSrc = reinterpret_cast<const uint8_t*>(pPositions);
+	for (auto i = 0u; i < numVertices; ++i)
+		memcpy(&m_positions[static_cast<size_t>(i) * 3], pSrc + static_cast<size_t>(stride) * i, sizeof(float[3]));
+}
+
+float MeshSimplifier::Simplify(vector<uint32_t>& indices, uint32_t targetNumIndices, float maxError)
+{
+	// Drop degenerate triangles up front.
+	auto numIndices = 0u;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const auto i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+		if (i0 == i1 || i1 == i2 || i2 == i0) continue;
+		indices[numIndices++] = i0;
+		indices[numIndices++] = i1;
+		indices[numIndices++] = i2;
+	}
+	indices.resize(numIndices);
+	if (indices.size() <= targetNumIndices) return 0.0f;
+
+	buildAdjacency(indices);
+	computeQuadrics(indices);
+	lockBorders(indices);
+
+	auto& collapses = m_collapses;
+	auto& remap = m_remap;
+	auto& touched = m_touched;
+	remap.resize(m_numVertices);
+	touched.resize(m_numVertices);
+	auto maxCollapseError = 0.0f;
+	while (indices.size() > targetNumIndices)
+	{
+		// Gather the collapse of every half edge that starts at an unlocked vertex, cheapest first.
+		collapses.clear();
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto source = indices[i + j];
+				const auto target = indices[i + (j + 1) % 3];
+				if (!m_locked[source]) collapses.push_back({ source, target, getError(source, target) });
+			}
+		}
+		sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.Error < b.Error; });
+
+		// An interior collapse removes 2 triangles. The one-rings of both end vertices are
+		// frozen for the rest of the pass, so that every validity test sees current topology.
+		const auto collapseGoal = static_cast<uint32_t>((indices.size() - targetNumIndices) / 6 + 1);
+		for (auto i = 0u; i < m_numVertices; ++i) remap[i] = i;
+		memset(touched.data(), 0, touched.size());
+
+		auto numCollapses = 0u;
+		for (const auto& collapse : collapses)
+		{
+			if (collapse.Error > maxError) break;
+			if (touched[collapse.Source] || touched[collapse.Target]) continue;
+			if (!isValidCollapse(indices, collapse.Source, collapse.Target)) continue;
+
+			remap[collapse.Source] = collapse.Target;
+			addQuadric(m_quadrics[collapse.Target], m_quadrics[collapse.Source]);
+			for (const auto vi : { collapse.Source, collapse.Target })
+				for (auto k = m_adjOffsets[vi]; k < m_adjOffsets[vi + 1]; ++k)
+					for (uint8_t j = 0; j < 3; ++j) touched[indices[m_adjTris[k] * 3 + j]] = 1;
+
+			maxCollapseError = (max)(collapse.Error, maxCollapseError);
+			if (++numCollapses >= collapseGoal) break;
+		}
+		if (numCollapses == 0) break;
+
+		// Apply the collapses and drop the triangles that became degenerate.
+		numIndices = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const auto i0 = remap[indices[i]], i1 = remap[indices[i + 1]], i2 = remap[indices[i + 2]];
+			if (i0 == i1 || i1 == i2 || i2 == i0) continue;
+			indices[numIndices++] = i0;
+			indices[numIndices++] = i1;
+			indices[numIndices++] = i2;
+		}
+		indices.resize(numIndices);
+		buildAdjacency(indices);
+	}
+
+	return maxCollapseError;
+}
+
+void MeshSimplifier::buildAdjacency(const vector<uint32_t>& indices)
+{
+	m_adjOffsets.assign(m_numVertices + 1, 0);
+	for (const auto vi : indices) ++m_adjOffsets[vi + 1];
+	for (auto i = 0u; i < m_numVertices; ++i) m_adjOffsets[i + 1] += m_adjOffsets[i];
+
+	m_cursors.assign(m_adjOffsets.begin(), m_adjOffsets.end() - 1);
+	m_adjTris.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i) m_adjTris[m_cursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+}
+
+void MeshSimplifier::computeQuadrics(const vector<uint32_t>& indices)
+{
+	// Sum the area-weighted plane quadrics of the triangles around each vertex.
+	m_quadrics.assign(m_numVertices, Quadric());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const auto p0 = &m_positions[static_cast<size_t>(indices[i]) * 3];
+		float n[3];
+		getTriangleNormal(p0, &m_positions[static_cast<size_t>(indices[i + 1]) * 3],
+			&m_positions[static_cast<size_t>(indices[i + 2]) * 3], n);
+
+		const auto length = sqrt(static_cast<double>(n[0]) * n[0] + static_cast<double>(n[1]) * n[1] + static_cast<double>(n[2]) * n[2]);
+		if (length <= 0.0) continue;
+
+		const auto a = n[0] / length, b = n[1] / length, c = n[2] / length;
+		const auto d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+		const auto w = length * 0.5;
+
+		Quadric quadric;
+		quadric.A00 = w * a * a;
+		quadric.A01 = w * a * b;
+		quadric.A02 = w * a * c;
+		quadric.A11 = w * b * b;
+		quadric.A12 = w * b * c;
+		quadric.A22 = w * c * c;
+		quadric.B0 = w * a * d;
+		quadric.B1 = w * b * d;
+		quadric.B2 = w * c * d;
+		quadric.C = w * d * d;
+		quadric.Weight = w;
+
+		for (uint8_t j = 0; j < 3; ++j) addQuadric(m_quadrics[indices[i + j]], quadric);
+	}
+}
+
+void MeshSimplifier::lockBorders(const vector<uint32_t>& indices)
+{
+	// An edge of a closed manifold is shared by exactly 2 triangles; lock the vertices of
+	// border and non-manifold edges, which keeps open boundaries and seams in place.
+	m_locked.assign(m_numVertices, 0);
+	auto& edgeCounts = m_edgeCounts;
+	for (auto vi = 0u; vi < m_numVertices; ++vi)
+	{
+		edgeCounts.clear();
+		for (auto k = m_adjOffsets[vi]; k < m_adjOffsets[vi + 1]; ++k)
+		{
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto vj = indices[m_adjTris[k] * 3 + j];
+				if (vj == vi) continue;
+
+				auto found = false;
+				for (auto& edgeCount : edgeCounts)
+				{
+					if (edgeCount.first == vj)
+					{
+						++edgeCount.second;
+						found = true;
+						break;
+					}
+				}
+				if (!found) edgeCounts.emplace_back(vj, 1);
+			}
+		}
+
+		for (const auto& edgeCount : edgeCounts)
+		{
+			if (edgeCount.second != 2)
+			{
+				m_locked[vi] = 1;
+				break;
+			}
+		}
+	}
+}
+
+bool MeshSimplifier::isValidCollapse(const vector<uint32_t>& indices, uint32_t source, uint32_t target) const
+{
+	// Link condition: the end vertices may only share the 2 vertices opposite the edge;
+	// any other common neighbour would pinch the surface into a non-manifold edge.
+	const uint32_t maxNeighbors = 64;
+	uint32_t neighbors[maxNeighbors];
+	auto numNeighbors = 0u;
+	auto numCommon = 0u;
+	for (auto k = m_adjOffsets[source]; k < m_adjOffsets[source + 1]; ++k)
+	{
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto vi = indices[m_adjTris[k] * 3 + j];
+			if (vi == source || find(neighbors, neighbors + numNeighbors, vi) != neighbors + numNeighbors) continue;
+			if (numNeighbors >= maxNeighbors) return false;
+			neighbors[numNeighbors++] = vi;
+		}
+	}
+
+	for (auto k = m_adjOffsets[target]; k < m_adjOffsets[target + 1]; ++k)
+	{
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto vi = indices[m_adjTris[k] * 3 + j];
+			if (vi == target || vi == source) continue;
+			const auto pNeighbor = find(neighbors, neighbors + numNeighbors, vi);
+			if (pNeighbor == neighbors + numNeighbors) continue;
+			*pNeighbor = source; // Count each common neighbour once
+			++numCommon;
+		}
+	}
+	if (numCommon != 2) return false;
+
+	// Reject the collapse if a remaining triangle around the source would flip or degenerate.
+	const auto pTarget = &m_positions[static_cast<size_t>(target) * 3];
+	for (auto k = m_adjOffsets[source]; k < m_adjOffsets[source + 1]; ++k)
+	{
+		const auto pTri = &indices[m_adjTris[k] * 3];
+		if (pTri[0] == target || pTri[1] == target || pTri[2] == target) continue;
+
+		const float* p[3];
+		const float* q[3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			p[j] = &m_positions[static_cast<size_t>(pTri[j]) * 3];
+			q[j] = pTri[j] == source ? pTarget : p[j];
+		}
+
+		float n0[3], n1[3];
+		getTriangleNormal(p[0], p[1], p[2], n0);
+		getTriangleNormal(q[0], q[1], q[2], n1);
+		const auto dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+		const auto lengthSq0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+		const auto lengthSq1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+		if (dot <= 0.0f || dot * dot < 0.0625f * lengthSq0 * lengthSq1) return false; // Over 75 degrees
+	}
+
+	return true;
+}
+
+float MeshSimplifier::getError(uint32_t source, uint32_t target) const
+{
+	// Evaluate the merged quadric at the target position; normalizing by the area gives
+	// an RMS distance to the original planes.
+	auto q = m_quadrics[source];
+	addQuadric(q, m_quadrics[target]);
+
+	const auto p = &m_positions[static_cast<size_t>(target) * 3];
+	const double x = p[0], y = p[1], z = p[2];
+	const auto error = q.A00 * x * x + q.A11 * y * y + q.A22 * z * z +
+		2.0 * (q.A01 * x * y + q.A02 * x * z + q.A12 * y * z) +
+		2.0 * (q.B0 * x + q.B1 * y + q.B2 * z) + q.C;
+
+	return q.Weight > 0.0 ? static_cast<float>(sqrt((max)(error, 0.0) / q.Weight)) : 0.0f;
+}
+
+void MeshSimplifier::addQuadric(Quadric& dst, const Quadric& src)
+{
+	dst.A00 += src.A00;
+	dst.A01 += src.A01;
+	dst.A02 += src.A02;
+	dst.A11 += src.A11;
+	dst.A12 += src.A12;
+	dst.A22 += src.A22;
+	dst.B0 += src.B0;
+	dst.B1 += src.B1;
+	dst.B2 += src.B2;
+	dst.C += src.C;
+	dst.Weight += src.Weight;
+}
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cfloat>
+
+namespace XUSG
+{
+	// Quadric-error-metric simplifier of indexed triangle lists. Edges are collapsed onto one
+	// of their end vertices, so every simplified level indexes the original vertex buffer.
+	// Border and non-manifold vertices are locked, and collapses that pinch the surface or
+	// fold triangles over are rejected, so that closed meshes stay closed. The working
+	// buffers are kept between calls, so a reused simplifier does not allocate once warm.
+	class MeshSimplifier
+	{
+	public:
+		MeshSimplifier();
+		virtual ~MeshSimplifier();
+
+		// Positions are 3 floats at the start of each element of the given byte stride.
+		void Init(const void* pPositions, uint32_t stride, uint32_t numVertices);
+
+		// Simplifies the triangles in place toward the target index count, without exceeding
+		// the max error; returns the largest error of the collapses made, in object units.
+		float Simplify(std::vector<uint32_t>& indices, uint32_t targetNumIndices, float maxError = FLT_MAX);
+
+	protected:
+		struct Quadric
+		{
+			double A00, A01, A02, A11, A12, A22;	// Symmetric 3x3 part
+			double B0, B1, B2;
+			double C;
+			double Weight;	// Total triangle area, for an error in object units
+		};
+
+		struct Collapse
+		{
+			uint32_t	Source;
+			uint32_t	Target;
+			float		Error;
+		};
+
+		void buildAdjacency(const std::vector<uint32_t>& indices);
+		void computeQuadrics(const std::vector<uint32_t>& indices);
+		void lockBorders(const std::vector<uint32_t>& indices);
+		bool isValidCollapse(const std::vector<uint32_t>& indices, uint32_t source, uint32_t target) const;
+		float getError(uint32_t source, uint32_t target) const;
+
+		static void addQuadric(Quadric& dst, const Quadric& src);
+
+		std::vector<float>		m_positions;	// Packed xyz
+		std::vector<Quadric>	m_quadrics;
+		std::vector<uint8_t>	m_locked;
+		std::vector<uint32_t>	m_adjOffsets;	// Vertex-triangle adjacency (CSR)
+		std::vector<uint32_t>	m_adjTris;
+		std::vector<uint32_t>	m_cursors;
+		std::vector<Collapse>	m_collapses;
+		std::vector<uint32_t>	m_remap;
+		std::vector<uint8_t>	m_touched;
+		std::vector<std::pair<uint32_t, uint32_t>> m_edgeCounts;
+		uint32_t				m_numVertices;
+	};
+}
@@ -0,0 +1,198 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include "XUSGMeshletBuilder.h"
+
+using namespace std;
+using namespace XUSG;
+
+MeshletBuilder::MeshletBuilder() :
+	m_pPositions(nullptr),
+	m_stride(0)
+{
+}
+
+MeshletBuilder::~MeshletBuilder()
+{
+}
+
+uint32_t MeshletBuilder::Add(const uint32_t* pIndices, uint32_t numIndices, const void* pPositions,
+	uint32_t stride, uint32_t numVertices, uint32_t baseVertex, uint32_t maxVertices, uint32_t maxPrimitives)
+{
+	// Local vertex indices are packed in 8 bits.
+	maxVertices = (min)(maxVertices, 256u);
+	if (maxVertices < 3 || maxPrimitives < 1) return 0;
+
+	m_pPositions = reinterpret_cast<const uint8_t*>(pPositions);
+	m_stride = stride;
+
+	const auto numMeshlets = GetNumMeshlets();
+	vector<uint32_t> localIndices(numVertices, UINT32_MAX);
+	vector<uint32_t> vertices, primitives;
+	vertices.reserve(maxVertices);
+	primitives.reserve(maxPrimitives);
+
+	const auto flush = [&]()
+	{
+		if (primitives.empty()) return;
+		addMeshlet(vertices.data(), static_cast<uint32_t>(vertices.size()),
+			primitives.data(), static_cast<uint32_t>(primitives.size()), baseVertex);
+		for (const auto& vi : vertices) localIndices[vi] = UINT32_MAX;
+		vertices.clear();
+		primitives.clear();
+	};
+
+	for (auto i = 0u; i + 2 < numIndices; i += 3)
+	{
+		const auto pTri = &pIndices[i];
+		if (pTri[0] >= numVertices || pTri[1] >= numVertices || pTri[2] >= numVertices) continue;
+
+		// Start a new meshlet when the triangle does not fit.
+		auto numNewVertices = 0u;
+		for (uint8_t j = 0; j < 3; ++j)
+			if (localIndices[pTri[j]] == UINT32_MAX && (j < 1 || pTri[j] != pTri[0]) && (j < 2 || pTri[j] != pTri[1]))
+				++numNewVertices;
+		if (vertices.size() + numNewVertices > maxVertices || primitives.size() + 1 > maxPrimitives) flush();
+
+		uint32_t primitive = 0;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			auto& localIndex = localIndices[pTri[j]];
+			if (localIndex == UINT32_MAX)
+			{
+				localIndex = static_cast<uint32_t>(vertices.size());
+				vertices.emplace_back(pTri[j]);
+			}
+			primitive |= localIndex << (8 * j);
+		}
+		primitives.emplace_back(primitive);
+	}
+	flush();
+
+	return GetNumMeshlets() - numMeshlets;
+}
+
+void MeshletBuilder::Clear()
+{
+	m_meshlets.clear();
+	m_bounds.clear();
+	m_vertexIndices.clear();
+	m_primitives.clear();
+}
+
+uint32_t MeshletBuilder::GetNumMeshlets() const
+{
+	return static_cast<uint32_t>(m_meshlets.size());
+}
+
+uint32_t MeshletBuilder::GetNumVertexIndices() const
+{
+	return static_cast<uint32_t>(m_vertexIndices.size());
+}
+
+uint32_t MeshletBuilder::GetNumPrimitives() const
+{
+	return static_cast<uint32_t>(m_primitives.size());
+}
+
+const MeshletBuilder::Meshlet* MeshletBuilder::GetMeshlets() const
+{
+	return m_meshlets.data();
+}
+
+const MeshletBuilder::BoundingSphere* MeshletBuilder::GetBounds() const
+{
+	return m_bounds.data();
+}
+
+const uint32_t* MeshletBuilder::GetVertexIndices() const
+{
+	return m_vertexIndices.data();
+}
+
+const uint32_t* MeshletBuilder::GetPrimitives() const
+{
+	return m_primitives.data();
+}
+
+void MeshletBuilder::GetFrustumPlanes(float planes[6][4], const float viewProj[4][4])
+{
+	// Clip coordinate k of a point p is dot(p, column k); each plane is a column combination.
+	const auto getColumn = [&viewProj](uint8_t k, float sign, float (&column)[4])
+	{
+		for (uint8_t i = 0; i < 4; ++i) column[i] = sign * viewProj[i][k];
+	};
+
+	float w[4], c[4];
+	getColumn(3, 1.0f, w);
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		const auto axis = static_cast<uint8_t>(i / 2);
+		getColumn(axis, i & 1 ? -1.0f : 1.0f, c);
+		for (uint8_t j = 0; j < 4; ++j)
+		{
+			// Near plane is z >= 0 rather than z >= -w.
+			if (axis == 2 && !(i & 1)) planes[i][j] = c[j];
+			else planes[i][j] = w[j] + c[j];
+		}
+
+		const auto length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		if (length > 0.0f) for (uint8_t j = 0; j < 4; ++j) planes[i][j] /= length;
+	}
+}
+
+bool MeshletBuilder::IsSphereInFrustum(const float planes[6][4], const float center[3], float radius)
+{
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		const auto& plane = planes[i];
+		if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius) return false;
+	}
+
+	return true;
+}
+
+void MeshletBuilder::addMeshlet(const uint32_t* pVertices, uint32_t numVertices,
+	const uint32_t* pPrimitives, uint32_t numPrimitives, uint32_t baseVertex)
+{
+	Meshlet meshlet;
+	meshlet.VertexOffset = GetNumVertexIndices();
+	meshlet.VertexCount = numVertices;
+	meshlet.PrimitiveOffset = GetNumPrimitives();
+	meshlet.PrimitiveCount = numPrimitives;
+	m_meshlets.emplace_back(meshlet);
+
+	for (auto i = 0u; i < numVertices; ++i) m_vertexIndices.emplace_back(pVertices[i] + baseVertex);
+	m_primitives.insert(m_primitives.end(), pPrimitives, pPrimitives + numPrimitives);
+
+	// Sphere around the center of the AABB
+	float minVal[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maxVal[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (auto i = 0u; i < numVertices; ++i)
+	{
+		const auto p = getPosition(pVertices[i]);
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			minVal[j] = (min)(p[j], minVal[j]);
+			maxVal[j] = (max)(p[j], maxVal[j]);
+		}
+	}
+
+	BoundingSphere bound;
+	auto radiusSq = 0.0f;
+	for (uint8_t j = 0; j < 3; ++j) bound.Center[j] = (minVal[j] + maxVal[j]) / 2.0f;
+	for (auto i = 0u; i < numVertices; ++i)
+	{
+		const auto p = getPosition(pVertices[i]);
+		const float d[] = { p[0] - bound.Center[0], p[1] - bound.Center[1], p[2] - bound.Center[2] };
+		radiusSq = (max)(d[0] * d[0] + d[1] * d[1] + d[2] * d[2], radiusSq);
+	}
+	bound.Radius = sqrtf(radiusSq);
+	m_bounds.emplace_back(bound);
+}
+
+const float* MeshletBuilder::getPosition(uint32_t i) const
+{
+	return reinterpret_cast<const float*>(&m_pPositions[static_cast<size_t>(m_stride) * i]);
+}
@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Splits indexed triangle lists into meshlets for mesh shaders, and provides the cluster
+	// culling math shared with the amplification shader. Triangles are taken in index order,
+	// so vertex-cache optimized indices give compact meshlets.
+	class MeshletBuilder
+	{
+	public:
+		struct Meshlet
+		{
+			uint32_t	VertexOffset;		// Into the vertex indices
+			uint32_t	VertexCount;
+			uint32_t	PrimitiveOffset;	// Into the primitives
+			uint32_t	PrimitiveCount;
+		};
+
+		struct BoundingSphere
+		{
+			float		Center[3];
+			float		Radius;
+		};
+
+		MeshletBuilder();
+		virtual ~MeshletBuilder();
+
+		// Appends the meshlets of a triangle list and returns how many were added. Positions are
+		// 3 floats at the start of each element of the given byte stride; baseVertex is added to
+		// the stored vertex indices only.
+		uint32_t Add(const uint32_t* pIndices, uint32_t numIndices, const void* pPositions,
+			uint32_t stride, uint32_t numVertices, uint32_t baseVertex = 0,
+			uint32_t maxVertices = 64, uint32_t maxPrimitives = 124);
+		void Clear();
+
+		uint32_t GetNumMeshlets() const;
+		uint32_t GetNumVertexIndices() const;
+		uint32_t GetNumPrimitives() const;
+
+		const Meshlet* GetMeshlets() const;
+		const BoundingSphere* GetBounds() const;
+		const uint32_t* GetVertexIndices() const;
+		const uint32_t* GetPrimitives() const;	// Local vertex indices packed as 8:8:8
+
+		// Planes (a, b, c, d) of clip-space -w <= x, y <= w and 0 <= z <= w, for row vectors
+		// (p * viewProj) as in DirectXMath; normalized and facing inward.
+		static void GetFrustumPlanes(float planes[6][4], const float viewProj[4][4]);
+		static bool IsSphereInFrustum(const float planes[6][4], const float center[3], float radius);
+
+	protected:
+		void addMeshlet(const uint32_t* pVertices, uint32_t numVertices,
+			const uint32_t* pPrimitives, uint32_t numPrimitives, uint32_t baseVertex);
+
+		const float* getPosition(uint32_t i) const;
+
+		std::vector<Meshlet>		m_meshlets;
+		std::vector<BoundingSphere>	m_bounds;
+		std::vector<uint32_t>		m_vertexIndices;
+		std::vector<uint32_t>		m_primitives;
+
+		const uint8_t*				m_pPositions;
+		uint32_t					m_stride;
+	};
+}
@@ -2,12 +2,234 @@
 // Copyright (c) XU, Tianchen. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "XUSGObjLoader.h"
+#include "XUSGMeshSimplifier.h"
+#include "XUSGObjScanner.h"
+#include "XUSGParallel.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_MSC_VER)
+#define fscanf_s fscanf
+#define sscanf_s sscanf
+
+static inline int fopen_s(FILE** ppFile, const char* pszFilename, const char* mode)
+{
+	*ppFile = fopen(pszFilename, mode);
+
+	return *ppFile ? 0 : -1;
+}
+#endif
 
 using namespace std;
 using namespace XUSG;
 
-ObjLoader::ObjLoader()
+const uint32_t ObjLoader::MeshCacheVersion = 8;
+const uint32_t ObjLoader::VertexCacheSize = 32;
+
+struct MeshCacheHeader
+{
+	uint32_t		Magic;
+	uint32_t		Version;
+	uint64_t		SourceSize;
+	int64_t			SourceTime;
+	uint64_t		SourceHash;
+	uint64_t		ImportKey;
+	uint32_t		VertexStride;
+	uint32_t		NumVertices;
+	uint32_t		NumIndices;
+	uint32_t		NumVerticesBeforeWeld;
+	float			ACMRBefore;
+	float			ACMRAfter;
+	float			IndexDistanceBefore;
+	float			IndexDistanceAfter;
+	float			MaxPositionError;
+	float			MaxNormalError;
+	uint32_t		NumDegenerateTriangles;
+	uint32_t		NumDuplicateTriangles;
+	uint32_t		NumUnreferencedVertices;
+	uint32_t		NumNonManifoldEdges;
+	ObjLoader::AABB	AABB;
+	uint32_t		NumLODs;
+	ObjLoader::LOD	LODs[ObjLoader::MaxLODs];
+	uint64_t		VertexOffset;
+	uint64_t		IndexOffset;
+};
+
+static const uint32_t g_meshCacheMagic = 0x534d5653; // "SVMS"
+
+// Buffers are named after their use; stages that never overlap share them. Vertices and
+// Indices hold stage outputs, which are copied back into the loader's buffers.
+class ObjLoader::Scratch
+{
+public:
+	ObjData					Data;
+	vector<ObjData>			Chunks;			// Per-thread parser output
+	vector<const char*>		ChunkBounds;
+	SoAStream				Positions;
+	SoAStream				Normals;
+	vector<uint32_t>		TIndices;
+	vector<uint32_t>		NIndices;
+	vector<float3>			FaceNormals;
+	vector<uint32_t>		Table;			// Open-addressing hash tables
+	vector<uint32_t>		Remap;
+	vector<uint32_t>		Counts;
+	vector<uint32_t>		Offsets;		// Vertex-triangle adjacency (CSR)
+	vector<uint32_t>		Adjacency;
+	vector<uint32_t>		Cursors;
+	vector<uint32_t>		Keys;
+	vector<uint64_t>		Hashes;
+	vector<uint64_t>		SortItems;		// Radix sort buffers
+	vector<uint64_t>		SortTemp;
+	vector<uint32_t>		Histograms;
+	vector<uint8_t>			Flags;
+	vector<int32_t>			CachePositions;
+	vector<float>			VertexScores;
+	vector<float>			TriangleScores;
+	vector<uint32_t>		Indices;
+	vector<uint8_t>			Vertices;
+	vector<uint32_t>		LODIndices;
+	vector<uint32_t>		LevelIndices;
+	MeshSimplifier			Simplifier;
+};
+
+static inline int seekFile(FILE* pFile, uint64_t offset)
+{
+#if defined(_MSC_VER)
+	return _fseeki64(pFile, static_cast<int64_t>(offset), SEEK_SET);
+#else
+	return fseeko(pFile, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+// Writes streamed vertices and indices straight into their sections of a mesh cache file.
+class MeshCacheSink : public ObjLoader::Sink
+{
+public:
+	MeshCacheSink(const string& fileName, const MeshCacheHeader& header, const ObjLoader& loader) :
+		m_fileName(fileName),
+		m_header(header),
+		m_loader(loader),
+		m_pFile(nullptr),
+		m_vertexCursor(0),
+		m_indexCursor(0)
+	{
+	}
+
+	virtual ~MeshCacheSink()
+	{
+		if (m_pFile)
+		{
+			fclose(m_pFile);
+			remove(m_fileName.c_str());
+		}
+	}
+
+	virtual bool Begin(uint32_t vertexStride, uint32_t numVertices, uint32_t numIndices, const ObjLoader::AABB& aabb)
+	{
+		const uint64_t alignment = 16;
+		m_header.Magic = g_meshCacheMagic;
+		m_header.Version = ObjLoader::MeshCacheVersion;
+		m_header.VertexStride = vertexStride;
+		m_header.NumVertices = numVertices;
+		m_header.NumIndices = numIndices;
+		m_header.AABB = aabb;
+		m_header.NumLODs = 1;
+		m_header.LODs[0] = { 0, numIndices, 0.0f };
+		m_header.VertexOffset = (sizeof(m_header) + alignment - 1) / alignment * alignment;
+		m_header.IndexOffset = (m_header.VertexOffset + static_cast<uint64_t>(vertexStride) * numVertices +
+			alignment - 1) / alignment * alignment;
+		m_vertexCursor = m_header.VertexOffset;
+		m_indexCursor = m_header.IndexOffset;
+
+		fopen_s(&m_pFile, m_fileName.c_str(), "wb");
+
+		return m_pFile != nullptr;
+	}
+
+	virtual bool WriteVertices(const uint8_t* pData, uint32_t numVertices)
+	{
+		const auto size = static_cast<size_t>(m_header.VertexStride) * numVertices;
+		const auto success = write(m_vertexCursor, pData, size);
+		m_vertexCursor += size;
+
+		return success;
+	}
+
+	virtual bool WriteIndices(const uint32_t* pData, uint32_t numIndices)
+	{
+		const auto size = sizeof(uint32_t) * numIndices;
+		const auto success = write(m_indexCursor, pData, size);
+		m_indexCursor += size;
+
+		return success;
+	}
+
+	virtual bool End()
+	{
+		// The header goes last, once the statistics are final.
+		const auto& stats = m_loader.GetImportStats();
+		m_header.NumVerticesBeforeWeld = stats.NumVerticesBeforeWeld;
+		m_header.MaxPositionError = stats.MaxPositionError;
+		m_header.MaxNormalError = stats.MaxNormalError;
+
+		auto success = m_vertexCursor == m_header.VertexOffset + static_cast<uint64_t>(m_header.VertexStride) * m_header.NumVertices;
+		success = success && m_indexCursor == m_header.IndexOffset + sizeof(uint32_t) * static_cast<uint64_t>(m_header.NumIndices);
+		success = success && write(0, &m_header, sizeof(m_header));
+		success = fclose(m_pFile) == 0 && success;
+		m_pFile = nullptr;
+
+		if (!success) remove(m_fileName.c_str());
+
+		return success;
+	}
+
+protected:
+	bool write(uint64_t offset, const void* pData, size_t size)
+	{
+		return !seekFile(m_pFile, offset) && fwrite(pData, 1, size, m_pFile) == size;
+	}
+
+	string				m_fileName;
+	MeshCacheHeader		m_header;
+	const ObjLoader&	m_loader;
+	FILE*				m_pFile;
+	uint64_t			m_vertexCursor;
+	uint64_t			m_indexCursor;
+};
+
+ObjLoader::ObjLoader() :
+	m_stride(0),
+	m_aabb(),
+	m_needAABB(true),
+	m_parser(PARSER_MAPPED),
+	m_numThreads(1),
+	m_useMeshCache(false),
+	m_weldVertices(false),
+	m_weldTolerance(0.0f),
+	m_optimizeIndices(false),
+	m_vertexLayout(VERTEX_LAYOUT_INTERLEAVED),
+	m_quantize(false),
+	m_streaming(false),
+	m_generateLODs(false),
+	m_cleanupMesh(false),
+	m_reorderTriangles(false),
+	m_importStats(),
+	m_scratch(nullptr),
+	m_pCachedVertices(nullptr),
+	m_pCachedIndices(nullptr),
+	m_numCachedVertices(0),
+	m_numCachedIndices(0)
 {
 }
 
@@ -15,8 +237,578 @@ ObjLoader::~ObjLoader()
 {
 }
 
-bool ObjLoader::Import(const char* pszFilename, bool needNorm, bool needAABB, bool forDX, bool swapYZ)
+bool ObjLoader::Import(const char* pszFilename, bool needNorm, bool needAABB, bool forDX, bool swapYZ)
+{
+	const auto startTime = chrono::steady_clock::now();
+	m_importStats = {};
+	m_vertices.clear();
+	m_indices.clear();
+	m_lods.clear();
+	m_meshCache.reset();
+	m_pCachedVertices = nullptr;
+	m_pCachedIndices = nullptr;
+	m_numCachedVertices = 0;
+	m_numCachedIndices = 0;
+	if (!m_scratch) m_scratch = MakeScratch();
+
+	// Try the binary mesh cache first.
+	SourceInfo source = {};
+	string cacheName;
+	const auto importKey = getImportKey(needNorm, needAABB, forDX, swapYZ);
+	if (m_useMeshCache || m_streaming)
+	{
+#if defined(WIN32) || defined(_WIN32)
+		struct _stat64 st;
+		if (_stat64(pszFilename, &st)) return false;
+#else
+		struct stat st;
+		if (stat(pszFilename, &st)) return false;
+#endif
+		source.Size = static_cast<uint64_t>(st.st_size);
+		source.Time = static_cast<int64_t>(st.st_mtime);
+
+		// One cache per set of import options, so that apps importing the same file differently
+		// do not overwrite each other's cache.
+		char keyName[20];
+		snprintf(keyName, sizeof(keyName), ".%016llx", static_cast<unsigned long long>(importKey));
+		cacheName = string(pszFilename) + keyName + ".svmesh";
+
+		if (m_useMeshCache && loadMeshCache(cacheName, pszFilename, source, importKey))
+		{
+			m_importStats.CacheHit = true;
+			m_importStats.ImportTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+			return true;
+		}
+	}
+
+	// Stream out of core into the cache file and map the result.
+	if (m_streaming && supportsStreaming())
+	{
+		MeshCacheHeader header = {};
+		header.SourceSize = source.Size;
+		header.SourceTime = source.Time;
+		header.ImportKey = importKey;
+		if (!hashFile(pszFilename, header.SourceHash)) return false;
+
+		MeshCacheSink sink(cacheName, header, *this);
+		if (!ImportStreaming(pszFilename, &sink, forDX, swapYZ)) return false;
+		const auto importStats = m_importStats;
+		if (!loadMeshCache(cacheName, pszFilename, source, importKey)) return false;
+
+		m_importStats = importStats;
+		m_importStats.ImportTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+		return true;
+	}
+
+	// Import the mesh file. Triangle reordering, LODs, and quantization need the AABB anyway.
+	m_aabb = {};
+	m_needAABB = needAABB || m_reorderTriangles || m_generateLODs || m_quantize;
+	uint32_t numNorm;
+	if (!importFile(pszFilename, needNorm, forDX, swapYZ, numNorm)) return false;
+
+	// Perform post import tasks. Importers of unindexed formats weld on their own and
+	// report the count before welding.
+	const auto isWelded = m_importStats.NumVerticesBeforeWeld > 0;
+	if (needNorm && !numNorm) recomputeNormals();
+	if (!isWelded) m_importStats.NumVerticesBeforeWeld = GetNumVertices();
+	if (m_weldVertices && !isWelded) weldVertices();
+	m_importStats.NumVerticesAfterWeld = GetNumVertices();
+	if (m_cleanupMesh) cleanupMesh();
+	m_importStats.ACMRBefore = computeACMR(m_indices.data(), GetNumIndices(), GetNumVertices(), VertexCacheSize, m_scratch->Counts);
+	m_importStats.IndexDistanceBefore = computeIndexDistance(m_indices.data(), GetNumIndices());
+	if (m_reorderTriangles) reorderTriangles();
+	if (m_optimizeIndices) optimizeVertexCache(m_indices);
+	if (m_reorderTriangles || m_optimizeIndices) optimizeVertexFetch();
+	m_importStats.ACMRAfter = computeACMR(m_indices.data(), GetNumIndices(), GetNumVertices(), VertexCacheSize, m_scratch->Counts);
+	m_importStats.IndexDistanceAfter = computeIndexDistance(m_indices.data(), GetNumIndices());
+	m_lods.assign(1, { 0, GetNumIndices(), 0.0f });
+	if (m_generateLODs)
+	{
+		const auto lodStartTime = chrono::steady_clock::now();
+		generateLODs();
+		m_importStats.LODTime = chrono::duration<double>(chrono::steady_clock::now() - lodStartTime).count();
+	}
+	if (m_quantize) quantizeVertices();
+	if (m_vertexLayout == VERTEX_LAYOUT_SPLIT) splitVertexStreams();
+
+	if (m_useMeshCache) writeMeshCache(cacheName, pszFilename, source, importKey);
+
+	m_importStats.ImportTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	return true;
+}
+
+const uint32_t ObjLoader::GetNumVertices() const
+{
+	return m_pCachedVertices ? m_numCachedVertices : static_cast<uint32_t>(m_vertices.size() / GetVertexStride());
+}
+
+const uint32_t ObjLoader::GetNumIndices() const
+{
+	return m_pCachedIndices ? m_numCachedIndices : static_cast<uint32_t>(m_indices.size());
+}
+
+const uint32_t ObjLoader::GetVertexStride() const
+{
+	return m_stride;
+}
+
+const uint8_t* ObjLoader::GetVertices() const
+{
+	return m_pCachedVertices ? m_pCachedVertices : m_vertices.data();
+}
+
+const uint32_t* ObjLoader::GetIndices() const
+{
+	return m_pCachedIndices ? m_pCachedIndices : m_indices.data();
+}
+
+const uint8_t* ObjLoader::GetPositions() const
+{
+	return GetVertices();
+}
+
+const uint8_t* ObjLoader::GetAttributes() const
+{
+	return m_vertexLayout == VERTEX_LAYOUT_SPLIT ? GetVertices() + getPositionSize() * GetNumVertices() : GetVertices() + getPositionSize();
+}
+
+const uint32_t ObjLoader::GetPositionStride() const
+{
+	return m_vertexLayout == VERTEX_LAYOUT_SPLIT ? getPositionSize() : GetVertexStride();
+}
+
+const uint32_t ObjLoader::GetAttributeStride() const
+{
+	return m_vertexLayout == VERTEX_LAYOUT_SPLIT ? GetVertexStride() - getPositionSize() : GetVertexStride();
+}
+
+const bool ObjLoader::IsQuantized() const
+{
+	return m_quantize;
+}
+
+const ObjLoader::float3 ObjLoader::GetDequantizationScale() const
+{
+	// Half extents of the AABB; flat axes keep a unit scale.
+	const auto getScale = [](float minVal, float maxVal) { return maxVal > minVal ? (maxVal - minVal) / 2.0f : 1.0f; };
+
+	return float3(getScale(m_aabb.Min.x, m_aabb.Max.x), getScale(m_aabb.Min.y, m_aabb.Max.y), getScale(m_aabb.Min.z, m_aabb.Max.z));
+}
+
+const ObjLoader::float3 ObjLoader::GetDequantizationBias() const
+{
+	return float3((m_aabb.Min.x + m_aabb.Max.x) / 2.0f, (m_aabb.Min.y + m_aabb.Max.y) / 2.0f, (m_aabb.Min.z + m_aabb.Max.z) / 2.0f);
+}
+
+const uint32_t ObjLoader::GetNumLODs() const
+{
+	return static_cast<uint32_t>(m_lods.size());
+}
+
+const ObjLoader::LOD* ObjLoader::GetLODs() const
+{
+	return m_lods.data();
+}
+
+const ObjLoader::AABB& ObjLoader::GetAABB() const
+{
+	return m_aabb;
+}
+
+const ObjLoader::ImportStats& ObjLoader::GetImportStats() const
+{
+	return m_importStats;
+}
+
+void ObjLoader::SetParser(Parser parser)
+{
+	m_parser = parser;
+}
+
+void ObjLoader::SetNumThreads(uint32_t numThreads)
+{
+	m_numThreads = numThreads;
+}
+
+void ObjLoader::SetMeshCache(bool enable)
+{
+	m_useMeshCache = enable;
+}
+
+void ObjLoader::SetVertexWelding(bool enable, float tolerance)
+{
+	m_weldVertices = enable;
+	m_weldTolerance = (max)(tolerance, 0.0f);
+}
+
+void ObjLoader::SetIndexOptimization(bool enable)
+{
+	m_optimizeIndices = enable;
+}
+
+void ObjLoader::SetVertexLayout(VertexLayout layout)
+{
+	m_vertexLayout = layout;
+}
+
+void ObjLoader::SetQuantization(bool enable)
+{
+	m_quantize = enable;
+}
+
+void ObjLoader::SetStreaming(bool enable)
+{
+	m_streaming = enable;
+}
+
+void ObjLoader::SetLODChain(bool enable)
+{
+	m_generateLODs = enable;
+}
+
+void ObjLoader::SetMeshCleanup(bool enable)
+{
+	m_cleanupMesh = enable;
+}
+
+void ObjLoader::SetTriangleReordering(bool enable)
+{
+	m_reorderTriangles = enable;
+}
+
+void ObjLoader::SetScratch(const shared_ptr<Scratch>& scratch)
+{
+	m_scratch = scratch;
+}
+
+float ObjLoader::ComputeACMR(const uint32_t* pIndices, uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize)
+{
+	vector<uint32_t> timestamps;
+
+	return computeACMR(pIndices, numIndices, numVertices, cacheSize, timestamps);
+}
+
+shared_ptr<ObjLoader::Scratch> ObjLoader::MakeScratch()
+{
+	return make_shared<Scratch>();
+}
+
+double ObjLoader::ImportStats::GetBytesPerSecond() const
+{
+	return ImportTime > 0.0 ? NumBytes / ImportTime : 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+// Memory-mapped file
+//--------------------------------------------------------------------------------------
+
+ObjLoader::MappedFile::MappedFile() :
+	m_pData(nullptr),
+	m_size(0),
+#if defined(WIN32) || defined(_WIN32)
+	m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(nullptr)
+#else
+	m_fd(-1)
+#endif
+{
+}
+
+ObjLoader::MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool ObjLoader::MappedFile::Open(const char* pszFilename)
+{
+	Close();
+
+#if defined(WIN32) || defined(_WIN32)
+	m_hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0) return false;
+	m_size = static_cast<uint64_t>(size.QuadPart);
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_hMapping) return false;
+
+	m_pData = static_cast<const char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	m_fd = open(pszFilename, O_RDONLY);
+	if (m_fd < 0) return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) || st.st_size <= 0) return false;
+	m_size = static_cast<uint64_t>(st.st_size);
+
+	const auto pData = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (pData == MAP_FAILED) return false;
+	madvise(pData, m_size, MADV_SEQUENTIAL);
+	m_pData = static_cast<const char*>(pData);
+#endif
+
+	return m_pData != nullptr;
+}
+
+void ObjLoader::MappedFile::Close()
+{
+#if defined(WIN32) || defined(_WIN32)
+	if (m_pData) UnmapViewOfFile(m_pData);
+	if (m_hMapping) CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData) munmap(const_cast<char*>(m_pData), m_size);
+	if (m_fd >= 0) close(m_fd);
+	m_fd = -1;
+#endif
+	m_pData = nullptr;
+	m_size = 0;
+}
+
+const char* ObjLoader::MappedFile::GetData() const
+{
+	return m_pData;
+}
+
+uint64_t ObjLoader::MappedFile::GetSize() const
+{
+	return m_size;
+}
+
+//--------------------------------------------------------------------------------------
+// Binary mesh cache
+//--------------------------------------------------------------------------------------
+
+static uint64_t hashData(const char* pData, uint64_t size)
+{
+	const uint64_t prime = 0x100000001b3ull;
+	auto h = 0xcbf29ce484222325ull ^ size;
+
+	const auto numWords = size / sizeof(uint64_t);
+	for (uint64_t i = 0; i < numWords; ++i)
+	{
+		uint64_t word;
+		memcpy(&word, &pData[sizeof(uint64_t) * i], sizeof(uint64_t));
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	}
+
+	for (auto i = sizeof(uint64_t) * numWords; i < size; ++i)
+		h = (h ^ static_cast<uint8_t>(pData[i])) * prime;
+
+	return h;
+}
+
+float ObjLoader::computeACMR(const uint32_t* pIndices, uint32_t numIndices, uint32_t numVertices,
+	uint32_t cacheSize, vector<uint32_t>& timestamps)
+{
+	if (numIndices < 3) return 0.0f;
+
+	// FIFO cache: a vertex hits while fewer than cacheSize misses happened since it was loaded.
+	timestamps.assign(numVertices, 0);
+	auto numMisses = 0u;
+	for (auto i = 0u; i < numIndices; ++i)
+	{
+		const auto vi = pIndices[i];
+		if (timestamps[vi] == 0 || numMisses + 1 - timestamps[vi] > cacheSize)
+			timestamps[vi] = ++numMisses;
+	}
+
+	return static_cast<float>(numMisses) / (numIndices / 3);
+}
+
+float ObjLoader::computeIndexDistance(const uint32_t* pIndices, uint32_t numIndices)
+{
+	if (numIndices < 2) return 0.0f;
+
+	uint64_t distance = 0;
+	for (auto i = 1u; i < numIndices; ++i)
+		distance += pIndices[i] > pIndices[i - 1] ? pIndices[i] - pIndices[i - 1] : pIndices[i - 1] - pIndices[i];
+
+	return static_cast<float>(static_cast<double>(distance) / (numIndices - 1));
+}
+
+bool ObjLoader::hashFile(const char* pszFilename, uint64_t& hash)
+{
+	MappedFile file;
+	if (!file.Open(pszFilename)) return false;
+	hash = hashData(file.GetData(), file.GetSize());
+
+	return true;
+}
+
+bool ObjLoader::loadMeshCache(const string& cacheName, const char* pszFilename,
+	const SourceInfo& source, uint64_t importKey)
+{
+	unique_ptr<MappedFile> cache(new MappedFile);
+	if (!cache->Open(cacheName.c_str())) return false;
+
+	// Validate the header against the source file and the import options.
+	if (cache->GetSize() < sizeof(MeshCacheHeader)) return false;
+	const auto& header = *reinterpret_cast<const MeshCacheHeader*>(cache->GetData());
+	if (header.Magic != g_meshCacheMagic || header.Version != MeshCacheVersion) return false;
+	if (header.SourceSize != source.Size || header.SourceTime != source.Time) return false;
+	if (header.ImportKey != importKey || header.VertexStride == 0) return false;
+	if (header.VertexOffset + static_cast<uint64_t>(header.VertexStride) * header.NumVertices > cache->GetSize()) return false;
+	if (header.IndexOffset + sizeof(uint32_t) * static_cast<uint64_t>(header.NumIndices) > cache->GetSize()) return false;
+	if (header.NumLODs == 0 || header.NumLODs > MaxLODs) return false;
+	for (auto i = 0u; i < header.NumLODs; ++i)
+		if (static_cast<uint64_t>(header.LODs[i].StartIndex) + header.LODs[i].NumIndices > header.NumIndices) return false;
+
+	uint64_t sourceHash;
+	if (!hashFile(pszFilename, sourceHash) || header.SourceHash != sourceHash) return false;
+
+	// Point straight into the mapped file.
+	const auto pData = reinterpret_cast<const uint8_t*>(cache->GetData());
+	m_stride = header.VertexStride;
+	m_aabb = header.AABB;
+	m_numCachedVertices = header.NumVertices;
+	m_numCachedIndices = header.NumIndices;
+	m_lods.assign(header.LODs, header.LODs + header.NumLODs);
+	m_importStats.NumVerticesBeforeWeld = header.NumVerticesBeforeWeld;
+	m_importStats.NumVerticesAfterWeld = header.NumVertices;
+	m_importStats.ACMRBefore = header.ACMRBefore;
+	m_importStats.ACMRAfter = header.ACMRAfter;
+	m_importStats.IndexDistanceBefore = header.IndexDistanceBefore;
+	m_importStats.IndexDistanceAfter = header.IndexDistanceAfter;
+	m_importStats.MaxPositionError = header.MaxPositionError;
+	m_importStats.MaxNormalError = header.MaxNormalError;
+	m_importStats.NumDegenerateTriangles = header.NumDegenerateTriangles;
+	m_importStats.NumDuplicateTriangles = header.NumDuplicateTriangles;
+	m_importStats.NumUnreferencedVertices = header.NumUnreferencedVertices;
+	m_importStats.NumNonManifoldEdges = header.NumNonManifoldEdges;
+	m_pCachedVertices = pData + header.VertexOffset;
+	m_pCachedIndices = reinterpret_cast<const uint32_t*>(pData + header.IndexOffset);
+	m_importStats.NumBytes = cache->GetSize();
+	m_meshCache = move(cache);
+
+	return true;
+}
+
+bool ObjLoader::writeMeshCache(const string& cacheName, const char* pszFilename,
+	const SourceInfo& source, uint64_t importKey) const
+{
+	const uint64_t alignment = 16;
+	const auto vertexBytes = static_cast<uint64_t>(GetVertexStride()) * GetNumVertices();
+
+	MeshCacheHeader header = {};
+	header.Magic = g_meshCacheMagic;
+	header.Version = MeshCacheVersion;
+	header.SourceSize = source.Size;
+	header.SourceTime = source.Time;
+	header.ImportKey = importKey;
+	header.VertexStride = GetVertexStride();
+	header.NumVertices = GetNumVertices();
+	header.NumIndices = GetNumIndices();
+	header.NumVerticesBeforeWeld = m_importStats.NumVerticesBeforeWeld;
+	header.ACMRBefore = m_importStats.ACMRBefore;
+	header.ACMRAfter = m_importStats.ACMRAfter;
+	header.IndexDistanceBefore = m_importStats.IndexDistanceBefore;
+	header.IndexDistanceAfter = m_importStats.IndexDistanceAfter;
+	header.MaxPositionError = m_importStats.MaxPositionError;
+	header.MaxNormalError = m_importStats.MaxNormalError;
+	header.NumDegenerateTriangles = m_importStats.NumDegenerateTriangles;
+	header.NumDuplicateTriangles = m_importStats.NumDuplicateTriangles;
+	header.NumUnreferencedVertices = m_importStats.NumUnreferencedVertices;
+	header.NumNonManifoldEdges = m_importStats.NumNonManifoldEdges;
+	header.AABB = m_aabb;
+	header.NumLODs = GetNumLODs();
+	memcpy(header.LODs, GetLODs(), sizeof(LOD) * header.NumLODs);
+	header.VertexOffset = (sizeof(header) + alignment - 1) / alignment * alignment;
+	header.IndexOffset = (header.VertexOffset + vertexBytes + alignment - 1) / alignment * alignment;
+	if (!hashFile(pszFilename, header.SourceHash)) return false;
+
+	FILE* pFile;
+	fopen_s(&pFile, cacheName.c_str(), "wb");
+	if (!pFile) return false;
+
+	const uint8_t padding[alignment] = {};
+	const size_t padding0 = header.VertexOffset - sizeof(header);
+	const size_t padding1 = header.IndexOffset - header.VertexOffset - vertexBytes;
+	auto success = fwrite(&header, sizeof(header), 1, pFile) == 1;
+	success = success && fwrite(padding, 1, padding0, pFile) == padding0;
+	success = success && fwrite(GetVertices(), 1, vertexBytes, pFile) == vertexBytes;
+	success = success && fwrite(padding, 1, padding1, pFile) == padding1;
+	success = success && fwrite(GetIndices(), sizeof(uint32_t), GetNumIndices(), pFile) == GetNumIndices();
+	fclose(pFile);
+
+	if (!success) remove(cacheName.c_str());
+
+	return success;
+}
+
+uint64_t ObjLoader::getImportKey(bool needNorm, bool needAABB, bool forDX, bool swapYZ) const
+{
+	uint64_t key = 0;
+	key |= needNorm ? (1 << 0) : 0;
+	key |= needAABB ? (1 << 1) : 0;
+	key |= forDX ? (1 << 2) : 0;
+	key |= swapYZ ? (1 << 3) : 0;
+	key |= m_weldVertices ? (1 << 4) : 0;
+	key |= m_optimizeIndices ? (1 << 5) : 0;
+	key |= m_vertexLayout == VERTEX_LAYOUT_SPLIT ? (1 << 6) : 0;
+	key |= m_quantize ? (1 << 7) : 0;
+	key |= m_streaming ? (1 << 8) : 0;
+	key |= m_generateLODs ? (1 << 9) : 0;
+	key |= m_cleanupMesh ? (1 << 10) : 0;
+	key |= m_reorderTriangles ? (1 << 11) : 0;
+
+	if (m_weldVertices)
+	{
+		uint32_t tolerance;
+		memcpy(&tolerance, &m_weldTolerance, sizeof(tolerance));
+		key |= static_cast<uint64_t>(tolerance) << 32;
+	}
+
+	return key;
+}
+
+//--------------------------------------------------------------------------------------
+// Single-pass tokenizer
+//--------------------------------------------------------------------------------------
+
+static inline bool isIndexStart(char c)
+{
+	return ObjScanner::IsDigit(c) || c == '-' || c == '+';
+}
+
+static inline int scanToken(FILE* pFile, char (&buffer)[256])
+{
+#if defined(_MSC_VER)
+	return fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer)));
+#else
+	return fscanf(pFile, "%255s", buffer);
+#endif
+}
+
+static inline uint32_t resolveIndex(int64_t i, size_t count)
+{
+	return static_cast<uint32_t>(i < 0 ? i + static_cast<int64_t>(count) : i - 1);
+}
+
+bool ObjLoader::importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm)
+{
+	return m_parser == PARSER_MAPPED ? importMapped(pszFilename, needNorm, forDX, swapYZ, numNorm) :
+		importStdio(pszFilename, needNorm, forDX, swapYZ, numNorm);
+}
+
+bool ObjLoader::supportsStreaming() const
+{
+	return true;
+}
+
+bool ObjLoader::importStdio(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm)
 {
+	const auto startTime = chrono::steady_clock::now();
+
 	FILE* pFile;
 	fopen_s(&pFile, pszFilename, "r");
 
@@ -26,47 +818,261 @@ bool ObjLoader::Import(const char* pszFilename, bool needNorm, bool needAABB, bo
 	m_stride += needNorm ? sizeof(float3) : 0;
 
 	// Import the OBJ file.
-	uint32_t numTexc, numNorm;
+	uint32_t numTexc;
 	importGeometryFirstPass(pFile, numTexc, numNorm);
 	rewind(pFile);
 	importGeometrySecondPass(pFile, numTexc, numNorm, forDX, swapYZ);
+	fseek(pFile, 0, SEEK_END);
+	m_importStats.NumBytes = static_cast<uint64_t>(ftell(pFile));
 	fclose(pFile);
 
-	// Perform post import tasks.
-	if (needNorm && !numNorm) recomputeNormals();
-	if (needAABB) computeAABB();
+	m_importStats.ParseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
 
 	return true;
 }
 
-const uint32_t ObjLoader::GetNumVertices() const
+bool ObjLoader::importMapped(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm)
 {
-	return static_cast<uint32_t>(m_vertices.size() / GetVertexStride());
+	const auto startTime = chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(pszFilename)) return false;
+
+	// Tokenize the whole file in one pass into growable buffers.
+	auto& objData = m_scratch->Data;
+	objData.Clear();
+	const auto pData = file.GetData();
+	parseMapped(pData, pData + file.GetSize(), objData);
+	m_importStats.NumBytes = file.GetSize();
+	file.Close();
+
+	m_importStats.ParseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	numNorm = static_cast<uint32_t>(objData.Normals.GetSize());
+	m_stride = sizeof(float3);
+	m_stride += needNorm ? sizeof(float3) : 0;
+	loadMappedData(objData, forDX, swapYZ);
+
+	return true;
 }
 
-const uint32_t ObjLoader::GetNumIndices() const
+void ObjLoader::parseMapped(const char* pData, const char* pEnd, ObjData& objData)
 {
-	return static_cast<uint32_t>(m_indices.size());
+	// Split the file at line boundaries.
+	const auto size = static_cast<size_t>(pEnd - pData);
+	const auto numThreads = getNumThreads();
+	const auto numChunks = static_cast<uint32_t>((min)(static_cast<size_t>(numThreads), size / 4096 + 1));
+
+	auto& bounds = m_scratch->ChunkBounds;
+	bounds.resize(numChunks + 1);
+	bounds[0] = pData;
+	bounds[numChunks] = pEnd;
+	for (auto i = 1u; i < numChunks; ++i)
+		bounds[i] = (max)(bounds[i - 1], ObjScanner::SkipLine(pData + size * i / numChunks, pEnd));
+
+	if (numChunks <= 1)
+	{
+		parseMappedChunk(pData, pEnd, objData);
+		objData.RelIndices.clear();
+		objData.RelNIndices.clear();
+
+		// Faces without normal references still get their UINT32_MAX slots when the file has normals.
+		if (objData.Normals.GetSize()) objData.NIndices.resize(objData.Indices.size(), UINT32_MAX);
+		else objData.NIndices.clear();
+
+		return;
+	}
+
+	// Parse the chunks on worker threads, the first one on the calling thread.
+	auto& chunks = m_scratch->Chunks;
+	chunks.resize(numChunks);
+	vector<thread> workers;
+	workers.reserve(numChunks - 1);
+	for (auto i = 1u; i < numChunks; ++i)
+		workers.emplace_back(&ObjLoader::parseMappedChunk, this, bounds[i], bounds[i + 1], ref(chunks[i]));
+	parseMappedChunk(bounds[0], bounds[1], chunks[0]);
+	for (auto& worker : workers) worker.join();
+
+	mergeChunks(chunks, objData);
 }
 
-const uint32_t ObjLoader::GetVertexStride() const
+void ObjLoader::parseMappedChunk(const char* p, const char* pEnd, ObjData& objData)
 {
-	return m_stride;
+	objData.NumTexc = 0;
+
+	// Values are stored as written; the coordinate-system conversion runs on the merged streams.
+	const auto loadFloat3 = [&](const char* p, SoAStream& stream)
+	{
+		float x, y, z;
+		p = ObjScanner::ParseFloat(p, pEnd, x);
+		p = ObjScanner::ParseFloat(p, pEnd, y);
+		p = ObjScanner::ParseFloat(p, pEnd, z);
+		stream.PushBack(x, y, z);
+	};
+
+	while (p < pEnd)
+	{
+		p = ObjScanner::SkipBlanks(p, pEnd);
+		const auto key = p < pEnd ? *p : '\0';
+		const auto key1 = p + 1 < pEnd ? p[1] : '\0';
+		const auto key2 = p + 2 < pEnd ? p[2] : '\0';
+
+		if (key == 'v' && ObjScanner::IsBlank(key1)) // v
+		{
+			loadFloat3(p + 1, objData.Positions);
+		}
+		else if (key == 'v' && key1 == 'n' && ObjScanner::IsBlank(key2)) // vn
+		{
+			loadFloat3(p + 2, objData.Normals);
+		}
+		else if (key == 'v' && key1 == 't' && ObjScanner::IsBlank(key2)) ++objData.NumTexc; // vt
+		else if (key == 'f' && ObjScanner::IsBlank(key1)) // v, v//vn, v/vt, or v/vt/vn.
+		{
+			const auto numVert = objData.Positions.GetSize();
+			const auto numNorm = objData.Normals.GetSize();
+			uint32_t v[3] = { 0 };
+			uint32_t vn[3] = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
+			bool isRel[3] = { false }, isRelN[3] = { false };
+
+			auto n = 0u;
+			for (++p; ; ++n)
+			{
+				int64_t vi, vti, vni;
+				p = ObjScanner::SkipBlanks(p, pEnd);
+				if (p >= pEnd || !isIndexStart(*p)) break;
+
+				const auto i = (min)(n, 2u);
+				const auto mask = ObjScanner::ParseIndexTriplet(p, pEnd, vi, vti, vni); // vt is not stored
+				v[i] = resolveIndex(vi, numVert);
+				vn[i] = mask & ObjScanner::INDEX_VN ? resolveIndex(vni, numNorm) : UINT32_MAX;
+				isRel[i] = vi < 0;
+				isRelN[i] = (mask & ObjScanner::INDEX_VN) && vni < 0;
+				while (p < pEnd && !ObjScanner::IsSeparator(*p)) ++p;
+
+				if (n < 2) continue;
+
+				// Triangle fan
+				const auto base = static_cast<uint32_t>(objData.Indices.size());
+				objData.Indices.insert(objData.Indices.end(), v, v + 3);
+				if ((vn[0] & vn[1] & vn[2]) != UINT32_MAX || !objData.NIndices.empty())
+				{
+					objData.NIndices.resize(base, UINT32_MAX);
+					objData.NIndices.insert(objData.NIndices.end(), vn, vn + 3);
+				}
+
+				// Record relative references, which are fixed up when merging chunks.
+				for (uint8_t j = 0; j < 3; ++j)
+				{
+					if (isRel[j]) objData.RelIndices.emplace_back(base + j);
+					if (isRelN[j]) objData.RelNIndices.emplace_back(base + j);
+				}
+
+				v[1] = v[2];
+				vn[1] = vn[2];
+				isRel[1] = isRel[2];
+				isRelN[1] = isRelN[2];
+			}
+		}
+
+		p = ObjScanner::SkipLine(p, pEnd);
+	}
+
+	if (!objData.NIndices.empty()) objData.NIndices.resize(objData.Indices.size(), UINT32_MAX);
 }
 
-const uint8_t* ObjLoader::GetVertices() const
+void ObjLoader::mergeChunks(vector<ObjData>& chunks, ObjData& objData)
 {
-	return m_vertices.data();
+	// Prefix sums of the per-chunk element counts
+	size_t numVert = 0, numNorm = 0, numIdx = 0;
+	objData.NumTexc = 0;
+	for (const auto& chunk : chunks)
+	{
+		numVert += chunk.Positions.GetSize();
+		numNorm += chunk.Normals.GetSize();
+		numIdx += chunk.Indices.size();
+		objData.NumTexc += chunk.NumTexc;
+	}
+
+	// As for a single chunk, normal indices cover every face whenever the file has normals.
+	const auto hasNIndices = numNorm > 0;
+
+	objData.Positions.Reserve(numVert);
+	objData.Normals.Reserve(numNorm);
+	objData.Indices.reserve(numIdx);
+	if (hasNIndices) objData.NIndices.reserve(numIdx);
+
+	// Concatenate in file order, offsetting relative references by the elements of the preceding chunks.
+	for (auto& chunk : chunks)
+	{
+		const auto vBase = static_cast<uint32_t>(objData.Positions.GetSize());
+		const auto nBase = static_cast<uint32_t>(objData.Normals.GetSize());
+		for (const auto& i : chunk.RelIndices) chunk.Indices[i] += vBase;
+		for (const auto& i : chunk.RelNIndices) chunk.NIndices[i] += nBase;
+
+		objData.Positions.Append(chunk.Positions);
+		objData.Normals.Append(chunk.Normals);
+		objData.Indices.insert(objData.Indices.end(), chunk.Indices.cbegin(), chunk.Indices.cend());
+		if (hasNIndices)
+		{
+			if (chunk.NIndices.empty()) objData.NIndices.resize(objData.Indices.size(), UINT32_MAX);
+			else objData.NIndices.insert(objData.NIndices.end(), chunk.NIndices.cbegin(), chunk.NIndices.cend());
+		}
+
+		chunk.Clear();
+	}
 }
 
-const uint32_t* ObjLoader::GetIndices() const
+void ObjLoader::ObjData::Clear()
 {
-	return m_indices.data();
+	Positions.Clear();
+	Normals.Clear();
+	Indices.clear();
+	NIndices.clear();
+	RelIndices.clear();
+	RelNIndices.clear();
+	NumTexc = 0;
 }
 
-const ObjLoader::AABB& ObjLoader::GetAABB() const
+void ObjLoader::loadMappedData(ObjData& objData, bool forDX, bool swapYZ)
 {
-	return m_aabb;
+	const auto numVert = static_cast<uint32_t>(objData.Positions.GetSize());
+	const auto numNorm = static_cast<uint32_t>(objData.Normals.GetSize());
+	const auto numTexc = objData.NumTexc;
+
+	// Allocate memory for the OBJ model data.
+	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
+	m_stride += numTexc ? sizeof(float[2]) : 0;
+	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
+	m_vertices.resize(m_stride * numVert);
+	m_indices.assign(objData.Indices.cbegin(), objData.Indices.cend());
+
+	loadStreams(objData.Positions, objData.Normals, objData.NIndices, forDX, swapYZ);
+}
+
+void ObjLoader::loadStreams(SoAStream& positions, SoAStream& normals,
+	const vector<uint32_t>& nIndices, bool forDX, bool swapYZ)
+{
+	// Coordinate-system conversion and normalization run over the SoA streams; the
+	// interleaved layout is only produced at the end.
+	if (swapYZ)
+	{
+		positions.SwapYZ();
+		normals.SwapYZ();
+	}
+
+	if (forDX)
+	{
+		positions.NegateZ();
+		normals.NegateZ();
+	}
+
+	normals.Normalize();
+	if (m_needAABB) computeAABB(positions);
+	positions.Store(m_vertices.data(), GetVertexStride());
+
+	computePerVertexNormals(normals, nIndices);
+
+	if ((forDX && !swapYZ) || (!forDX && swapYZ)) reverse(m_indices.begin(), m_indices.end());
 }
 
 void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm)
@@ -81,12 +1087,12 @@ void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t
 	numTexc = 0;
 	numNorm = 0;
 
-	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+	while (scanToken(pFile, buffer) != EOF)
 	{
 		switch (buffer[0])
 		{
 		case 'f':   // v, v//vn, v/vt, v/vt/vn.
-			fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer)));
+			scanToken(pFile, buffer);
 
 			if (strstr(buffer, "//")) // v//vn
 			{
@@ -154,265 +1160,997 @@ void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t
 		}
 	}
 
-	// Allocate memory for the OBJ model data.
-	const auto numIdx = numTri * 3;
-	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
-	m_stride += numTexc ? sizeof(float[2]) : 0;
-	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
-	m_vertices.resize(m_stride * numVert);
-	m_indices.resize(numIdx);
+	// Allocate memory for the OBJ model data.
+	const auto numIdx = numTri * 3;
+	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
+	m_stride += numTexc ? sizeof(float[2]) : 0;
+	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
+	m_vertices.resize(m_stride * numVert);
+	m_indices.resize(numIdx);
+}
+
+void ObjLoader::importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ)
+{
+	auto numTri = 0u;
+	char buffer[256] = { 0 };
+
+	auto& positions = m_scratch->Positions;
+	auto& normals = m_scratch->Normals;
+	auto& tIndices = m_scratch->TIndices;
+	auto& nIndices = m_scratch->NIndices;
+	positions.Clear();
+	normals.Clear();
+	tIndices.clear();
+	nIndices.clear();
+	if (numTexc) tIndices.resize(m_indices.size());
+	if (numNorm) nIndices.resize(m_indices.size());
+	positions.Reserve(GetNumVertices());
+	normals.Reserve(numNorm);
+
+	while (scanToken(pFile, buffer) != EOF)
+	{
+		switch (buffer[0])
+		{
+		case 'f': // v, v//vn, v/vt, or v/vt/vn.
+			loadIndices(pFile, numTri, numTexc, numNorm, nIndices, tIndices);
+			break;
+		case 'v': // v, vn, or vt.
+			switch (buffer[1])
+			{
+			case '\0': // v
+			{
+				float3 p;
+				fscanf_s(pFile, "%f %f %f", &p.x, &p.y, &p.z);
+				positions.PushBack(p.x, p.y, p.z);
+				break;
+			}
+			case 'n':
+			{
+				float3 n;
+				fscanf_s(pFile, "%f %f %f", &n.x, &n.y, &n.z);
+				normals.PushBack(n.x, n.y, n.z);
+				break;
+			}
+			default:
+				break;
+			}
+			break;
+
+		default:
+			fgets(buffer, sizeof(buffer), pFile);
+			break;
+		}
+	}
+
+	positions.Resize(GetNumVertices());
+	loadStreams(positions, normals, nIndices, forDX, swapYZ);
+}
+
+void ObjLoader::loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc,
+	uint32_t numNorm, vector<uint32_t>& nIndices, vector<uint32_t>& tIndices)
+{
+	long long vi;	// Exactly the type of %lld, which int64_t is not on every platform
+	uint32_t v[3] = { 0 };
+	uint32_t vt[3] = { 0 };
+	uint32_t vn[3] = { 0 };
+
+	const auto numVert = GetNumVertices();
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		fscanf_s(pFile, "%lld", &vi);
+		v[i] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
+		m_indices[numTri * 3 + i] = v[i];
+
+		if (tIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vt[i] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
+			tIndices[numTri * 3 + i] = vt[i];
+		}
+		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+
+		if (nIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vn[i] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
+			nIndices[numTri * 3 + i] = vn[i];
+		}
+	}
+	++numTri;
+
+	v[1] = v[2];
+	vt[1] = vt[2];
+	vn[1] = vn[2];
+
+	while (fscanf_s(pFile, "%lld", &vi) > 0)
+	{
+		v[2] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
+		m_indices[numTri * 3] = v[0];
+		m_indices[numTri * 3 + 1] = v[1];
+		m_indices[numTri * 3 + 2] = v[2];
+		v[1] = v[2];
+
+		if (tIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vt[2] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
+			tIndices[numTri * 3] = vt[0];
+			tIndices[numTri * 3 + 1] = vt[1];
+			tIndices[numTri * 3 + 2] = vt[2];
+			vt[1] = vt[2];
+		}
+		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+
+		if (nIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vn[2] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
+			nIndices[numTri * 3] = vn[0];
+			nIndices[numTri * 3 + 1] = vn[1];
+			nIndices[numTri * 3 + 2] = vn[2];
+			vn[1] = vn[2];
+		}
+
+		++numTri;
+	}
+}
+
+void ObjLoader::computePerVertexNormals(const SoAStream& normals, const vector<uint32_t>& nIndices)
+{
+	if (!normals.GetSize()) return;
+
+	// Each vertex keeps the first normal it is referenced with; every other normal splits off
+	// a copy. The splits are counted first, so that the vertices grow only once.
+	const auto stride = GetVertexStride();
+	const auto numVert = GetNumVertices();
+	auto& vni = m_scratch->Remap;
+	vni.assign(numVert, UINT32_MAX);
+
+	const auto numIdx = static_cast<uint32_t>(m_indices.size());
+	auto numSplits = 0u;
+	for (auto i = 0u; i < numIdx; i++)
+	{
+		const auto vi = m_indices[i];
+		if (nIndices[i] >= normals.GetSize()) continue;
+		if (vni[vi] == UINT32_MAX) vni[vi] = nIndices[i];
+		else if (vni[vi] != nIndices[i]) ++numSplits;
+	}
+	m_vertices.resize(static_cast<size_t>(stride) * (numVert + numSplits));
+
+	auto numSplitVert = numVert;
+	for (auto i = 0u; i < numIdx; i++)
+	{
+		auto vi = m_indices[i];
+		const auto ni = nIndices[i];
+		if (ni >= normals.GetSize()) continue;
+
+		if (vni[vi] != ni)
+		{
+			// Split vertex
+			vi = numSplitVert++;
+			memcpy(getVertex(vi), getVertex(m_indices[i]), stride);
+			m_indices[i] = vi;
+		}
+
+		getNormal(vi) = float3(normals.X[ni], normals.Y[ni], normals.Z[ni]);
+	}
+}
+
+// Stable LSD radix sort of the items by 8-bit digits of bits [firstBit, lastBit). Each
+// pass histograms the items of every range, takes the digit-major prefix sums, and scatters
+// each range to its own cursors, so that equal digits keep their order.
+static void radixSort(uint32_t numThreads, vector<uint64_t>& items, vector<uint64_t>& temp,
+	vector<uint32_t>& histograms, uint8_t firstBit, uint8_t lastBit)
+{
+	const auto count = static_cast<uint32_t>(items.size());
+	const auto numRanges = (min)(numThreads, count / 4096 + 1);
+	const auto getBound = [&](uint32_t r) { return static_cast<uint32_t>(static_cast<uint64_t>(count) * r / numRanges); };
+	temp.resize(count);
+	histograms.resize(256 * numRanges);
+
+	for (auto shift = firstBit; shift < lastBit; shift += 8)
+	{
+		Parallel::Run(numRanges, [&](uint32_t r)
+		{
+			const auto pHistogram = &histograms[256 * r];
+			memset(pHistogram, 0, sizeof(uint32_t[256]));
+			for (auto i = getBound(r); i < getBound(r + 1); ++i) ++pHistogram[(items[i] >> shift) & 0xff];
+		});
+
+		// Skip the digits that all items share.
+		auto offset = 0u;
+		auto isUniform = false;
+		for (auto d = 0u; d < 256; ++d)
+		{
+			auto digitCount = 0u;
+			for (auto r = 0u; r < numRanges; ++r)
+			{
+				const auto n = histograms[256 * r + d];
+				histograms[256 * r + d] = offset + digitCount;
+				digitCount += n;
+			}
+			isUniform = isUniform || digitCount == count;
+			offset += digitCount;
+		}
+		if (isUniform) continue;
+
+		Parallel::Run(numRanges, [&](uint32_t r)
+		{
+			const auto pCursors = &histograms[256 * r];
+			for (auto i = getBound(r); i < getBound(r + 1); ++i) temp[pCursors[(items[i] >> shift) & 0xff]++] = items[i];
+		});
+		items.swap(temp);
+	}
+}
+
+void ObjLoader::recomputeNormals()
+{
+	// Face normals. Ranges are aligned to 4 triangles, so every triangle takes the same
+	// path (SIMD or scalar tail) regardless of the thread count.
+	const auto numTri = static_cast<uint32_t>(m_indices.size()) / 3;
+	const auto numThreads = getNumThreads();
+	auto& faceNormals = m_scratch->FaceNormals;
+	faceNormals.resize(numTri);
+	Parallel::For(numThreads, numTri, 4, [&](uint32_t begin, uint32_t end)
+	{
+		auto i = begin;
+#if XUSG_OBJ_SCANNER_SSE2
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 v[3][3];
+			for (auto j = 0u; j < 3; ++j)
+			{
+				const auto& p0 = getPosition(m_indices[i * 3 + j]);
+				const auto& p1 = getPosition(m_indices[i * 3 + 3 + j]);
+				const auto& p2 = getPosition(m_indices[i * 3 + 6 + j]);
+				const auto& p3 = getPosition(m_indices[i * 3 + 9 + j]);
+				v[j][0] = _mm_setr_ps(p0.x, p1.x, p2.x, p3.x);
+				v[j][1] = _mm_setr_ps(p0.y, p1.y, p2.y, p3.y);
+				v[j][2] = _mm_setr_ps(p0.z, p1.z, p2.z, p3.z);
+			}
+
+			__m128 e1[3], e2[3], n[3];
+			for (auto k = 0u; k < 3; ++k)
+			{
+				e1[k] = _mm_sub_ps(v[1][k], v[0][k]);
+				e2[k] = _mm_sub_ps(v[2][k], v[1][k]);
+			}
+			n[0] = _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1]));
+			n[1] = _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2]));
+			n[2] = _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0]));
+
+			// Degenerate triangles contribute nothing.
+			const auto l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]),
+				_mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2])));
+			const auto valid = _mm_cmpgt_ps(l, _mm_setzero_ps());
+			float r[3][4];
+			for (auto k = 0u; k < 3; ++k) _mm_storeu_ps(r[k], _mm_and_ps(_mm_div_ps(n[k], l), valid));
+			for (auto j = 0u; j < 4; ++j) faceNormals[i + j] = float3(r[0][j], r[1][j], r[2][j]);
+		}
+#endif
+		for (; i < end; ++i)
+		{
+			const auto& v0 = getPosition(m_indices[i * 3]);
+			const auto& v1 = getPosition(m_indices[i * 3 + 1]);
+			const auto& v2 = getPosition(m_indices[i * 3 + 2]);
+			const float3 e1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+			const float3 e2(v2.x - v1.x, v2.y - v1.y, v2.z - v1.z);
+			const float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+			const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+			faceNormals[i] = l > 0.0f ? float3(n.x / l, n.y / l, n.z / l) : float3(0.0f, 0.0f, 0.0f);
+		}
+	});
+
+	// Vertex-to-face adjacency in CSR form; faces of each vertex stay in ascending order.
+	const auto numVert = GetNumVertices();
+	auto& faceOffsets = m_scratch->Offsets;
+	auto& vertexFaces = m_scratch->Adjacency;
+	auto& cursors = m_scratch->Cursors;
+	faceOffsets.assign(numVert + 1, 0);
+	vertexFaces.resize(m_indices.size());
+	for (const auto& index : m_indices) ++faceOffsets[index + 1];
+	for (auto i = 0u; i < numVert; ++i) faceOffsets[i + 1] += faceOffsets[i];
+	cursors.assign(faceOffsets.cbegin(), faceOffsets.cend() - 1);
+	for (size_t i = 0; i < m_indices.size(); ++i)
+		vertexFaces[cursors[m_indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+	// Gather the vertex normals; each vertex is owned by exactly one range.
+	auto& normals = m_scratch->Normals;
+	normals.Resize(numVert);
+	Parallel::For(numThreads, numVert, 64, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			float3 n(0.0f, 0.0f, 0.0f);
+			for (auto j = faceOffsets[i]; j < faceOffsets[i + 1]; ++j)
+			{
+				const auto& fn = faceNormals[vertexFaces[j]];
+				n.x += fn.x;
+				n.y += fn.y;
+				n.z += fn.z;
+			}
+
+			normals.X[i] = n.x;
+			normals.Y[i] = n.y;
+			normals.Z[i] = n.z;
+		}
+	});
+
+	normals.Normalize();
+	if (numVert) normals.Store(&getNormal(0), GetVertexStride());
+}
+
+static inline int64_t getWeldKey(float c)
+{
+	// Compare bit patterns with -0 folded into +0.
+	uint32_t bits;
+	memcpy(&bits, &c, sizeof(bits));
+
+	return c == 0.0f ? 0 : bits;
+}
+
+static inline uint32_t getWeldHash(const int64_t* keys, uint32_t numKeys)
+{
+	auto h = 0xcbf29ce484222325ull;
+	for (auto c = 0u; c < numKeys; ++c)
+	{
+		h = (h ^ static_cast<uint64_t>(keys[c])) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+
+	return static_cast<uint32_t>(h);
 }
 
-void ObjLoader::importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ)
+void ObjLoader::weldVertices()
 {
-	auto numVert = 0u;
-	auto numTri = 0u;
-	char buffer[256] = { 0 };
+	const auto stride = GetVertexStride();
+	const auto numComps = stride / static_cast<uint32_t>(sizeof(float));
+	const auto numVert = GetNumVertices();
+	const auto tolerance = m_weldTolerance;
+	const auto pComps = reinterpret_cast<const float*>(m_vertices.data());
+
+	// Open-addressing table of welded vertex indices. Welded vertices are compacted in place
+	// ahead of the cursor. Exact welding keys the table by the full attribute tuple; tolerance
+	// welding keys it by the position cell on a grid of the tolerance, and searches the 27 cells
+	// around a vertex for a welded vertex with every component within the tolerance, so the
+	// first such vertex in the input order wins.
+	auto tableSize = 1u;
+	while (tableSize < numVert * 2) tableSize <<= 1;
+	auto& table = m_scratch->Table;
+	auto& remap = m_scratch->Remap;
+	table.assign(tableSize, UINT32_MAX);
+	remap.resize(numVert);
+
+	const auto isWeldable = [&](const float* pWelded, const float* pVert)
+	{
+		auto c = 0u;
+		if (tolerance > 0.0f) while (c < numComps && fabs(pWelded[c] - pVert[c]) <= tolerance) ++c;
+		else while (c < numComps && getWeldKey(pWelded[c]) == getWeldKey(pVert[c])) ++c;
 
-	vector<float3> normals;
-	vector<uint32_t> tIndices, nIndices;
-	if (numTexc) tIndices.resize(m_indices.size());
-	if (numNorm) nIndices.resize(m_indices.size());
-	normals.reserve(numNorm);
+		return c == numComps;
+	};
 
-	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+	int64_t keys[(2 * sizeof(float3) + sizeof(float[2])) / sizeof(float)];	// Position, normal, and texcoord at most
+	auto numWelded = 0u;
+	for (auto i = 0u; i < numVert; ++i)
 	{
-		switch (buffer[0])
+		const auto pVert = &pComps[numComps * i];
+		auto welded = UINT32_MAX;
+		auto slot = 0u;
+		if (tolerance > 0.0f)
 		{
-		case 'f': // v, v//vn, v/vt, or v/vt/vn.
-			loadIndices(pFile, numTri, numTexc, numNorm, nIndices, tIndices);
-			break;
-		case 'v': // v, vn, or vt.
-			switch (buffer[1])
-			{
-			case '\0': // v
+			const auto invTolerance = 1.0 / tolerance;
+			int64_t cell[3];
+			for (auto c = 0u; c < 3; ++c) cell[c] = static_cast<int64_t>(floor(pVert[c] * invTolerance));
+
+			for (auto n = 0u; n < 27 && welded == UINT32_MAX; ++n)
 			{
-				auto& p = getPosition(numVert++);
-				fscanf_s(pFile, "%f %f %f", &p.x, &p.y, &p.z);
-				if (swapYZ)
-				{
-					const auto tmp = p.y;
-					p.y = p.z;
-					p.z = tmp;
-				}
-				p.z = forDX ? -p.z : p.z;
-				break;
+				keys[0] = cell[0] + static_cast<int64_t>(n % 3) - 1;
+				keys[1] = cell[1] + static_cast<int64_t>(n / 3 % 3) - 1;
+				keys[2] = cell[2] + static_cast<int64_t>(n / 9) - 1;
+				for (slot = getWeldHash(keys, 3) & (tableSize - 1); table[slot] != UINT32_MAX;
+					slot = (slot + 1) & (tableSize - 1))
+					if (isWeldable(&pComps[numComps * table[slot]], pVert))
+					{
+						welded = table[slot];
+						break;
+					}
 			}
-			case 'n':
-				normals.emplace_back();
-				fscanf_s(pFile, "%f %f %f",
-					&normals.back().x,
-					&normals.back().y,
-					&normals.back().z);
-				if (swapYZ)
+
+			// Insert into the run of the own cell, the last one probed.
+			if (welded == UINT32_MAX)
+				for (slot = getWeldHash(cell, 3) & (tableSize - 1); table[slot] != UINT32_MAX;)
+					slot = (slot + 1) & (tableSize - 1);
+		}
+		else
+		{
+			for (auto c = 0u; c < numComps; ++c) keys[c] = getWeldKey(pVert[c]);
+			for (slot = getWeldHash(keys, numComps) & (tableSize - 1); table[slot] != UINT32_MAX;
+				slot = (slot + 1) & (tableSize - 1))
+				if (isWeldable(&pComps[numComps * table[slot]], pVert))
 				{
-					const auto tmp = normals.back().y;
-					normals.back().y = normals.back().z;
-					normals.back().z = tmp;
+					welded = table[slot];
+					break;
 				}
-				normals.back().z = forDX ? -normals.back().z : normals.back().z;
-			default:
-				break;
-			}
-			break;
+		}
 
-		default:
-			fgets(buffer, sizeof(buffer), pFile);
-			break;
+		if (welded == UINT32_MAX)
+		{
+			if (numWelded != i) memcpy(getVertex(numWelded), getVertex(i), stride);
+			welded = table[slot] = numWelded++;
 		}
+		remap[i] = welded;
 	}
 
-	computePerVertexNormals(normals, nIndices);
-
-	if ((forDX && !swapYZ) || (!forDX && swapYZ)) reverse(m_indices.begin(), m_indices.end());
+	for (auto& index : m_indices) index = remap[index];
+	m_vertices.resize(static_cast<size_t>(stride) * numWelded);
 }
 
-void ObjLoader::loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc,
-	uint32_t numNorm, vector<uint32_t>& nIndices, vector<uint32_t>& tIndices)
+void ObjLoader::cleanupMesh()
 {
-	int64_t vi;
-	uint32_t v[3] = { 0 };
-	uint32_t vt[3] = { 0 };
-	uint32_t vn[3] = { 0 };
+	enum TriangleStatus : uint8_t
+	{
+		TRIANGLE_KEPT,
+		TRIANGLE_DEGENERATE,
+		TRIANGLE_DUPLICATE
+	};
 
+	const auto numThreads = getNumThreads();
+	const auto stride = GetVertexStride();
 	const auto numVert = GetNumVertices();
-
-	for (uint8_t i = 0; i < 3; ++i)
+	const auto numTri = GetNumIndices() / 3;
+
+	// Flag the degenerate triangles, and key the others by their vertices rotated to start at
+	// the smallest index, so that repeats match only with the same winding. Opposite windings
+	// are kept, as they are the two sides of a closed zero-thickness part.
+	auto& status = m_scratch->Flags;
+	auto& rotated = m_scratch->Keys;
+	auto& hashes = m_scratch->Hashes;
+	status.assign(numTri, TRIANGLE_KEPT);
+	rotated.resize(3 * static_cast<size_t>(numTri));
+	hashes.resize(numTri);
+	Parallel::For(numThreads, numTri, 64, [&](uint32_t begin, uint32_t end)
 	{
-		fscanf_s(pFile, "%lld", &vi);
-		v[i] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
-		m_indices[numTri * 3 + i] = v[i];
-
-		if (tIndices.size() > 0)
+		for (auto i = begin; i < end; ++i)
 		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vt[i] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
-			tIndices[numTri * 3 + i] = vt[i];
+			const auto pTri = &m_indices[3 * i];
+			const auto& p0 = getPosition(pTri[0]);
+			const auto& p1 = getPosition(pTri[1]);
+			const auto& p2 = getPosition(pTri[2]);
+			const float e1[] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+			const float e2[] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			const float n[] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			if (pTri[0] == pTri[1] || pTri[1] == pTri[2] || pTri[2] == pTri[0] || (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f))
+			{
+				status[i] = TRIANGLE_DEGENERATE;
+				continue;
+			}
+
+			const auto first = pTri[0] < pTri[1] ? (pTri[0] < pTri[2] ? 0 : 2) : (pTri[1] < pTri[2] ? 1 : 2);
+			auto h = 0xcbf29ce484222325ull;
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				rotated[3 * i + j] = pTri[(first + j) % 3];
+				h = (h ^ rotated[3 * i + j]) * 0x100000001b3ull;
+				h ^= h >> 29;
+			}
+			hashes[i] = h;
 		}
-		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+	});
+
+	// The first occurrence of each triangle wins.
+	auto tableSize = 1u;
+	while (tableSize < numTri * 2) tableSize <<= 1;
+	auto& table = m_scratch->Table;
+	table.assign(tableSize, UINT32_MAX);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		if (status[i] != TRIANGLE_KEPT) continue;
 
-		if (nIndices.size() > 0)
+		auto slot = static_cast<uint32_t>(hashes[i]) & (tableSize - 1);
+		for (; table[slot] != UINT32_MAX; slot = (slot + 1) & (tableSize - 1))
+			if (equal(&rotated[3 * i], &rotated[3 * i + 3], &rotated[3 * table[slot]])) break;
+
+		if (table[slot] == UINT32_MAX) table[slot] = i;
+		else status[i] = TRIANGLE_DUPLICATE;
+	}
+
+	// Compact the triangles in order
+	auto numKept = 0u;
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		if (status[i] == TRIANGLE_KEPT)
 		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vn[i] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
-			nIndices[numTri * 3 + i] = vn[i];
+			if (numKept != i) memcpy(&m_indices[3 * numKept], &m_indices[3 * i], sizeof(uint32_t[3]));
+			++numKept;
 		}
+		else if (status[i] == TRIANGLE_DEGENERATE) ++m_importStats.NumDegenerateTriangles;
+		else ++m_importStats.NumDuplicateTriangles;
 	}
-	++numTri;
+	m_indices.resize(3 * static_cast<size_t>(numKept));
+
+	// Compact the referenced vertices in order
+	auto& remap = m_scratch->Remap;
+	remap.assign(numVert, UINT32_MAX);
+	for (const auto& vi : m_indices) remap[vi] = 0;
+	auto numReferenced = 0u;
+	for (auto& vi : remap)
+		if (vi != UINT32_MAX) vi = numReferenced++;
+	m_importStats.NumUnreferencedVertices = numVert - numReferenced;
+
+	if (numReferenced < numVert)
+	{
+		auto& vertices = m_scratch->Vertices;
+		vertices.resize(static_cast<size_t>(stride) * numReferenced);
+		Parallel::For(numThreads, numVert, 256, [&](uint32_t begin, uint32_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+				if (remap[i] != UINT32_MAX) memcpy(&vertices[static_cast<size_t>(stride) * remap[i]], getVertex(i), stride);
+		});
+		m_vertices.assign(vertices.cbegin(), vertices.cend());
 
-	v[1] = v[2];
-	vt[1] = vt[2];
-	vn[1] = vn[2];
+		Parallel::For(numThreads, GetNumIndices(), 256, [&](uint32_t begin, uint32_t end)
+		{
+			for (auto i = begin; i < end; ++i) m_indices[i] = remap[m_indices[i]];
+		});
+	}
 
-	while (fscanf_s(pFile, "%lld", &vi) > 0)
+	// Vertex-triangle adjacency (CSR) for the edge report
+	auto& adjOffsets = m_scratch->Offsets;
+	auto& adjTris = m_scratch->Adjacency;
+	auto& cursors = m_scratch->Cursors;
+	adjOffsets.assign(numReferenced + 1, 0);
+	for (const auto& vi : m_indices) ++adjOffsets[vi + 1];
+	for (auto i = 0u; i < numReferenced; ++i) adjOffsets[i + 1] += adjOffsets[i];
+	adjTris.resize(m_indices.size());
+	cursors.assign(adjOffsets.cbegin(), adjOffsets.cend() - 1);
+	for (auto i = 0u; i < GetNumIndices(); ++i) adjTris[cursors[m_indices[i]]++] = i / 3;
+
+	// Each edge is counted at its smaller vertex, on the first triangle that has it; an edge
+	// of more than two triangles is non-manifold. The one-rings are small, so the quadratic
+	// scan beats sorting into a per-thread buffer.
+	atomic<uint32_t> numNonManifoldEdges(0);
+	Parallel::For(numThreads, numReferenced, 64, [&](uint32_t begin, uint32_t end)
 	{
-		v[2] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
-		m_indices[numTri * 3] = v[0];
-		m_indices[numTri * 3 + 1] = v[1];
-		m_indices[numTri * 3 + 2] = v[2];
-		v[1] = v[2];
+		const auto hasVertex = [&](uint32_t t, uint32_t u)
+		{
+			const auto pTri = &m_indices[3 * adjTris[t]];
 
-		if (tIndices.size() > 0)
+			return pTri[0] == u || pTri[1] == u || pTri[2] == u;
+		};
+
+		auto numEdges = 0u;
+		for (auto v = begin; v < end; ++v)
 		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vt[2] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
-			tIndices[numTri * 3] = vt[0];
-			tIndices[numTri * 3 + 1] = vt[1];
-			tIndices[numTri * 3 + 2] = vt[2];
-			vt[1] = vt[2];
+			for (auto i = adjOffsets[v]; i < adjOffsets[v + 1]; ++i)
+			{
+				const auto pTri = &m_indices[3 * adjTris[i]];
+				for (uint8_t j = 0; j < 3; ++j)
+				{
+					const auto u = pTri[j];
+					if (u <= v) continue;
+
+					auto k = adjOffsets[v];
+					while (k < i && !hasVertex(k, u)) ++k;
+					if (k < i) continue;
+
+					auto count = 1u;
+					for (k = i + 1; k < adjOffsets[v + 1]; ++k) if (hasVertex(k, u)) ++count;
+					if (count > 2) ++numEdges;
+				}
+			}
 		}
-		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+		numNonManifoldEdges += numEdges;
+	});
+	m_importStats.NumNonManifoldEdges = numNonManifoldEdges;
+}
 
-		if (nIndices.size() > 0)
+static inline uint32_t expandBits10(uint32_t v)
+{
+	// Spreads 10 bits to every third bit.
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+
+	return v;
+}
+
+void ObjLoader::reorderTriangles()
+{
+	// Key each triangle by the 30-bit Morton code of its centroid on a 1024^3 grid over the
+	// AABB, above its index, so that the sort is stable and the keys are unique.
+	const auto numThreads = getNumThreads();
+	const auto numTri = GetNumIndices() / 3;
+	const float minVal[] = { m_aabb.Min.x, m_aabb.Min.y, m_aabb.Min.z };
+	const float extents[] = { m_aabb.Max.x - m_aabb.Min.x, m_aabb.Max.y - m_aabb.Min.y, m_aabb.Max.z - m_aabb.Min.z };
+	float scales[3];
+	for (uint8_t j = 0; j < 3; ++j) scales[j] = extents[j] > 0.0f ? 1024.0f / extents[j] : 0.0f;
+
+	auto& items = m_scratch->SortItems;
+	items.resize(numTri);
+	Parallel::For(numThreads, numTri, 256, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
 		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vn[2] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
-			nIndices[numTri * 3] = vn[0];
-			nIndices[numTri * 3 + 1] = vn[1];
-			nIndices[numTri * 3 + 2] = vn[2];
-			vn[1] = vn[2];
+			const auto pTri = &m_indices[3 * i];
+			const auto& p0 = getPosition(pTri[0]);
+			const auto& p1 = getPosition(pTri[1]);
+			const auto& p2 = getPosition(pTri[2]);
+			const float centroid[] = { (p0.x + p1.x + p2.x) / 3.0f, (p0.y + p1.y + p2.y) / 3.0f, (p0.z + p1.z + p2.z) / 3.0f };
+
+			uint32_t code = 0;
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto q = (min)((max)((centroid[j] - minVal[j]) * scales[j], 0.0f), 1023.0f);
+				code |= expandBits10(static_cast<uint32_t>(q)) << (2 - j);
+			}
+			items[i] = (static_cast<uint64_t>(code) << 32) | i;
 		}
+	});
 
-		++numTri;
-	}
+	radixSort(numThreads, items, m_scratch->SortTemp, m_scratch->Histograms, 32, 62);
+
+	auto& indices = m_scratch->Indices;
+	indices.resize(m_indices.size());
+	Parallel::For(numThreads, numTri, 256, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
+			memcpy(&indices[3 * i], &m_indices[3 * static_cast<uint32_t>(items[i])], sizeof(uint32_t[3]));
+	});
+	m_indices.assign(indices.cbegin(), indices.cend());
 }
 
-void ObjLoader::computePerVertexNormals(const vector<float3>& normals, const vector<uint32_t>& nIndices)
+static inline float getVertexCacheScore(int32_t cachePos, uint32_t numLiveTris)
 {
-	if (normals.empty()) return;
+	// Forsyth's linear-speed vertex cache optimization scoring
+	if (numLiveTris == 0) return -1.0f;
 
-	const auto stride = GetVertexStride();
-	vector<uint32_t> vni(GetNumVertices(), UINT32_MAX);
+	auto score = 0.0f;
+	if (cachePos >= 0)
+	{
+		if (cachePos < 3) score = 0.75f; // The last triangle's vertices
+		else
+		{
+			const auto scaler = 1.0f / (ObjLoader::VertexCacheSize - 3);
+			score = powf(1.0f - (cachePos - 3) * scaler, 1.5f);
+		}
+	}
 
-	const auto numIdx = static_cast<uint32_t>(m_indices.size());
-	for (auto i = 0u; i < numIdx; i++)
+	// Boost vertices with few triangles left, so that lone triangles get finished early.
+	return score + 2.0f / sqrtf(static_cast<float>(numLiveTris));
+}
+
+void ObjLoader::optimizeVertexCache(vector<uint32_t>& indices) const
+{
+	const auto numVert = GetNumVertices();
+	const auto numTri = static_cast<uint32_t>(indices.size() / 3);
+	if (numTri == 0) return;
+
+	// Build vertex-triangle adjacency.
+	auto& numLiveTris = m_scratch->Counts;
+	numLiveTris.assign(numVert, 0);
+	for (const auto& vi : indices) ++numLiveTris[vi];
+
+	auto& adjOffsets = m_scratch->Offsets;
+	adjOffsets.assign(numVert + 1, 0);
+	for (auto i = 0u; i < numVert; ++i) adjOffsets[i + 1] = adjOffsets[i] + numLiveTris[i];
+
+	auto& adjTris = m_scratch->Adjacency;
+	auto& adjCounts = m_scratch->Cursors;
+	adjTris.resize(indices.size());
+	adjCounts.assign(numVert, 0);
+	for (auto i = 0u; i < numTri * 3; ++i)
 	{
-		auto vi = m_indices[i];
-		if (vni[vi] == nIndices[i]) continue;
+		const auto vi = indices[i];
+		adjTris[adjOffsets[vi] + adjCounts[vi]++] = i / 3;
+	}
 
-		if (vni[vi] < UINT32_MAX)
+	// Initialize scores.
+	auto& cachePos = m_scratch->CachePositions;
+	auto& vertScores = m_scratch->VertexScores;
+	cachePos.assign(numVert, -1);
+	vertScores.resize(numVert);
+	for (auto i = 0u; i < numVert; ++i) vertScores[i] = getVertexCacheScore(-1, numLiveTris[i]);
+
+	auto& triScores = m_scratch->TriangleScores;
+	triScores.resize(numTri);
+	for (auto i = 0u; i < numTri; ++i)
+		triScores[i] = vertScores[indices[i * 3]] + vertScores[indices[i * 3 + 1]] + vertScores[indices[i * 3 + 2]];
+
+	auto& emitted = m_scratch->Flags;
+	auto& optimized = m_scratch->Indices;
+	emitted.assign(numTri, 0);
+	optimized.clear();
+	optimized.reserve(indices.size());
+
+	// The LRU cache holds 3 extra entries for the vertices pushed out by the newest triangle.
+	uint32_t cache[VertexCacheSize + 3], newCache[VertexCacheSize + 3];
+	auto cacheCount = 0u;
+	auto bestTri = 0u;
+	for (auto i = 1u; i < numTri; ++i) if (triScores[i] > triScores[bestTri]) bestTri = i;
+
+	auto cursor = 0u;
+	for (auto n = 0u; n < numTri; ++n)
+	{
+		if (bestTri == UINT32_MAX)
 		{
-			// Split vertex
-			vi = GetNumVertices();
-			m_vertices.resize(m_vertices.size() + stride);
-			const auto pDst = getVertex(vi);
-			const auto pSrc = getVertex(m_indices[i]);
-			memcpy(pDst, pSrc, stride);
-			m_indices[i] = vi;
+			// Nothing in the cache is adjacent to a live triangle; take the next unemitted one.
+			while (emitted[cursor]) ++cursor;
+			bestTri = cursor;
+		}
+
+		// Emit the triangle and retire it from its vertices' adjacency lists.
+		const auto pTri = &indices[bestTri * 3];
+		emitted[bestTri] = 1;
+		auto newCount = 0u;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto vi = pTri[j];
+			optimized.emplace_back(vi);
+			newCache[newCount++] = vi;
+
+			const auto pAdj = &adjTris[adjOffsets[vi]];
+			const auto numAdj = numLiveTris[vi]--;
+			for (auto k = 0u; k < numAdj; ++k)
+			{
+				if (pAdj[k] == bestTri)
+				{
+					pAdj[k] = pAdj[numAdj - 1];
+					break;
+				}
+			}
+		}
+
+		// Move the triangle's vertices to the front of the cache.
+		for (auto j = 0u; j < cacheCount; ++j)
+		{
+			const auto vi = cache[j];
+			if (vi != pTri[0] && vi != pTri[1] && vi != pTri[2]) newCache[newCount++] = vi;
+		}
+
+		// Update vertex and triangle scores, and find the best live triangle in the cache.
+		bestTri = UINT32_MAX;
+		auto bestScore = -1.0f;
+		for (auto j = 0u; j < newCount; ++j)
+		{
+			const auto vi = newCache[j];
+			cachePos[vi] = j < VertexCacheSize ? static_cast<int32_t>(j) : -1;
+			const auto score = getVertexCacheScore(cachePos[vi], numLiveTris[vi]);
+			const auto delta = score - vertScores[vi];
+			vertScores[vi] = score;
+
+			const auto pAdj = &adjTris[adjOffsets[vi]];
+			for (auto k = 0u; k < numLiveTris[vi]; ++k) triScores[pAdj[k]] += delta;
 		}
-		else vni[vi] = nIndices[i];
 
-		float3 n = normals[nIndices[i]];
-		const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
-		n.x /= l;
-		n.y /= l;
-		n.z /= l;
+		for (auto j = 0u; j < newCount && j < VertexCacheSize; ++j)
+		{
+			const auto vi = newCache[j];
+			const auto pAdj = &adjTris[adjOffsets[vi]];
+			for (auto k = 0u; k < numLiveTris[vi]; ++k)
+			{
+				const auto ti = pAdj[k];
+				if (triScores[ti] > bestScore)
+				{
+					bestScore = triScores[ti];
+					bestTri = ti;
+				}
+			}
+		}
 
-		getNormal(vi) = n;
+		cacheCount = (min)(newCount, VertexCacheSize);
+		memcpy(cache, newCache, sizeof(uint32_t) * cacheCount);
 	}
 
-	m_vertices.shrink_to_fit();
+	indices.assign(optimized.cbegin(), optimized.cend());
 }
 
-void ObjLoader::recomputeNormals()
+void ObjLoader::optimizeVertexFetch()
 {
-	float3 e1, e2, n;
+	// Renumber vertices in the order of first reference; unreferenced vertices go last.
+	const auto stride = GetVertexStride();
+	const auto numVert = GetNumVertices();
+	auto& remap = m_scratch->Remap;
+	auto& vertices = m_scratch->Vertices;
+	remap.assign(numVert, UINT32_MAX);
+	vertices.resize(m_vertices.size());
 
-	const auto numTri = static_cast<uint32_t>(m_indices.size()) / 3;
-	for (auto i = 0u; i < numTri; i++)
-	{
-		const auto pv0 = &getPosition(m_indices[i * 3]);
-		const auto pv1 = &getPosition(m_indices[i * 3 + 1]);
-		const auto pv2 = &getPosition(m_indices[i * 3 + 2]);
-		e1.x = pv1->x - pv0->x;
-		e1.y = pv1->y - pv0->y;
-		e1.z = pv1->z - pv0->z;
-		e2.x = pv2->x - pv1->x;
-		e2.y = pv2->y - pv1->y;
-		e2.z = pv2->z - pv1->z;
-		n.x = e1.y * e2.z - e1.z * e2.y;
-		n.y = e1.z * e2.x - e1.x * e2.z;
-		n.z = e1.x * e2.y - e1.y * e2.x;
-		const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
-		n.x /= l;
-		n.y /= l;
-		n.z /= l;
-
-		const auto pVn0 = &getNormal(m_indices[i * 3]);
-		const auto pVn1 = &getNormal(m_indices[i * 3 + 1]);
-		const auto pVn2 = &getNormal(m_indices[i * 3 + 2]);
-		pVn0->x += n.x;
-		pVn0->y += n.y;
-		pVn0->z += n.z;
-		pVn1->x += n.x;
-		pVn1->y += n.y;
-		pVn1->z += n.z;
-		pVn2->x += n.x;
-		pVn2->y += n.y;
-		pVn2->z += n.z;
+	auto numFetched = 0u;
+	for (auto& vi : m_indices)
+	{
+		if (remap[vi] == UINT32_MAX)
+		{
+			memcpy(&vertices[static_cast<size_t>(stride) * numFetched], getVertex(vi), stride);
+			remap[vi] = numFetched++;
+		}
+		vi = remap[vi];
 	}
 
-	const auto numVert = GetNumVertices();
 	for (auto i = 0u; i < numVert; ++i)
+		if (remap[i] == UINT32_MAX) memcpy(&vertices[static_cast<size_t>(stride) * numFetched++], getVertex(i), stride);
+
+	m_vertices.assign(vertices.cbegin(), vertices.cend());
+}
+
+void ObjLoader::generateLODs()
+{
+	// Each level aims at half the triangles of the previous one. The chain ends once a level
+	// gets small or the simplifier stalls, e.g. on a mesh that is mostly locked border.
+	const auto minNumIndices = 3u * 256;
+	const auto dx = m_aabb.Max.x - m_aabb.Min.x;
+	const auto dy = m_aabb.Max.y - m_aabb.Min.y;
+	const auto dz = m_aabb.Max.z - m_aabb.Min.z;
+	const auto maxError = sqrtf(dx * dx + dy * dy + dz * dz) / 16.0f;
+
+	auto& simplifier = m_scratch->Simplifier;
+	simplifier.Init(m_vertices.data(), GetVertexStride(), GetNumVertices());
+
+	auto& indices = m_scratch->LODIndices;
+	auto& levelIndices = m_scratch->LevelIndices;
+	indices.assign(m_indices.cbegin(), m_indices.cend());
+	auto error = 0.0f;
+	while (m_lods.size() < MaxLODs && indices.size() >= minNumIndices * 2)
 	{
-		const auto pVn = &getNormal(i);
-		const auto l = sqrt(pVn->x * pVn->x + pVn->y * pVn->y + pVn->z * pVn->z);
-		pVn->x /= l;
-		pVn->y /= l;
-		pVn->z /= l;
+		const auto numIndices = static_cast<uint32_t>(indices.size());
+		const auto targetNumIndices = numIndices / 6 * 3;
+		error += simplifier.Simplify(indices, targetNumIndices, maxError);
+		if (indices.size() > numIndices / 4 * 3) break;
+
+		// Errors of the levels add up, since each level simplifies the one before.
+		levelIndices.assign(indices.cbegin(), indices.cend());
+		if (m_optimizeIndices) optimizeVertexCache(levelIndices);
+		m_lods.push_back({ GetNumIndices(), static_cast<uint32_t>(levelIndices.size()), error });
+		m_indices.insert(m_indices.end(), levelIndices.cbegin(), levelIndices.cend());
 	}
 }
 
-void ObjLoader::computeAABB()
+void ObjLoader::computeAABB(const SoAStream& positions)
+{
+	float minVal[3] = {}, maxVal[3] = {};
+	positions.GetBounds(minVal, maxVal);
+	m_aabb.Min = float3(minVal);
+	m_aabb.Max = float3(maxVal);
+}
+
+static inline int16_t toSnorm16(float v)
+{
+	return static_cast<int16_t>(lroundf((min)((max)(v, -1.0f), 1.0f) * 32767.0f));
+}
+
+static inline float fromSnorm16(int16_t q)
+{
+	return (max)(q / 32767.0f, -1.0f);
+}
+
+static inline uint16_t toHalf(float f)
 {
-	float xMax, xMin, yMax, yMin, zMax, zMin;
-	const auto& p = getPosition(0);
-	xMax = xMin = p.x;
-	yMax = yMin = p.y;
-	zMax = zMin = p.z;
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	const auto sign = (bits >> 16) & 0x8000;
+	const auto exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+	if (exponent <= 0) return static_cast<uint16_t>(sign);				// Flush denormals to zero
+	if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7c00);	// Infinity
+
+	const auto mantissa = bits & 0x7fffff;
 
-	auto x = 0.0f, y = 0.0f, z = 0.0f;
+	return static_cast<uint16_t>((sign | (exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
 
+void ObjLoader::quantizeVertices()
+{
+	const auto stride = GetVertexStride();
+	const auto attribSize = stride - static_cast<uint32_t>(sizeof(float3));
+	const auto hasNormal = attribSize >= sizeof(float3);
+	const auto hasTexc = attribSize % sizeof(float3) == sizeof(float[2]);
+	const auto qStride = static_cast<uint32_t>(sizeof(int16_t[4]) +
+		(hasNormal ? sizeof(int16_t[2]) : 0) + (hasTexc ? sizeof(uint16_t[2]) : 0));
 	const auto numVert = GetNumVertices();
-	for (auto i = 1u; i < numVert; ++i)
+	const auto scale = GetDequantizationScale();
+	const auto bias = GetDequantizationBias();
+
+	auto& vertices = m_scratch->Vertices;
+	vertices.resize(static_cast<size_t>(qStride) * numVert);
+	auto maxPosError = 0.0f;
+	auto maxNormalChord = 0.0f;
+	for (auto i = 0u; i < numVert; ++i)
 	{
+		auto pDst = &vertices[static_cast<size_t>(qStride) * i];
+
+		// Positions: SNORM16 over the AABB, padded to 4 components for the
+		// R16G16B16A16_SNORM vertex and BLAS format.
 		const auto& p = getPosition(i);
-		x = p.x;
-		y = p.y;
-		z = p.z;
+		const int16_t qPos[] = { toSnorm16((p.x - bias.x) / scale.x), toSnorm16((p.y - bias.y) / scale.y), toSnorm16((p.z - bias.z) / scale.z), 0 };
+		memcpy(pDst, qPos, sizeof(qPos));
+		pDst += sizeof(qPos);
+		maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[0]) * scale.x + bias.x - p.x));
+		maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[1]) * scale.y + bias.y - p.y));
+		maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[2]) * scale.z + bias.z - p.z));
+
+		// Normals: octahedral mapping to two SNORM16 values
+		if (hasNormal)
+		{
+			const auto& n = getNormal(i);
+			const auto l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+			auto x = l1 > 0.0f ? n.x / l1 : 0.0f;
+			auto y = l1 > 0.0f ? n.y / l1 : 0.0f;
+			if (n.z < 0.0f)
+			{
+				const auto ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = ox;
+			}
+
+			const int16_t qNrm[] = { toSnorm16(x), toSnorm16(y) };
+			memcpy(pDst, qNrm, sizeof(qNrm));
+			pDst += sizeof(qNrm);
+
+			// Decode to measure the angular error.
+			auto dx = fromSnorm16(qNrm[0]), dy = fromSnorm16(qNrm[1]);
+			const auto dz = 1.0f - fabsf(dx) - fabsf(dy);
+			if (dz < 0.0f)
+			{
+				const auto ox = (1.0f - fabsf(dy)) * (dx >= 0.0f ? 1.0f : -1.0f);
+				dy = (1.0f - fabsf(dx)) * (dy >= 0.0f ? 1.0f : -1.0f);
+				dx = ox;
+			}
+			// The chord between unit vectors keeps tiny angles accurate where acos would not.
+			const auto nl = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+			const auto dl = sqrtf(dx * dx + dy * dy + dz * dz);
+			if (nl > 0.0f)
+			{
+				const auto cx = n.x / nl - dx / dl, cy = n.y / nl - dy / dl, cz = n.z / nl - dz / dl;
+				maxNormalChord = (max)(maxNormalChord, sqrtf(cx * cx + cy * cy + cz * cz));
+			}
+		}
+
+		// Texcoords: half floats
+		if (hasTexc)
+		{
+			const auto pTexc = reinterpret_cast<const float*>(&reinterpret_cast<uint8_t*>(getVertex(i))[stride - sizeof(float[2])]);
+			const uint16_t qTexc[] = { toHalf(pTexc[0]), toHalf(pTexc[1]) };
+			memcpy(pDst, qTexc, sizeof(qTexc));
+		}
+	}
 
-		if (x < xMin) xMin = x;
-		else if (x > xMax) xMax = x;
+	m_stride = qStride;
+	m_vertices.assign(vertices.cbegin(), vertices.cend());
+	m_importStats.MaxPositionError = maxPosError;
+	m_importStats.MaxNormalError = 2.0f * asinf((min)(maxNormalChord / 2.0f, 1.0f)) * 180.0f / 3.14159265f;
+}
 
-		if (y < yMin) yMin = y;
-		else if (y > yMax) yMax = y;
+void ObjLoader::splitVertexStreams()
+{
+	// Positions first, then the remaining attributes, in one allocation. The per-vertex
+	// helpers above assume interleaved vertices, so this must be the last import stage.
+	const auto stride = GetVertexStride();
+	const auto posSize = getPositionSize();
+	const auto attribStride = stride - posSize;
+	const auto numVert = GetNumVertices();
+	auto& vertices = m_scratch->Vertices;
+	vertices.resize(m_vertices.size());
 
-		if (z < zMin) zMin = z;
-		else if (z > zMax) zMax = z;
+	const auto pPositions = vertices.data();
+	const auto pAttributes = vertices.data() + static_cast<size_t>(posSize) * numVert;
+	for (auto i = 0u; i < numVert; ++i)
+	{
+		const auto pSrc = reinterpret_cast<const uint8_t*>(getVertex(i));
+		memcpy(&pPositions[static_cast<size_t>(posSize) * i], pSrc, posSize);
+		if (attribStride > 0) memcpy(&pAttributes[static_cast<size_t>(attribStride) * i], &pSrc[posSize], attribStride);
 	}
 
-	m_aabb.Min = float3(xMin, yMin, zMin);
-	m_aabb.Max = float3(xMax, yMax, zMax);
+	m_vertices.assign(vertices.cbegin(), vertices.cend());
+}
+
+uint32_t ObjLoader::getPositionSize() const
+{
+	return m_quantize ? sizeof(int16_t[4]) : sizeof(float3);
+}
+
+uint32_t ObjLoader::getNumThreads() const
+{
+	return m_numThreads ? m_numThreads : (max)(thread::hardware_concurrency(), 1u);
 }
 
 void* ObjLoader::getVertex(uint32_t i)
@@ -429,3 +2167,148 @@ ObjLoader::float3& ObjLoader::getNormal(uint32_t i)
 {
 	return reinterpret_cast<float3*>(getVertex(i))[1];
 }
+
+//--------------------------------------------------------------------------------------
+// Out-of-core streaming import
+//--------------------------------------------------------------------------------------
+
+// Calls onVertex for every position and onTriangle for every fan triangle, in file order.
+template<typename VertexFunc, typename TriangleFunc>
+static void streamObj(const char* p, const char* pEnd, bool forDX, bool swapYZ,
+	const VertexFunc& onVertex, const TriangleFunc& onTriangle)
+{
+	const auto flipWinding = forDX != swapYZ;
+	uint64_t numVert = 0;
+	while (p < pEnd)
+	{
+		p = ObjScanner::SkipBlanks(p, pEnd);
+		const auto key = p < pEnd ? *p : '\0';
+		const auto key1 = p + 1 < pEnd ? p[1] : '\0';
+
+		if (key == 'v' && ObjScanner::IsBlank(key1)) // v
+		{
+			ObjLoader::float3 f;
+			p = ObjScanner::ParseFloat(p + 1, pEnd, f.x);
+			p = ObjScanner::ParseFloat(p, pEnd, f.y);
+			p = ObjScanner::ParseFloat(p, pEnd, f.z);
+			if (swapYZ)
+			{
+				const auto tmp = f.y;
+				f.y = f.z;
+				f.z = tmp;
+			}
+			f.z = forDX ? -f.z : f.z;
+			onVertex(f);
+			++numVert;
+		}
+		else if (key == 'f' && ObjScanner::IsBlank(key1)) // Positions only
+		{
+			uint32_t v[3] = { 0 };
+			auto n = 0u;
+			for (++p; ; ++n)
+			{
+				int64_t vi, vti, vni;
+				p = ObjScanner::SkipBlanks(p, pEnd);
+				if (p >= pEnd || !isIndexStart(*p)) break;
+
+				const auto i = (min)(n, 2u);
+				ObjScanner::ParseIndexTriplet(p, pEnd, vi, vti, vni);
+				v[i] = resolveIndex(vi, numVert);
+				while (p < pEnd && !ObjScanner::IsSeparator(*p)) ++p;
+
+				if (n < 2) continue;
+
+				// Triangle fan; the in-memory importers reverse the whole index buffer instead.
+				if (flipWinding) onTriangle(v[2], v[1], v[0]);
+				else onTriangle(v[0], v[1], v[2]);
+				v[1] = v[2];
+			}
+		}
+
+		p = ObjScanner::SkipLine(p, pEnd);
+	}
+}
+
+bool ObjLoader::ImportStreaming(const char* pszFilename, Sink* pSink, bool forDX, bool swapYZ)
+{
+	const auto startTime = chrono::steady_clock::now();
+	m_importStats = {};
+
+	MappedFile file;
+	if (!pSink || !file.Open(pszFilename)) return false;
+	const auto pData = file.GetData();
+	const auto pEnd = pData + file.GetSize();
+
+	// First pass: count the elements and bound the positions.
+	uint64_t numVert = 0, numIdx = 0;
+	AABB aabb = { float3(FLT_MAX, FLT_MAX, FLT_MAX), float3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+	streamObj(pData, pEnd, forDX, swapYZ, [&](const float3& p)
+	{
+		aabb.Min = float3((min)(aabb.Min.x, p.x), (min)(aabb.Min.y, p.y), (min)(aabb.Min.z, p.z));
+		aabb.Max = float3((max)(aabb.Max.x, p.x), (max)(aabb.Max.y, p.y), (max)(aabb.Max.z, p.z));
+		++numVert;
+	}, [&](uint32_t, uint32_t, uint32_t) { numIdx += 3; });
+	if (numVert == 0 || numVert > UINT32_MAX || numIdx > UINT32_MAX) return false;
+
+	// Second pass: encode positions and hand both streams to the sink in bounded batches.
+	const uint32_t batchSize = 1 << 16;
+	m_aabb = aabb;
+	const auto scale = GetDequantizationScale();
+	const auto bias = GetDequantizationBias();
+	m_stride = getPositionSize();
+
+	vector<uint8_t> vertices;
+	vector<uint32_t> indices;
+	vertices.reserve(static_cast<size_t>(m_stride) * batchSize);
+	indices.reserve(batchSize * 3);
+
+	auto success = pSink->Begin(m_stride, static_cast<uint32_t>(numVert), static_cast<uint32_t>(numIdx), aabb);
+	auto maxPosError = 0.0f;
+	const auto flushVertices = [&]()
+	{
+		success = success && pSink->WriteVertices(vertices.data(), static_cast<uint32_t>(vertices.size() / m_stride));
+		vertices.clear();
+	};
+	const auto flushIndices = [&]()
+	{
+		success = success && pSink->WriteIndices(indices.data(), static_cast<uint32_t>(indices.size()));
+		indices.clear();
+	};
+
+	streamObj(pData, pEnd, forDX, swapYZ, [&](const float3& p)
+	{
+		if (m_quantize)
+		{
+			const int16_t qPos[] = { toSnorm16((p.x - bias.x) / scale.x), toSnorm16((p.y - bias.y) / scale.y), toSnorm16((p.z - bias.z) / scale.z), 0 };
+			const auto pBytes = reinterpret_cast<const uint8_t*>(qPos);
+			vertices.insert(vertices.end(), pBytes, pBytes + sizeof(qPos));
+			maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[0]) * scale.x + bias.x - p.x));
+			maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[1]) * scale.y + bias.y - p.y));
+			maxPosError = (max)(maxPosError, fabsf(fromSnorm16(qPos[2]) * scale.z + bias.z - p.z));
+		}
+		else
+		{
+			const auto pBytes = reinterpret_cast<const uint8_t*>(&p);
+			vertices.insert(vertices.end(), pBytes, pBytes + sizeof(float3));
+		}
+		if (vertices.size() >= static_cast<size_t>(m_stride) * batchSize) flushVertices();
+	}, [&](uint32_t i0, uint32_t i1, uint32_t i2)
+	{
+		const uint32_t tri[] = { i0, i1, i2 };
+		indices.insert(indices.end(), tri, tri + 3);
+		if (indices.size() >= batchSize * 3) flushIndices();
+	});
+	flushVertices();
+	flushIndices();
+
+	m_importStats.NumBytes = file.GetSize();
+	m_importStats.NumVerticesBeforeWeld = static_cast<uint32_t>(numVert);
+	m_importStats.NumVerticesAfterWeld = static_cast<uint32_t>(numVert);
+	m_importStats.MaxPositionError = maxPosError;
+	success = success && pSink->End();
+
+	m_importStats.ParseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	m_importStats.ImportTime = m_importStats.ParseTime;
+
+	return success;
+}
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include "XUSGSoAStream.h"
+
 namespace XUSG
 {
 	class ObjLoader
@@ -28,28 +30,194 @@ namespace XUSG
 			float3 Max;
 		};
 
+		// Index range of one level of detail; all levels share the vertex buffer
+		struct LOD
+		{
+			uint32_t	StartIndex;
+			uint32_t	NumIndices;
+			float		Error;	// Simplification error (object units) against level 0
+		};
+
+		enum Parser : uint8_t
+		{
+			PARSER_STDIO,	// Two-pass fscanf_s reader
+			PARSER_MAPPED	// Single-pass tokenizer over a memory-mapped file
+		};
+
+		enum VertexLayout : uint8_t
+		{
+			VERTEX_LAYOUT_INTERLEAVED,	// One stream of position + attributes
+			VERTEX_LAYOUT_SPLIT			// Packed position stream followed by the attribute stream
+		};
+
+		struct ImportStats
+		{
+			uint64_t	NumBytes;
+			double		ParseTime;	// Seconds spent reading and tokenizing the file
+			double		ImportTime;	// Seconds spent in Import(), post-import tasks included
+			bool		CacheHit;	// Loaded from the binary mesh cache
+			uint32_t	NumVerticesBeforeWeld;
+			uint32_t	NumVerticesAfterWeld;
+			float		ACMRBefore;	// Average cache miss ratio (misses per triangle) of the simulated
+			float		ACMRAfter;	// post-transform cache, around triangle reordering and index optimization
+			float		IndexDistanceBefore;	// Mean distance between consecutive indices,
+			float		IndexDistanceAfter;		// around the same stages
+			float		MaxPositionError;	// Round-trip error of quantized positions (object units)
+			float		MaxNormalError;		// Round-trip error of quantized normals (degrees)
+			uint32_t	NumDegenerateTriangles;		// Removed by the mesh cleanup
+			uint32_t	NumDuplicateTriangles;		// Removed by the mesh cleanup; same vertices and winding
+			uint32_t	NumUnreferencedVertices;	// Removed by the mesh cleanup
+			uint32_t	NumNonManifoldEdges;		// Shared by more than two triangles after the cleanup
+			double		LODTime;	// Seconds spent generating the LOD chain, part of ImportTime
+
+			double GetBytesPerSecond() const;
+		};
+
+		// Receives the streams of ImportStreaming() in bounded batches
+		class Sink
+		{
+		public:
+			virtual ~Sink() {}
+
+			virtual bool Begin(uint32_t vertexStride, uint32_t numVertices, uint32_t numIndices, const AABB& aabb) = 0;
+			virtual bool WriteVertices(const uint8_t* pData, uint32_t numVertices) = 0;
+			virtual bool WriteIndices(const uint32_t* pData, uint32_t numIndices) = 0;
+			virtual bool End() = 0;
+		};
+
+		// Reusable buffers for the import temporaries. Loaders that share one, e.g. across a
+		// batch of parts, reach steady state without heap allocations once the buffers have
+		// grown to the largest part. Imports sharing a scratch must not run concurrently.
+		class Scratch;
+
 		ObjLoader();
 		virtual ~ObjLoader();
 
 		bool Import(const char* pszFilename, bool needNorm = true,
 			bool needAABB = true, bool forDX = true, bool swapYZ = false);
+		bool ImportStreaming(const char* pszFilename, Sink* pSink, bool forDX = true, bool swapYZ = false);
 
 		const uint32_t GetNumVertices() const;
-		const uint32_t GetNumIndices() const;
+		const uint32_t GetNumIndices() const;	// All levels of detail
 		const uint32_t GetVertexStride() const;
 		const uint8_t* GetVertices() const;
 		const uint32_t* GetIndices() const;
+		const uint8_t* GetPositions() const;
+		const uint8_t* GetAttributes() const;
+		const uint32_t GetPositionStride() const;
+		const uint32_t GetAttributeStride() const;
+		const bool IsQuantized() const;
+		const float3 GetDequantizationScale() const;	// Position = SNORM16 value * scale + bias
+		const float3 GetDequantizationBias() const;
+		const uint32_t GetNumLODs() const;
+		const LOD* GetLODs() const;				// Finest first; level 0 is the full mesh
+
+		const AABB& GetAABB() const;			// Empty unless imported with needAABB, reordering, LODs, or quantization
+		const ImportStats& GetImportStats() const;
+
+		void SetParser(Parser parser);
+		void SetNumThreads(uint32_t numThreads);	// 0 for the hardware concurrency
+		void SetMeshCache(bool enable);				// Read/write the <file>.<options>.svmesh sidecar
+		void SetVertexWelding(bool enable, float tolerance = 0.0f);	// 0 welds bit-identical vertices only, else within the tolerance per component
+		void SetIndexOptimization(bool enable);		// Vertex-cache then vertex-fetch reordering
+		void SetVertexLayout(VertexLayout layout);
+		void SetQuantization(bool enable);			// SNORM16 positions, octahedral SNORM16 normals, half texcoords
+		void SetStreaming(bool enable);				// Import() streams positions and indices through <file>.<options>.svmesh
+		void SetLODChain(bool enable);				// Append simplified levels of detail to the indices
+		void SetMeshCleanup(bool enable);			// Remove degenerate and duplicate triangles and unreferenced vertices
+		void SetTriangleReordering(bool enable);	// Sort triangles by the Morton codes of their centroids
+		void SetScratch(const std::shared_ptr<Scratch>& scratch);	// Null for one of its own
 
-		const AABB& GetAABB() const;
+		static float ComputeACMR(const uint32_t* pIndices, uint32_t numIndices,
+			uint32_t numVertices, uint32_t cacheSize = VertexCacheSize);
+		static std::shared_ptr<Scratch> MakeScratch();
+
+		static const uint32_t MeshCacheVersion;
+		static const uint32_t VertexCacheSize;
+		static const uint8_t MaxLODs = 8;
 
 	protected:
+		class MappedFile
+		{
+		public:
+			MappedFile();
+			~MappedFile();
+
+			bool Open(const char* pszFilename);
+			void Close();
+
+			const char* GetData() const;
+			uint64_t GetSize() const;
+
+		protected:
+			const char*	m_pData;
+			uint64_t	m_size;
+#if defined(WIN32) || defined(_WIN32)
+			void*		m_hFile;
+			void*		m_hMapping;
+#else
+			int			m_fd;
+#endif
+		};
+
+		struct ObjData
+		{
+			SoAStream				Positions;
+			SoAStream				Normals;
+			std::vector<uint32_t>	Indices;
+			std::vector<uint32_t>	NIndices;
+			std::vector<uint32_t>	RelIndices;		// Slots of relative (negative) v references
+			std::vector<uint32_t>	RelNIndices;	// Slots of relative (negative) vn references
+			uint32_t				NumTexc;
+
+			void Clear();	// Keeps the capacity
+		};
+
+		struct SourceInfo
+		{
+			uint64_t	Size;
+			int64_t		Time;
+		};
+
+		bool loadMeshCache(const std::string& cacheName, const char* pszFilename,
+			const SourceInfo& source, uint64_t importKey);
+		bool writeMeshCache(const std::string& cacheName, const char* pszFilename,
+			const SourceInfo& source, uint64_t importKey) const;
+		uint64_t getImportKey(bool needNorm, bool needAABB, bool forDX, bool swapYZ) const;
+
+		static bool hashFile(const char* pszFilename, uint64_t& hash);
+		static float computeACMR(const uint32_t* pIndices, uint32_t numIndices, uint32_t numVertices,
+			uint32_t cacheSize, std::vector<uint32_t>& timestamps);
+		static float computeIndexDistance(const uint32_t* pIndices, uint32_t numIndices);
+
+		virtual bool importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm);
+		virtual bool supportsStreaming() const;	// Whether Import() can use the out-of-core path
+
+		bool importStdio(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm);
+		bool importMapped(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm);
+		void parseMapped(const char* pData, const char* pEnd, ObjData& objData);
+		void parseMappedChunk(const char* pData, const char* pEnd, ObjData& objData);
+		void mergeChunks(std::vector<ObjData>& chunks, ObjData& objData);
+		void loadMappedData(ObjData& objData, bool forDX, bool swapYZ);
+		void loadStreams(SoAStream& positions, SoAStream& normals,
+			const std::vector<uint32_t>& nIndices, bool forDX, bool swapYZ);
 		void importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm);
 		void importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ);
 		void loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc, uint32_t numNorm,
 			std::vector<uint32_t>& nIndices, std::vector<uint32_t>& tIndices);
-		void computePerVertexNormals(const std::vector<float3>& normals, const std::vector<uint32_t>& nIndices);
+		void computePerVertexNormals(const SoAStream& normals, const std::vector<uint32_t>& nIndices);
 		void recomputeNormals();
-		void computeAABB();
+		void weldVertices();
+		void cleanupMesh();
+		void reorderTriangles();
+		void optimizeVertexCache(std::vector<uint32_t>& indices) const;
+		void optimizeVertexFetch();
+		void generateLODs();
+		void computeAABB(const SoAStream& positions);
+		void quantizeVertices();
+		void splitVertexStreams();
+		uint32_t getPositionSize() const;
+		uint32_t getNumThreads() const;
 
 		void* getVertex(uint32_t i);
 		float3& getPosition(uint32_t i);
@@ -57,9 +225,34 @@ namespace XUSG
 
 		std::vector<uint8_t>	m_vertices;
 		std::vector<uint32_t>	m_indices;
+		std::vector<LOD>		m_lods;
 
 		uint32_t	m_stride;
 
 		AABB		m_aabb;
+		bool		m_needAABB;
+
+		Parser		m_parser;
+		uint32_t	m_numThreads;
+		bool		m_useMeshCache;
+		bool		m_weldVertices;
+		float		m_weldTolerance;
+		bool		m_optimizeIndices;
+		VertexLayout m_vertexLayout;
+		bool		m_quantize;
+		bool		m_streaming;
+		bool		m_generateLODs;
+		bool		m_cleanupMesh;
+		bool		m_reorderTriangles;
+		ImportStats	m_importStats;
+
+		std::shared_ptr<Scratch> m_scratch;
+
+		// Zero-copy views into a mapped mesh cache
+		std::unique_ptr<MappedFile> m_meshCache;
+		const uint8_t*	m_pCachedVertices;
+		const uint32_t*	m_pCachedIndices;
+		uint32_t		m_numCachedVertices;
+		uint32_t		m_numCachedIndices;
 	};
 }
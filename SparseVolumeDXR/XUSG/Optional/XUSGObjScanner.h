@@ -0,0 +1,198 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XUSG_OBJ_SCANNER_SSE2 1
+#endif
+
+namespace XUSG
+{
+	// Numeric token scanner for OBJ text. Character classification and delimiter
+	// searches run on 16-byte blocks; the tail of a buffer falls back to scalar code,
+	// so no load ever crosses pEnd.
+	class ObjScanner
+	{
+	public:
+		enum IndexMask : uint8_t
+		{
+			INDEX_V = (1 << 0),
+			INDEX_VT = (1 << 1),
+			INDEX_VN = (1 << 2)
+		};
+
+		static bool IsBlank(char c) { return c == ' ' || c == '\t'; }
+		static bool IsSeparator(char c) { return IsBlank(c) || c == '\r' || c == '\n'; }
+		static bool IsDigit(char c) { return static_cast<uint8_t>(c - '0') < 10; }
+
+		static const char* SkipBlanks(const char* p, const char* pEnd)
+		{
+			while (p < pEnd && IsBlank(*p)) ++p;
+
+			return p;
+		}
+
+		// Returns the pointer past the next '\n', or pEnd.
+		static const char* SkipLine(const char* p, const char* pEnd)
+		{
+#if XUSG_OBJ_SCANNER_SSE2
+			const auto lf = _mm_set1_epi8('\n');
+			for (; pEnd - p >= 16; p += 16)
+			{
+				const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf)));
+				if (mask) return p + countTrailingZeros(mask) + 1;
+			}
+#endif
+			while (p < pEnd && *p != '\n') ++p;
+
+			return p < pEnd ? p + 1 : pEnd;
+		}
+
+		// Returns the first separator (blank, CR, LF) or '/' at or after p.
+		static const char* FindDelimiter(const char* p, const char* pEnd)
+		{
+#if XUSG_OBJ_SCANNER_SSE2
+			for (; pEnd - p >= 16; p += 16)
+			{
+				const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(classifyDelimiters(block)));
+				if (mask) return p + countTrailingZeros(mask);
+			}
+#endif
+			while (p < pEnd && !IsSeparator(*p) && *p != '/') ++p;
+
+			return p;
+		}
+
+		// Parses a decimal float with the same rounding as strtof: exactly representable
+		// cases take a fast path; anything ambiguous is handed to strtof.
+		static const char* ParseFloat(const char* p, const char* pEnd, float& f)
+		{
+			p = SkipBlanks(p, pEnd);
+			const auto pToken = p;
+			const auto pTokenEnd = FindDelimiter(p, pEnd);
+
+			auto neg = false;
+			if (p < pTokenEnd && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+			uint64_t mantissa = 0;
+			int32_t exp10 = 0;
+			auto numDigits = 0;
+			const auto pDigits = p;
+			for (; p < pTokenEnd && IsDigit(*p); ++p, ++numDigits) mantissa = mantissa * 10 + (*p - '0');
+			if (p < pTokenEnd && *p == '.')
+				for (++p; p < pTokenEnd && IsDigit(*p); ++p, ++numDigits, --exp10) mantissa = mantissa * 10 + (*p - '0');
+			auto valid = numDigits > 0 && p > pDigits;
+
+			if (valid && p < pTokenEnd && (*p == 'e' || *p == 'E'))
+			{
+				auto expNeg = false;
+				if (++p < pTokenEnd && (*p == '-' || *p == '+')) expNeg = *p++ == '-';
+				int32_t e = 0;
+				valid = p < pTokenEnd && IsDigit(*p);
+				for (; p < pTokenEnd && IsDigit(*p) && e < 10000; ++p) e = e * 10 + (*p - '0');
+				exp10 += expNeg ? -e : e;
+			}
+
+			// Clinger's fast path in double precision. The double result is correctly rounded,
+			// so rounding it to float is exact unless it landed on a float midpoint.
+			static const double powersOf10[] =
+			{
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+				1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+			if (valid && p == pTokenEnd && numDigits <= 19 && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22)
+			{
+				auto d = static_cast<double>(mantissa);
+				d = exp10 < 0 ? d / powersOf10[-exp10] : d * powersOf10[exp10];
+
+				uint64_t bits;
+				memcpy(&bits, &d, sizeof(bits));
+				if ((bits & ((1ull << 29) - 1)) != (1ull << 28))
+				{
+					f = static_cast<float>(neg ? -d : d);
+
+					return pTokenEnd;
+				}
+			}
+
+			return parseFloatSlow(pToken, pTokenEnd, f);
+		}
+
+		// Parses a signed decimal integer; stops at the first non-digit.
+		static const char* ParseIndex(const char* p, const char* pEnd, int64_t& i)
+		{
+			const auto neg = p < pEnd && *p == '-';
+			if (p < pEnd && (*p == '-' || *p == '+')) ++p;
+
+			const auto pDigitsEnd = FindDelimiter(p, pEnd);
+			i = 0;
+			for (; p < pDigitsEnd && IsDigit(*p); ++p) i = i * 10 + (*p - '0');
+			i = neg ? -i : i;
+
+			return p;
+		}
+
+		// Parses v, v/vt, v//vn or v/vt/vn and returns the IndexMask of what was present.
+		static uint8_t ParseIndexTriplet(const char*& p, const char* pEnd, int64_t& v, int64_t& vt, int64_t& vn)
+		{
+			uint8_t mask = INDEX_V;
+			p = ParseIndex(p, pEnd, v);
+			if (p < pEnd && *p == '/')
+			{
+				if (++p < pEnd && *p != '/')
+				{
+					p = ParseIndex(p, pEnd, vt);
+					mask |= INDEX_VT;
+				}
+				if (p < pEnd && *p == '/')
+				{
+					p = ParseIndex(p + 1, pEnd, vn);
+					mask |= INDEX_VN;
+				}
+			}
+
+			return mask;
+		}
+
+	protected:
+		static const char* parseFloatSlow(const char* p, const char* pEnd, float& f)
+		{
+			char buffer[64];
+			auto n = 0u;
+			while (p < pEnd && n + 1 < sizeof(buffer)) buffer[n++] = *p++;
+			buffer[n] = '\0';
+			f = n ? strtof(buffer, nullptr) : 0.0f;
+
+			return pEnd;
+		}
+
+		static uint32_t countTrailingZeros(uint32_t mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+
+			return index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+#if XUSG_OBJ_SCANNER_SSE2
+		static __m128i classifyDelimiters(__m128i block)
+		{
+			auto mask = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+			mask = _mm_or_si128(mask, _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+			mask = _mm_or_si128(mask, _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+			mask = _mm_or_si128(mask, _mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+
+			return _mm_or_si128(mask, _mm_cmpeq_epi8(block, _mm_set1_epi8('/')));
+		}
+#endif
+	};
+}
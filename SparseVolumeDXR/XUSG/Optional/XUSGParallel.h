@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace XUSG
+{
+	// Fork-join helpers of the CPU paths: threads are started per call, the first share of
+	// the work runs on the calling thread, and every call returns after all of it is done.
+	class Parallel
+	{
+	public:
+		// Splits [0, count) into at most numThreads ranges aligned to the granularity and runs
+		// func(begin, end) on them; nothing runs if count is 0.
+		template<typename Func>
+		static void For(uint32_t numThreads, uint32_t count, uint32_t granularity, const Func& func)
+		{
+			if (count == 0) return;
+
+			granularity = (std::max)(granularity, 1u);
+			const auto numBlocks = static_cast<uint32_t>((static_cast<uint64_t>(count) + granularity - 1) / granularity);
+			const auto numRanges = (std::min)((std::max)(numThreads, 1u), numBlocks / 16 + 1);
+			const auto getBound = [&](uint32_t i)
+			{
+				return static_cast<uint32_t>((std::min)(static_cast<uint64_t>(numBlocks) * i / numRanges * granularity,
+					static_cast<uint64_t>(count)));
+			};
+
+			std::vector<std::thread> workers;
+			workers.reserve(numRanges - 1);
+			for (auto i = 1u; i < numRanges; ++i) workers.emplace_back(func, getBound(i), getBound(i + 1));
+			func(0, getBound(1));
+			for (auto& worker : workers) worker.join();
+		}
+
+		// Runs func(i) for each i in [0, count) on its own thread.
+		template<typename Func>
+		static void Run(uint32_t count, const Func& func)
+		{
+			if (count == 0) return;
+
+			std::vector<std::thread> workers;
+			workers.reserve(count - 1);
+			for (auto i = 1u; i < count; ++i) workers.emplace_back(func, i);
+			func(0);
+			for (auto& worker : workers) worker.join();
+		}
+	};
+}
@@ -0,0 +1,405 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <chrono>
+#include "XUSGPlyLoader.h"
+#include "XUSGObjScanner.h"
+
+using namespace std;
+using namespace XUSG;
+
+static inline void loadBytes(void* pDst, const uint8_t* pSrc, uint32_t size, bool swapBytes)
+{
+	if (swapBytes) for (auto i = 0u; i < size; ++i) static_cast<uint8_t*>(pDst)[i] = pSrc[size - 1 - i];
+	else memcpy(pDst, pSrc, size);
+}
+
+template<typename T>
+static inline T loadValue(const uint8_t* p, bool swapBytes)
+{
+	T value;
+	loadBytes(&value, p, sizeof(T), swapBytes);
+
+	return value;
+}
+
+PlyLoader::PlyLoader() :
+	ObjLoader()
+{
+}
+
+PlyLoader::~PlyLoader()
+{
+}
+
+bool PlyLoader::importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm)
+{
+	const auto startTime = chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(pszFilename)) return false;
+
+	auto p = file.GetData();
+	const auto pEnd = p + file.GetSize();
+	auto bigEndian = false;
+	vector<Element> elements;
+	if (!parseHeader(p, pEnd, bigEndian, elements)) return false;
+
+	// Elements are stored back to back in header order.
+	const uint16_t endianProbe = 1;
+	const auto swapBytes = bigEndian == (*reinterpret_cast<const uint8_t*>(&endianProbe) == 1);
+	auto pBytes = reinterpret_cast<const uint8_t*>(p);
+	const auto pBytesEnd = reinterpret_cast<const uint8_t*>(pEnd);
+	SoAStream positions, normals;
+	auto hasVertices = false;
+	auto hasFaces = false;
+	const Element* pDeferredFaces = nullptr;
+	const uint8_t* pDeferredFaceRecords = nullptr;
+	for (const auto& element : elements)
+	{
+		if (element.Name == "vertex" && !hasVertices)
+		{
+			pBytes = loadVertices(pBytes, pBytesEnd, element, swapBytes, positions, normals);
+			hasVertices = true;
+		}
+		else if (element.Name == "face" && !hasFaces)
+		{
+			// Faces ahead of the vertices are loaded once the vertex count is known.
+			if (hasVertices) pBytes = loadFaces(pBytes, pBytesEnd, element, swapBytes, static_cast<uint32_t>(positions.GetSize()));
+			else
+			{
+				pDeferredFaces = &element;
+				pDeferredFaceRecords = pBytes;
+				pBytes = skipRecords(pBytes, pBytesEnd, element, swapBytes);
+			}
+			hasFaces = true;
+		}
+		else pBytes = skipRecords(pBytes, pBytesEnd, element, swapBytes);
+
+		if (!pBytes) return false;
+	}
+
+	if (pDeferredFaces && !loadFaces(pDeferredFaceRecords, pBytesEnd, *pDeferredFaces,
+		swapBytes, static_cast<uint32_t>(positions.GetSize()))) return false;
+
+	m_importStats.NumBytes = file.GetSize();
+	file.Close();
+
+	m_importStats.ParseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	if (!hasVertices) return false;
+
+	// PLY normals are per vertex, so every corner refers to the normal of its vertex.
+	const auto numVert = static_cast<uint32_t>(positions.GetSize());
+	numNorm = static_cast<uint32_t>(normals.GetSize());
+	m_stride = sizeof(float3);
+	m_stride += needNorm || numNorm ? sizeof(float3) : 0;
+	m_vertices.resize(m_stride * numVert);
+	// The normal indices alias the vertex indices, which loadStreams() then leaves unsplit.
+	loadStreams(positions, normals, m_indices, forDX, swapYZ);
+
+	return true;
+}
+
+bool PlyLoader::supportsStreaming() const
+{
+	return false;
+}
+
+bool PlyLoader::parseHeader(const char*& p, const char* pEnd, bool& bigEndian, vector<Element>& elements)
+{
+	auto isBinary = false;
+	for (auto isFirstLine = true; p < pEnd; isFirstLine = false)
+	{
+		const auto pLineEnd = ObjScanner::SkipLine(p, pEnd);
+		istringstream line(string(p, pLineEnd));
+		p = pLineEnd;
+
+		string keyword;
+		line >> keyword;
+		if (isFirstLine && keyword != "ply") return false;
+
+		if (keyword == "format")
+		{
+			string format;
+			line >> format;
+			bigEndian = format == "binary_big_endian";
+			isBinary = bigEndian || format == "binary_little_endian";
+		}
+		else if (keyword == "element")
+		{
+			elements.emplace_back();
+			auto& element = elements.back();
+			element.Count = 0;
+			element.RecordSize = 0;
+			line >> element.Name >> element.Count;
+		}
+		else if (keyword == "property")
+		{
+			if (elements.empty()) return false;
+
+			Property property = {};
+			string type;
+			line >> type;
+			if (type == "list")
+			{
+				string countType;
+				line >> countType >> type;
+				property.IsList = true;
+				property.CountType = getPropertyType(countType);
+				if (property.CountType >= NUM_PROPERTY_TYPE) return false;
+			}
+			property.Type = getPropertyType(type);
+			if (property.Type >= NUM_PROPERTY_TYPE) return false;
+			line >> property.Name;
+			elements.back().Properties.emplace_back(property);
+		}
+		else if (keyword == "end_header")
+		{
+			// Offsets and record sizes of elements without list properties
+			for (auto& element : elements)
+			{
+				auto offset = 0u;
+				auto isFixedSize = true;
+				for (auto& property : element.Properties)
+				{
+					property.Offset = offset;
+					offset += getPropertySize(property.Type);
+					isFixedSize = isFixedSize && !property.IsList;
+				}
+				element.RecordSize = isFixedSize ? offset : 0;
+			}
+
+			return isBinary;
+		}
+	}
+
+	return false;
+}
+
+const uint8_t* PlyLoader::loadVertices(const uint8_t* p, const uint8_t* pEnd, const Element& element,
+	bool swapBytes, SoAStream& positions, SoAStream& normals)
+{
+	static const char* names[] = { "x", "y", "z", "nx", "ny", "nz" };
+	int32_t propIdx[6] = { -1, -1, -1, -1, -1, -1 };
+	const auto numProps = static_cast<uint32_t>(element.Properties.size());
+	for (auto i = 0u; i < numProps; ++i)
+		for (uint8_t j = 0; j < 6; ++j)
+			if (!element.Properties[i].IsList && element.Properties[i].Name == names[j]) propIdx[j] = static_cast<int32_t>(i);
+	if (propIdx[0] < 0 || propIdx[1] < 0 || propIdx[2] < 0 || element.Count > UINT32_MAX) return nullptr;
+
+	const auto hasNormals = propIdx[3] >= 0 && propIdx[4] >= 0 && propIdx[5] >= 0;
+	const auto numVert = static_cast<size_t>(element.Count);
+	positions.Resize(numVert);
+	normals.Resize(hasNormals ? numVert : 0);
+	SoAStream* const pStreams[] = { &positions, &normals };
+
+	if (element.RecordSize)
+	{
+		const auto size = static_cast<uint64_t>(element.RecordSize) * element.Count;
+		if (static_cast<uint64_t>(pEnd - p) < size) return nullptr;
+
+		// Bulk path: packed float32 triples in native byte order are deinterleaved with
+		// strided copies; anything else is converted value by value.
+		for (uint8_t s = 0; s < (hasNormals ? 2 : 1); ++s)
+		{
+			const auto& px = element.Properties[propIdx[s * 3]];
+			const auto& py = element.Properties[propIdx[s * 3 + 1]];
+			const auto& pz = element.Properties[propIdx[s * 3 + 2]];
+			const auto isPacked = !swapBytes && px.Type == PROPERTY_FLOAT32 && py.Type == PROPERTY_FLOAT32 &&
+				pz.Type == PROPERTY_FLOAT32 && py.Offset == px.Offset + 4 && pz.Offset == px.Offset + 8;
+			auto& stream = *pStreams[s];
+			if (isPacked) stream.Load(p + px.Offset, element.RecordSize, numVert);
+			else for (size_t i = 0; i < numVert; ++i)
+			{
+				const auto pRecord = p + element.RecordSize * i;
+				stream.X[i] = static_cast<float>(readScalar(pRecord + px.Offset, px.Type, swapBytes));
+				stream.Y[i] = static_cast<float>(readScalar(pRecord + py.Offset, py.Type, swapBytes));
+				stream.Z[i] = static_cast<float>(readScalar(pRecord + pz.Offset, pz.Type, swapBytes));
+			}
+		}
+
+		return p + size;
+	}
+
+	// Records with list properties are walked property by property.
+	for (size_t i = 0; i < numVert; ++i)
+	{
+		float values[6] = {};
+		for (auto j = 0u; j < numProps; ++j)
+		{
+			const auto& property = element.Properties[j];
+			if (property.IsList)
+			{
+				const auto countSize = getPropertySize(property.CountType);
+				if (static_cast<size_t>(pEnd - p) < countSize) return nullptr;
+				const auto count = static_cast<uint64_t>(readScalar(p, property.CountType, swapBytes));
+				const auto size = countSize + count * getPropertySize(property.Type);
+				if (static_cast<uint64_t>(pEnd - p) < size) return nullptr;
+				p += size;
+				continue;
+			}
+
+			const auto size = getPropertySize(property.Type);
+			if (static_cast<size_t>(pEnd - p) < size) return nullptr;
+			for (uint8_t k = 0; k < 6; ++k)
+				if (propIdx[k] == static_cast<int32_t>(j)) values[k] = static_cast<float>(readScalar(p, property.Type, swapBytes));
+			p += size;
+		}
+
+		positions.X[i] = values[0];
+		positions.Y[i] = values[1];
+		positions.Z[i] = values[2];
+		if (hasNormals)
+		{
+			normals.X[i] = values[3];
+			normals.Y[i] = values[4];
+			normals.Z[i] = values[5];
+		}
+	}
+
+	return p;
+}
+
+const uint8_t* PlyLoader::loadFaces(const uint8_t* p, const uint8_t* pEnd, const Element& element,
+	bool swapBytes, uint32_t numVert)
+{
+	auto listIdx = -1;
+	const auto numProps = static_cast<uint32_t>(element.Properties.size());
+	for (auto i = 0u; i < numProps; ++i)
+	{
+		const auto& property = element.Properties[i];
+		if (property.IsList && (property.Name == "vertex_indices" || property.Name == "vertex_index"))
+			listIdx = static_cast<int32_t>(i);
+	}
+	if (listIdx < 0) return nullptr;
+
+	const auto& list = element.Properties[listIdx];
+	const auto indexSize = getPropertySize(list.Type);
+	const auto isCommonLayout = numProps == 1 && list.CountType == PROPERTY_UINT8 &&
+		(list.Type == PROPERTY_INT32 || list.Type == PROPERTY_UINT32);
+	m_indices.reserve(static_cast<size_t>((min)(element.Count, static_cast<uint64_t>(UINT32_MAX / 3))) * 3);
+
+	vector<uint32_t> polygon;
+	for (uint64_t i = 0; i < element.Count; ++i)
+	{
+		for (auto j = 0u; j < numProps; ++j)
+		{
+			const auto& property = element.Properties[j];
+			if (!property.IsList)
+			{
+				const auto size = getPropertySize(property.Type);
+				if (static_cast<size_t>(pEnd - p) < size) return nullptr;
+				p += size;
+				continue;
+			}
+
+			if (static_cast<size_t>(pEnd - p) < getPropertySize(property.CountType)) return nullptr;
+			const auto count = isCommonLayout ? *p : static_cast<uint64_t>(readScalar(p, property.CountType, swapBytes));
+			p += getPropertySize(property.CountType);
+			const auto size = count * getPropertySize(property.Type);
+			if (static_cast<uint64_t>(pEnd - p) < size) return nullptr;
+
+			if (static_cast<int32_t>(j) == listIdx)
+			{
+				polygon.resize(static_cast<size_t>(count));
+				if (isCommonLayout) for (auto k = 0u; k < count; ++k)
+					polygon[k] = loadValue<uint32_t>(p + indexSize * k, swapBytes);
+				else for (auto k = 0u; k < count; ++k)
+					polygon[k] = static_cast<uint32_t>(readScalar(p + indexSize * k, list.Type, swapBytes));
+
+				// Triangle fan; triangles referencing missing vertices are dropped.
+				for (auto k = 2u; k < count; ++k)
+				{
+					const uint32_t tri[] = { polygon[0], polygon[k - 1], polygon[k] };
+					if (tri[0] < numVert && tri[1] < numVert && tri[2] < numVert)
+						m_indices.insert(m_indices.end(), tri, tri + 3);
+				}
+			}
+			p += size;
+		}
+	}
+	return p;
+}
+
+const uint8_t* PlyLoader::skipRecords(const uint8_t* p, const uint8_t* pEnd, const Element& element, bool swapBytes)
+{
+	if (element.RecordSize)
+	{
+		const auto size = static_cast<uint64_t>(element.RecordSize) * element.Count;
+
+		return static_cast<uint64_t>(pEnd - p) < size ? nullptr : p + size;
+	}
+
+	for (uint64_t i = 0; i < element.Count; ++i)
+	{
+		for (const auto& property : element.Properties)
+		{
+			auto size = static_cast<uint64_t>(getPropertySize(property.Type));
+			if (property.IsList)
+			{
+				const auto countSize = getPropertySize(property.CountType);
+				if (static_cast<size_t>(pEnd - p) < countSize) return nullptr;
+				size = countSize + static_cast<uint64_t>(readScalar(p, property.CountType, swapBytes)) * size;
+			}
+
+			if (static_cast<uint64_t>(pEnd - p) < size) return nullptr;
+			p += size;
+		}
+	}
+
+	return p;
+}
+
+double PlyLoader::readScalar(const uint8_t* p, PropertyType type, bool swapBytes)
+{
+	switch (type)
+	{
+	case PROPERTY_INT8:
+		return static_cast<int8_t>(*p);
+	case PROPERTY_UINT8:
+		return *p;
+	case PROPERTY_INT16:
+		return loadValue<int16_t>(p, swapBytes);
+	case PROPERTY_UINT16:
+		return loadValue<uint16_t>(p, swapBytes);
+	case PROPERTY_INT32:
+		return loadValue<int32_t>(p, swapBytes);
+	case PROPERTY_UINT32:
+		return loadValue<uint32_t>(p, swapBytes);
+	case PROPERTY_FLOAT32:
+		return loadValue<float>(p, swapBytes);
+	case PROPERTY_FLOAT64:
+		return loadValue<double>(p, swapBytes);
+	default:
+		return 0.0;
+	}
+}
+
+PlyLoader::PropertyType PlyLoader::getPropertyType(const string& name)
+{
+	static const char* names[][2] =
+	{
+		{ "char", "int8" },
+		{ "uchar", "uint8" },
+		{ "short", "int16" },
+		{ "ushort", "uint16" },
+		{ "int", "int32" },
+		{ "uint", "uint32" },
+		{ "float", "float32" },
+		{ "double", "float64" }
+	};
+
+	for (uint8_t i = 0; i < NUM_PROPERTY_TYPE; ++i)
+		if (name == names[i][0] || name == names[i][1]) return static_cast<PropertyType>(i);
+
+	return NUM_PROPERTY_TYPE;
+}
+
+uint32_t PlyLoader::getPropertySize(PropertyType type)
+{
+	static const uint32_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+	return type < NUM_PROPERTY_TYPE ? sizes[type] : 0;
+}
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "XUSGObjLoader.h"
+
+namespace XUSG
+{
+	// Binary PLY (little or big endian) importer. Shares the post-import pipeline and the
+	// output interface of ObjLoader; x/y/z and nx/ny/nz are read, other properties skipped.
+	class PlyLoader :
+		public ObjLoader
+	{
+	public:
+		PlyLoader();
+		virtual ~PlyLoader();
+
+	protected:
+		enum PropertyType : uint8_t
+		{
+			PROPERTY_INT8,
+			PROPERTY_UINT8,
+			PROPERTY_INT16,
+			PROPERTY_UINT16,
+			PROPERTY_INT32,
+			PROPERTY_UINT32,
+			PROPERTY_FLOAT32,
+			PROPERTY_FLOAT64,
+
+			NUM_PROPERTY_TYPE
+		};
+
+		struct Property
+		{
+			std::string		Name;
+			PropertyType	Type;
+			PropertyType	CountType;	// Valid for list properties only
+			bool			IsList;
+			uint32_t		Offset;		// Byte offset in fixed-size records
+		};
+
+		struct Element
+		{
+			std::string				Name;
+			uint64_t				Count;
+			std::vector<Property>	Properties;
+			uint32_t				RecordSize;	// 0 if the element has list properties
+		};
+
+		virtual bool importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm);
+		virtual bool supportsStreaming() const;
+
+		bool parseHeader(const char*& p, const char* pEnd, bool& bigEndian, std::vector<Element>& elements);
+		const uint8_t* loadVertices(const uint8_t* p, const uint8_t* pEnd, const Element& element,
+			bool swapBytes, SoAStream& positions, SoAStream& normals);
+		const uint8_t* loadFaces(const uint8_t* p, const uint8_t* pEnd, const Element& element,
+			bool swapBytes, uint32_t numVert);
+
+		static const uint8_t* skipRecords(const uint8_t* p, const uint8_t* pEnd, const Element& element, bool swapBytes);
+		static double readScalar(const uint8_t* p, PropertyType type, bool swapBytes);
+		static PropertyType getPropertyType(const std::string& name);
+		static uint32_t getPropertySize(PropertyType type);
+	};
+}
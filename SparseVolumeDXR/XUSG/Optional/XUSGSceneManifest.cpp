@@ -0,0 +1,234 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <fstream>
+#include "XUSGSceneManifest.h"
+
+using namespace std;
+using namespace XUSG;
+
+SceneManifest::SceneManifest()
+{
+}
+
+SceneManifest::~SceneManifest()
+{
+}
+
+bool SceneManifest::Load(const char* fileName)
+{
+	ifstream file(fileName, ios::in | ios::binary);
+	if (!file) return false;
+
+	const string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	const string path(fileName);
+	const auto slashPos = path.find_last_of("/\\");
+
+	return Parse(text.c_str(), text.size(), slashPos != string::npos ? path.substr(0, slashPos + 1).c_str() : "");
+}
+
+bool SceneManifest::Parse(const char* pText, size_t size, const char* baseDir)
+{
+	Clear();
+
+	const string dir(baseDir);
+	const auto pEnd = pText + size;
+	for (auto p = pText; p < pEnd;)
+	{
+		auto pLineEnd = p;
+		while (pLineEnd < pEnd && *pLineEnd != '\n') ++pLineEnd;
+		if (!parseLine(string(p, pLineEnd), dir)) return false;
+		p = pLineEnd + 1;
+	}
+
+	Pack();
+
+	return true;
+}
+
+uint32_t SceneManifest::AddMesh(const char* name, const char* fileName)
+{
+	m_meshes.push_back({ name, fileName });
+
+	return static_cast<uint32_t>(m_meshes.size() - 1);
+}
+
+void SceneManifest::AddInstance(uint32_t meshIndex, const float transform[3][4])
+{
+	Instance instance;
+	instance.MeshIndex = meshIndex;
+	memcpy(instance.Transform, transform, sizeof(instance.Transform));
+	m_instances.push_back(instance);
+}
+
+void SceneManifest::Clear()
+{
+	m_meshes.clear();
+	m_instances.clear();
+	m_drawRanges.clear();
+}
+
+void SceneManifest::Pack()
+{
+	const auto numMeshes = static_cast<uint32_t>(m_meshes.size());
+
+	// Count the instances of each mesh, and compact away the meshes without instances
+	vector<uint32_t> counts(numMeshes);
+	for (const auto& instance : m_instances) ++counts[instance.MeshIndex];
+
+	vector<uint32_t> meshRemap(numMeshes);
+	uint32_t numUsedMeshes = 0;
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		meshRemap[i] = numUsedMeshes;
+		if (counts[i] == 0) continue;
+		if (numUsedMeshes != i) m_meshes[numUsedMeshes] = move(m_meshes[i]);
+		++numUsedMeshes;
+	}
+	m_meshes.resize(numUsedMeshes);
+
+	// Counting sort keeps the manifest order of the instances within each mesh
+	m_drawRanges.resize(numUsedMeshes);
+	uint32_t firstInstance = 0;
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		if (counts[i] == 0) continue;
+		auto& drawRange = m_drawRanges[meshRemap[i]];
+		drawRange.MeshIndex = meshRemap[i];
+		drawRange.FirstInstance = firstInstance;
+		drawRange.NumInstances = counts[i];
+		firstInstance += counts[i];
+	}
+
+	vector<Instance> instances(m_instances.size());
+	vector<uint32_t> offsets(numUsedMeshes);
+	for (const auto& instance : m_instances)
+	{
+		const auto meshIndex = meshRemap[instance.MeshIndex];
+		auto& dst = instances[m_drawRanges[meshIndex].FirstInstance + offsets[meshIndex]++];
+		dst = instance;
+		dst.MeshIndex = meshIndex;
+	}
+	m_instances.swap(instances);
+}
+
+uint32_t SceneManifest::GetNumMeshes() const
+{
+	return static_cast<uint32_t>(m_meshes.size());
+}
+
+uint32_t SceneManifest::GetNumInstances() const
+{
+	return static_cast<uint32_t>(m_instances.size());
+}
+
+uint32_t SceneManifest::GetNumDrawRanges() const
+{
+	return static_cast<uint32_t>(m_drawRanges.size());
+}
+
+const SceneManifest::Mesh* SceneManifest::GetMeshes() const
+{
+	return m_meshes.data();
+}
+
+const SceneManifest::Instance* SceneManifest::GetInstances() const
+{
+	return m_instances.data();
+}
+
+const SceneManifest::DrawRange* SceneManifest::GetDrawRanges() const
+{
+	return m_drawRanges.data();
+}
+
+void SceneManifest::ComposeTransform(float transform[3][4], const float translation[3],
+	float scale, float pitch, float yaw, float roll)
+{
+	// Scale, then roll (Z), pitch (X) and yaw (Y), then translate; R = Ry * Rx * Rz
+	const auto toRadians = 3.14159265358979f / 180.0f;
+	const auto sp = sinf(pitch * toRadians), cp = cosf(pitch * toRadians);
+	const auto sy = sinf(yaw * toRadians), cy = cosf(yaw * toRadians);
+	const auto sr = sinf(roll * toRadians), cr = cosf(roll * toRadians);
+	const float rotation[3][3] =
+	{
+		{ cy * cr + sy * sp * sr,	sy * sp * cr - cy * sr,	sy * cp },
+		{ cp * sr,					cp * cr,				-sp },
+		{ cy * sp * sr - sy * cr,	sy * sr + cy * sp * cr,	cy * cp }
+	};
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		for (uint8_t j = 0; j < 3; ++j) transform[i][j] = rotation[i][j] * scale;
+		transform[i][3] = translation[i];
+	}
+}
+
+bool SceneManifest::parseLine(const string& line, const string& baseDir)
+{
+	istringstream stream(line.substr(0, line.find('#')));
+	string keyword;
+	if (!(stream >> keyword)) return true; // Blank or comment line
+
+	if (keyword == "mesh")
+	{
+		string name, fileName;
+		if (!(stream >> name >> fileName)) return false;
+		if (!stream.eof() && !(stream >> ws).eof()) return false;
+		if (findMesh(name) >= 0) return false;
+		AddMesh(name.c_str(), (isAbsolutePath(fileName) ? fileName : baseDir + fileName).c_str());
+
+		return true;
+	}
+
+	if (keyword == "instance")
+	{
+		string name;
+		if (!(stream >> name)) return false;
+		const auto meshIndex = findMesh(name);
+		if (meshIndex < 0) return false;
+
+		float values[12];
+		uint8_t numValues = 0;
+		while (numValues < 12 && stream >> values[numValues]) ++numValues;
+		if (!stream.eof() && !(stream >> ws).eof()) return false;
+
+		float transform[3][4];
+		switch (numValues)
+		{
+		case 3:
+			ComposeTransform(transform, values);
+			break;
+		case 4:
+			ComposeTransform(transform, values, values[3]);
+			break;
+		case 7:
+			ComposeTransform(transform, values, values[3], values[4], values[5], values[6]);
+			break;
+		case 12:
+			memcpy(transform, values, sizeof(transform));
+			break;
+		default:
+			return false;
+		}
+		AddInstance(static_cast<uint32_t>(meshIndex), transform);
+
+		return true;
+	}
+
+	return false;
+}
+
+int32_t SceneManifest::findMesh(const string& name) const
+{
+	for (size_t i = 0; i < m_meshes.size(); ++i)
+		if (m_meshes[i].Name == name) return static_cast<int32_t>(i);
+
+	return -1;
+}
+
+bool SceneManifest::isAbsolutePath(const string& path)
+{
+	return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
@@ -0,0 +1,70 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Text manifest of the meshes in a scene and their instances. Each line is one of
+	//   mesh <name> <file>				File path relative to the manifest
+	//   instance <mesh name> <values>	3 values: translation; 4: + uniform scale;
+	//									7: + pitch, yaw and roll in degrees; 12: row-major 3x4 matrix
+	// and '#' starts a comment. The manifest has no platform or graphics API dependencies.
+	class SceneManifest
+	{
+	public:
+		struct Mesh
+		{
+			std::string	Name;
+			std::string	FileName;
+		};
+
+		struct Instance
+		{
+			uint32_t	MeshIndex;
+			float		Transform[3][4];	// Row-major 3x4 (column vectors), as in ray-tracing instance descs
+		};
+
+		struct DrawRange
+		{
+			uint32_t	MeshIndex;
+			uint32_t	FirstInstance;
+			uint32_t	NumInstances;
+		};
+
+		SceneManifest();
+		virtual ~SceneManifest();
+
+		bool Load(const char* fileName);
+		bool Parse(const char* pText, size_t size, const char* baseDir = "");
+		uint32_t AddMesh(const char* name, const char* fileName);
+		void AddInstance(uint32_t meshIndex, const float transform[3][4]);
+		void Clear();
+
+		// Drops unreferenced meshes and groups the instances by mesh, so that each mesh
+		// draws all of its instances from one contiguous range.
+		void Pack();
+
+		uint32_t GetNumMeshes() const;
+		uint32_t GetNumInstances() const;
+		uint32_t GetNumDrawRanges() const;
+
+		const Mesh* GetMeshes() const;
+		const Instance* GetInstances() const;
+		const DrawRange* GetDrawRanges() const;
+
+		static void ComposeTransform(float transform[3][4], const float translation[3],
+			float scale = 1.0f, float pitch = 0.0f, float yaw = 0.0f, float roll = 0.0f);
+
+	protected:
+		bool parseLine(const std::string& line, const std::string& baseDir);
+		int32_t findMesh(const std::string& name) const;
+
+		static bool isAbsolutePath(const std::string& path);
+
+		std::vector<Mesh>		m_meshes;
+		std::vector<Instance>	m_instances;
+		std::vector<DrawRange>	m_drawRanges;
+	};
+}
@@ -0,0 +1,227 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define XUSG_SOA_STREAM_AVX 1
+#elif defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XUSG_SOA_STREAM_SSE2 1
+#endif
+
+namespace XUSG
+{
+	// Structure-of-arrays float3 stream. The element-wise passes process 8 elements per
+	// step: one AVX register, or a pair of SSE registers when AVX is not enabled. NegateZ()
+	// and Normalize() are bit-identical to their scalar tails.
+	class SoAStream
+	{
+	public:
+		void Reserve(size_t size)
+		{
+			X.reserve(size);
+			Y.reserve(size);
+			Z.reserve(size);
+		}
+
+		void Resize(size_t size)
+		{
+			X.resize(size);
+			Y.resize(size);
+			Z.resize(size);
+		}
+
+		void Clear()
+		{
+			X.clear();
+			Y.clear();
+			Z.clear();
+		}
+
+		size_t GetSize() const { return X.size(); }
+
+		void PushBack(float x, float y, float z)
+		{
+			X.push_back(x);
+			Y.push_back(y);
+			Z.push_back(z);
+		}
+
+		void Append(const SoAStream& src)
+		{
+			X.insert(X.end(), src.X.cbegin(), src.X.cend());
+			Y.insert(Y.end(), src.Y.cbegin(), src.Y.cend());
+			Z.insert(Z.end(), src.Z.cbegin(), src.Z.cend());
+		}
+
+		// Gathers count float3 elements spaced by stride bytes.
+		void Load(const void* pSrc, size_t stride, size_t count)
+		{
+			Resize(count);
+			const auto pBytes = static_cast<const uint8_t*>(pSrc);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const auto p = reinterpret_cast<const float*>(pBytes + stride * i);
+				X[i] = p[0];
+				Y[i] = p[1];
+				Z[i] = p[2];
+			}
+		}
+
+		// Scatters the elements to float3 slots spaced by stride bytes.
+		void Store(void* pDst, size_t stride) const
+		{
+			const auto pBytes = static_cast<uint8_t*>(pDst);
+			const auto size = GetSize();
+			for (size_t i = 0; i < size; ++i)
+			{
+				const auto p = reinterpret_cast<float*>(pBytes + stride * i);
+				p[0] = X[i];
+				p[1] = Y[i];
+				p[2] = Z[i];
+			}
+		}
+
+		void SwapYZ() { Y.swap(Z); }
+
+		void NegateZ()
+		{
+			const auto size = GetSize();
+			auto pZ = Z.data();
+			size_t i = 0;
+#if XUSG_SOA_STREAM_AVX || XUSG_SOA_STREAM_SSE2
+			const auto sign = set1(-0.0f);
+			for (; i + 8 <= size; i += 8) store(pZ + i, xorBits(load(pZ + i), sign));
+#endif
+			for (; i < size; ++i) pZ[i] = -pZ[i];
+		}
+
+		// Scales each element to unit length; zero-length elements are left as they are.
+		void Normalize()
+		{
+			const auto size = GetSize();
+			auto pX = X.data(), pY = Y.data(), pZ = Z.data();
+			size_t i = 0;
+#if XUSG_SOA_STREAM_AVX || XUSG_SOA_STREAM_SSE2
+			for (; i + 8 <= size; i += 8)
+			{
+				const auto x = load(pX + i);
+				const auto y = load(pY + i);
+				const auto z = load(pZ + i);
+				const auto l = sqrt(add(add(mul(x, x), mul(y, y)), mul(z, z)));
+				const auto valid = greater(l, set1(0.0f));
+				store(pX + i, select(valid, div(x, l), x));
+				store(pY + i, select(valid, div(y, l), y));
+				store(pZ + i, select(valid, div(z, l), z));
+			}
+#endif
+			for (; i < size; ++i)
+			{
+				const auto l = std::sqrt(pX[i] * pX[i] + pY[i] * pY[i] + pZ[i] * pZ[i]);
+				if (l > 0.0f)
+				{
+					pX[i] /= l;
+					pY[i] /= l;
+					pZ[i] /= l;
+				}
+			}
+		}
+
+		// Returns false for an empty stream.
+		bool GetBounds(float(&minVal)[3], float(&maxVal)[3]) const
+		{
+			const auto size = GetSize();
+			if (!size) return false;
+
+			const float* pStreams[] = { X.data(), Y.data(), Z.data() };
+			for (uint8_t c = 0; c < 3; ++c)
+			{
+				const auto pS = pStreams[c];
+				auto minV = pS[0], maxV = pS[0];
+				size_t i = 0;
+#if XUSG_SOA_STREAM_AVX || XUSG_SOA_STREAM_SSE2
+				if (size >= 8)
+				{
+					auto minL = load(pS), maxL = minL;
+					for (i = 8; i + 8 <= size; i += 8)
+					{
+						const auto v = load(pS + i);
+						minL = (min)(minL, v);
+						maxL = (max)(maxL, v);
+					}
+
+					float minLanes[8], maxLanes[8];
+					store(minLanes, minL);
+					store(maxLanes, maxL);
+					for (uint8_t j = 0; j < 8; ++j)
+					{
+						minV = minLanes[j] < minV ? minLanes[j] : minV;
+						maxV = maxLanes[j] > maxV ? maxLanes[j] : maxV;
+					}
+				}
+#endif
+				for (; i < size; ++i)
+				{
+					minV = pS[i] < minV ? pS[i] : minV;
+					maxV = pS[i] > maxV ? pS[i] : maxV;
+				}
+
+				minVal[c] = minV;
+				maxVal[c] = maxV;
+			}
+
+			return true;
+		}
+
+		std::vector<float> X;
+		std::vector<float> Y;
+		std::vector<float> Z;
+
+	protected:
+#if XUSG_SOA_STREAM_AVX
+		using float8 = __m256;
+
+		static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+		static void store(float* p, float8 v) { _mm256_storeu_ps(p, v); }
+		static float8 set1(float f) { return _mm256_set1_ps(f); }
+		static float8 add(float8 a, float8 b) { return _mm256_add_ps(a, b); }
+		static float8 mul(float8 a, float8 b) { return _mm256_mul_ps(a, b); }
+		static float8 div(float8 a, float8 b) { return _mm256_div_ps(a, b); }
+		static float8 sqrt(float8 a) { return _mm256_sqrt_ps(a); }
+		static float8 (min)(float8 a, float8 b) { return _mm256_min_ps(a, b); }
+		static float8 (max)(float8 a, float8 b) { return _mm256_max_ps(a, b); }
+		static float8 xorBits(float8 a, float8 b) { return _mm256_xor_ps(a, b); }
+		static float8 greater(float8 a, float8 b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static float8 select(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b, a, mask); }
+#elif XUSG_SOA_STREAM_SSE2
+		struct float8
+		{
+			__m128 Lo;
+			__m128 Hi;
+		};
+
+		static float8 load(const float* p) { return { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+		static void store(float* p, float8 v) { _mm_storeu_ps(p, v.Lo); _mm_storeu_ps(p + 4, v.Hi); }
+		static float8 set1(float f) { return { _mm_set1_ps(f), _mm_set1_ps(f) }; }
+		static float8 add(float8 a, float8 b) { return { _mm_add_ps(a.Lo, b.Lo), _mm_add_ps(a.Hi, b.Hi) }; }
+		static float8 mul(float8 a, float8 b) { return { _mm_mul_ps(a.Lo, b.Lo), _mm_mul_ps(a.Hi, b.Hi) }; }
+		static float8 div(float8 a, float8 b) { return { _mm_div_ps(a.Lo, b.Lo), _mm_div_ps(a.Hi, b.Hi) }; }
+		static float8 sqrt(float8 a) { return { _mm_sqrt_ps(a.Lo), _mm_sqrt_ps(a.Hi) }; }
+		static float8 (min)(float8 a, float8 b) { return { _mm_min_ps(a.Lo, b.Lo), _mm_min_ps(a.Hi, b.Hi) }; }
+		static float8 (max)(float8 a, float8 b) { return { _mm_max_ps(a.Lo, b.Lo), _mm_max_ps(a.Hi, b.Hi) }; }
+		static float8 xorBits(float8 a, float8 b) { return { _mm_xor_ps(a.Lo, b.Lo), _mm_xor_ps(a.Hi, b.Hi) }; }
+		static float8 greater(float8 a, float8 b) { return { _mm_cmpgt_ps(a.Lo, b.Lo), _mm_cmpgt_ps(a.Hi, b.Hi) }; }
+		static float8 select(float8 mask, float8 a, float8 b)
+		{
+			return
+			{
+				_mm_or_ps(_mm_and_ps(mask.Lo, a.Lo), _mm_andnot_ps(mask.Lo, b.Lo)),
+				_mm_or_ps(_mm_and_ps(mask.Hi, a.Hi), _mm_andnot_ps(mask.Hi, b.Hi))
+			};
+		}
+#endif
+	};
+}
@@ -0,0 +1,445 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <thread>
+#include "XUSGSparseRayCaster.h"
+#include "XUSGParallel.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XUSG_SPARSE_RAY_CASTER_SSE2 1
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+// Same as SparseRayCast.hlsli
+static const float g_lightColor = 0.8f;
+static const float g_ambient = 0.2f;
+static const float g_density = 1.0f;
+static const float g_absorption = 1.0f;
+
+//--------------------------------------------------------------------------------------
+// Four pixels in SIMD lanes, or in plain arrays without SSE2. Both paths do the same
+// float operations, including the exp approximation, so that they give the same results.
+// They are local to this file, as XUSGTriangleBVH.cpp has lanes of its own.
+//--------------------------------------------------------------------------------------
+namespace
+{
+#if XUSG_SPARSE_RAY_CASTER_SSE2
+	struct Lanes
+	{
+		__m128 V;
+	};
+
+	struct LaneMask
+	{
+		__m128 V;
+	};
+
+	Lanes splat(float s) { return { _mm_set1_ps(s) }; }
+	Lanes load(const float* p) { return { _mm_loadu_ps(p) }; }
+	void store(float* p, const Lanes& a) { _mm_storeu_ps(p, a.V); }
+	Lanes operator+(const Lanes& a, const Lanes& b) { return { _mm_add_ps(a.V, b.V) }; }
+	Lanes operator-(const Lanes& a, const Lanes& b) { return { _mm_sub_ps(a.V, b.V) }; }
+	Lanes operator*(const Lanes& a, const Lanes& b) { return { _mm_mul_ps(a.V, b.V) }; }
+	Lanes operator/(const Lanes& a, const Lanes& b) { return { _mm_div_ps(a.V, b.V) }; }
+	Lanes maxLanes(const Lanes& a, const Lanes& b) { return { _mm_max_ps(a.V, b.V) }; }
+	Lanes sqrtLanes(const Lanes& a) { return { _mm_sqrt_ps(a.V) }; }
+	LaneMask operator<(const Lanes& a, const Lanes& b) { return { _mm_cmplt_ps(a.V, b.V) }; }
+	LaneMask operator&(const LaneMask& a, const LaneMask& b) { return { _mm_and_ps(a.V, b.V) }; }
+	Lanes select(const LaneMask& m, const Lanes& a, const Lanes& b) { return { _mm_or_ps(_mm_and_ps(m.V, a.V), _mm_andnot_ps(m.V, b.V)) }; }
+	uint32_t getBits(const LaneMask& m) { return static_cast<uint32_t>(_mm_movemask_ps(m.V)); }
+
+	// Floor of the values, then 2 to the power of that integer
+	Lanes floorLanes(const Lanes& a)
+	{
+		const auto t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.V));
+
+		return { _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.V), _mm_set1_ps(1.0f))) };
+	}
+
+	Lanes exp2Integer(const Lanes& n)
+	{
+		return { _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.V), _mm_set1_epi32(127)), 23)) };
+	}
+#else
+	struct Lanes
+	{
+		float V[4];
+	};
+
+	struct LaneMask
+	{
+		bool V[4];
+	};
+
+#define XUSG_LANES_OP(expr) Lanes r; for (uint8_t i = 0; i < 4; ++i) r.V[i] = (expr); return r
+
+	Lanes splat(float s) { XUSG_LANES_OP(s); }
+	Lanes load(const float* p) { XUSG_LANES_OP(p[i]); }
+	void store(float* p, const Lanes& a) { for (uint8_t i = 0; i < 4; ++i) p[i] = a.V[i]; }
+	Lanes operator+(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(a.V[i] + b.V[i]); }
+	Lanes operator-(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(a.V[i] - b.V[i]); }
+	Lanes operator*(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(a.V[i] * b.V[i]); }
+	Lanes operator/(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(a.V[i] / b.V[i]); }
+	Lanes maxLanes(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(a.V[i] > b.V[i] ? a.V[i] : b.V[i]); }
+	Lanes sqrtLanes(const Lanes& a) { XUSG_LANES_OP(sqrtf(a.V[i])); }
+	Lanes select(const LaneMask& m, const Lanes& a, const Lanes& b) { XUSG_LANES_OP(m.V[i] ? a.V[i] : b.V[i]); }
+	Lanes floorLanes(const Lanes& a) { XUSG_LANES_OP(floorf(a.V[i])); }
+
+	Lanes exp2Integer(const Lanes& n)
+	{
+		Lanes r;
+		for (uint8_t i = 0; i < 4; ++i)
+		{
+			const auto bits = static_cast<uint32_t>(static_cast<int32_t>(n.V[i]) + 127) << 23;
+			memcpy(&r.V[i], &bits, sizeof(float));
+		}
+
+		return r;
+	}
+
+	LaneMask operator<(const Lanes& a, const Lanes& b)
+	{
+		LaneMask r;
+		for (uint8_t i = 0; i < 4; ++i) r.V[i] = a.V[i] < b.V[i];
+
+		return r;
+	}
+
+	LaneMask operator&(const LaneMask& a, const LaneMask& b)
+	{
+		LaneMask r;
+		for (uint8_t i = 0; i < 4; ++i) r.V[i] = a.V[i] && b.V[i];
+
+		return r;
+	}
+
+	uint32_t getBits(const LaneMask& m)
+	{
+		return (m.V[0] ? 1 : 0) | (m.V[1] ? 2 : 0) | (m.V[2] ? 4 : 0) | (m.V[3] ? 8 : 0);
+	}
+
+#undef XUSG_LANES_OP
+#endif
+}
+
+// exp(x) for x <= 0 with the Cephes polynomial; below -87, the result flushes to 0.
+static Lanes expLanes(const Lanes& x)
+{
+	const auto minX = splat(-87.0f);
+	const auto inRange = minX < x;
+	const auto a = maxLanes(x, minX);
+	const auto n = floorLanes(a * splat(1.44269504088896341f) + splat(0.5f));
+	const auto r = a - n * splat(0.693359375f) - n * splat(-2.12194440e-4f);
+
+	auto p = splat(1.9875691500e-4f);
+	p = p * r + splat(1.3981999507e-3f);
+	p = p * r + splat(8.3334519073e-3f);
+	p = p * r + splat(4.1665795894e-2f);
+	p = p * r + splat(1.6666665459e-1f);
+	p = p * r + splat(5.0000001201e-1f);
+	p = p * r * r + r + splat(1.0f);
+
+	return select(inRange, p * exp2Integer(n), splat(0.0f));
+}
+
+// Gauss-Jordan elimination with partial pivoting, in double precision
+static bool invertMatrix(const double m[4][4], double inv[4][4])
+{
+	double a[4][8];
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j)
+		{
+			a[i][j] = m[i][j];
+			a[i][j + 4] = i == j ? 1.0 : 0.0;
+		}
+
+	for (uint8_t c = 0; c < 4; ++c)
+	{
+		auto pivot = c;
+		for (uint8_t r = c + 1; r < 4; ++r) if (fabs(a[r][c]) > fabs(a[pivot][c])) pivot = r;
+		if (a[pivot][c] == 0.0) return false;
+		if (pivot != c) for (uint8_t j = 0; j < 8; ++j) swap(a[c][j], a[pivot][j]);
+
+		const auto scale = 1.0 / a[c][c];
+		for (uint8_t j = 0; j < 8; ++j) a[c][j] *= scale;
+		for (uint8_t r = 0; r < 4; ++r)
+		{
+			if (r == c || a[r][c] == 0.0) continue;
+			const auto f = a[r][c];
+			for (uint8_t j = 0; j < 8; ++j) a[r][j] -= f * a[c][j];
+		}
+	}
+
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j) inv[i][j] = a[i][j + 4];
+
+	return true;
+}
+
+SparseRayCaster::SparseRayCaster() :
+	m_screenToWorld(),
+	m_viewProjLS(),
+	m_width(0),
+	m_height(0),
+	m_lightSize(0),
+	m_numLayers(16),
+	m_numThreads(0),
+	m_zNear(1.0f),
+	m_zFar(1000.0f),
+	m_zNearLS(1.0f),
+	m_zFarLS(128.0f)
+{
+	// CLEAR_COLOR of the renderer
+	m_clearColor[0] = 0.0f;
+	m_clearColor[1] = 0.2f;
+	m_clearColor[2] = 0.4f;
+}
+
+SparseRayCaster::~SparseRayCaster()
+{
+}
+
+bool SparseRayCaster::SetView(uint32_t width, uint32_t height, const float viewProj[4][4], float zNear, float zFar)
+{
+	m_width = width;
+	m_height = height;
+	m_zNear = zNear;
+	m_zFar = zFar;
+
+	// Inverse of the view projection followed by the viewport transform, as in SparseVolume::UpdateFrame()
+	const double toScreen[4][4] =
+	{
+		{ 0.5 * width, 0.0, 0.0, 0.0 },
+		{ 0.0, -0.5 * height, 0.0, 0.0 },
+		{ 0.0, 0.0, 1.0, 0.0 },
+		{ 0.5 * width, 0.5 * height, 0.0, 1.0 }
+	};
+
+	double worldToScreen[4][4], screenToWorld[4][4];
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j)
+		{
+			worldToScreen[i][j] = 0.0;
+			for (uint8_t k = 0; k < 4; ++k) worldToScreen[i][j] += viewProj[i][k] * toScreen[k][j];
+		}
+	if (!invertMatrix(worldToScreen, screenToWorld)) return false;
+
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j) m_screenToWorld[i][j] = static_cast<float>(screenToWorld[i][j]);
+
+	return true;
+}
+
+void SparseRayCaster::SetLight(uint32_t size, const float viewProjLS[4][4], float zNearLS, float zFarLS)
+{
+	m_lightSize = size;
+	memcpy(m_viewProjLS, viewProjLS, sizeof(m_viewProjLS));
+	m_zNearLS = zNearLS;
+	m_zFarLS = zFarLS;
+}
+
+void SparseRayCaster::SetNumLayers(uint32_t numLayers)
+{
+	m_numLayers = numLayers;
+}
+
+void SparseRayCaster::SetClearColor(const float clearColor[3])
+{
+	memcpy(m_clearColor, clearColor, sizeof(m_clearColor));
+}
+
+void SparseRayCaster::SetNumThreads(uint32_t numThreads)
+{
+	m_numThreads = numThreads;
+}
+
+void SparseRayCaster::Render(uint8_t* pDst, const uint32_t* pKBuffer, const uint32_t* pKBufferLS) const
+{
+	const auto numTilesX = (m_width + TileSize - 1) / TileSize;
+	const auto numTiles = numTilesX * ((m_height + TileSize - 1) / TileSize);
+	if (numTiles < 1) return;
+
+	atomic<uint32_t> nextTile(0);
+	Parallel::Run((min)(getNumThreads(), numTiles), [&](uint32_t)
+	{
+		for (auto tile = nextTile++; tile < numTiles; tile = nextTile++) renderTile(pDst, pKBuffer, pKBufferLS, tile);
+	});
+}
+
+uint32_t SparseRayCaster::GetWidth() const
+{
+	return m_width;
+}
+
+uint32_t SparseRayCaster::GetHeight() const
+{
+	return m_height;
+}
+
+void SparseRayCaster::renderTile(uint8_t* pDst, const uint32_t* pKBuffer, const uint32_t* pKBufferLS, uint32_t tile) const
+{
+	const auto numTilesX = (m_width + TileSize - 1) / TileSize;
+	const auto left = tile % numTilesX * TileSize;
+	const auto top = tile / numTilesX * TileSize;
+	const auto right = (min)(left + TileSize, m_width);
+	const auto bottom = (min)(top + TileSize, m_height);
+	const auto& m = m_screenToWorld;
+
+	// Matrix rows as lanes
+	Lanes screenToWorld[4][4];
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j) screenToWorld[i][j] = splat(m[i][j]);
+
+	const auto toViewZ = [this](const Lanes& z)
+	{
+		// PrespectiveToViewZ() of SparseRayCast.hlsli
+		return splat(m_zNear * m_zFar) / (splat(m_zFar) - z * splat(m_zFar - m_zNear));
+	};
+
+	for (auto y = top; y < bottom; ++y)
+	{
+		for (auto x = left; x < right; x += 4)
+		{
+			// Pixel centers, as SV_Position of the screen quad
+			const float xs[] = { x + 0.5f, x + 1.5f, x + 2.5f, x + 3.5f };
+			const auto px = load(xs);
+			const auto py = splat(y + 0.5f);
+			const auto numLanes = (min)(right - x, 4u);
+			const auto pPixels = &pKBuffer[(static_cast<size_t>(m_width) * y + x) * m_numLayers];
+
+			// Screen-space xy parts of the screen-to-world transform
+			Lanes xyTerms[4];
+			for (uint8_t j = 0; j < 4; ++j)
+				xyTerms[j] = px * screenToWorld[0][j] + py * screenToWorld[1][j] + screenToWorld[3][j];
+			const auto screenToWorldPos = [&](const Lanes& z, Lanes(&pos)[3])
+			{
+				const auto w = xyTerms[3] + z * screenToWorld[2][3];
+				for (uint8_t j = 0; j < 3; ++j) pos[j] = (xyTerms[j] + z * screenToWorld[2][j]) / w;
+			};
+
+			auto thickness = splat(0.0f);
+			auto scatter = splat(0.0f);
+			auto active = px < splat(static_cast<float>(right));
+			for (auto i = 0u; i < m_numLayers >> 1; ++i)
+			{
+				// Screen-space depths; the lanes stop at the first incomplete pair.
+				float fronts[4] = { 1.0f, 1.0f, 1.0f, 1.0f }, backs[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+				for (auto j = 0u; j < numLanes; ++j)
+				{
+					memcpy(&fronts[j], &pPixels[m_numLayers * j + i * 2], sizeof(float));
+					memcpy(&backs[j], &pPixels[m_numLayers * j + i * 2 + 1], sizeof(float));
+				}
+				const auto depthFront = load(fronts);
+				const auto depthBack = load(backs);
+				active = active & (depthFront < splat(1.0f)) & (depthBack < splat(1.0f));
+				const auto activeBits = getBits(active);
+				if (!activeBits) break;
+
+				// Transform to world space, at the ends and the thirds of the segment
+				Lanes posFront[3], posBack[3], posFMid[3], posBMid[3];
+				screenToWorldPos(depthFront, posFront);
+				screenToWorldPos(depthBack, posBack);
+				for (uint8_t j = 0; j < 3; ++j)
+				{
+					const auto d = posBack[j] - posFront[j];
+					posFMid[j] = posFront[j] + d * splat(1.0f / 3.0f);
+					posBMid[j] = posFront[j] + d * splat(2.0f / 3.0f);
+				}
+
+				// Thickness of the current interval (segment) in view space
+				const auto thicknessSeg = toViewZ(depthBack) - toViewZ(depthFront);
+
+				// Light-path thicknesses, gathered per lane
+				float lightPaths[4][4] = {};
+				const Lanes* const pPoints[] = { posFront, posFMid, posBMid, posBack };
+				for (uint8_t k = 0; k < 4; ++k)
+				{
+					float pos[3][4];
+					for (uint8_t j = 0; j < 3; ++j) store(pos[j], pPoints[k][j]);
+					for (uint8_t j = 0; j < 4; ++j)
+						if (activeBits & (1 << j)) lightPaths[k][j] = getLightPathThickness(pKBufferLS, pos[0][j], pos[1][j], pos[2][j]);
+				}
+
+				Lanes thicknesses[4];	// Front, 1/3, 2/3, and back thicknesses
+				thicknesses[0] = load(lightPaths[0]) + thickness;
+				thicknesses[1] = load(lightPaths[1]) + thicknessSeg / splat(3.0f) + thickness;
+				thicknesses[2] = load(lightPaths[2]) + thicknessSeg * splat(2.0f / 3.0f) + thickness;
+
+				// Update the total thickness
+				const auto newThickness = thickness + thicknessSeg;
+				thicknesses[3] = load(lightPaths[3]) + newThickness;
+				thickness = select(active, newThickness, thickness);
+
+				// Transmissions, and the Simpson rule over [0, thicknessSeg]
+				Lanes transmissions[4];
+				for (uint8_t k = 0; k < 4; ++k) transmissions[k] = expLanes(splat(0.0f) - thicknesses[k] * splat(g_absorption * g_density));
+				const auto integral = thicknessSeg / splat(8.0f) * (transmissions[0] + splat(3.0f) * (transmissions[1] + transmissions[2]) + transmissions[3]);
+				scatter = select(active, scatter + splat(g_density) * integral, scatter);
+			}
+
+			// Blend with the squared clear color by the transmission, then to the gamma space
+			const auto transmission = expLanes(splat(0.0f) - thickness * splat(g_absorption * g_density));
+			const auto radiance = scatter * splat(g_lightColor) + splat(g_ambient);
+			float colors[3][4];
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto clear = splat(m_clearColor[j] * m_clearColor[j]);
+				store(colors[j], sqrtLanes(radiance + transmission * (clear - radiance)));
+			}
+
+			for (auto j = 0u; j < numLanes; ++j)
+			{
+				const auto pPixel = &pDst[(static_cast<size_t>(m_width) * y + x + j) * 4];
+				for (uint8_t k = 0; k < 3; ++k)
+					pPixel[k] = static_cast<uint8_t>((min)((max)(colors[k][j], 0.0f), 1.0f) * 255.0f + 0.5f);
+				pPixel[3] = 255;
+			}
+		}
+	}
+}
+
+float SparseRayCaster::getLightPathThickness(const uint32_t* pKBufferLS, float x, float y, float z) const
+{
+	// To light space, which is orthographic
+	const auto& m = m_viewProjLS;
+	const auto u = (x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0]) * 0.5f + 0.5f;
+	const auto v = (x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1]) * -0.5f + 0.5f;
+	const auto depth = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+
+	// Float-to-uint conversion clamps negative values to 0, and the loads out of the texture
+	// return 0 for every layer, which adds no thickness.
+	const auto s = u * m_lightSize, t = v * m_lightSize;
+	if (!(s < static_cast<float>(m_lightSize)) || !(t < static_cast<float>(m_lightSize))) return 0.0f;
+	const auto locX = s > 0.0f ? static_cast<uint32_t>(s) : 0;
+	const auto locY = t > 0.0f ? static_cast<uint32_t>(t) : 0;
+	const auto pLayers = &pKBufferLS[(static_cast<size_t>(m_lightSize) * locY + locX) * m_numLayers];
+
+	auto thickness = 0.0f;
+	for (auto i = 0u; i < m_numLayers >> 1; ++i)
+	{
+		float depthFront, depthBack;
+		memcpy(&depthFront, &pLayers[i * 2], sizeof(float));
+		memcpy(&depthBack, &pLayers[i * 2 + 1], sizeof(float));
+
+		// Clip to the current point
+		if (depthFront > depth || depthBack >= 1.0f) break;
+		depthBack = (min)(depthBack, depth);
+
+		// OrthoToViewZ() of SparseRayCast.hlsli
+		const auto zFront = depthFront * (m_zFarLS - m_zNearLS) + m_zNearLS;
+		const auto zBack = depthBack * (m_zFarLS - m_zNearLS) + m_zNearLS;
+		thickness += zBack - zFront;
+	}
+
+	return thickness;
+}
+
+uint32_t SparseRayCaster::getNumThreads() const
+{
+	return m_numThreads ? m_numThreads : (max)(thread::hardware_concurrency(), 1u);
+}
@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Portable CPU counterpart of the sparse ray casting (PSSparseRayCast.hlsl). The view
+	// k-buffer is taken as front/back depth pairs; each segment integrates single scattering
+	// with the Simpson rule over the light-path thicknesses at its ends and thirds, which are
+	// gathered from the light-space k-buffer. Pixels go through 4-wide SIMD lanes, and screen
+	// tiles are spread over threads. The k-buffers are pixel-major, as from KBufferRasterizer.
+	class SparseRayCaster
+	{
+	public:
+		SparseRayCaster();
+		virtual ~SparseRayCaster();
+
+		// Matrices take row vectors (clip = (p, 1) * viewProj) as in DirectXMath; the view is
+		// perspective and the light orthographic, each with its own depth range.
+		bool SetView(uint32_t width, uint32_t height, const float viewProj[4][4], float zNear, float zFar);
+		void SetLight(uint32_t size, const float viewProjLS[4][4], float zNearLS, float zFarLS);
+		void SetNumLayers(uint32_t numLayers);
+		void SetClearColor(const float clearColor[3]);
+		void SetNumThreads(uint32_t numThreads);	// 0 for the hardware concurrency
+
+		// Writes width x height pixels of R8G8B8A8_UNORM, as the render target of the GPU path.
+		void Render(uint8_t* pDst, const uint32_t* pKBuffer, const uint32_t* pKBufferLS) const;
+
+		uint32_t GetWidth() const;
+		uint32_t GetHeight() const;
+
+		static const uint32_t TileSize = 32;
+
+	protected:
+		void renderTile(uint8_t* pDst, const uint32_t* pKBuffer, const uint32_t* pKBufferLS, uint32_t tile) const;
+		float getLightPathThickness(const uint32_t* pKBufferLS, float x, float y, float z) const;
+
+		uint32_t getNumThreads() const;
+
+		float		m_screenToWorld[4][4];
+		float		m_viewProjLS[4][4];
+		float		m_clearColor[3];
+
+		uint32_t	m_width;
+		uint32_t	m_height;
+		uint32_t	m_lightSize;
+		uint32_t	m_numLayers;
+		uint32_t	m_numThreads;
+		float		m_zNear;
+		float		m_zFar;
+		float		m_zNearLS;
+		float		m_zFarLS;
+	};
+}
@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <chrono>
+#include "XUSGStlLoader.h"
+
+using namespace std;
+using namespace XUSG;
+
+const uint32_t StlLoader::HeaderSize = 84;		// 80-byte comment and the triangle count
+const uint32_t StlLoader::TriangleSize = 50;	// Facet normal, 3 vertices and the attribute byte count
+
+StlLoader::StlLoader() :
+	ObjLoader()
+{
+}
+
+StlLoader::~StlLoader()
+{
+}
+
+bool StlLoader::importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm)
+{
+	const auto startTime = chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(pszFilename)) return false;
+
+	// ASCII STL ("solid ...") does not match the binary size and is rejected here.
+	const auto pData = reinterpret_cast<const uint8_t*>(file.GetData());
+	if (file.GetSize() < HeaderSize) return false;
+	uint32_t numTri;
+	memcpy(&numTri, pData + HeaderSize - sizeof(uint32_t), sizeof(uint32_t));
+	if (numTri > UINT32_MAX / 3 || file.GetSize() < HeaderSize + static_cast<uint64_t>(TriangleSize) * numTri) return false;
+
+	const auto numVert = numTri * 3;
+	SoAStream positions, normals;
+	positions.Resize(numVert);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto pTri = pData + HeaderSize + static_cast<size_t>(TriangleSize) * i;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			float p[3];
+			memcpy(p, pTri + sizeof(float[3]) * (j + 1), sizeof(p));
+			positions.X[i * 3 + j] = p[0];
+			positions.Y[i * 3 + j] = p[1];
+			positions.Z[i * 3 + j] = p[2];
+		}
+	}
+
+	m_importStats.NumBytes = file.GetSize();
+	file.Close();
+
+	m_importStats.ParseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	m_stride = sizeof(float3);
+	m_stride += needNorm ? sizeof(float3) : 0;
+	m_vertices.resize(static_cast<size_t>(m_stride) * numVert);
+	m_indices.resize(numVert);
+	for (auto i = 0u; i < numVert; ++i) m_indices[i] = i;
+	loadStreams(positions, normals, vector<uint32_t>(), forDX, swapYZ);
+
+	// Weld the corners here, in place of the post-import weld, before the normals are computed,
+	// so that shared vertices get smooth normals.
+	m_importStats.NumVerticesBeforeWeld = numVert;
+	weldVertices();
+	numNorm = 0;
+
+	return true;
+}
+
+bool StlLoader::supportsStreaming() const
+{
+	return false;
+}
@@ -0,0 +1,27 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "XUSGObjLoader.h"
+
+namespace XUSG
+{
+	// Binary STL importer. The unindexed triangles are welded into an indexed mesh, and
+	// vertex normals are recomputed; facet normals and attribute bytes are ignored.
+	class StlLoader :
+		public ObjLoader
+	{
+	public:
+		StlLoader();
+		virtual ~StlLoader();
+
+	protected:
+		virtual bool importFile(const char* pszFilename, bool needNorm, bool forDX, bool swapYZ, uint32_t& numNorm);
+		virtual bool supportsStreaming() const;
+
+		static const uint32_t HeaderSize;
+		static const uint32_t TriangleSize;
+	};
+}
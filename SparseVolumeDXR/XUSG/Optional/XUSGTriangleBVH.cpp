@@ -0,0 +1,759 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include <thread>
+#include "XUSGTriangleBVH.h"
+#include "XUSGParallel.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XUSG_TRIANGLE_BVH_SSE2 1
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+// Traversal stacks are this deep; below g_maxSAHDepth, nodes split at the object median,
+// which takes at most 32 more levels.
+static const uint32_t g_maxDepth = 64;
+static const uint32_t g_maxSAHDepth = 32;
+
+// Cost of a node visit in units of ray-triangle tests, for the SAH
+static const float g_traversalCost = 1.0f;
+
+// 1 + 2 gamma(3) of Ize, "Robust BVH Ray Traversal", so that the slab test cannot miss
+// a triangle that the watertight test hits
+static const float g_slabScale = 1.0000004f;
+
+namespace
+{
+	struct Bounds
+	{
+		float Min[3];
+		float Max[3];
+
+		void Reset()
+		{
+			for (uint8_t i = 0; i < 3; ++i)
+			{
+				Min[i] = FLT_MAX;
+				Max[i] = -FLT_MAX;
+			}
+		}
+
+		void Grow(const float p[3])
+		{
+			for (uint8_t i = 0; i < 3; ++i)
+			{
+				Min[i] = (min)(p[i], Min[i]);
+				Max[i] = (max)(p[i], Max[i]);
+			}
+		}
+
+		void Grow(const Bounds& bounds)
+		{
+			for (uint8_t i = 0; i < 3; ++i)
+			{
+				Min[i] = (min)(bounds.Min[i], Min[i]);
+				Max[i] = (max)(bounds.Max[i], Max[i]);
+			}
+		}
+
+		float GetHalfArea() const
+		{
+			if (Max[0] < Min[0]) return 0.0f;
+			const float ext[] = { Max[0] - Min[0], Max[1] - Min[1], Max[2] - Min[2] };
+
+			return ext[0] * ext[1] + ext[1] * ext[2] + ext[2] * ext[0];
+		}
+	};
+}
+
+//--------------------------------------------------------------------------------------
+// Four packet rays in SIMD lanes, or in plain arrays without SSE2. Both paths do the float
+// operations of the single-ray tests, so that packets hit exactly what single rays hit.
+// They are local to this file, as XUSGSparseRayCaster.cpp has lanes of its own.
+//--------------------------------------------------------------------------------------
+namespace
+{
+#if XUSG_TRIANGLE_BVH_SSE2
+	struct Lanes
+	{
+		__m128 V;
+	};
+
+	struct LaneMask
+	{
+		__m128 V;
+	};
+
+	Lanes splat(float s) { return { _mm_set1_ps(s) }; }
+	Lanes load(const float* p) { return { _mm_loadu_ps(p) }; }
+	void store(float* p, const Lanes& a) { _mm_storeu_ps(p, a.V); }
+	Lanes operator+(const Lanes& a, const Lanes& b) { return { _mm_add_ps(a.V, b.V) }; }
+	Lanes operator-(const Lanes& a, const Lanes& b) { return { _mm_sub_ps(a.V, b.V) }; }
+	Lanes operator*(const Lanes& a, const Lanes& b) { return { _mm_mul_ps(a.V, b.V) }; }
+	Lanes operator/(const Lanes& a, const Lanes& b) { return { _mm_div_ps(a.V, b.V) }; }
+	Lanes minLanes(const Lanes& a, const Lanes& b) { return { _mm_min_ps(a.V, b.V) }; }
+	Lanes maxLanes(const Lanes& a, const Lanes& b) { return { _mm_max_ps(a.V, b.V) }; }
+	LaneMask operator<(const Lanes& a, const Lanes& b) { return { _mm_cmplt_ps(a.V, b.V) }; }
+	LaneMask operator<=(const Lanes& a, const Lanes& b) { return { _mm_cmple_ps(a.V, b.V) }; }
+	LaneMask operator==(const Lanes& a, const Lanes& b) { return { _mm_cmpeq_ps(a.V, b.V) }; }
+	LaneMask operator|(const LaneMask& a, const LaneMask& b) { return { _mm_or_ps(a.V, b.V) }; }
+	LaneMask operator&(const LaneMask& a, const LaneMask& b) { return { _mm_and_ps(a.V, b.V) }; }
+	uint32_t getBits(const LaneMask& m) { return static_cast<uint32_t>(_mm_movemask_ps(m.V)); }
+#else
+	struct Lanes
+	{
+		float V[4];
+	};
+
+	struct LaneMask
+	{
+		bool V[4];
+	};
+
+#define XUSG_LANES_OP(type, expr) type r; for (uint8_t i = 0; i < 4; ++i) r.V[i] = (expr); return r
+
+	Lanes splat(float s) { XUSG_LANES_OP(Lanes, s); }
+	Lanes load(const float* p) { XUSG_LANES_OP(Lanes, p[i]); }
+	void store(float* p, const Lanes& a) { for (uint8_t i = 0; i < 4; ++i) p[i] = a.V[i]; }
+	Lanes operator+(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] + b.V[i]); }
+	Lanes operator-(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] - b.V[i]); }
+	Lanes operator*(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] * b.V[i]); }
+	Lanes operator/(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] / b.V[i]); }
+	Lanes minLanes(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] < b.V[i] ? a.V[i] : b.V[i]); }
+	Lanes maxLanes(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(Lanes, a.V[i] > b.V[i] ? a.V[i] : b.V[i]); }
+	LaneMask operator<(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(LaneMask, a.V[i] < b.V[i]); }
+	LaneMask operator<=(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(LaneMask, a.V[i] <= b.V[i]); }
+	LaneMask operator==(const Lanes& a, const Lanes& b) { XUSG_LANES_OP(LaneMask, a.V[i] == b.V[i]); }
+	LaneMask operator|(const LaneMask& a, const LaneMask& b) { XUSG_LANES_OP(LaneMask, a.V[i] || b.V[i]); }
+	LaneMask operator&(const LaneMask& a, const LaneMask& b) { XUSG_LANES_OP(LaneMask, a.V[i] && b.V[i]); }
+
+	uint32_t getBits(const LaneMask& m)
+	{
+		auto bits = 0u;
+		for (uint8_t i = 0; i < 4; ++i) bits |= m.V[i] ? 1u << i : 0u;
+
+		return bits;
+	}
+
+#undef XUSG_LANES_OP
+#endif
+}
+
+// Top-left rule in the sheared ray space: of the two triangles on an edge, which run it in
+// opposite directions once oriented by their determinants, exactly one takes the ray.
+static bool isTopLeft(double ex, double ey)
+{
+	return ey > 0.0 || (ey == 0.0 && ex < 0.0);
+}
+
+TriangleBVH::TriangleBVH() :
+	m_numThreads(0)
+{
+}
+
+TriangleBVH::~TriangleBVH()
+{
+}
+
+void TriangleBVH::AddTriangles(const void* pPositions, uint32_t stride, uint32_t numVertices,
+	const uint32_t* pIndices, uint32_t numIndices, const float world[4][4])
+{
+	// DXR decides the facing in object space, so mirroring transforms keep it by swapping
+	// two vertices.
+	const auto det = world ? world[0][0] * (world[1][1] * world[2][2] - world[1][2] * world[2][1]) -
+		world[0][1] * (world[1][0] * world[2][2] - world[1][2] * world[2][0]) +
+		world[0][2] * (world[1][0] * world[2][1] - world[1][1] * world[2][0]) : 1.0f;
+
+	const auto pPosData = reinterpret_cast<const uint8_t*>(pPositions);
+	const auto numTriangles = numIndices / 3;
+	m_triangles.reserve(m_triangles.size() + numTriangles);
+	for (auto i = 0u; i < numTriangles; ++i)
+	{
+		const auto pTriIndices = &pIndices[i * 3];
+		if (pTriIndices[0] >= numVertices || pTriIndices[1] >= numVertices || pTriIndices[2] >= numVertices) continue;
+
+		Triangle triangle;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			float p[3];
+			memcpy(p, &pPosData[static_cast<size_t>(stride) * pTriIndices[j]], sizeof(p));
+			auto& v = triangle.V[det < 0.0f && j ? 3 - j : j];
+			if (world)
+				for (uint8_t k = 0; k < 3; ++k)
+					v[k] = p[0] * world[0][k] + p[1] * world[1][k] + p[2] * world[2][k] + world[3][k];
+			else memcpy(v, p, sizeof(p));
+		}
+
+		// Non-finite vertices would poison the bounds of the build.
+		auto isFinite = true;
+		for (const auto& v : triangle.V) isFinite = isFinite && isfinite(v[0]) && isfinite(v[1]) && isfinite(v[2]);
+		if (isFinite) m_triangles.emplace_back(triangle);
+	}
+}
+
+void TriangleBVH::Build()
+{
+	m_nodes.clear();
+	const auto numTriangles = static_cast<uint32_t>(m_triangles.size());
+	if (numTriangles == 0) return;
+
+	// Triangle bounds and centroids
+	vector<Bounds> bounds(numTriangles);
+	vector<float> centroids(numTriangles * 3);
+	Parallel::For(getNumThreads(), numTriangles, 1024, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto& triangle = m_triangles[i];
+			bounds[i].Reset();
+			for (const auto& v : triangle.V) bounds[i].Grow(v);
+			for (uint8_t j = 0; j < 3; ++j) centroids[i * 3 + j] = (bounds[i].Min[j] + bounds[i].Max[j]) * 0.5f;
+		}
+	});
+
+	// Top-down binned SAH, from an explicit stack of the node ranges
+	struct Task
+	{
+		uint32_t NodeIndex;
+		uint32_t Begin;
+		uint32_t End;
+		uint32_t Depth;
+	};
+
+	struct Bin
+	{
+		Bounds Box;
+		uint32_t Count;
+	};
+
+	vector<uint32_t> indices(numTriangles);
+	for (auto i = 0u; i < numTriangles; ++i) indices[i] = i;
+	m_nodes.reserve(numTriangles * 2);
+	m_nodes.emplace_back();
+
+	vector<Task> tasks(1, { 0, 0, numTriangles, 1 });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		Bounds nodeBounds, centroidBounds;
+		nodeBounds.Reset();
+		centroidBounds.Reset();
+		for (auto i = task.Begin; i < task.End; ++i)
+		{
+			nodeBounds.Grow(bounds[indices[i]]);
+			centroidBounds.Grow(&centroids[indices[i] * 3]);
+		}
+
+		auto& node = m_nodes[task.NodeIndex];
+		memcpy(node.Min, nodeBounds.Min, sizeof(node.Min));
+		memcpy(node.Max, nodeBounds.Max, sizeof(node.Max));
+		node.Offset = task.Begin;
+		node.Count = static_cast<uint16_t>(task.End - task.Begin);
+		node.Axis = 0;
+
+		const auto count = task.End - task.Begin;
+		if (count <= 1) continue;
+
+		// Best plane between the bins along each axis
+		auto bestAxis = 0u, bestSplit = 0u;
+		auto bestCost = FLT_MAX;
+		if (task.Depth < g_maxSAHDepth)
+		{
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				const auto extent = centroidBounds.Max[axis] - centroidBounds.Min[axis];
+				if (!(extent > 0.0f)) continue;
+
+				Bin bins[NumBins];
+				for (auto& bin : bins)
+				{
+					bin.Box.Reset();
+					bin.Count = 0;
+				}
+
+				const auto scale = NumBins / extent;
+				for (auto i = task.Begin; i < task.End; ++i)
+				{
+					const auto b = (min)(static_cast<uint32_t>((centroids[indices[i] * 3 + axis] - centroidBounds.Min[axis]) * scale), NumBins - 1);
+					bins[b].Box.Grow(bounds[indices[i]]);
+					++bins[b].Count;
+				}
+
+				// Sweep from the right for the right-hand costs, then from the left
+				float rightCosts[NumBins];
+				Bounds accum;
+				accum.Reset();
+				auto accumCount = 0u;
+				for (auto i = NumBins - 1; i > 0; --i)
+				{
+					accum.Grow(bins[i].Box);
+					accumCount += bins[i].Count;
+					rightCosts[i] = accumCount ? accum.GetHalfArea() * accumCount : FLT_MAX;
+				}
+
+				accum.Reset();
+				accumCount = 0;
+				for (auto i = 1u; i < NumBins; ++i)
+				{
+					accum.Grow(bins[i - 1].Box);
+					accumCount += bins[i - 1].Count;
+					if (accumCount == 0 || rightCosts[i] == FLT_MAX) continue;
+
+					const auto cost = accum.GetHalfArea() * accumCount + rightCosts[i];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = i;
+					}
+				}
+			}
+		}
+
+		auto mid = task.Begin;
+		if (bestCost < FLT_MAX)
+		{
+			// Leaves are kept when cheaper and small enough for the node count.
+			const auto area = nodeBounds.GetHalfArea();
+			const auto splitCost = g_traversalCost + (area > 0.0f ? bestCost / area : static_cast<float>(count));
+			if (count <= MaxLeafSize && splitCost >= static_cast<float>(count)) continue;
+
+			const auto minVal = centroidBounds.Min[bestAxis];
+			const auto scale = NumBins / (centroidBounds.Max[bestAxis] - minVal);
+			mid = static_cast<uint32_t>(partition(indices.begin() + task.Begin, indices.begin() + task.End, [&](uint32_t i)
+			{
+				return (min)(static_cast<uint32_t>((centroids[i * 3 + bestAxis] - minVal) * scale), NumBins - 1) < bestSplit;
+			}) - indices.begin());
+		}
+		else
+		{
+			// Coincident centroids or too deep: the object median along the widest axis
+			if (count <= MaxLeafSize) continue;
+
+			for (uint8_t axis = 1; axis < 3; ++axis)
+				if (centroidBounds.Max[axis] - centroidBounds.Min[axis] > centroidBounds.Max[bestAxis] - centroidBounds.Min[bestAxis])
+					bestAxis = axis;
+			mid = task.Begin + count / 2;
+			nth_element(indices.begin() + task.Begin, indices.begin() + mid, indices.begin() + task.End, [&](uint32_t a, uint32_t b)
+			{
+				return centroids[a * 3 + bestAxis] < centroids[b * 3 + bestAxis];
+			});
+		}
+
+		const auto childIndex = static_cast<uint32_t>(m_nodes.size());
+		node.Offset = childIndex;
+		node.Count = 0;
+		node.Axis = static_cast<uint16_t>(bestAxis);
+		m_nodes.emplace_back();
+		m_nodes.emplace_back();
+		tasks.push_back({ childIndex + 1, mid, task.End, task.Depth + 1 });
+		tasks.push_back({ childIndex, task.Begin, mid, task.Depth + 1 });
+	}
+
+	// Triangles in leaf order
+	vector<Triangle> triangles(numTriangles);
+	for (auto i = 0u; i < numTriangles; ++i) triangles[i] = m_triangles[indices[i]];
+	m_triangles.swap(triangles);
+	m_nodes.shrink_to_fit();
+}
+
+void TriangleBVH::Clear()
+{
+	m_triangles.clear();
+	m_nodes.clear();
+}
+
+void TriangleBVH::SetNumThreads(uint32_t numThreads)
+{
+	m_numThreads = numThreads;
+}
+
+float TriangleBVH::TraceRayLengthSum(const Ray& ray, RayFlag flags, uint32_t* pNumHits) const
+{
+	auto rayLengthSum = 0.0f;
+	auto numHits = 0u;
+
+	RayState state;
+	setupRay(ray, state);
+	if (!m_nodes.empty() && intersectNode(m_nodes[0], state))
+	{
+		// Children are visited in the order of the direction along the split axis.
+		uint32_t stack[g_maxDepth];
+		auto stackSize = 0u;
+		auto nodeIndex = 0u;
+		for (;;)
+		{
+			const auto& node = m_nodes[nodeIndex];
+			if (node.Count > 0)
+			{
+				for (auto i = node.Offset; i < node.Offset + node.Count; ++i)
+				{
+					float t;
+					HitKind hitKind;
+					if (!intersectTriangle(m_triangles[i], state, t, hitKind)) continue;
+
+					const auto isBackFace = hitKind == HIT_KIND_TRIANGLE_BACK_FACE;
+					if (flags & (isBackFace ? RAY_FLAG_CULL_BACK_FACING_TRIANGLES : RAY_FLAG_CULL_FRONT_FACING_TRIANGLES)) continue;
+
+					rayLengthSum += flags == RAY_FLAG_NONE && !isBackFace ? -t : t;
+					++numHits;
+				}
+			}
+			else
+			{
+				const auto isNegative = state.InvDir[node.Axis] < 0.0f;
+				const auto first = node.Offset + (isNegative ? 1 : 0);
+				const auto second = node.Offset + (isNegative ? 0 : 1);
+				const auto hitFirst = intersectNode(m_nodes[first], state);
+				const auto hitSecond = intersectNode(m_nodes[second], state);
+				if (hitFirst)
+				{
+					if (hitSecond) stack[stackSize++] = second;
+					nodeIndex = first;
+					continue;
+				}
+				if (hitSecond)
+				{
+					nodeIndex = second;
+					continue;
+				}
+			}
+
+			if (stackSize == 0) break;
+			nodeIndex = stack[--stackSize];
+		}
+	}
+
+	if (pNumHits) *pNumHits = numHits;
+
+	return rayLengthSum;
+}
+
+void TriangleBVH::TraceRayLengthSums(float* pSums, const float* pOrigins, uint32_t numRays, const float direction[3],
+	float tMin, float tMax, RayFlag flags, TraceMode mode) const
+{
+	Ray ray = {};
+	memcpy(ray.Direction, direction, sizeof(ray.Direction));
+	ray.TMin = tMin;
+	ray.TMax = tMax;
+
+	// The shear, inverse direction and child order are shared by all rays.
+	RayState state;
+	setupRay(ray, state);
+
+	const auto packetSize = mode == TRACE_MODE_PACKET_16 ? 16u : (mode == TRACE_MODE_PACKET_8 ? 8u : 1u);
+	const auto numPackets = (numRays + packetSize - 1) / packetSize;
+	Parallel::For(getNumThreads(), numPackets, 256 / packetSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto first = i * packetSize;
+			if (packetSize > 1) tracePacket(&pSums[first], &pOrigins[first * 3], (min)(numRays - first, packetSize), state, flags);
+			else
+			{
+				auto singleRay = ray;
+				memcpy(singleRay.Origin, &pOrigins[first * 3], sizeof(singleRay.Origin));
+				pSums[first] = TraceRayLengthSum(singleRay, flags);
+			}
+		}
+	});
+}
+
+uint32_t TriangleBVH::GetNumTriangles() const
+{
+	return static_cast<uint32_t>(m_triangles.size());
+}
+
+uint32_t TriangleBVH::GetNumNodes() const
+{
+	return static_cast<uint32_t>(m_nodes.size());
+}
+
+const TriangleBVH::Node* TriangleBVH::GetNodes() const
+{
+	return m_nodes.data();
+}
+
+float TriangleBVH::GetSAHCost() const
+{
+	if (m_nodes.empty()) return 0.0f;
+
+	const auto getHalfArea = [](const Node& node)
+	{
+		Bounds bounds;
+		memcpy(bounds.Min, node.Min, sizeof(bounds.Min));
+		memcpy(bounds.Max, node.Max, sizeof(bounds.Max));
+
+		return static_cast<double>(bounds.GetHalfArea());
+	};
+
+	const auto rootArea = getHalfArea(m_nodes[0]);
+	if (!(rootArea > 0.0)) return static_cast<float>(m_triangles.size());
+
+	auto cost = 0.0;
+	for (const auto& node : m_nodes)
+		cost += getHalfArea(node) / rootArea * (node.Count > 0 ? node.Count : g_traversalCost);
+
+	return static_cast<float>(cost);
+}
+
+void TriangleBVH::tracePacket(float* pSums, const float* pOrigins, uint32_t numRays, const RayState& state, RayFlag flags) const
+{
+	// Unused lanes repeat the first ray, out of the masks.
+	Packet packet;
+	float rayLengthSums[MaxPacketSize] = {};
+	for (auto i = 0u; i < MaxPacketSize; ++i)
+	{
+		const auto pOrigin = &pOrigins[(i < numRays ? i : 0) * 3];
+		packet.States[i] = state;
+		for (uint8_t j = 0; j < 3; ++j) packet.Origins[j][i] = packet.States[i].Origin[j] = pOrigin[j];
+	}
+
+	auto mask = m_nodes.empty() ? 0 : intersectNode(m_nodes[0], state, packet, (1u << numRays) - 1);
+	if (mask)
+	{
+		// Each stack entry keeps the rays that hit its node; the child order is that of single rays.
+		struct Entry
+		{
+			uint32_t NodeIndex;
+			uint32_t Mask;
+		};
+
+		Entry stack[g_maxDepth];
+		auto stackSize = 0u;
+		auto nodeIndex = 0u;
+		for (;;)
+		{
+			const auto& node = m_nodes[nodeIndex];
+			if (node.Count > 0)
+			{
+				for (auto i = node.Offset; i < node.Offset + node.Count; ++i)
+				{
+					float t[MaxPacketSize];
+					uint32_t backFaceMask;
+					const auto hitMask = intersectTriangle(m_triangles[i], state, packet, mask, t, backFaceMask);
+					for (auto j = 0u; hitMask >> j; ++j)
+					{
+						if (!((hitMask >> j) & 1)) continue;
+
+						const auto isBackFace = ((backFaceMask >> j) & 1) != 0;
+						if (flags & (isBackFace ? RAY_FLAG_CULL_BACK_FACING_TRIANGLES : RAY_FLAG_CULL_FRONT_FACING_TRIANGLES)) continue;
+
+						rayLengthSums[j] += flags == RAY_FLAG_NONE && !isBackFace ? -t[j] : t[j];
+					}
+				}
+			}
+			else
+			{
+				const auto isNegative = state.InvDir[node.Axis] < 0.0f;
+				const auto first = node.Offset + (isNegative ? 1 : 0);
+				const auto second = node.Offset + (isNegative ? 0 : 1);
+				const auto firstMask = intersectNode(m_nodes[first], state, packet, mask);
+				const auto secondMask = intersectNode(m_nodes[second], state, packet, mask);
+				if (firstMask)
+				{
+					if (secondMask) stack[stackSize++] = { second, secondMask };
+					nodeIndex = first;
+					mask = firstMask;
+					continue;
+				}
+				if (secondMask)
+				{
+					nodeIndex = second;
+					mask = secondMask;
+					continue;
+				}
+			}
+
+			if (stackSize == 0) break;
+			nodeIndex = stack[--stackSize].NodeIndex;
+			mask = stack[stackSize].Mask;
+		}
+	}
+
+	memcpy(pSums, rayLengthSums, sizeof(float) * numRays);
+}
+
+void TriangleBVH::setupRay(const Ray& ray, RayState& state)
+{
+	// The dominant axis becomes z, with x and y swapped for a negative z to keep the winding.
+	const auto& d = ray.Direction;
+	state.Kz = fabsf(d[0]) > fabsf(d[1]) ? (fabsf(d[0]) > fabsf(d[2]) ? 0 : 2) : (fabsf(d[1]) > fabsf(d[2]) ? 1 : 2);
+	state.Kx = (state.Kz + 1) % 3;
+	state.Ky = (state.Kx + 1) % 3;
+	if (d[state.Kz] < 0.0f) swap(state.Kx, state.Ky);
+	state.Shear[0] = d[state.Kx] / d[state.Kz];
+	state.Shear[1] = d[state.Ky] / d[state.Kz];
+	state.Shear[2] = 1.0f / d[state.Kz];
+
+	// Huge but finite reciprocals of zero components, so that the slabs never get 0 * inf.
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		state.Origin[i] = ray.Origin[i];
+		state.InvDir[i] = d[i] != 0.0f ? 1.0f / d[i] : (signbit(d[i]) ? -1.0e30f : 1.0e30f);
+	}
+	state.TMin = ray.TMin;
+	state.TMax = ray.TMax;
+}
+
+bool TriangleBVH::intersectNode(const Node& node, const RayState& state)
+{
+	auto tNear = state.TMin, tFar = state.TMax;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto t0 = (node.Min[i] - state.Origin[i]) * state.InvDir[i];
+		const auto t1 = (node.Max[i] - state.Origin[i]) * state.InvDir[i];
+		tNear = (max)((min)(t0, t1), tNear);
+		tFar = (min)((max)(t0, t1) * g_slabScale, tFar);
+	}
+
+	return tNear <= tFar;
+}
+
+// Woop et al., "Watertight Ray/Triangle Intersection", with the exact edge functions of
+// double precision on the edges
+bool TriangleBVH::intersectTriangle(const Triangle& triangle, const RayState& state, float& t, HitKind& hitKind)
+{
+	const auto kx = state.Kx, ky = state.Ky, kz = state.Kz;
+	float a[3], b[3], c[3];
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		a[i] = triangle.V[0][i] - state.Origin[i];
+		b[i] = triangle.V[1][i] - state.Origin[i];
+		c[i] = triangle.V[2][i] - state.Origin[i];
+	}
+
+	const auto ax = a[kx] - state.Shear[0] * a[kz], ay = a[ky] - state.Shear[1] * a[kz];
+	const auto bx = b[kx] - state.Shear[0] * b[kz], by = b[ky] - state.Shear[1] * b[kz];
+	const auto cx = c[kx] - state.Shear[0] * c[kz], cy = c[ky] - state.Shear[1] * c[kz];
+
+	auto u = cx * by - cy * bx;
+	auto v = ax * cy - ay * cx;
+	auto w = bx * ay - by * ax;
+	if (u == 0.0f || v == 0.0f || w == 0.0f)
+	{
+		const auto du = static_cast<double>(cx) * by - static_cast<double>(cy) * bx;
+		const auto dv = static_cast<double>(ax) * cy - static_cast<double>(ay) * cx;
+		const auto dw = static_cast<double>(bx) * ay - static_cast<double>(by) * ax;
+		const auto ddet = du + dv + dw;
+		if (ddet == 0.0) return false;
+
+		const auto sign = ddet > 0.0 ? 1.0 : -1.0;
+		const auto isInside = [sign](double e, float ex, float ey)
+		{
+			return e * sign > 0.0 || (e == 0.0 && isTopLeft(ex * sign, ey * sign));
+		};
+
+		if (!isInside(du, cx - bx, cy - by) || !isInside(dv, ax - cx, ay - cy) || !isInside(dw, bx - ax, by - ay)) return false;
+
+		u = static_cast<float>(du);
+		v = static_cast<float>(dv);
+		w = static_cast<float>(dw);
+	}
+	else if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+
+	const auto det = u + v + w;
+	if (det == 0.0f) return false;
+
+	const auto az = state.Shear[2] * a[kz], bz = state.Shear[2] * b[kz], cz = state.Shear[2] * c[kz];
+	t = (u * az + v * bz + w * cz) / det;
+	if (!(t >= state.TMin && t <= state.TMax)) return false;
+
+	// Clockwise from the ray origin in the left-handed space gives a positive determinant.
+	hitKind = det > 0.0f ? HIT_KIND_TRIANGLE_FRONT_FACE : HIT_KIND_TRIANGLE_BACK_FACE;
+
+	return true;
+}
+
+uint32_t TriangleBVH::intersectNode(const Node& node, const RayState& state, const Packet& packet, uint32_t mask)
+{
+	const auto tMin = splat(state.TMin), tMax = splat(state.TMax), slabScale = splat(g_slabScale);
+	auto hitMask = 0u;
+	for (auto i = 0u; i < MaxPacketSize / 4; ++i)
+	{
+		if (!((mask >> (i * 4)) & 0xf)) continue;
+
+		auto tNear = tMin, tFar = tMax;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto origin = load(&packet.Origins[j][i * 4]);
+			const auto invDir = splat(state.InvDir[j]);
+			const auto t0 = (splat(node.Min[j]) - origin) * invDir;
+			const auto t1 = (splat(node.Max[j]) - origin) * invDir;
+			tNear = maxLanes(minLanes(t0, t1), tNear);
+			tFar = minLanes(maxLanes(t0, t1) * slabScale, tFar);
+		}
+		hitMask |= getBits(tNear <= tFar) << (i * 4);
+	}
+
+	return hitMask & mask;
+}
+
+uint32_t TriangleBVH::intersectTriangle(const Triangle& triangle, const RayState& state, const Packet& packet,
+	uint32_t mask, float* pT, uint32_t& backFaceMask)
+{
+	const auto kx = state.Kx, ky = state.Ky, kz = state.Kz;
+	const auto sx = splat(state.Shear[0]), sy = splat(state.Shear[1]), sz = splat(state.Shear[2]);
+	const auto tMin = splat(state.TMin), tMax = splat(state.TMax), zero = splat(0.0f);
+
+	auto hitMask = 0u;
+	backFaceMask = 0;
+	for (auto i = 0u; i < MaxPacketSize / 4; ++i)
+	{
+		const auto laneMask = (mask >> (i * 4)) & 0xf;
+		if (!laneMask) continue;
+
+		Lanes a[3], b[3], c[3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto origin = load(&packet.Origins[j][i * 4]);
+			a[j] = splat(triangle.V[0][j]) - origin;
+			b[j] = splat(triangle.V[1][j]) - origin;
+			c[j] = splat(triangle.V[2][j]) - origin;
+		}
+
+		const auto ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+		const auto bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+		const auto cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+		const auto u = cx * by - cy * bx;
+		const auto v = ax * cy - ay * cx;
+		const auto w = bx * ay - by * ax;
+
+		// Lanes on an edge take the exact test of single rays.
+		const auto exactMask = getBits((u == zero) | (v == zero) | (w == zero)) & laneMask;
+		const auto outsideMask = getBits(((u < zero) | (v < zero) | (w < zero)) & ((zero < u) | (zero < v) | (zero < w)));
+
+		const auto det = u + v + w;
+		const auto t = (u * (sz * a[kz]) + v * (sz * b[kz]) + w * (sz * c[kz])) / det;
+		auto lanes = laneMask & ~exactMask & ~outsideMask & ~getBits(det == zero) & getBits((tMin <= t) & (t <= tMax));
+		const auto frontMask = getBits(zero < det);
+		store(&pT[i * 4], t);
+
+		for (uint8_t j = 0; j < 4; ++j)
+		{
+			if (!((exactMask >> j) & 1)) continue;
+
+			HitKind hitKind;
+			if (!intersectTriangle(triangle, packet.States[i * 4 + j], pT[i * 4 + j], hitKind)) continue;
+			lanes |= 1u << j;
+			if (hitKind == HIT_KIND_TRIANGLE_BACK_FACE) backFaceMask |= 1u << (i * 4 + j);
+		}
+
+		hitMask |= lanes << (i * 4);
+		backFaceMask |= (lanes & ~exactMask & ~frontMask) << (i * 4);
+	}
+
+	return hitMask;
+}
+
+uint32_t TriangleBVH::getNumThreads() const
+{
+	return m_numThreads ? m_numThreads : (max)(thread::hardware_concurrency(), 1u);
+}
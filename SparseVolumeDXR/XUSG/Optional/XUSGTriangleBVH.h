@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Portable CPU counterpart of the ray-tracing acceleration structures of SparseVolume, for
+	// the all-hit light rays of SparseRayCast.hlsl. The triangles of every instance go to world
+	// space in one binned-SAH BVH. The ray-triangle test is watertight, with a top-left rule for
+	// the rays through shared edges, so that each surface crossing is reported exactly once,
+	// and hits are front facing when clockwise from the ray origin in object space, as in DXR.
+	class TriangleBVH
+	{
+	public:
+		enum RayFlag : uint8_t
+		{
+			RAY_FLAG_NONE = 0,
+			RAY_FLAG_CULL_BACK_FACING_TRIANGLES = 0x10,
+			RAY_FLAG_CULL_FRONT_FACING_TRIANGLES = 0x20
+		};
+
+		enum HitKind : uint8_t
+		{
+			HIT_KIND_TRIANGLE_FRONT_FACE = 0xfe,
+			HIT_KIND_TRIANGLE_BACK_FACE = 0xff
+		};
+
+		enum TraceMode : uint8_t
+		{
+			TRACE_MODE_SINGLE,
+			TRACE_MODE_PACKET_8,
+			TRACE_MODE_PACKET_16
+		};
+
+		struct Ray
+		{
+			float		Origin[3];
+			float		TMin;
+			float		Direction[3];
+			float		TMax;
+		};
+
+		struct Node
+		{
+			float		Min[3];
+			uint32_t	Offset;	// First triangle of a leaf; otherwise the left child, with the right one next
+			float		Max[3];
+			uint16_t	Count;	// Triangles of a leaf; 0 for interior nodes
+			uint16_t	Axis;	// Split axis of interior nodes
+		};
+
+		TriangleBVH();
+		virtual ~TriangleBVH();
+
+		// Positions are 3 floats at the start of each element of the given byte stride. The
+		// matrix takes row vectors ((p, 1) * world) as in DirectXMath; null for the identity.
+		void AddTriangles(const void* pPositions, uint32_t stride, uint32_t numVertices,
+			const uint32_t* pIndices, uint32_t numIndices, const float world[4][4] = nullptr);
+		void Build();
+		void Clear();
+		void SetNumThreads(uint32_t numThreads);	// 0 for the hardware concurrency
+
+		// RayLengthSum of the any-hit shader of SparseRayCast.hlsl, over all hits in [TMin, TMax]:
+		// with RAY_FLAG_NONE (TRACE_RAY_ONCE), back faces add the hit distance and front faces
+		// subtract it; with either culling flag, the remaining hits add their distances.
+		float TraceRayLengthSum(const Ray& ray, RayFlag flags = RAY_FLAG_NONE, uint32_t* pNumHits = nullptr) const;
+
+		// The light rays of raygenMain, which share the direction and extent; origins are 3 floats
+		// each. Packet modes trace 8 or 16 consecutive rays together, with one inverse direction
+		// and child order, so that every node and triangle fetch serves the whole packet; the sums
+		// are those of single rays. Coherent origins, e.g. in screen tiles, keep packets together.
+		void TraceRayLengthSums(float* pSums, const float* pOrigins, uint32_t numRays, const float direction[3],
+			float tMin, float tMax, RayFlag flags = RAY_FLAG_NONE, TraceMode mode = TRACE_MODE_PACKET_16) const;
+
+		uint32_t GetNumTriangles() const;
+		uint32_t GetNumNodes() const;
+		const Node* GetNodes() const;
+		float GetSAHCost() const;	// Expected intersection tests and node visits of a random ray
+
+		static const uint32_t MaxLeafSize = 8;
+		static const uint32_t NumBins = 16;
+		static const uint32_t MaxPacketSize = 16;
+
+	protected:
+		struct Triangle
+		{
+			float		V[3][3];
+		};
+
+		struct RayState
+		{
+			float		Origin[3];
+			float		InvDir[3];
+			float		Shear[3];	// Sx, Sy and Sz of the watertight test
+			float		TMin;
+			float		TMax;
+			uint8_t		Kx, Ky, Kz;
+		};
+
+		struct Packet
+		{
+			float		Origins[3][MaxPacketSize];	// For the SIMD lanes
+			RayState	States[MaxPacketSize];		// For the exact edge tests of single rays
+		};
+
+		void tracePacket(float* pSums, const float* pOrigins, uint32_t numRays, const RayState& state, RayFlag flags) const;
+
+		static void setupRay(const Ray& ray, RayState& state);
+		static bool intersectNode(const Node& node, const RayState& state);
+		static bool intersectTriangle(const Triangle& triangle, const RayState& state, float& t, HitKind& hitKind);
+
+		// Masks of the packet rays, with the shared parts of the ray state
+		static uint32_t intersectNode(const Node& node, const RayState& state, const Packet& packet, uint32_t mask);
+		static uint32_t intersectTriangle(const Triangle& triangle, const RayState& state, const Packet& packet,
+			uint32_t mask, float* pT, uint32_t& backFaceMask);
+
+		uint32_t getNumThreads() const;
+
+		std::vector<Triangle>	m_triangles;	// In leaf order after Build()
+		std::vector<Node>		m_nodes;
+
+		uint32_t	m_numThreads;
+	};
+}
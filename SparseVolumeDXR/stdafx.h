@@ -40,7 +40,9 @@
 #include <vector>
 #include <unordered_map>
 #endif
+#include <chrono>
 #include <functional>
+#include <future>
 #include <wrl.h>
 #include <shellapi.h>
 
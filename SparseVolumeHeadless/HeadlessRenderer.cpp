@@ -0,0 +1,240 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include "HeadlessRenderer.h"
+#include "Optional/XUSGPlyLoader.h"
+#include "Optional/XUSGStlLoader.h"
+#include "SharedConst.h"
+
+using namespace std;
+using namespace XUSG;
+
+//--------------------------------------------------------------------------------------
+// Row-vector matrices of DirectXMath
+//--------------------------------------------------------------------------------------
+static void multiply(const float a[4][4], const float b[4][4], float(&c)[4][4])
+{
+	for (uint8_t i = 0; i < 4; ++i)
+		for (uint8_t j = 0; j < 4; ++j)
+			c[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+}
+
+// XMMatrixLookAtLH() with the up direction (0, 1, 0)
+static void lookAtLH(const float eyePt[3], const float focusPt[3], float(&view)[4][4])
+{
+	const auto normalize = [](float(&v)[3])
+	{
+		const auto length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (length > 0.0f) for (auto& c : v) c /= length;
+	};
+
+	float x[3], y[3], z[3];
+	for (uint8_t i = 0; i < 3; ++i) z[i] = focusPt[i] - eyePt[i];
+	normalize(z);
+	x[0] = z[2];
+	x[1] = 0.0f;
+	x[2] = -z[0];
+	normalize(x);
+	y[0] = z[1] * x[2] - z[2] * x[1];
+	y[1] = z[2] * x[0] - z[0] * x[2];
+	y[2] = z[0] * x[1] - z[1] * x[0];
+
+	const float* axes[] = { x, y, z };
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		for (uint8_t j = 0; j < 3; ++j) view[i][j] = axes[j][i];
+		view[i][3] = 0.0f;
+		view[3][i] = -(axes[i][0] * eyePt[0] + axes[i][1] * eyePt[1] + axes[i][2] * eyePt[2]);
+	}
+	view[3][3] = 1.0f;
+}
+
+HeadlessRenderer::HeadlessRenderer() :
+	m_bound(),
+	m_numThreads(0)
+{
+}
+
+HeadlessRenderer::~HeadlessRenderer()
+{
+}
+
+bool HeadlessRenderer::LoadMesh(const char* fileName, const float posScale[4], bool cleanup)
+{
+	// A single mesh is a scene of one instance with the identity transform.
+	const float identity[3][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } };
+	m_scene.Clear();
+	m_scene.AddInstance(m_scene.AddMesh(fileName, fileName), identity);
+	m_scene.Pack();
+
+	return importMeshes(posScale, cleanup);
+}
+
+bool HeadlessRenderer::LoadScene(const char* fileName, const float posScale[4], bool cleanup)
+{
+	if (!m_scene.Load(fileName)) return false;
+
+	return importMeshes(posScale, cleanup);
+}
+
+void HeadlessRenderer::SetNumThreads(uint32_t numThreads)
+{
+	m_numThreads = numThreads;
+}
+
+bool HeadlessRenderer::Render(uint8_t* pDst, uint32_t width, uint32_t height,
+	const float eyePt[3], const float focusPt[3], float fovAngleY)
+{
+	if (m_meshLoaders.empty() || width < 1 || height < 1) return false;
+
+	// Camera, as SparseVolumeDXR::LoadAssets() with XMMatrixPerspectiveFovLH()
+	float view[4][4], viewProj[4][4];
+	lookAtLH(eyePt, focusPt, view);
+	const auto yScale = 1.0f / tanf(fovAngleY / 2.0f);
+	const auto range = g_zFar / (g_zFar - g_zNear);
+	const float proj[4][4] =
+	{
+		{ yScale * height / width, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, yScale, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, range, 1.0f },
+		{ 0.0f, 0.0f, -range * g_zNear, 0.0f }
+	};
+	multiply(view, proj, viewProj);
+
+	// Light, as SparseVolume::UpdateFrame() with XMMatrixOrthographicLH()
+	const float lightPt[] = { m_bound[0] - 10.0f, m_bound[1] + 45.0f, m_bound[2] - 75.0f };
+	float viewLS[4][4], viewProjLS[4][4];
+	lookAtLH(lightPt, m_bound, viewLS);
+	const auto sizeLS = m_bound[3] * 3.0f;
+	const float projLS[4][4] =
+	{
+		{ 2.0f / sizeLS, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 2.0f / sizeLS, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f / (g_zFarLS - g_zNearLS), 0.0f },
+		{ 0.0f, 0.0f, -g_zNearLS / (g_zFarLS - g_zNearLS), 1.0f }
+	};
+	multiply(viewLS, projLS, viewProjLS);
+
+	// Depth peeling of every instance from the camera and from the light
+	if (m_kBuffer.GetWidth() != width || m_kBuffer.GetHeight() != height)
+		m_kBuffer.Init(width, height, NUM_K_LAYERS);
+	if (m_kBufferLS.GetWidth() != SHADOW_MAP_SIZE)
+		m_kBufferLS.Init(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, NUM_K_LAYERS);
+	m_kBuffer.SetNumThreads(m_numThreads);
+	m_kBufferLS.SetNumThreads(m_numThreads);
+
+	const auto numInstances = m_scene.GetNumInstances();
+	const auto pInstances = m_scene.GetInstances();
+	for (auto pKBuffer : { &m_kBuffer, &m_kBufferLS })
+	{
+		pKBuffer->Clear();
+		for (auto i = 0u; i < numInstances; ++i)
+		{
+			const auto& meshLoader = m_meshLoaders[pInstances[i].MeshIndex];
+			float worldViewProj[4][4];
+			multiply(m_worlds[i].M, pKBuffer == &m_kBuffer ? viewProj : viewProjLS, worldViewProj);
+			pKBuffer->Draw(worldViewProj, meshLoader->GetPositions(), meshLoader->GetPositionStride(),
+				meshLoader->GetNumVertices(), meshLoader->GetIndices(), meshLoader->GetNumIndices());
+		}
+	}
+
+	// Sparse ray casting
+	const float clearColor[] = { CLEAR_COLOR };
+	if (!m_rayCaster.SetView(width, height, viewProj, g_zNear, g_zFar)) return false;
+	m_rayCaster.SetLight(SHADOW_MAP_SIZE, viewProjLS, g_zNearLS, g_zFarLS);
+	m_rayCaster.SetNumLayers(NUM_K_LAYERS);
+	m_rayCaster.SetClearColor(clearColor);
+	m_rayCaster.SetNumThreads(m_numThreads);
+	m_rayCaster.Render(pDst, m_kBuffer.GetKBuffer(), m_kBufferLS.GetKBuffer());
+
+	return true;
+}
+
+uint32_t HeadlessRenderer::GetNumTriangles() const
+{
+	auto numTriangles = 0u;
+	const auto numInstances = m_scene.GetNumInstances();
+	const auto pInstances = m_scene.GetInstances();
+	for (auto i = 0u; i < numInstances; ++i)
+		numTriangles += m_meshLoaders[pInstances[i].MeshIndex]->GetNumIndices() / 3;
+
+	return numTriangles;
+}
+
+bool HeadlessRenderer::importMeshes(const float posScale[4], bool cleanup)
+{
+	// The import options of SparseVolume::importMeshes(), but with float positions and no
+	// LOD chain, as the CPU back end draws the full detail.
+	const auto numMeshes = m_scene.GetNumMeshes();
+	if (numMeshes == 0) return false;
+
+	const auto scratch = ObjLoader::MakeScratch();
+	m_meshLoaders.resize(numMeshes);
+	for (auto i = 0u; i < numMeshes; ++i)
+	{
+		// Choose the importer by the file extension.
+		const auto& fileName = m_scene.GetMeshes()[i].FileName;
+		const auto extPos = fileName.find_last_of('.');
+		auto ext = extPos != string::npos ? fileName.substr(extPos + 1) : string();
+		for (auto& c : ext) c = static_cast<char>(tolower(c));
+
+		auto& meshLoader = m_meshLoaders[i];
+		if (ext == "ply") meshLoader = make_unique<PlyLoader>();
+		else if (ext == "stl") meshLoader = make_unique<StlLoader>();
+		else meshLoader = make_unique<ObjLoader>();
+		meshLoader->SetNumThreads(m_numThreads);
+		meshLoader->SetScratch(scratch);
+		meshLoader->SetMeshCache(true);
+		meshLoader->SetVertexWelding(true);
+		meshLoader->SetTriangleReordering(true);
+		meshLoader->SetIndexOptimization(true);
+		meshLoader->SetMeshCleanup(cleanup);
+		if (!meshLoader->Import(fileName.c_str(), false, true)) return false;
+	}
+
+	// World transforms: the instance transform, then the position scale
+	const auto numInstances = m_scene.GetNumInstances();
+	const auto pInstances = m_scene.GetInstances();
+	const float posScaleXform[4][4] =
+	{
+		{ posScale[3], 0.0f, 0.0f, 0.0f },
+		{ 0.0f, posScale[3], 0.0f, 0.0f },
+		{ 0.0f, 0.0f, posScale[3], 0.0f },
+		{ posScale[0], posScale[1], posScale[2], 1.0f }
+	};
+	float boundMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, boundMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	m_worlds.resize(numInstances);
+	for (auto i = 0u; i < numInstances; ++i)
+	{
+		// The 3x4 instance transforms take column vectors.
+		const auto& t = pInstances[i].Transform;
+		const float transform[4][4] =
+		{
+			{ t[0][0], t[1][0], t[2][0], 0.0f },
+			{ t[0][1], t[1][1], t[2][1], 0.0f },
+			{ t[0][2], t[1][2], t[2][2], 0.0f },
+			{ t[0][3], t[1][3], t[2][3], 1.0f }
+		};
+		multiply(transform, posScaleXform, m_worlds[i].M);
+
+		// Grow the boundary by the transformed AABB corners, as SparseVolume does
+		const auto& aabb = m_meshLoaders[pInstances[i].MeshIndex]->GetAABB();
+		for (uint8_t j = 0; j < 8; ++j)
+		{
+			const float corner[] = { j & 1 ? aabb.Max.x : aabb.Min.x, j & 2 ? aabb.Max.y : aabb.Min.y, j & 4 ? aabb.Max.z : aabb.Min.z };
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				const auto v = corner[0] * transform[0][k] + corner[1] * transform[1][k] + corner[2] * transform[2][k] + transform[3][k];
+				boundMin[k] = (min)(v, boundMin[k]);
+				boundMax[k] = (max)(v, boundMax[k]);
+			}
+		}
+	}
+
+	for (uint8_t k = 0; k < 3; ++k) m_bound[k] = (boundMax[k] + boundMin[k]) / 2.0f;
+	m_bound[3] = (max)(boundMax[0] - boundMin[0], (max)(boundMax[1] - boundMin[1], boundMax[2] - boundMin[2])) / 2.0f;
+
+	return true;
+}
@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Optional/XUSGKBufferRasterizer.h"
+#include "Optional/XUSGObjLoader.h"
+#include "Optional/XUSGSceneManifest.h"
+#include "Optional/XUSGSparseRayCaster.h"
+
+// Sparse-volume rendering of SparseVolume on the CPU back end: the depth-peeling passes
+// go through KBufferRasterizer and the ray casting through SparseRayCaster, so that no
+// window or graphics device is needed. The camera, light and constants are those of the
+// windowed renderer; the meshes are drawn at full detail.
+class HeadlessRenderer
+{
+public:
+	HeadlessRenderer();
+	virtual ~HeadlessRenderer();
+
+	// posScale is the position and uniform scale of SparseVolumeDXR -mesh.
+	bool LoadMesh(const char* fileName, const float posScale[4], bool cleanup = false);
+	bool LoadScene(const char* fileName, const float posScale[4], bool cleanup = false);
+
+	void SetNumThreads(uint32_t numThreads);	// 0 for the hardware concurrency
+
+	// Writes width x height pixels of RGBA8, as the render target of the GPU path.
+	bool Render(uint8_t* pDst, uint32_t width, uint32_t height,
+		const float eyePt[3], const float focusPt[3], float fovAngleY);
+
+	uint32_t GetNumTriangles() const;
+
+protected:
+	struct Matrix
+	{
+		float	M[4][4];	// Row vectors, as in DirectXMath
+	};
+
+	bool importMeshes(const float posScale[4], bool cleanup);
+
+	XUSG::SceneManifest	m_scene;
+	std::vector<std::unique_ptr<XUSG::ObjLoader>> m_meshLoaders;
+	std::vector<Matrix>	m_worlds;	// Per instance
+
+	XUSG::KBufferRasterizer	m_kBuffer;
+	XUSG::KBufferRasterizer	m_kBufferLS;
+	XUSG::SparseRayCaster	m_rayCaster;
+
+	float		m_bound[4];	// Center and half of the largest extent
+	uint32_t	m_numThreads;
+};
@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Headless SparseVolumeDXR: renders on the CPU back end and writes PNGs, with no window or
+// device. Portable; on Linux, build with
+// g++ -std=c++14 -O2 -pthread -include stdafx.h -I../SparseVolumeDXR/XUSG -I../SparseVolumeDXR/Common
+//     -I../SparseVolumeDXR/Content *.cpp ../SparseVolumeDXR/XUSG/Optional/*.cpp ../SparseVolumeDXR/Common/stb_image_write.cpp
+
+#include "HeadlessRenderer.h"
+#include "stb_image_write.h"
+
+using namespace std;
+
+static const float g_pi = 3.14159265f;
+
+int main(int argc, char* argv[])
+{
+	const auto str_tolower = [](string s)
+	{
+		transform(s.begin(), s.end(), s.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+
+		return s;
+	};
+
+	const auto isArgMatched = [&argv, &str_tolower](int i, const char* paramName)
+	{
+		const auto& arg = argv[i];
+
+		return arg[0] == '-' && str_tolower(&arg[1]) == str_tolower(paramName);
+	};
+
+	// Negative numbers are values; other arguments starting with '-' are options.
+	const auto hasNextArgValue = [&argv, &argc](int i)
+	{
+		if (i + 1 >= argc) return false;
+		const auto& arg = argv[i + 1];
+
+		return arg[0] != '-' || (arg[1] >= '0' && arg[1] <= '9') || arg[1] == '.';
+	};
+
+	// Consumes the next argument only if it is a number, as swscanf_s() in SparseVolumeDXR.
+	const auto scanNextArgValue = [&argv, &hasNextArgValue](int& i, float& value)
+	{
+		if (!hasNextArgValue(i)) return false;
+		char* pEnd;
+		const auto v = strtof(argv[i + 1], &pEnd);
+		if (pEnd == argv[i + 1]) return false;
+		value = v;
+		++i;
+
+		return true;
+	};
+
+	// The defaults of SparseVolumeDXR
+	string meshFileName = "Assets/bunny.obj";
+	string sceneFileName;
+	string outFileName = "SparseVolumeHeadless.png";
+	float posScale[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float eyePt[] = { 8.0f, 12.0f, -14.0f };
+	float focusPt[] = { 0.0f, 4.0f, 0.0f };
+	auto fovAngleY = 45.0f;
+	auto width = 1280u, height = 720u;
+	auto numFrames = 1u, numThreads = 0u;
+	auto cleanup = false;
+	for (auto i = 1; i < argc; ++i)
+	{
+		float value;
+		if (isArgMatched(i, "cleanup")) cleanup = true;
+		else if (isArgMatched(i, "mesh"))
+		{
+			if (hasNextArgValue(i)) meshFileName = argv[++i];
+			for (uint8_t j = 0; j < 4 && scanNextArgValue(i, posScale[j]); ++j);
+		}
+		else if (isArgMatched(i, "scene"))
+		{
+			if (hasNextArgValue(i)) sceneFileName = argv[++i];
+		}
+		else if (isArgMatched(i, "eye"))
+		{
+			for (uint8_t j = 0; j < 3 && scanNextArgValue(i, eyePt[j]); ++j);
+		}
+		else if (isArgMatched(i, "focus"))
+		{
+			for (uint8_t j = 0; j < 3 && scanNextArgValue(i, focusPt[j]); ++j);
+		}
+		else if (isArgMatched(i, "fov")) scanNextArgValue(i, fovAngleY);
+		else if (isArgMatched(i, "width"))
+		{
+			if (scanNextArgValue(i, value)) width = static_cast<uint32_t>((max)(value, 0.0f));
+		}
+		else if (isArgMatched(i, "height"))
+		{
+			if (scanNextArgValue(i, value)) height = static_cast<uint32_t>((max)(value, 0.0f));
+		}
+		else if (isArgMatched(i, "frames"))
+		{
+			if (scanNextArgValue(i, value)) numFrames = static_cast<uint32_t>((max)(value, 0.0f));
+		}
+		else if (isArgMatched(i, "threads"))
+		{
+			if (scanNextArgValue(i, value)) numThreads = static_cast<uint32_t>((max)(value, 0.0f));
+		}
+		else if (isArgMatched(i, "out"))
+		{
+			if (hasNextArgValue(i)) outFileName = argv[++i];
+		}
+		else
+		{
+			cerr << "Usage: SparseVolumeHeadless [-mesh file [x y z scale]] [-scene file] [-cleanup]"
+				" [-eye x y z] [-focus x y z] [-fov degrees] [-width N] [-height N] [-frames N]"
+				" [-threads N] [-out file.png]" << endl;
+
+			return 1;
+		}
+	}
+
+	if (width < 1 || height < 1 || numFrames < 1 || fovAngleY <= 0.0f || fovAngleY >= 180.0f)
+	{
+		cerr << "Invalid view: " << width << "x" << height << ", " << numFrames << " frames, fov " << fovAngleY << endl;
+
+		return 1;
+	}
+
+	HeadlessRenderer renderer;
+	renderer.SetNumThreads(numThreads);
+
+	const auto startTime = chrono::steady_clock::now();
+	if (sceneFileName.empty() ? !renderer.LoadMesh(meshFileName.c_str(), posScale, cleanup) :
+		!renderer.LoadScene(sceneFileName.c_str(), posScale, cleanup))
+	{
+		cerr << "Failed to load " << (sceneFileName.empty() ? meshFileName : sceneFileName) << endl;
+
+		return 1;
+	}
+	const auto loadTime = chrono::steady_clock::now();
+	cout << "Load: " << renderer.GetNumTriangles() << " triangles in "
+		<< chrono::duration<double, milli>(loadTime - startTime).count() << " ms" << endl;
+
+	// More than one frame orbits the eye around the vertical axis through the focus.
+	string baseName = outFileName, ext;
+	const auto extPos = outFileName.find_last_of('.');
+	if (extPos != string::npos && outFileName.find_first_of("/\\", extPos) == string::npos)
+	{
+		baseName = outFileName.substr(0, extPos);
+		ext = outFileName.substr(extPos);
+	}
+	else ext = ".png";
+
+	vector<uint8_t> rgba(4 * width * height), rgb(3 * width * height);
+	for (auto n = 0u; n < numFrames; ++n)
+	{
+		const auto angle = 2.0f * g_pi * n / numFrames;
+		const auto x = eyePt[0] - focusPt[0], z = eyePt[2] - focusPt[2];
+		const float frameEyePt[] =
+		{
+			focusPt[0] + x * cosf(angle) - z * sinf(angle),
+			eyePt[1],
+			focusPt[2] + x * sinf(angle) + z * cosf(angle)
+		};
+
+		const auto frameStart = chrono::steady_clock::now();
+		if (!renderer.Render(rgba.data(), width, height, frameEyePt, focusPt, fovAngleY * g_pi / 180.0f))
+		{
+			cerr << "Failed to render frame " << n << endl;
+
+			return 1;
+		}
+		const auto frameEnd = chrono::steady_clock::now();
+
+		// RGB, as the screen shots of SparseVolumeDXR
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+			for (uint8_t j = 0; j < 3; ++j) rgb[3 * i + j] = rgba[4 * i + j];
+
+		string fileName = outFileName;
+		if (numFrames > 1)
+		{
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "_%04u", n);
+			fileName = baseName + suffix + ext;
+		}
+		if (!stbi_write_png(fileName.c_str(), width, height, 3, rgb.data(), 0))
+		{
+			cerr << "Failed to write " << fileName << endl;
+
+			return 1;
+		}
+
+		cout << fileName << ": " << width << "x" << height << " in "
+			<< chrono::duration<double, milli>(frameEnd - frameStart).count() << " ms" << endl;
+	}
+
+	return 0;
+}